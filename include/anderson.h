@@ -0,0 +1,28 @@
+#ifndef ANDERSON_H
+#define ANDERSON_H
+
+#include "gday.h"
+#include "utilities.h"
+
+/*
+ * Anderson acceleration of a fixed-point iteration x = G(x), see anderson.c
+ */
+#define ANDERSON_MAX_DEPTH 10
+
+typedef struct {
+    int     n;          /* length of the state vector */
+    int     depth;      /* number of past steps kept */
+    int     count;      /* number of past steps held so far */
+    int     head;       /* where the next one goes in the ring */
+    double *f_prev;     /* last residual, G(x) - x */
+    double *g_prev;     /* last G(x) */
+    double *df;         /* depth x n ring of residual differences */
+    double *dg;         /* depth x n ring of G differences */
+} anderson;
+
+anderson *anderson_new(int, int);
+void      anderson_step(anderson *, double *, double *);
+void      anderson_reset(anderson *);
+void      anderson_free(anderson *);
+
+#endif /* ANDERSON_H */
@@ -0,0 +1,26 @@
+#ifndef ARROW_WRITER_H
+#define ARROW_WRITER_H
+
+#include "gday.h"
+#include "utilities.h"
+
+/*
+ * Outputs as an Apache Arrow IPC stream: a schema, then record batches of
+ * float64 columns (and an optional utf8 site column), written without the
+ * Arrow libraries.
+ */
+#define ARROW_METADATA_V5       4
+#define ARROW_HEADER_SCHEMA     1
+#define ARROW_HEADER_BATCH      3
+#define ARROW_TYPE_FLOAT        3
+#define ARROW_TYPE_UTF8         5
+#define ARROW_PRECISION_DOUBLE  2
+
+typedef struct arrow_writer arrow_writer;
+
+arrow_writer *open_arrow_writer(FILE *, struct output_writer *, int,
+                                const char **, const char *, int);
+void  arrow_writer_row(arrow_writer *, const double *);
+void  close_arrow_writer(arrow_writer *);
+
+#endif /* ARROW_WRITER_H */
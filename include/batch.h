@@ -0,0 +1,25 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "gday.h"
+#include "utilities.h"
+#include "gday_sim.h"
+#include "gday_thread.h"
+
+/* One row of the site manifest */
+typedef struct {
+    char *cfg_fname;
+    char *met_fname;    /* NULL = take it from the .ini */
+    char *out_fname;    /* NULL = take it from the .ini */
+    int   status;       /* 0 once the site has run successfully */
+    int    cost_class;  /* run type/spin-up combination, see site_cost.h */
+    double units;       /* model estimate of the work, simulated day-units */
+    double estimate;    /* predicted cost, seconds once there's history */
+    double seconds;     /* measured wall time of the run */
+} batch_site;
+
+int   run_batch(char *, int, int);
+int   read_manifest(char *, batch_site **, int *);
+void  free_manifest(batch_site *, int);
+
+#endif /* BATCH_H */
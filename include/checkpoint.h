@@ -0,0 +1,21 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "gday.h"
+#include "utilities.h"
+
+/*
+ * Binary snapshot of everything a run carries from one day to the next, so
+ * that a run (or spin-up) can be stopped at a day boundary and picked up
+ * again later, giving exactly the same answers as if it never stopped.
+ */
+#define CHECKPOINT_MAGIC   "GDAYCKPT"
+#define CHECKPOINT_VERSION 2
+
+void write_checkpoint(char *, canopy_wk *, control *, fluxes *, fast_spinup *,
+                      met *, params *, state *, nrutil *, run_clock *);
+void read_checkpoint(char *, canopy_wk *, control *, fluxes *, fast_spinup *,
+                     met *, params *, state *, nrutil *, run_clock *);
+void keep_run_settings(control *, control *);
+
+#endif /* CHECKPOINT_H */
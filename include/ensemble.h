@@ -0,0 +1,23 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include "gday.h"
+#include "utilities.h"
+#include "gday_sim.h"
+#include "gday_thread.h"
+
+/* One row of the ensemble (or sweep) file */
+typedef struct {
+    char  *id;          /* written in the first column of the output */
+    char  *cfg_fname;   /* keys that override the base param file */
+    char **values;      /* ...or for a sweep, the values of its columns */
+    int    nvalues;
+    int    status;      /* 0 once the member has run successfully */
+} ensemble_member;
+
+int   run_ensemble(char *, char *, int, int);
+int   run_sweep(char *, char *, int, int);
+int   read_ensemble(char *, ensemble_member **, int *);
+void  free_ensemble(ensemble_member *, int);
+
+#endif /* ENSEMBLE_H */
@@ -0,0 +1,25 @@
+#ifndef FORCING_H
+#define FORCING_H
+
+#include "gday.h"
+#include "gday_sim.h"
+
+/*
+ * Met forcing read once and shared, read-only, between ensemble members
+ * (see gday_forcing_new and gday_sim_load_member), or made from the
+ * caller's own columns (gday_forcing_from_columns), or some years of
+ * another forcing (gday_forcing_years).
+ */
+struct gday_forcing {
+    control     c;              /* flags/file names the forcing was read with */
+    met_arrays  ma;
+    double     *cz_store;       /* sub-daily solar geometry, NULL for daily */
+    double     *ele_store;
+    double     *df_store;
+    double      latitude;       /* where the solar geometry was worked out */
+    double      longitude;
+    int         caller_met;     /* ma points at the caller's columns */
+    int         view;           /* ...or into another forcing's arrays */
+};
+
+#endif /* FORCING_H */
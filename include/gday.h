@@ -5,6 +5,11 @@
 //not #if defined(_WIN32) || defined(_WIN64) because we have strncasecmp in mingw
 #define strncasecmp _strnicmp
 #define strcasecmp _stricmp
+#define THREAD_LOCAL __declspec(thread)
+#define NORETURN __declspec(noreturn)
+#else
+#define THREAD_LOCAL __thread
+#define NORETURN __attribute__((noreturn))
 #endif
 
 #include <stdio.h>
@@ -13,6 +18,7 @@
 #include <ctype.h>
 //#include <unistd.h>
 #include <math.h>
+#include <setjmp.h>
 
 #define M_PI       3.14159265358979323846
 #define EPSILON 1E-08
@@ -29,6 +35,9 @@
 #endif
 
 #define STRING_LENGTH 2000
+#define MAX_OUTPUT_VARS 128     /* columns [output] variables can ask for */
+#define MAX_OUTPUT_DIGITS 17    /* decimals an ascii output column can have */
+#define ARROW_BATCH_ROWS 365    /* rows in an Arrow output record batch */
 
 #define MIN(a,b) (((a) < (b)) ? (a) : (b))
 #define MAX(a,b) (((a) > (b)) ? (a) : (b))
@@ -61,6 +70,16 @@
 #define SUBDAILY 0
 #define DAILY 1
 #define END 2
+#define MONTHLY 3           /* the days aggregated, see output_vars.c */
+#define SEASONAL 4
+#define ANNUAL 5
+#define AGGREGATED(x) ((x) == MONTHLY || (x) == SEASONAL || (x) == ANNUAL)
+
+/* how a column is aggregated over the days */
+#define AGG_MEAN 0
+#define AGG_SUM 1
+#define AGG_MIN 2
+#define AGG_MAX 3
 
 /* Texture identifiers */
 #define SILT 0
@@ -78,6 +97,11 @@
 /* Spinup method */
 #define BRUTE 0
 #define SAS 1
+#define ANDERSON 2
+
+/* Pools accelerated by the ANDERSON spin-up, see get_spinup_pools */
+#define N_SPINUP_POOLS 26
+#define ANDERSON_DEPTH 5
 
 /* Spinup array index */
 #define AF 0
@@ -111,10 +135,30 @@
 
 
 void   clparser(int, char **, control *);
+char  *next_arg(int, char **, int *);
 void   usage(char **);
 
 void   run_sim(canopy_wk *, control *, fluxes *, fast_spinup *, met_arrays *,
                met *, params *p, state *, nrutil *);
+void   start_run(canopy_wk *, control *, fluxes *, fast_spinup *, met_arrays *,
+                 met *, params *, state *, nrutil *, run_clock *);
+void   run_days(canopy_wk *, control *, fluxes *, fast_spinup *, met_arrays *,
+                met *, params *, state *, nrutil *, run_clock *, int, int);
+int    next_day(control *, met_arrays *, run_clock *, int *, int *);
+void   step_day(canopy_wk *, control *, fluxes *, fast_spinup *,
+                met_arrays *, met *, params *, state *, nrutil *,
+                run_clock *);
+void   advance_day(canopy_wk *, control *, fluxes *, fast_spinup *,
+                   met_arrays *, met *, params *, state *, nrutil *,
+                   run_clock *);
+void   begin_day(control *, fluxes *, fast_spinup *, met_arrays *, met *,
+                 params *, state *, run_clock *);
+void   end_day(canopy_wk *, control *, fluxes *, fast_spinup *, met *,
+               params *, state *, run_clock *);
+void   start_year(control *, fluxes *, met_arrays *, params *, state *,
+                  run_clock *);
+void   end_year(control *, fluxes *, params *, state *);
+void   end_run(control *, params *, state *, run_clock *);
 void   spin_up_pools(canopy_wk *, control *, fluxes *, fast_spinup *,
                      met_arrays *, met *, params *p, state *, nrutil *);
 void   correct_rate_constants(params *, int output);
@@ -127,4 +171,9 @@ void   fill_up_solar_arrays(canopy_wk *, control *, met_arrays *, params *);
 void   zero_fast_spinup_stuff(fast_spinup *);
 void   sas_spinup(canopy_wk *, control *, fluxes *, fast_spinup *,
                      met_arrays *, met *, params *p, state *, nrutil *);
+void   anderson_spinup(canopy_wk *, control *, fluxes *, fast_spinup *,
+                       met_arrays *, met *, params *p, state *, nrutil *,
+                       double);
+void   get_spinup_pools(state *, double *);
+void   set_spinup_pools(state *, double *);
 #endif /* GDAY_H */
@@ -0,0 +1,100 @@
+#ifndef GDAY_SIM_H
+#define GDAY_SIM_H
+
+/*
+ * Self-contained simulation handle. Everything a single G'DAY run needs
+ * (control, params, state, fluxes, met, ...) lives inside the handle, so
+ * any number of sites can be created and run in the same process, each on
+ * its own thread if needed.
+ *
+ *    gday_sim *sim = gday_sim_create("par.cfg", 0);
+ *    if (sim != NULL) {
+ *        error = gday_sim_run(sim);
+ *        gday_sim_destroy(sim);
+ *    }
+ *
+ * Errors inside the model no longer exit the process when called through
+ * here; create returns NULL and load/run return a non-zero status instead.
+ *
+ * A handle can be loaded with one site after another (gday_sim_new then
+ * repeated gday_sim_load/gday_sim_run), which recycles its allocations.
+ * Each load is run once, running it again is an error until it has been
+ * loaded again, as is running a handle whose load or run failed.
+ *
+ * For ensembles the met forcing can be read once with gday_forcing_new and
+ * shared, read-only, by every member loaded with gday_sim_load_member.
+ * gday_forcing_years gives members a run over only some of its years.
+ * Members of a parameter sweep can be loaded straight from their values
+ * with gday_sim_load_values, with no .ini of their own.
+ *
+ * A run can also be done without any files, e.g. for calibration:
+ *
+ *    fc = gday_forcing_from_columns(NULL, nrows, columns);
+ *    gday_sim_load_values(sim, NULL, n, names, values, fc, NULL, 0);
+ *    ncols = gday_sim_output_columns(sim, NULL, &max_rows);
+ *    gday_sim_set_output(sim, buffer, max_rows);
+ *    error = gday_sim_run(sim);
+ *
+ * where columns are the met file's columns (gday_met_columns names them)
+ * and buffer has room for max_rows * ncols doubles. The columns and the
+ * buffer stay the caller's, the run reads one and fills the other.
+ *
+ * A run can be stopped at a given day with gday_sim_run_to and any number
+ * of scenarios forked from it with gday_sim_fork, each then finished off
+ * with gday_sim_run. Fork into handles loaded with gday_sim_load_member so
+ * that only the keys in the scenario's own .ini are treated as changes.
+ *
+ * To couple the model to another one a day at a time,
+ *
+ *    while ((error = gday_sim_advance_day(sim)) == 0) {
+ *        gday_sim_get_state(sim, "shoot", &shoot);
+ *        gday_sim_get_state(sim, "shootn", &shootn);
+ *        gday_sim_set_state(sim, "shoot", shoot - eaten);
+ *        gday_sim_set_state(sim, "shootn", shootn * (shoot - eaten) / shoot);
+ *    }
+ *
+ * which finishes with error == GDAY_SIM_END if all went well. The pools'
+ * C and N are separate, so taking off C means taking off its N as well.
+ */
+
+/* flags */
+#define GDAY_SIM_SPIN_UP 0x1    /* spin-up rather than a normal run */
+#define GDAY_SIM_QUIET   0x2    /* no per-day diagnostics on stdout */
+
+#define GDAY_SIM_END     (-1)   /* advance_day: the met data has run out */
+
+#define GDAY_MET_COLUMNS 21     /* most columns a met file can have */
+
+typedef struct gday_sim gday_sim;
+typedef struct gday_forcing gday_forcing;
+
+gday_sim *gday_sim_new(void);
+int       gday_sim_load(gday_sim *, const char *, const char *, const char *,
+                        int);
+int       gday_sim_load_member(gday_sim *, const char *, const char *,
+                               const gday_forcing *, const char *, int);
+int       gday_sim_load_values(gday_sim *, const char *, int, const char **,
+                               const char **, const gday_forcing *,
+                               const char *, int);
+gday_sim *gday_sim_create(const char *, int);
+int       gday_sim_set_output(gday_sim *, double *, long);
+int       gday_sim_output_columns(gday_sim *, const char **, long *);
+long      gday_sim_output_rows(gday_sim *);
+int       gday_sim_run(gday_sim *);
+int       gday_sim_run_to(gday_sim *, int, int);
+int       gday_sim_start(gday_sim *);
+int       gday_sim_advance_day(gday_sim *);
+int       gday_sim_next_day(gday_sim *, int *, int *);
+int       gday_sim_get_state(gday_sim *, const char *, double *);
+int       gday_sim_set_state(gday_sim *, const char *, double);
+int       gday_sim_fork(gday_sim *, gday_sim *);
+void      gday_sim_destroy(gday_sim *);
+
+gday_forcing *gday_forcing_new(const char *, const char *);
+gday_forcing *gday_forcing_from_columns(const char *, long,
+                                        const double *const *);
+gday_forcing *gday_forcing_years(const gday_forcing *, int, int);
+int           gday_met_columns(int, const char **);
+void          gday_forcing_free(gday_forcing *);
+
+#endif /* GDAY_SIM_H */
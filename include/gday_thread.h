@@ -0,0 +1,38 @@
+#ifndef GDAY_THREAD_H
+#define GDAY_THREAD_H
+
+/*
+ * Minimal threading shim so the batch driver builds with both the Visual
+ * Studio project (Win32 threads) and gcc/clang (pthreads).
+ */
+#ifdef _WIN32
+#include <windows.h>
+typedef HANDLE           gday_thread;
+typedef CRITICAL_SECTION gday_mutex;
+typedef CONDITION_VARIABLE gday_cond;
+typedef INIT_ONCE        gday_once;
+#define GDAY_ONCE_INIT   INIT_ONCE_STATIC_INIT
+#else
+#include <pthread.h>
+typedef pthread_t        gday_thread;
+typedef pthread_mutex_t  gday_mutex;
+typedef pthread_cond_t   gday_cond;
+typedef pthread_once_t   gday_once;
+#define GDAY_ONCE_INIT   PTHREAD_ONCE_INIT
+#endif
+
+int   thread_start(gday_thread *, void (*)(void *), void *);
+void  thread_join(gday_thread);
+void  mutex_init(gday_mutex *);
+void  mutex_lock(gday_mutex *);
+void  mutex_unlock(gday_mutex *);
+void  mutex_free(gday_mutex *);
+void  cond_init(gday_cond *);
+void  cond_wait(gday_cond *, gday_mutex *);
+void  cond_signal(gday_cond *);
+void  cond_free(gday_cond *);
+int   number_of_cpus(void);
+double wall_clock(void);
+void  thread_once(gday_once *, void (*)(void));
+
+#endif /* GDAY_THREAD_H */
@@ -9,6 +9,6 @@ void   annual_grazing_calc(params *, fluxes *, state *);
 float  decay_in_dry_soils(double, double, params *, state *);
 void   calculate_litterfall(control *, fluxes *, fast_spinup *, params *,
                             state *, int, double *, double *);
-void calculate_harvest(fluxes *, params *, state *, int*, int*);
+void calculate_harvest(fluxes *, params *, state *, int, int);
 
 #endif /* LITTER */
@@ -0,0 +1,40 @@
+#ifndef MET_CACHE_H
+#define MET_CACHE_H
+
+#include "gday.h"
+#include "utilities.h"
+#include "read_met_file.h"
+
+/*
+ * Binary, column by column copy of a met file kept next to it, which is
+ * mapped straight into the met arrays instead of parsing the text.
+ */
+#define MET_CACHE_MAGIC     "GDAYMETC"
+#define MET_CACHE_VERSION   3
+#define MET_CACHE_SUFFIX    ".metcache"
+#define MET_CACHE_ALIGN     64          /* bytes, every column starts on one */
+#define MET_CACHE_NAME_LEN  16
+#define MET_CACHE_BYTE_ORDER 0x01020304
+
+typedef struct {
+    char                magic[8];
+    int                 version;
+    int                 byte_order;     /* MET_CACHE_BYTE_ORDER as written */
+    int                 steps_per_day;  /* 1 daily, 48 sub-daily */
+    int                 ncols;
+    long long           nrows;
+    int                 num_years;
+    int                 unused;
+    long long           source_size;    /* met file it was made from */
+    long long           source_mtime;   /* its modification time, s */
+    long long           source_mtime_ns;
+    unsigned long long  source_digest;  /* of its contents, see digest_file */
+    unsigned long long  checksum;       /* FNV-1a of the columns */
+    char                names[MAX_MET_VARS][MET_CACHE_NAME_LEN];
+    long long           offset[MAX_MET_VARS]; /* column starts, bytes */
+} met_cache_header;
+
+long  load_met_cache(control *, met_arrays *, int);
+void  write_met_cache(control *, int);
+
+#endif /* MET_CACHE_H */
@@ -0,0 +1,31 @@
+#ifndef MET_STORE_H
+#define MET_STORE_H
+
+#include "gday.h"
+#include "utilities.h"
+#include "read_met_file.h"
+
+/*
+ * Process-wide store of met forcing, read once per met file and shared,
+ * read-only, by every handle loaded against it while the store is open
+ * (e.g. the sites of a batch on the same grid cell).
+ */
+#define MET_STORE_IDLE_BYTES ((size_t)256 << 20) /* unused forcing kept */
+
+typedef struct met_entry met_entry;
+typedef struct met_solar met_solar;
+
+/* what a handle holds on to while it uses stored forcing */
+typedef struct {
+    met_entry  *entry;
+    met_solar  *solar;          /* sub-daily solar geometry, NULL if daily */
+} met_store_ref;
+
+void  met_store_open(void);
+void  met_store_close(void);
+int   met_store_active(void);
+void  met_store_acquire(canopy_wk *, control *, met_arrays *, params *,
+                        met_store_ref *);
+void  met_store_release(met_store_ref *);
+
+#endif /* MET_STORE_H */
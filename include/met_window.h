@@ -0,0 +1,21 @@
+#ifndef MET_WINDOW_H
+#define MET_WINDOW_H
+
+#include "gday.h"
+#include "utilities.h"
+#include "read_met_file.h"
+#include "radiation.h"
+
+/*
+ * Met forcing streamed from the file a year at a time, the next year being
+ * read on a thread of its own while the current one runs.
+ */
+#define MET_LOOKBACK_DAYS 30    /* rainfall phenology looks back this far */
+
+typedef struct met_window met_window;
+
+void  open_met_window(canopy_wk *, control *, met_arrays *, params *);
+void  met_window_day(met_arrays *, long);
+void  close_met_window(met_arrays *);
+
+#endif /* MET_WINDOW_H */
@@ -1,43 +1,31 @@
 #ifndef _NR_UTILS_H_
 #define _NR_UTILS_H_
 
-static float sqrarg;
-#define SQR(a) ((sqrarg=(a)) == 0.0 ? 0.0 : sqrarg*sqrarg)
+/*
+ * These used to stash their arguments in file-static scratch variables
+ * (sqrarg, dmaxarg1, ...), which is not safe once several simulations run
+ * on different threads. The arguments are now evaluated in place instead;
+ * the float/long/int casts keep the original NR arithmetic.
+ */
+#define SQR(a) ((float)(a) == 0.0 ? 0.0 : (float)(a)*(float)(a))
 
-static double dsqrarg;
-#define DSQR(a) ((dsqrarg=(a)) == 0.0 ? 0.0 : dsqrarg*dsqrarg)
+#define DSQR(a) ((double)(a) == 0.0 ? 0.0 : (double)(a)*(double)(a))
 
-static double dmaxarg1,dmaxarg2;
-#define DMAX(a,b) (dmaxarg1=(a),dmaxarg2=(b),(dmaxarg1) > (dmaxarg2) ?\
-        (dmaxarg1) : (dmaxarg2))
+#define DMAX(a,b) ((double)(a) > (double)(b) ? (double)(a) : (double)(b))
 
-static double dminarg1,dminarg2;
-#define DMIN(a,b) (dminarg1=(a),dminarg2=(b),(dminarg1) < (dminarg2) ?\
-        (dminarg1) : (dminarg2))
+#define DMIN(a,b) ((double)(a) < (double)(b) ? (double)(a) : (double)(b))
 
-static float maxarg1,maxarg2;
-#define FMAX(a,b) (maxarg1=(a),maxarg2=(b),(maxarg1) > (maxarg2) ?\
-        (maxarg1) : (maxarg2))
+#define FMAX(a,b) ((float)(a) > (float)(b) ? (float)(a) : (float)(b))
 
-static float minarg1,minarg2;
-#define FMIN(a,b) (minarg1=(a),minarg2=(b),(minarg1) < (minarg2) ?\
-        (minarg1) : (minarg2))
+#define FMIN(a,b) ((float)(a) < (float)(b) ? (float)(a) : (float)(b))
 
-static long lmaxarg1,lmaxarg2;
-#define LMAX(a,b) (lmaxarg1=(a),lmaxarg2=(b),(lmaxarg1) > (lmaxarg2) ?\
-        (lmaxarg1) : (lmaxarg2))
+#define LMAX(a,b) ((long)(a) > (long)(b) ? (long)(a) : (long)(b))
 
-static long lminarg1,lminarg2;
-#define LMIN(a,b) (lminarg1=(a),lminarg2=(b),(lminarg1) < (lminarg2) ?\
-        (lminarg1) : (lminarg2))
+#define LMIN(a,b) ((long)(a) < (long)(b) ? (long)(a) : (long)(b))
 
-static int imaxarg1,imaxarg2;
-#define IMAX(a,b) (imaxarg1=(a),imaxarg2=(b),(imaxarg1) > (imaxarg2) ?\
-        (imaxarg1) : (imaxarg2))
+#define IMAX(a,b) ((int)(a) > (int)(b) ? (int)(a) : (int)(b))
 
-static int iminarg1,iminarg2;
-#define IMIN(a,b) (iminarg1=(a),iminarg2=(b),(iminarg1) < (iminarg2) ?\
-        (iminarg1) : (iminarg2))
+#define IMIN(a,b) ((int)(a) < (int)(b) ? (int)(a) : (int)(b))
 
 #define SIGN(a,b) ((b) >= 0.0 ? fabs(a) : -fabs(a))
 
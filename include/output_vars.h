@@ -0,0 +1,39 @@
+#ifndef OUTPUT_VARS_H
+#define OUTPUT_VARS_H
+
+#include <stddef.h>
+#include "gday.h"
+#include "utilities.h"
+
+/*
+ * Registry of the daily output columns, by name, and where in the state,
+ * fluxes or canopy structures each one is found.
+ */
+#define OUT_STATE   0
+#define OUT_FLUXES  1
+#define OUT_CANOPY  2
+#define OUT_THETA   3           /* s->water_frac[layer], -999.9 if no layers */
+
+#define OUT_MISSING -999.9
+
+typedef struct {
+    const char *name;
+    const char *units;
+    int         where;
+    size_t      offset;         /* of the double, or the layer for OUT_THETA */
+} output_var;
+
+extern const output_var output_vars[];
+extern const int        num_output_vars;
+extern const output_var subdaily_output_vars[];
+extern const int        num_subdaily_output_vars;
+
+int     find_output_var(const char *);
+void    select_output_vars(control *, char *);
+void    default_output_vars(control *);
+int     find_aggregate(const char *);
+void    aggregation_period(control *, int, int, int *, int *);
+double  output_var_value(control *, canopy_wk *, fluxes *, state *,
+                         const output_var *);
+
+#endif /* OUTPUT_VARS_H */
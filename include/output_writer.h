@@ -0,0 +1,20 @@
+#ifndef OUTPUT_WRITER_H
+#define OUTPUT_WRITER_H
+
+#include "gday.h"
+#include "utilities.h"
+
+/*
+ * Output files written by a thread of their own, the model handing it
+ * what it would have written through a ring of buffers.
+ */
+#define OUTPUT_WRITER_SLOTS     32          /* buffers in the ring */
+#define OUTPUT_WRITER_SLOT_LEN  (64 * 1024) /* bytes in each */
+
+typedef struct output_writer output_writer;
+
+output_writer *open_output_writer(void);
+void  output_writer_put(output_writer *, FILE *, const void *, size_t);
+int   close_output_writer(output_writer *);
+
+#endif /* OUTPUT_WRITER_H */
@@ -0,0 +1,53 @@
+#ifndef PARAM_REGISTRY_H
+#define PARAM_REGISTRY_H
+
+#include <stddef.h>
+#include "gday.h"
+#include "utilities.h"
+
+/*
+ * Registry of the keys of the param (.ini) file, by section and name, and
+ * the field of control, params or state each one sets.
+ */
+#define INI_DOUBLE  0
+#define INI_INT     1
+#define INI_BOOL    2           /* true/false */
+#define INI_OPTION  3           /* one of the key's options, by name */
+#define INI_STRING  4
+#define INI_SPECIAL 5           /* set by a function of its own */
+
+#define INI_CONTROL 0
+#define INI_PARAMS  1
+#define INI_STATE   2
+
+typedef struct {
+    const char *name;
+    int         value;
+} ini_option;
+
+typedef struct {
+    const char       *section;
+    const char       *name;
+    int               type;         /* INI_ */
+    int               where;        /* INI_CONTROL, INI_PARAMS or INI_STATE */
+    size_t            offset;
+    size_t            size;         /* of the field */
+    const char       *units;
+    const char       *what;         /* it's "Unknown what" if it's wrong */
+    const ini_option *options;      /* of an INI_OPTION, ending in a NULL */
+    void            (*set)(control *, params *, state *, char *);
+    int               saved;        /* written back by write_final_state */
+    int               run;          /* a [control] key that is a setting of
+                                       the run, not of the model */
+} ini_key;
+
+extern const ini_key ini_keys[];
+extern const int     num_ini_keys;
+
+const ini_key *find_ini_key(const char *, const char *);
+const ini_key *find_ini_name(const char *);
+void   set_ini_value(control *, params *, state *, const ini_key *, char *);
+void  *ini_field(control *, params *, state *, const ini_key *);
+int    is_model_option(const ini_key *);
+
+#endif /* PARAM_REGISTRY_H */
@@ -7,8 +7,31 @@
 #include "gday.h"
 #include "utilities.h"
 
-void    read_daily_met_data(char **, control *, met_arrays *);
-void    read_subdaily_met_data(char **, control *, met_arrays *);
+#define N_DAILY_VARS    21      /* columns in a daily met file */
+#define N_SUBDAILY_VARS 13      /* ... and a sub-daily one */
+#define MAX_MET_VARS    N_DAILY_VARS
+
+/* a line-aligned piece of a mapped met file, read on a thread of its own */
+typedef struct {
+    const char  *start;         /* first byte of the chunk, starts a line */
+    const char  *end;           /* one past the last byte, ends a line */
+    long         nlines;        /* lines in the chunk, comments included */
+    long         nrows;         /* data rows in the chunk */
+    long         row0;          /* index of the chunk's first data row */
+    long         bad_line;      /* first unreadable line in the chunk, 1 is
+                                   the chunk's first line, 0 if none */
+    double     **cols;          /* where each field goes, NULL to skip it */
+    int          ncols;
+} met_chunk;
+
+void    read_daily_met_data(control *, met_arrays *);
+void    read_subdaily_met_data(control *, met_arrays *);
+long    read_met_csv(control *, met_arrays *, int);
+int     met_columns(met_arrays *, int, double ***, char **);
+void    free_met_arrays(met_arrays *);
+void    parse_met_chunk(void *);
+const char *parse_met_number(const char *, const char *, double *);
+void    bad_met_line(control *, int, long);
 
 
 #endif /* READ_MET_H */
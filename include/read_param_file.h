@@ -3,6 +3,8 @@
 
 #include "gday.h"
 #include "utilities.h"
+#include "output_vars.h"
+#include "param_registry.h"
 
 
 
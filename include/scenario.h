@@ -0,0 +1,12 @@
+#ifndef SCENARIO_H
+#define SCENARIO_H
+
+#include "gday.h"
+#include "utilities.h"
+#include "gday_sim.h"
+#include "gday_thread.h"
+#include "ensemble.h"
+
+int   run_scenarios(char *, char *, int, int, int, int);
+
+#endif /* SCENARIO_H */
@@ -0,0 +1,13 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "gday.h"
+#include "utilities.h"
+#include "gday_sim.h"
+
+#define SERVER_LINE     65536   /* longest request */
+#define SERVER_KEYS     256     /* most key=value pairs in one */
+
+int   run_server(char *, char *, int);
+
+#endif /* SERVER_H */
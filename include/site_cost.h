@@ -0,0 +1,49 @@
+#ifndef SITE_COST_H
+#define SITE_COST_H
+
+#include "batch.h"
+
+/*
+ * Cost model for scheduling batch sites. Each site gets a cost class (which
+ * inner loop dominates the run) and a number of work units (simulated days
+ * weighted by how expensive a day is for that class). Measured run times are
+ * kept in a history file so later batches can turn units into seconds.
+ */
+
+/* run types */
+#define COST_DAILY       0   /* daily bucket model */
+#define COST_SUB_DAILY   1   /* half-hourly bucket model */
+#define COST_HYDRAULICS  2   /* half-hourly, odeint through the soil column */
+#define N_RUN_TYPES      3
+
+/* cost class = run type + N_RUN_TYPES * spin-up mode */
+#define SPIN_UP_NONE     0
+#define SPIN_UP_BRUTE    1
+#define SPIN_UP_SAS      2
+#define SPIN_UP_ANDERSON 3
+#define N_COST_CLASSES   (4 * N_RUN_TYPES)
+
+typedef struct {
+    char   *cfg_fname;
+    char   *met_fname;  /* "" when the .ini's own met file was used */
+    int     cost_class;
+    double  units;
+    double  seconds;
+} cost_record;
+
+typedef struct {
+    cost_record *rec;
+    int          n;
+    int          size;
+    int          nsorted;                   /* leading records kept sorted */
+    double       rate[N_COST_CLASSES];      /* seconds per unit, 0 = unknown */
+    double       global_rate;
+} cost_history;
+
+int   read_cost_history(char *, cost_history *);
+int   write_cost_history(char *, cost_history *);
+void  free_cost_history(cost_history *);
+void  estimate_site_cost(cost_history *, batch_site *, int);
+void  record_site_cost(cost_history *, batch_site *);
+
+#endif /* SITE_COST_H */
@@ -5,6 +5,22 @@
 #include "utilities.h"
 #include "constants.h"
 
+/*
+ * Fractions of what decays from one SOM pool that reach another (after
+ * CENTURY), the rest is respired. Shared by the cfluxes_from_* and
+ * nfluxes_from_* functions and the steady state solve in
+ * steady_state_soil_c, which have to agree.
+ */
+#define STRUCT_TO_SLOW          0.7     /* lignin part of structural */
+#define SURF_STRUCT_TO_ACTIVE   0.55    /* rest of surface structural */
+#define SOIL_STRUCT_TO_ACTIVE   0.45    /* rest of soil structural */
+#define METAB_TO_ACTIVE         0.45
+#define ACTIVE_TO_PASSIVE       0.004   /* active -> slow is what's left
+                                           after respiration */
+#define SLOW_TO_ACTIVE          0.42
+#define SLOW_TO_PASSIVE         0.03
+#define PASSIVE_TO_ACTIVE       0.45
+
 double calc_soil_temp_factor(double);
 void   calculate_csoil_flows(control *, fluxes *, fast_spinup *fs, params *,
                              state *, double, int);
@@ -25,6 +41,8 @@ void   cfluxes_from_passive_pool(fluxes *, params *, state *);
 void   calculate_soil_respiration(control *, fluxes *, params *, state *);
 void   calculate_cpools(fluxes *, state *);
 void   precision_control_soil_c(fluxes *, state *);
+int    steady_state_soil_c(params *, double *, double *, double, int,
+                           double *);
 
 
 
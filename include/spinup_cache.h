@@ -0,0 +1,22 @@
+#ifndef SPINUP_CACHE_H
+#define SPINUP_CACHE_H
+
+#include "gday.h"
+#include "utilities.h"
+#include "checkpoint.h"
+
+/*
+ * On-disk cache of spun-up model states, keyed by a hash of everything the
+ * spin-up depends on (parameters, initial state, control flags and the met
+ * data), so that repeating a spin-up that has already been done anywhere
+ * that shares the cache directory is just a file read.
+ */
+#define SPINUP_CACHE_KEY_LEN 17     /* 16 hex digits + '\0' */
+
+int   spinup_cache_key(control *, met_arrays *, params *, state *, char *);
+int   read_spinup_cache(char *, canopy_wk *, control *, fluxes *,
+                        fast_spinup *, met *, params *, state *, nrutil *);
+void  write_spinup_cache(char *, canopy_wk *, control *, fluxes *,
+                         fast_spinup *, met *, params *, state *, nrutil *);
+
+#endif /* SPINUP_CACHE_H */
@@ -7,13 +7,15 @@ typedef struct {
     FILE *ifp;
     FILE *ofp;
     FILE *ofp_sd;
-    FILE *ofp_hdr;
     char  cfg_fname[STRING_LENGTH];
     char  met_fname[STRING_LENGTH];
     char  out_fname[STRING_LENGTH];
     char  out_subdaily_fname[STRING_LENGTH];
     char  out_fname_hdr[STRING_LENGTH];
     char  out_param_fname[STRING_LENGTH];
+    char  checkpoint_fname[STRING_LENGTH];
+    char  restart_fname[STRING_LENGTH];
+    char  spinup_cache_dir[STRING_LENGTH];
     char  git_hash[STRING_LENGTH];
     int   adjust_rtslow;
     int   alloc_model;
@@ -56,6 +58,40 @@ typedef struct {
     int   pdebug;
     int   spinup_method;
     int   soil_drainage;
+    int   quiet;            /* suppress the per-day diagnostics to stdout */
+    char  batch_fname[STRING_LENGTH];
+    char  ensemble_fname[STRING_LENGTH];
+    char  sweep_fname[STRING_LENGTH];
+    char  serve_path[STRING_LENGTH];
+    char  scenario_fname[STRING_LENGTH];
+    int   fork_year;
+    int   fork_doy;
+    int   nthreads;
+    int   checkpoint_interval;  /* days between checkpoints, 0 = never */
+    int   convert_met;      /* write the met file's binary cache and stop */
+    int   stream_met;       /* only keep a window of the met file in memory */
+    int   verify_met_cache; /* digest the met file on every cache load */
+    int   num_out_vars;     /* daily output columns, 0 = the default set */
+    int   out_vars[MAX_OUTPUT_VARS];    /* registry index of each column */
+    int   out_digits[MAX_OUTPUT_VARS];  /* its decimals, -1 = out_precision */
+    int   out_precision;    /* decimals in the ascii outputs */
+    int   async_output;     /* write the outputs on a thread of their own */
+    struct output_writer *writer;   /* doing so, NULL if not */
+    long  num_out_records;  /* in the binary daily output, -1 if none */
+    long  num_out_sd_records;   /* and sub-daily */
+    int   out_aggregate;    /* AGG_ of the columns when print_options is */
+    int   out_how[MAX_OUTPUT_VARS];     /* a column's own, -1 = that */
+    int   agg_year;         /* period being aggregated, see output_vars.c */
+    int   agg_period;
+    int   agg_ndays;        /* days in it so far, 0 = none open */
+    double agg_value[MAX_OUTPUT_VARS];
+    int   output_arrow;     /* daily/aggregated output as an Arrow stream */
+    int   arrow_batch;      /* rows in each of its record batches */
+    char  site_id[STRING_LENGTH];   /* its site column, "" = none */
+    struct arrow_writer *arrow;     /* writing it, NULL if not */
+    double *out_buffer;     /* caller's rows in place of output files */
+    long  out_buffer_rows;  /* rows it holds */
+    long  out_rows;         /* rows written to it so far */
 } control;
 
 
@@ -393,6 +429,12 @@ typedef struct {
     int use_cover; // 1-growth depend on cover; 0-growth is independent of existing cover
 } params;
 
+/* a whole file mapped into memory, see map_file */
+typedef struct {
+    char   *data;
+    size_t  size;
+} mapped_file;
+
 typedef struct {
 
     double *year;
@@ -425,6 +467,9 @@ typedef struct {
     double *doy;
     double *diffuse_frac;
 
+    long    capacity;   /* rows the arrays can hold, kept between sites */
+    mapped_file cache;  /* binary met cache the arrays point into, if any */
+    struct met_window *window;  /* a year at a time, see met_window.c */
 
 } met_arrays;
 
@@ -695,6 +740,7 @@ typedef struct {
     double *cz_store;       /* Array to hold coz zenith angles */
     double *ele_store;      /* Array to hold elevations */
     double *df_store;       /* Array to hold diffuse fractions */
+    long    solar_capacity; /* number of slots in the three stores above */
 
     // Used in the hydraulics calculations when water is limiting //
     double ts_Cs;           // Temporary variable to store Cs //
@@ -762,4 +808,16 @@ typedef struct {
     double passivesoil_nc;
 } fast_spinup;
 
+/* Where a run has got to, carried between calls to advance_day */
+typedef struct {
+    struct sma_obj *hw;         /* running mean of the growth stress */
+    int    *disturbance_yrs;
+    int     num_disturbance_yrs;
+    int     nyr;                /* years completed */
+    int     doy;                /* next day of the year to run, 0 based */
+    int     year;               /* calendar year being run */
+    double  fdecay;             /* leaf/root litterfall rates for the day */
+    double  rdecay;
+} run_clock;
+
 #endif
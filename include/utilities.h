@@ -10,6 +10,10 @@
 #include "gday.h"
 #include "constants.h"
 
+/* 64-bit FNV-1a, see hash_bytes */
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME  1099511628211ULL
+
 
 
 
@@ -19,7 +23,13 @@ double day_length(int, int, double);
 void   calculate_daylength(state *, int, double);
 int    is_leap_year(int);
 void   prog_error(const char *, const unsigned int);
+NORETURN void gday_exit(int);
+jmp_buf *set_exit_handler(jmp_buf *);
 bool   float_eq(double, double);
+int    solve_linear(double *, double *, int);
+int    map_file(char *, int, mapped_file *);
+void   unmap_file(mapped_file *);
+unsigned long long hash_bytes(unsigned long long, const void *, size_t);
 
 char   *rstrip(char *);
 char   *lskip(char *);
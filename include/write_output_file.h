@@ -4,16 +4,62 @@
 
 #include "gday.h"
 #include "utilities.h"
+#include "output_vars.h"
+#include "output_writer.h"
+#include "arrow_writer.h"
+#include "param_registry.h"
+
+#define OUT_FILE_BUFFER (1 << 20)   /* stdio buffer of each output file */
+#define OUT_LINE_LEN    8192        /* record put together before writing */
+#define OUT_FIELD_LEN   352         /* longest "%.17f" of a double, and more */
+
+/*
+ * Binary output files: this header, ncols out_binary_columns, then records
+ * of ncols doubles from data_offset on.
+ */
+#define OUT_BINARY_MAGIC        "GDAYOUTB"
+#define OUT_BINARY_VERSION      1
+#define OUT_BINARY_BYTE_ORDER   0x01020304
+#define OUT_BINARY_NAME_LEN     40
+#define OUT_BINARY_UNITS_LEN    24
+
+typedef struct {
+    char        magic[8];
+    int         version;
+    int         byte_order;     /* OUT_BINARY_BYTE_ORDER as written */
+    int         steps_per_day;  /* 1 daily, 48 half-hourly, 0 aggregated */
+    int         ncols;          /* the time columns included */
+    long long   nrecords;       /* -1 until the file is closed */
+    long long   data_offset;    /* bytes before the first record */
+    char        model_version[64];  /* [git] git_hash of the run */
+} out_binary_header;
+
+typedef struct {
+    char        name[OUT_BINARY_NAME_LEN];
+    char        units[OUT_BINARY_UNITS_LEN];
+} out_binary_column;
 
 void  open_output_file(control *, char *, FILE **);
+void  open_binary_output_file(control *, char *, FILE **);
 void  write_output_subdaily_header(control *, FILE **);
 void  write_output_header(control *, FILE **);
+void  write_binary_output_header(control *, FILE *, int);
+void  finish_binary_outputs(control *);
+void  open_arrow_output(control *);
+void  finish_arrow_output(control *);
 void  write_daily_outputs_ascii(control *, canopy_wk *, fluxes *, state *, int,
                                 int);
-void  write_daily_outputs_binary(control *, fluxes *, state *, int, int);
+void  write_daily_outputs_binary(control *, canopy_wk *, fluxes *, state *, int,
+                                 int);
+void  write_aggregated_outputs(control *, canopy_wk *, fluxes *, state *, int,
+                                int);
+void  finish_aggregated_outputs(control *);
 void  write_subdaily_outputs_ascii(control *, canopy_wk *, double, double, int);
+void  write_subdaily_outputs_binary(control *, canopy_wk *, double, double,
+                                    int);
+int   output_columns(control *, const char **);
+int   format_fixed(char *, double, int);
 int   write_final_state(control *, params *p, state *);
-int   ohandler(char *, char *, char *, control *, params *p, state *, int *);
 
 
 #endif /* WRITE_OUT_H */
@@ -0,0 +1,133 @@
+/* ============================================================================
+* Anderson acceleration of a fixed-point iteration x_{k+1} = G(x_k).
+*
+* Rather than taking G(x_k) as the next iterate, the last few steps are used
+* to find the combination of recent iterates whose residuals, G(x) - x,
+* cancel best in a least-squares sense, and the next iterate is the same
+* combination of their G(x). For a map that converges slowly and roughly
+* linearly (e.g. the soil pools over repeated passes through the forcing)
+* this removes most of the slow geometric tail.
+*
+* NOTES:
+*   The least-squares problem only has as many unknowns as steps kept, so
+*   it is solved through its (slightly regularised) normal equations.
+*
+* References:
+* ----------
+* * Walker, H. F. and Ni, P. (2011) SIAM J. Numer. Anal., 49, 1715-1735.
+*
+* =========================================================================== */
+#include "anderson.h"
+
+/* relative Tikhonov term on the normal equations */
+#define REGULARISE 1E-10
+
+
+anderson *anderson_new(int n, int depth) {
+    /* accelerate a map on n values using up to depth past steps */
+    anderson *a;
+
+    depth = MAX(1, MIN(depth, ANDERSON_MAX_DEPTH));
+
+    if ((a = (anderson *)calloc(1, sizeof(anderson))) == NULL ||
+        (a->f_prev = (double *)calloc(n, sizeof(double))) == NULL ||
+        (a->g_prev = (double *)calloc(n, sizeof(double))) == NULL ||
+        (a->df = (double *)calloc(n * depth, sizeof(double))) == NULL ||
+        (a->dg = (double *)calloc(n * depth, sizeof(double))) == NULL) {
+        fprintf(stderr, "Error allocating space for anderson\n");
+        gday_exit(EXIT_FAILURE);
+    }
+    a->n = n;
+    a->depth = depth;
+    anderson_reset(a);
+
+    return (a);
+}
+
+void anderson_step(anderson *a, double *x, double *g) {
+    /*
+        Given the current iterate x and g = G(x), overwrite x with the next
+        iterate. g is left alone.
+    */
+    double  h[ANDERSON_MAX_DEPTH * ANDERSON_MAX_DEPTH];
+    double  gamma[ANDERSON_MAX_DEPTH];
+    double *dfi, *dfj, *dgj, f, trace;
+    int     n = a->n, m, i, j, k, first = (a->count < 0);
+
+    /* record the change since the last step */
+    for (k = 0; k < n; k++) {
+        f = g[k] - x[k];
+        if (! first) {
+            a->df[a->head * n + k] = f - a->f_prev[k];
+            a->dg[a->head * n + k] = g[k] - a->g_prev[k];
+        }
+        a->f_prev[k] = f;
+        a->g_prev[k] = g[k];
+    }
+    if (first) {
+        a->count = 0;
+        memcpy(x, g, n * sizeof(double));
+        return;
+    }
+    a->head = (a->head + 1) % a->depth;
+    if (a->count < a->depth)
+        a->count++;
+    m = a->count;
+
+    /* normal equations, (dF^T dF) gamma = dF^T f */
+    trace = 0.0;
+    for (i = 0; i < m; i++) {
+        dfi = a->df + i * n;
+        for (j = 0; j <= i; j++) {
+            dfj = a->df + j * n;
+            h[i * m + j] = 0.0;
+            for (k = 0; k < n; k++)
+                h[i * m + j] += dfi[k] * dfj[k];
+            h[j * m + i] = h[i * m + j];
+        }
+        trace += h[i * m + i];
+        gamma[i] = 0.0;
+        for (k = 0; k < n; k++)
+            gamma[i] += dfi[k] * a->f_prev[k];
+    }
+    for (i = 0; i < m; i++)
+        h[i * m + i] += REGULARISE * trace;
+
+    if (trace <= 0.0 || ! solve_linear(h, gamma, m)) {
+        /* nothing usable in the history, plain fixed-point step */
+        anderson_reset(a);
+        a->count = 0;
+        memcpy(x, g, n * sizeof(double));
+        return;
+    }
+
+    memcpy(x, g, n * sizeof(double));
+    for (j = 0; j < m; j++) {
+        dgj = a->dg + j * n;
+        for (k = 0; k < n; k++)
+            x[k] -= gamma[j] * dgj[k];
+    }
+
+    return;
+}
+
+void anderson_reset(anderson *a) {
+    /* forget the history, the next step is a plain fixed-point one */
+    a->count = -1;
+    a->head = 0;
+
+    return;
+}
+
+void anderson_free(anderson *a) {
+
+    if (a == NULL)
+        return;
+    free(a->f_prev);
+    free(a->g_prev);
+    free(a->df);
+    free(a->dg);
+    free(a);
+
+    return;
+}
@@ -0,0 +1,426 @@
+/* ============================================================================
+* Apache Arrow IPC stream output.
+*
+* With [output] arrow = true the daily (or monthly etc.) output file is an
+* Arrow IPC stream rather than a CSV: a schema message naming the columns,
+* then a record batch every [output] arrow_batch rows (ARROW_BATCH_ROWS
+* unless it says otherwise) and the end of stream marker. Every column is a
+* float64, as in the binary output, and with [output] site_id set there is
+* a utf8 "site" column in front of them, so the files of many sites can be
+* read as one table. Arrow readers (pyarrow.ipc.open_stream, R's
+* arrow::read_ipc_stream, polars, DuckDB, ...) take it as it is.
+*
+* NOTES:
+*   The Arrow libraries aren't needed: the messages' metadata is a
+*   flatbuffer, which is put together here by hand. It is written front to
+*   back, each table's vtable just before it and anything it refers to
+*   after it, the offsets to those being filled in once they are written.
+*   Only the handful of tables a schema and a record batch of flat columns
+*   need (Message, Schema, Field, FloatingPoint, Utf8, RecordBatch) are
+*   covered.
+*
+*   Each writer only has its own file, so any number of sites can write at
+*   once, and goes through the run's output writer thread when there is
+*   one.
+*
+* References:
+*   https://arrow.apache.org/docs/format/Columnar.html (IPC streaming
+*   format, Message.fbs, Schema.fbs)
+*
+* =========================================================================== */
+#include "arrow_writer.h"
+#include "output_writer.h"
+
+#define FB_MAX_SLOTS 8
+
+/* flatbuffer being put together */
+typedef struct {
+    unsigned char  *data;
+    size_t          len;
+    size_t          cap;
+} fb_buf;
+
+/* a field of a table: a scalar, or (size 4, no value) an offset */
+typedef struct {
+    int         id;
+    int         size;
+    long long   value;
+    size_t      at;             /* where it went, to patch offsets */
+} fb_field;
+
+struct arrow_writer {
+    FILE           *fp;
+    output_writer  *writer;
+    int             ncols;      /* float64 columns */
+    int             batch_rows;
+    int             nrows;      /* in the batch so far */
+    char           *site;       /* NULL if there is no site column */
+    double         *cols;       /* ncols x batch_rows */
+    fb_buf          fb;
+    unsigned char  *body;
+    size_t          body_cap;
+};
+
+static void   write_message(arrow_writer *, const unsigned char *, size_t);
+static void   write_batch(arrow_writer *);
+static void   arrow_out(arrow_writer *, const void *, size_t);
+static void   fb_grow(fb_buf *, size_t);
+static size_t fb_put(fb_buf *, const void *, size_t);
+static void   fb_align(fb_buf *, size_t, size_t);
+static void   fb_patch(fb_buf *, size_t);
+static void   fb_table(fb_buf *, size_t, fb_field *, int);
+static size_t fb_vector(fb_buf *, size_t, int, int);
+static void   fb_string(fb_buf *, size_t, const char *);
+static void   put_le(unsigned char *, unsigned long long, int);
+
+
+arrow_writer *open_arrow_writer(FILE *fp, output_writer *writer, int ncols,
+                                const char **names, const char *site,
+                                int batch_rows) {
+    /*
+        Start an Arrow stream of the ncols named float64 columns, with a
+        site column of site in front unless it is NULL or empty, by writing
+        its schema.
+    */
+    arrow_writer *w;
+    fb_field      msg[4], schema[2], field[5], fp64[1];
+    size_t        vec;
+    int           i, k, nfields;
+    unsigned int  one = 1;
+
+    if ((w = (arrow_writer *)calloc(1, sizeof(arrow_writer))) == NULL ||
+        (w->cols = (double *)malloc((size_t)ncols * batch_rows *
+                                    sizeof(double))) == NULL) {
+        fprintf(stderr, "Error allocating space for arrow output\n");
+        gday_exit(EXIT_FAILURE);
+    }
+    w->fp = fp;
+    w->writer = writer;
+    w->ncols = ncols;
+    w->batch_rows = batch_rows;
+    if (site != NULL && *site != '\0') {
+        if ((w->site = (char *)malloc(strlen(site) + 1)) == NULL) {
+            fprintf(stderr, "Error allocating space for arrow output\n");
+            gday_exit(EXIT_FAILURE);
+        }
+        strcpy(w->site, site);
+    }
+    nfields = ncols + (w->site != NULL ? 1 : 0);
+
+    /* Message { version, header_type, header: Schema, bodyLength } */
+    w->fb.len = 0;
+    fb_put(&(w->fb), "\0\0\0\0", 4);
+    msg[0].id = 0; msg[0].size = 2; msg[0].value = ARROW_METADATA_V5;
+    msg[1].id = 1; msg[1].size = 1; msg[1].value = ARROW_HEADER_SCHEMA;
+    msg[2].id = 2; msg[2].size = 4; msg[2].value = 0;
+    msg[3].id = 3; msg[3].size = 8; msg[3].value = 0;
+    fb_table(&(w->fb), 0, msg, 4);
+
+    /* Schema { endianness, fields } */
+    schema[0].id = 0; schema[0].size = 2;
+    schema[0].value = *(unsigned char *)&one ? 0 : 1;
+    schema[1].id = 1; schema[1].size = 4; schema[1].value = 0;
+    fb_table(&(w->fb), msg[2].at, schema, 2);
+    vec = fb_vector(&(w->fb), schema[1].at, nfields, 4);
+
+    /* Field { name, nullable, type_type, type, children } */
+    for (i = 0; i < nfields; i++) {
+        k = w->site != NULL ? i - 1 : i;
+        field[0].id = 0; field[0].size = 4; field[0].value = 0;
+        field[1].id = 1; field[1].size = 1; field[1].value = FALSE;
+        field[2].id = 2; field[2].size = 1;
+        field[2].value = k < 0 ? ARROW_TYPE_UTF8 : ARROW_TYPE_FLOAT;
+        field[3].id = 3; field[3].size = 4; field[3].value = 0;
+        field[4].id = 5; field[4].size = 4; field[4].value = 0;
+        fb_table(&(w->fb), vec + 4 * i, field, 5);
+        fb_string(&(w->fb), field[0].at, k < 0 ? "site" : names[k]);
+        if (k < 0) {
+            fb_table(&(w->fb), field[3].at, NULL, 0);
+        } else {
+            fp64[0].id = 0; fp64[0].size = 2;
+            fp64[0].value = ARROW_PRECISION_DOUBLE;
+            fb_table(&(w->fb), field[3].at, fp64, 1);
+        }
+        fb_vector(&(w->fb), field[4].at, 0, 4);
+    }
+    write_message(w, NULL, 0);
+
+    return (w);
+}
+
+void arrow_writer_row(arrow_writer *w, const double *values) {
+    /* add a row of the ncols values, writing the batch out once it's full */
+    int j;
+
+    for (j = 0; j < w->ncols; j++)
+        w->cols[(size_t)j * w->batch_rows + w->nrows] = values[j];
+    if (++w->nrows == w->batch_rows)
+        write_batch(w);
+
+    return;
+}
+
+void close_arrow_writer(arrow_writer *w) {
+    /* write out what's left and end the stream */
+    static const unsigned char eos[8] = { 0xff, 0xff, 0xff, 0xff, 0, 0, 0, 0 };
+
+    if (w->nrows > 0)
+        write_batch(w);
+    arrow_out(w, eos, sizeof(eos));
+
+    free(w->cols);
+    free(w->site);
+    free(w->fb.data);
+    free(w->body);
+    free(w);
+
+    return;
+}
+
+static void write_batch(arrow_writer *w) {
+    /*
+        The rows so far as a record batch. The body has a validity and a
+        data buffer per float64 column, the validity ones empty as nothing
+        is ever null, and for the site column the offsets and the
+        characters as well, each buffer starting on an 8 byte boundary.
+    */
+    fb_field       msg[4], batch[3];
+    size_t         nodes, buffers, off, len, body_len, slen = 0;
+    unsigned char *p;
+    int            n = w->nrows, nfields, nbuffers, i, j, b;
+
+    nfields = w->ncols + (w->site != NULL ? 1 : 0);
+    nbuffers = 2 * w->ncols + (w->site != NULL ? 3 : 0);
+
+    /* the body */
+    body_len = (size_t)w->ncols * n * sizeof(double);
+    if (w->site != NULL) {
+        slen = strlen(w->site);
+        body_len += ((size_t)(n + 1) * 4 + 7) / 8 * 8;
+        body_len += ((size_t)n * slen + 7) / 8 * 8;
+    }
+    if (body_len > w->body_cap) {
+        free(w->body);
+        if ((w->body = (unsigned char *)malloc(body_len)) == NULL) {
+            fprintf(stderr, "Error allocating space for arrow output\n");
+            gday_exit(EXIT_FAILURE);
+        }
+        w->body_cap = body_len;
+    }
+    memset(w->body, 0, body_len);
+
+    /* Message { version, header_type, header: RecordBatch, bodyLength } */
+    w->fb.len = 0;
+    fb_put(&(w->fb), "\0\0\0\0", 4);
+    msg[0].id = 0; msg[0].size = 2; msg[0].value = ARROW_METADATA_V5;
+    msg[1].id = 1; msg[1].size = 1; msg[1].value = ARROW_HEADER_BATCH;
+    msg[2].id = 2; msg[2].size = 4; msg[2].value = 0;
+    msg[3].id = 3; msg[3].size = 8; msg[3].value = (long long)body_len;
+    fb_table(&(w->fb), 0, msg, 4);
+
+    /* RecordBatch { length, nodes, buffers } */
+    batch[0].id = 0; batch[0].size = 8; batch[0].value = n;
+    batch[1].id = 1; batch[1].size = 4; batch[1].value = 0;
+    batch[2].id = 2; batch[2].size = 4; batch[2].value = 0;
+    fb_table(&(w->fb), msg[2].at, batch, 3);
+    nodes = fb_vector(&(w->fb), batch[1].at, nfields, 16);
+    for (i = 0; i < nfields; i++) {
+        put_le(w->fb.data + nodes + 16 * i, (unsigned long long)n, 8);
+        put_le(w->fb.data + nodes + 16 * i + 8, 0, 8);
+    }
+    buffers = fb_vector(&(w->fb), batch[2].at, nbuffers, 16);
+
+    off = 0;
+    b = 0;
+    if (w->site != NULL) {
+        /* validity, offsets, characters */
+        put_le(w->fb.data + buffers + 16 * b, off, 8);
+        put_le(w->fb.data + buffers + 16 * b++ + 8, 0, 8);
+        len = (size_t)(n + 1) * 4;
+        put_le(w->fb.data + buffers + 16 * b, off, 8);
+        put_le(w->fb.data + buffers + 16 * b++ + 8, len, 8);
+        for (i = 0; i <= n; i++)
+            put_le(w->body + off + 4 * i, (unsigned long long)(i * slen), 4);
+        off += (len + 7) / 8 * 8;
+        len = (size_t)n * slen;
+        put_le(w->fb.data + buffers + 16 * b, off, 8);
+        put_le(w->fb.data + buffers + 16 * b++ + 8, len, 8);
+        for (i = 0, p = w->body + off; i < n; i++, p += slen)
+            memcpy(p, w->site, slen);
+        off += (len + 7) / 8 * 8;
+    }
+    for (j = 0; j < w->ncols; j++) {
+        len = (size_t)n * sizeof(double);
+        put_le(w->fb.data + buffers + 16 * b, off, 8);
+        put_le(w->fb.data + buffers + 16 * b++ + 8, 0, 8);
+        put_le(w->fb.data + buffers + 16 * b, off, 8);
+        put_le(w->fb.data + buffers + 16 * b++ + 8, len, 8);
+        memcpy(w->body + off, w->cols + (size_t)j * w->batch_rows, len);
+        off += len;
+    }
+
+    write_message(w, w->body, body_len);
+    w->nrows = 0;
+
+    return;
+}
+
+static void write_message(arrow_writer *w, const unsigned char *body,
+                          size_t body_len) {
+    /* the flatbuffer in w->fb, framed, and its body */
+    unsigned char prefix[8];
+
+    fb_align(&(w->fb), 8, 0);
+    put_le(prefix, 0xffffffffULL, 4);
+    put_le(prefix + 4, (unsigned long long)w->fb.len, 4);
+    arrow_out(w, prefix, sizeof(prefix));
+    arrow_out(w, w->fb.data, w->fb.len);
+    if (body_len > 0)
+        arrow_out(w, body, body_len);
+
+    return;
+}
+
+static void arrow_out(arrow_writer *w, const void *data, size_t len) {
+    /* to the file, or the writer thread if there is one */
+    if (w->writer != NULL)
+        output_writer_put(w->writer, w->fp, data, len);
+    else
+        fwrite(data, 1, len, w->fp);
+
+    return;
+}
+
+static void fb_grow(fb_buf *b, size_t n) {
+    size_t         cap;
+    unsigned char *data;
+
+    if (b->len + n <= b->cap)
+        return;
+    cap = MAX(2 * b->cap, b->len + n + 256);
+    if ((data = (unsigned char *)realloc(b->data, cap)) == NULL) {
+        fprintf(stderr, "Error allocating space for arrow output\n");
+        gday_exit(EXIT_FAILURE);
+    }
+    b->data = data;
+    b->cap = cap;
+
+    return;
+}
+
+static size_t fb_put(fb_buf *b, const void *data, size_t n) {
+    /* append n bytes (zeros if data is NULL), returning where they went */
+    size_t at = b->len;
+
+    fb_grow(b, n);
+    if (data != NULL)
+        memcpy(b->data + at, data, n);
+    else
+        memset(b->data + at, 0, n);
+    b->len += n;
+
+    return (at);
+}
+
+static void fb_align(fb_buf *b, size_t align, size_t rem) {
+    /* pad until the length is rem more than a multiple of align */
+    while (b->len % align != rem)
+        fb_put(b, NULL, 1);
+
+    return;
+}
+
+static void fb_patch(fb_buf *b, size_t at) {
+    /* point the offset at at to whatever is written next */
+    put_le(b->data + at, (unsigned long long)(b->len - at), 4);
+
+    return;
+}
+
+static void fb_table(fb_buf *b, size_t ref, fb_field *f, int n) {
+    /*
+        A table of the n fields, its vtable first, with ref (the offset that
+        refers to it) patched to point at it. The table starts 4 past an 8
+        byte boundary so that, the largest fields going first, each field
+        is aligned to its size. f[i].at is where field i went.
+    */
+    unsigned char  vt[4 + 2 * FB_MAX_SLOTS];
+    int            off[FB_MAX_SLOTS];
+    int            slots = 0, size, tsize = 4, i;
+    size_t         vt_pos, t_pos;
+
+    for (i = 0; i < n; i++)
+        slots = MAX(slots, f[i].id + 1);
+    for (size = 8; size >= 1; size /= 2) {
+        for (i = 0; i < n; i++) {
+            if (f[i].size == size) {
+                while ((4 + tsize) % size != 0)
+                    tsize++;
+                off[i] = tsize;
+                tsize += size;
+            }
+        }
+    }
+    while (tsize % 4 != 0)
+        tsize++;
+
+    memset(vt, 0, sizeof(vt));
+    put_le(vt, (unsigned long long)(4 + 2 * slots), 2);
+    put_le(vt + 2, (unsigned long long)tsize, 2);
+    for (i = 0; i < n; i++)
+        put_le(vt + 4 + 2 * f[i].id, (unsigned long long)off[i], 2);
+    fb_align(b, 2, 0);
+    vt_pos = fb_put(b, vt, 4 + 2 * slots);
+
+    fb_align(b, 8, 4);
+    fb_patch(b, ref);
+    t_pos = fb_put(b, NULL, tsize);
+    put_le(b->data + t_pos, (unsigned long long)(t_pos - vt_pos), 4);
+    for (i = 0; i < n; i++) {
+        f[i].at = t_pos + off[i];
+        put_le(b->data + f[i].at, (unsigned long long)f[i].value, f[i].size);
+    }
+
+    return;
+}
+
+static size_t fb_vector(fb_buf *b, size_t ref, int n, int elem_size) {
+    /*
+        A vector of n zeroed elements, aligned for elements up to 8 bytes,
+        with ref patched to point at it. Returns where the elements start.
+    */
+    unsigned char len[4];
+
+    fb_align(b, elem_size >= 8 ? 8 : 4, elem_size >= 8 ? 4 : 0);
+    fb_patch(b, ref);
+    put_le(len, (unsigned long long)n, 4);
+    fb_put(b, len, 4);
+
+    return (fb_put(b, NULL, (size_t)n * elem_size));
+}
+
+static void fb_string(fb_buf *b, size_t ref, const char *s) {
+    /* a string, with ref patched to point at it */
+    unsigned char len[4];
+    size_t        n = strlen(s);
+
+    fb_align(b, 4, 0);
+    fb_patch(b, ref);
+    put_le(len, (unsigned long long)n, 4);
+    fb_put(b, len, 4);
+    fb_put(b, s, n + 1);
+
+    return;
+}
+
+static void put_le(unsigned char *p, unsigned long long v, int size) {
+    /* flatbuffers and the stream framing are little endian throughout */
+    int i;
+
+    for (i = 0; i < size; i++) {
+        p[i] = (unsigned char)(v & 0xff);
+        v >>= 8;
+    }
+
+    return;
+}
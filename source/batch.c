@@ -0,0 +1,439 @@
+/* ============================================================================
+* Batch driver: run every site listed in a manifest on a pool of threads.
+*
+* The manifest is a plain text file with one site per line,
+*
+*   param_file,met_file,output_file
+*
+* Lines starting with '#' are ignored. The met and output columns are
+* optional, when they are left blank the [files] section of the param file
+* is used instead.
+*
+* NOTES:
+*   Each worker owns a single gday_sim handle that it reloads for every site
+*   it picks up, so the hydraulics and numerical arrays are only allocated
+*   once per thread rather than once per site. The met store is open while
+*   the batch runs, so sites on the same met file (e.g. paddocks on one
+*   climate grid cell) share a single copy of it, see met_store.c.
+*
+*   Sites can differ in cost by orders of magnitude (a daily bucket run vs a
+*   half-hourly hydraulics spin-up), so rather than handing them out in
+*   manifest order they're scheduled longest first with work stealing, see
+*   run_batch and site_cost.c.
+*
+* =========================================================================== */
+#include "batch.h"
+#include "site_cost.h"
+#include "met_store.h"
+
+typedef struct {
+    int        *items;      /* site indices, costliest first */
+    int         head;       /* the owning worker takes from here */
+    int         tail;       /* thieves take from here, one past the end */
+    double      queued;     /* estimated cost still waiting */
+    gday_mutex  lock;
+} site_queue;
+
+typedef struct {
+    batch_site *sites;
+    int         nsites;
+    site_queue *queues;     /* one per worker */
+    int         nqueues;
+    int         flags;
+} batch_pool;
+
+typedef struct {
+    batch_pool *bp;
+    int         id;
+} worker_arg;
+
+typedef struct {
+    int    index;
+    double estimate;
+} site_order;
+
+static void batch_worker(void *);
+static int  deal_sites(batch_pool *);
+static void free_queues(batch_pool *);
+static int  take_site(batch_pool *, int, int);
+static int  steal_site(batch_pool *, int);
+static int  by_estimate(const void *, const void *);
+static char *copy_field(char *);
+
+
+int run_batch(char *manifest_fname, int nthreads, int flags) {
+    /*
+        Run all the sites in the manifest, returns the number that failed
+        (or -1 if the manifest couldn't be read).
+
+        The sites are costed up front (see site_cost.c) and dealt out to
+        per-worker queues, longest first, so each worker starts with about
+        the same amount of work. A worker that runs dry steals from whoever
+        has the most left. The measured run times are written back to
+        <manifest>.cost to sharpen the estimates next time.
+    */
+    batch_pool    bp;
+    cost_history  history;
+    gday_thread  *threads;
+    worker_arg   *args;
+    char          cost_fname[STRING_LENGTH];
+    int           i, nstarted = 0, nfailed = 0;
+
+    if (read_manifest(manifest_fname, &(bp.sites), &(bp.nsites)) != 0)
+        return (-1);
+
+    if (strlen(manifest_fname) + 6 > sizeof(cost_fname)) {
+        fprintf(stderr, "Manifest file name too long: %s\n", manifest_fname);
+        free_manifest(bp.sites, bp.nsites);
+        return (-1);
+    }
+    sprintf(cost_fname, "%s.cost", manifest_fname);
+
+    /* a bad history only costs us the better estimates */
+    if (read_cost_history(cost_fname, &history) != 0)
+        memset(&history, 0, sizeof(cost_history));
+
+    for (i = 0; i < bp.nsites; i++)
+        estimate_site_cost(&history, &(bp.sites[i]), flags);
+
+    if (nthreads <= 0)
+        nthreads = number_of_cpus();
+    nthreads = MAX(MIN(nthreads, bp.nsites), 1);
+
+    bp.flags = flags;
+    bp.nqueues = nthreads;
+    threads = (gday_thread *)calloc(nthreads, sizeof(gday_thread));
+    args = (worker_arg *)calloc(nthreads, sizeof(worker_arg));
+    if (threads == NULL || args == NULL || deal_sites(&bp) != 0) {
+        fprintf(stderr, "batch threads: Not allocated enough memory!\n");
+        free(threads);
+        free(args);
+        free_cost_history(&history);
+        free_manifest(bp.sites, bp.nsites);
+        return (-1);
+    }
+
+    met_store_open();
+    for (i = 0; i < nthreads; i++) {
+        args[i].bp = &bp;
+        args[i].id = i;
+        if (thread_start(&threads[i], batch_worker, &args[i]) != 0) {
+            fprintf(stderr, "Couldn't start batch thread %d\n", i);
+            break;
+        }
+        nstarted++;
+    }
+
+    /*
+     * Nothing started, do the work on this thread instead. Any queues
+     * without a worker are emptied by stealing.
+     */
+    if (nstarted == 0)
+        batch_worker(&args[0]);
+
+    for (i = 0; i < nstarted; i++)
+        thread_join(threads[i]);
+    met_store_close();
+
+    for (i = 0; i < bp.nsites; i++) {
+        if (bp.sites[i].status != 0) {
+            fprintf(stderr, "Batch: site %d (%s) failed\n", i+1,
+                    bp.sites[i].cfg_fname);
+            nfailed++;
+        }
+        record_site_cost(&history, &(bp.sites[i]));
+    }
+    fprintf(stderr, "Batch: %d of %d sites ran successfully\n",
+            bp.nsites - nfailed, bp.nsites);
+
+    write_cost_history(cost_fname, &history);
+
+    free_queues(&bp);
+    free(threads);
+    free(args);
+    free_cost_history(&history);
+    free_manifest(bp.sites, bp.nsites);
+
+    return (nfailed);
+}
+
+static void batch_worker(void *arg) {
+
+    batch_pool *bp = ((worker_arg *)arg)->bp;
+    int         id = ((worker_arg *)arg)->id;
+    batch_site *site;
+    gday_sim   *sim;
+    double      start;
+    int         i;
+
+    if ((sim = gday_sim_new()) == NULL)
+        return;
+
+    /* our own queue first, then help out whoever is furthest behind */
+    while ((i = take_site(bp, id, TRUE)) >= 0 ||
+           (i = steal_site(bp, id)) >= 0) {
+        site = &(bp->sites[i]);
+        if (site->cfg_fname == NULL)
+            continue;
+        start = wall_clock();
+        site->status = gday_sim_load(sim, site->cfg_fname, site->met_fname,
+                                     site->out_fname, bp->flags);
+        if (site->status == 0)
+            site->status = gday_sim_run(sim);
+        site->seconds = wall_clock() - start;
+    }
+    gday_sim_destroy(sim);
+
+    return;
+}
+
+static int deal_sites(batch_pool *bp) {
+    /*
+        Sort the sites costliest first and hand each one to the queue with
+        the least work so far (longest processing time first). Each queue
+        ends up in descending order of cost. Returns 0 on success.
+    */
+    site_order *order;
+    int        *owner, *count;
+    double     *load;
+    int         i, q, best, error = 0;
+
+    order = (site_order *)malloc(bp->nsites * sizeof(site_order));
+    owner = (int *)malloc(bp->nsites * sizeof(int));
+    count = (int *)calloc(bp->nqueues, sizeof(int));
+    load = (double *)calloc(bp->nqueues, sizeof(double));
+    bp->queues = (site_queue *)calloc(bp->nqueues, sizeof(site_queue));
+    if (order == NULL || owner == NULL || count == NULL || load == NULL ||
+        bp->queues == NULL) {
+        error = 1;
+        goto finished;
+    }
+
+    for (i = 0; i < bp->nsites; i++) {
+        order[i].index = i;
+        order[i].estimate = bp->sites[i].estimate;
+    }
+    qsort(order, bp->nsites, sizeof(site_order), by_estimate);
+
+    for (i = 0; i < bp->nsites; i++) {
+        best = 0;
+        for (q = 1; q < bp->nqueues; q++) {
+            if (load[q] < load[best])
+                best = q;
+        }
+        owner[i] = best;
+        load[best] += order[i].estimate;
+        count[best]++;
+    }
+
+    for (q = 0; q < bp->nqueues; q++) {
+        bp->queues[q].items = (int *)malloc(MAX(count[q], 1) * sizeof(int));
+        if (bp->queues[q].items == NULL) {
+            error = 1;
+            goto finished;
+        }
+        bp->queues[q].queued = load[q];
+        mutex_init(&(bp->queues[q].lock));
+    }
+    for (i = 0; i < bp->nsites; i++) {
+        q = owner[i];
+        bp->queues[q].items[bp->queues[q].tail++] = order[i].index;
+    }
+
+finished:
+    if (error && bp->queues != NULL) {
+        for (q = 0; q < bp->nqueues; q++) {
+            if (bp->queues[q].items != NULL)
+                mutex_free(&(bp->queues[q].lock));
+            free(bp->queues[q].items);
+        }
+        free(bp->queues);
+        bp->queues = NULL;
+    }
+    free(order);
+    free(owner);
+    free(count);
+    free(load);
+
+    return (error);
+}
+
+static void free_queues(batch_pool *bp) {
+    int q;
+
+    for (q = 0; q < bp->nqueues; q++) {
+        mutex_free(&(bp->queues[q].lock));
+        free(bp->queues[q].items);
+    }
+    free(bp->queues);
+    bp->queues = NULL;
+
+    return;
+}
+
+static int take_site(batch_pool *bp, int q, int from_head) {
+    /*
+        Pop a site off queue q, the owner takes the costliest from the
+        head, thieves take the cheapest from the tail so the owner's order
+        is left alone. Returns -1 if the queue is empty.
+    */
+    site_queue *sq = &(bp->queues[q]);
+    int         i = -1;
+
+    mutex_lock(&(sq->lock));
+    if (sq->head < sq->tail) {
+        i = from_head ? sq->items[sq->head++] : sq->items[--sq->tail];
+        sq->queued -= bp->sites[i].estimate;
+    }
+    mutex_unlock(&(sq->lock));
+
+    return (i);
+}
+
+static int steal_site(batch_pool *bp, int thief) {
+    /*
+        Take a site from the queue with the most estimated work left, -1
+        once every queue is empty.
+    */
+    double      most, queued;
+    int         q, victim, i;
+
+    while (TRUE) {
+        victim = -1;
+        most = -1.0;
+        for (q = 0; q < bp->nqueues; q++) {
+            if (q == thief)
+                continue;
+            mutex_lock(&(bp->queues[q].lock));
+            queued = (bp->queues[q].head < bp->queues[q].tail) ?
+                      bp->queues[q].queued : -1.0;
+            mutex_unlock(&(bp->queues[q].lock));
+            if (queued > most) {
+                most = queued;
+                victim = q;
+            }
+        }
+        if (victim < 0)
+            return (-1);
+
+        /* somebody may have beaten us to it, in which case look again */
+        if ((i = take_site(bp, victim, FALSE)) >= 0)
+            return (i);
+    }
+}
+
+static int by_estimate(const void *a, const void *b) {
+    /* descending estimated cost, ties keep manifest order */
+    const site_order *sa = (const site_order *)a;
+    const site_order *sb = (const site_order *)b;
+
+    if (sa->estimate > sb->estimate)
+        return (-1);
+    if (sa->estimate < sb->estimate)
+        return (1);
+    return (sa->index - sb->index);
+}
+
+int read_manifest(char *fname, batch_site **sites, int *nsites) {
+    /* returns 0 on success */
+    FILE       *fp;
+    char        line[STRING_LENGTH];
+    char       *field[3], *start, *end;
+    batch_site *tmp;
+    int         i, nf, size = 0, line_number = 0;
+
+    *sites = NULL;
+    *nsites = 0;
+
+    if ((fp = fopen(fname, "r")) == NULL) {
+        fprintf(stderr, "Error: couldn't open manifest file %s for read\n",
+                fname);
+        return (1);
+    }
+
+    while (fgets(line, STRING_LENGTH, fp) != NULL) {
+        line_number++;
+        start = lskip(rstrip(line));
+
+        /* ignore comments and blank lines */
+        if (*start == '#' || *start == '\0')
+            continue;
+
+        /* split on commas, missing columns stay NULL */
+        nf = 0;
+        field[0] = field[1] = field[2] = NULL;
+        while (start != NULL && nf < 3) {
+            end = strchr(start, ',');
+            if (end != NULL)
+                *end++ = '\0';
+            field[nf++] = rstrip(lskip(start));
+            start = end;
+        }
+        if (start != NULL || *field[0] == '\0') {
+            fprintf(stderr, "%s: badly formatted manifest on line %d\n",
+                    fname, line_number);
+            fclose(fp);
+            free_manifest(*sites, *nsites);
+            *sites = NULL;
+            *nsites = 0;
+            return (1);
+        }
+
+        if (*nsites == size) {
+            size = (size == 0) ? 64 : size * 2;
+            tmp = (batch_site *)realloc(*sites, size * sizeof(batch_site));
+            if (tmp == NULL) {
+                fprintf(stderr, "Error allocating space for manifest\n");
+                fclose(fp);
+                free_manifest(*sites, *nsites);
+                *sites = NULL;
+                *nsites = 0;
+                return (1);
+            }
+            *sites = tmp;
+        }
+
+        i = (*nsites)++;
+        (*sites)[i].cfg_fname = copy_field(field[0]);
+        (*sites)[i].met_fname = copy_field(field[1]);
+        (*sites)[i].out_fname = copy_field(field[2]);
+        (*sites)[i].status = -1;
+    }
+    fclose(fp);
+
+    if (*nsites == 0) {
+        fprintf(stderr, "%s: manifest doesn't list any sites\n", fname);
+        return (1);
+    }
+
+    return (0);
+}
+
+void free_manifest(batch_site *sites, int nsites) {
+    int i;
+
+    for (i = 0; i < nsites; i++) {
+        free(sites[i].cfg_fname);
+        free(sites[i].met_fname);
+        free(sites[i].out_fname);
+    }
+    free(sites);
+
+    return;
+}
+
+static char *copy_field(char *field) {
+    /* heap copy of a manifest column, blank columns become NULL */
+    char *copy;
+
+    if (field == NULL || *field == '\0')
+        return (NULL);
+
+    if ((copy = (char *)malloc(strlen(field) + 1)) == NULL) {
+        fprintf(stderr, "Error allocating space for manifest\n");
+        return (NULL);
+    }
+    strcpy(copy, field);
+
+    return (copy);
+}
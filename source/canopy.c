@@ -100,7 +100,7 @@ void canopy(canopy_wk *cw, control *c, fluxes *f, met_arrays *ma, met *m,
                     } else {
                         /* Nothing implemented */
                         fprintf(stderr, "C4 photosynthesis not implemented\n");
-                        exit(EXIT_FAILURE);
+                        gday_exit(EXIT_FAILURE);
                     }
 
                     if (cw->an_leaf[cw->ileaf] > 1E-04) {
@@ -120,7 +120,7 @@ void canopy(canopy_wk *cw, control *c, fluxes *f, met_arrays *ma, met *m,
 
                     if (iter >= itermax) {
                         fprintf(stderr, "No convergence in canopy loop:\n");
-                        exit(EXIT_FAILURE);
+                        gday_exit(EXIT_FAILURE);
                     } else if (fabs(cw->tleaf[cw->ileaf] - cw->tleaf_new) < 0.02) {
                         break;
                     }
@@ -177,7 +177,10 @@ void canopy(canopy_wk *cw, control *c, fluxes *f, met_arrays *ma, met *m,
                                           cw->trans_deficit_canopy, year, doy);
 
         if (c->print_options == SUBDAILY && c->spin_up == FALSE) {
-            write_subdaily_outputs_ascii(c, cw, year, doy, hod);
+            if (c->output_ascii)
+                write_subdaily_outputs_ascii(c, cw, year, doy, hod);
+            else
+                write_subdaily_outputs_binary(c, cw, year, doy, hod);
         }
         c->hour_idx++;
         sunlight_hrs++;
@@ -0,0 +1,499 @@
+/* ============================================================================
+* Binary checkpoint/restart of a run at a day boundary.
+*
+* A checkpoint holds the params, state, fluxes, canopy, met, spin-up and
+* numerical structures as they are in memory, the part of the control that
+* moves on as the run goes (the day and hour counters and any output period
+* being aggregated), followed by the contents of every heap array hanging
+* off them (day length, the soil hydraulics layers, the ODE workspace, the
+* growth stress running mean and the disturbance years). Restoring one
+* therefore puts a run back exactly where it was, bit for bit.
+*
+* NOTES:
+*   The structures are written raw, so a checkpoint can only be read back by
+*   a build with the same structure layout. The header records the format
+*   version and the size of every structure and anything that doesn't match
+*   is refused rather than misread.
+*
+*   The rest of the control (files, model options, command line options)
+*   belongs to the run doing the restoring and isn't saved at all, nor are
+*   the met arrays and solar geometry, which come from the met file.
+*
+*   A checkpoint is read and checked in full, up to its closing magic,
+*   before any of it is copied over the run, so one that is refused leaves
+*   the run as it was.
+*
+*   Checkpoints are written to a temporary file and renamed into place, so
+*   a run killed part way through writing one leaves the last good one.
+*
+* =========================================================================== */
+#include "checkpoint.h"
+#include "param_registry.h"
+
+#define N_LAYOUT   10
+#define MAX_ARRAYS 40
+
+/* what of the control a checkpoint keeps, see save_control */
+typedef struct {
+    int    num_years;
+    int    total_num_days;
+    int    sub_daily;
+    int    water_balance;
+    int    num_days;
+    long   hour_idx;
+    long   day_idx;
+    int    agg_year;
+    int    agg_period;
+    int    agg_ndays;
+    double agg_value[MAX_OUTPUT_VARS];
+} control_state;
+
+/* a heap array of the run and how many bytes of it are saved */
+typedef struct {
+    void   *ptr;
+    size_t  size;
+} saved_array;
+
+/* a checkpoint being read, pos is how far through data we are */
+typedef struct {
+    char        *fname;
+    mapped_file  mf;
+    size_t       pos;
+} checkpoint_reader;
+
+static void layout(int *);
+static void save_control(control *, control_state *);
+static void restore_control(control *, control_state *);
+static int  list_arrays(control *, params *, state *, fluxes *, nrutil *,
+                        saved_array *);
+static void write_block(FILE *, void *, size_t, char *);
+static void *take(checkpoint_reader *, size_t);
+static void refuse(checkpoint_reader *, char *);
+
+
+void write_checkpoint(char *fname, canopy_wk *cw, control *c, fluxes *f,
+                      fast_spinup *fs, met *m, params *p, state *s,
+                      nrutil *nr, run_clock *rc) {
+    /*
+        Snapshot the run, to be called between two days, i.e. before
+        advance_day or after it has returned.
+    */
+    FILE          *fp;
+    char           tmp_fname[STRING_LENGTH + 4];
+    int            sizes[N_LAYOUT], version = CHECKPOINT_VERSION;
+    int            i, narrays, period, has_nr;
+    control_state  cs;
+    saved_array    arrays[MAX_ARRAYS];
+
+    sprintf(tmp_fname, "%s.tmp", fname);
+    if ((fp = fopen(tmp_fname, "wb")) == NULL) {
+        fprintf(stderr, "Error: couldn't open checkpoint file %s for write\n",
+                tmp_fname);
+        gday_exit(EXIT_FAILURE);
+    }
+
+    layout(sizes);
+    write_block(fp, CHECKPOINT_MAGIC, 8, tmp_fname);
+    write_block(fp, &version, sizeof(int), tmp_fname);
+    write_block(fp, sizes, sizeof(sizes), tmp_fname);
+
+    /* the structures, pointers and all, sorted out again on the way in */
+    save_control(c, &cs);
+    write_block(fp, &cs, sizeof(control_state), tmp_fname);
+    write_block(fp, p, sizeof(params), tmp_fname);
+    write_block(fp, s, sizeof(state), tmp_fname);
+    write_block(fp, f, sizeof(fluxes), tmp_fname);
+    write_block(fp, cw, sizeof(canopy_wk), tmp_fname);
+    write_block(fp, m, sizeof(met), tmp_fname);
+    write_block(fp, fs, sizeof(fast_spinup), tmp_fname);
+    write_block(fp, rc, sizeof(run_clock), tmp_fname);
+
+    /* ODE workspace */
+    has_nr = (nr->y != NULL);
+    write_block(fp, &has_nr, sizeof(int), tmp_fname);
+    if (has_nr)
+        write_block(fp, nr, sizeof(nrutil), tmp_fname);
+
+    /* growth stress running mean, the window size changes as we go */
+    period = (rc->hw != NULL) ? rc->hw->period : 0;
+    write_block(fp, &period, sizeof(int), tmp_fname);
+    if (period > 0)
+        write_block(fp, rc->hw, sizeof(sma_obj), tmp_fname);
+
+    narrays = list_arrays(c, p, s, f, nr, arrays);
+    for (i = 0; i < narrays; i++)
+        write_block(fp, arrays[i].ptr, arrays[i].size, tmp_fname);
+
+    if (period > 0)
+        write_block(fp, rc->hw->values, period * sizeof(double), tmp_fname);
+
+    if (rc->num_disturbance_yrs > 0) {
+        write_block(fp, rc->disturbance_yrs,
+                    rc->num_disturbance_yrs * sizeof(int), tmp_fname);
+    }
+
+    /* so that a truncated file can't pass for a good one */
+    write_block(fp, CHECKPOINT_MAGIC, 8, tmp_fname);
+
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "Error writing checkpoint file %s\n", tmp_fname);
+        gday_exit(EXIT_FAILURE);
+    }
+
+    #ifdef _WIN32
+    remove(fname);
+    #endif
+    if (rename(tmp_fname, fname) != 0) {
+        fprintf(stderr, "Error: couldn't rename %s to %s\n", tmp_fname,
+                fname);
+        gday_exit(EXIT_FAILURE);
+    }
+
+    return;
+}
+
+void read_checkpoint(char *fname, canopy_wk *cw, control *c, fluxes *f,
+                     fast_spinup *fs, met *m, params *p, state *s,
+                     nrutil *nr, run_clock *rc) {
+    /*
+        Put a run back to where it was when the checkpoint was written. The
+        run must already have been set up (start_run) against the same met
+        file, so that all the arrays exist and are the right size.
+    */
+    checkpoint_reader  r;
+    char               why[STRING_LENGTH];
+    char              *src[MAX_ARRAYS], *sma_values = NULL, *yrs = NULL;
+    int                sizes[N_LAYOUT], expected[N_LAYOUT], version;
+    int                i, narrays, period, has_nr;
+    int               *disturbance_yrs = NULL;
+    control_state      now, cs;
+    params             pp;
+    state              ss;
+    fluxes             ff;
+    canopy_wk          cc;
+    met                mm;
+    fast_spinup        fss;
+    run_clock          rr;
+    nrutil             nn;
+    sma_obj            saved;
+    saved_array        arrays[MAX_ARRAYS];
+
+    r.fname = fname;
+    r.pos = 0;
+    if (! map_file(fname, FALSE, &r.mf)) {
+        fprintf(stderr, "Error: couldn't open checkpoint file %s for read\n",
+                fname);
+        gday_exit(EXIT_FAILURE);
+    }
+
+    /* everything is read into our own copies first ... */
+    layout(expected);
+    if (memcmp(take(&r, 8), CHECKPOINT_MAGIC, 8) != 0)
+        refuse(&r, "isn't a G'DAY checkpoint");
+    memcpy(&version, take(&r, sizeof(int)), sizeof(int));
+    if (version != CHECKPOINT_VERSION) {
+        sprintf(why, "is checkpoint version %d, expected %d", version,
+                CHECKPOINT_VERSION);
+        refuse(&r, why);
+    }
+    memcpy(sizes, take(&r, sizeof(sizes)), sizeof(sizes));
+    for (i = 0; i < N_LAYOUT; i++) {
+        if (sizes[i] != expected[i])
+            refuse(&r, "was written by a different build of the model");
+    }
+
+    memcpy(&cs, take(&r, sizeof(control_state)), sizeof(control_state));
+    memcpy(&pp, take(&r, sizeof(params)), sizeof(params));
+    memcpy(&ss, take(&r, sizeof(state)), sizeof(state));
+    memcpy(&ff, take(&r, sizeof(fluxes)), sizeof(fluxes));
+    memcpy(&cc, take(&r, sizeof(canopy_wk)), sizeof(canopy_wk));
+    memcpy(&mm, take(&r, sizeof(met)), sizeof(met));
+    memcpy(&fss, take(&r, sizeof(fast_spinup)), sizeof(fast_spinup));
+    memcpy(&rr, take(&r, sizeof(run_clock)), sizeof(run_clock));
+
+    /* a checkpoint only makes sense against the forcing it came from */
+    save_control(c, &now);
+    if (cs.num_years != now.num_years ||
+        cs.total_num_days != now.total_num_days ||
+        cs.sub_daily != now.sub_daily ||
+        cs.water_balance != now.water_balance ||
+        (cs.water_balance == HYDRAULICS &&
+         (pp.core != p->core || pp.wetting != p->wetting))) {
+        refuse(&r, "doesn't match the met file or model set up of this run");
+    }
+
+    memcpy(&has_nr, take(&r, sizeof(int)), sizeof(int));
+    if (has_nr != (nr->y != NULL))
+        refuse(&r, "doesn't match the model set up of this run");
+    if (has_nr) {
+        memcpy(&nn, take(&r, sizeof(nrutil)), sizeof(nrutil));
+        if (nn.N != nr->N || nn.kmax != nr->kmax)
+            refuse(&r, "doesn't match the model set up of this run");
+    }
+
+    memcpy(&period, take(&r, sizeof(int)), sizeof(int));
+    if (period < 0)
+        refuse(&r, "is corrupt");
+    if (period > 0) {
+        memcpy(&saved, take(&r, sizeof(sma_obj)), sizeof(sma_obj));
+        if (saved.period != period)
+            refuse(&r, "is corrupt");
+    }
+
+    /* our arrays are the right size, so theirs go straight over them */
+    narrays = list_arrays(c, p, s, f, nr, arrays);
+    for (i = 0; i < narrays; i++)
+        src[i] = take(&r, arrays[i].size);
+
+    if (period > 0)
+        sma_values = take(&r, period * sizeof(double));
+
+    if (rr.num_disturbance_yrs < 0)
+        refuse(&r, "is corrupt");
+    if (rr.num_disturbance_yrs > 0)
+        yrs = take(&r, rr.num_disturbance_yrs * sizeof(int));
+
+    if (memcmp(take(&r, 8), CHECKPOINT_MAGIC, 8) != 0)
+        refuse(&r, "is corrupt");
+
+    if (rr.num_disturbance_yrs > 0) {
+        disturbance_yrs = (int *)calloc(rr.num_disturbance_yrs, sizeof(int));
+        if (disturbance_yrs == NULL) {
+            unmap_file(&r.mf);
+            fprintf(stderr,"Error allocating space for disturbance_yrs\n");
+            gday_exit(EXIT_FAILURE);
+        }
+        memcpy(disturbance_yrs, yrs, rr.num_disturbance_yrs * sizeof(int));
+    }
+
+    /* ... and only once it has all checked out does it replace the run's,
+       with our own arrays back in place of the pointers that were saved */
+    pp.potA = p->potA;
+    pp.potB = p->potB;
+    pp.cond1 = p->cond1;
+    pp.cond2 = p->cond2;
+    pp.cond3 = p->cond3;
+    pp.porosity = p->porosity;
+    pp.field_capacity = p->field_capacity;
+    ss.day_length = s->day_length;
+    ss.water_frac = s->water_frac;
+    ss.wetting_bot = s->wetting_bot;
+    ss.wetting_top = s->wetting_top;
+    ss.thickness = s->thickness;
+    ss.root_mass = s->root_mass;
+    ss.root_length = s->root_length;
+    ss.layer_depth = s->layer_depth;
+    ff.soil_conduct = f->soil_conduct;
+    ff.swp = f->swp;
+    ff.soilR = f->soilR;
+    ff.fraction_uptake = f->fraction_uptake;
+    ff.ppt_gain = f->ppt_gain;
+    ff.water_loss = f->water_loss;
+    ff.water_gain = f->water_gain;
+    ff.est_evap = f->est_evap;
+    cc.cz_store = cw->cz_store;
+    cc.ele_store = cw->ele_store;
+    cc.df_store = cw->df_store;
+    cc.solar_capacity = cw->solar_capacity;
+    rr.hw = rc->hw;
+    rr.disturbance_yrs = disturbance_yrs;
+
+    if (period > 0) {
+        if (rr.hw == NULL || rr.hw->period != period) {
+            if (rr.hw != NULL)
+                sma(SMA_FREE, rr.hw);
+            rr.hw = sma(SMA_NEW, period).handle;
+        }
+        rr.hw->sma = saved.sma;
+        rr.hw->sum = saved.sum;
+        rr.hw->lv = saved.lv;
+        memcpy(rr.hw->values, sma_values, period * sizeof(double));
+    }
+    free(rc->disturbance_yrs);
+
+    restore_control(c, &cs);
+    *p = pp;
+    *s = ss;
+    *f = ff;
+    *cw = cc;
+    *m = mm;
+    *fs = fss;
+    *rc = rr;
+    for (i = 0; i < narrays; i++)
+        memcpy(arrays[i].ptr, src[i], arrays[i].size);
+
+    unmap_file(&r.mf);
+
+    return;
+}
+
+static void layout(int *sizes) {
+    /* anything that changes these invalidates old checkpoints */
+    sizes[0] = (int)sizeof(control_state);
+    sizes[1] = (int)sizeof(params);
+    sizes[2] = (int)sizeof(state);
+    sizes[3] = (int)sizeof(fluxes);
+    sizes[4] = (int)sizeof(canopy_wk);
+    sizes[5] = (int)sizeof(met);
+    sizes[6] = (int)sizeof(fast_spinup);
+    sizes[7] = (int)sizeof(run_clock);
+    sizes[8] = (int)sizeof(nrutil);
+    sizes[9] = (int)sizeof(sma_obj);
+
+    return;
+}
+
+static void save_control(control *c, control_state *cs) {
+    /*
+        The control fields that the model itself moves on from day to day,
+        plus the shape of the forcing, which a restart is checked against.
+        Anything else in the control is a setting of the run, taken from
+        the run doing the restoring.
+    */
+    memset(cs, 0, sizeof(control_state));
+    cs->num_years = c->num_years;
+    cs->total_num_days = c->total_num_days;
+    cs->sub_daily = c->sub_daily;
+    cs->water_balance = c->water_balance;
+    cs->num_days = c->num_days;
+    cs->hour_idx = c->hour_idx;
+    cs->day_idx = c->day_idx;
+    cs->agg_year = c->agg_year;
+    cs->agg_period = c->agg_period;
+    cs->agg_ndays = c->agg_ndays;
+    memcpy(cs->agg_value, c->agg_value, sizeof(cs->agg_value));
+
+    return;
+}
+
+static void restore_control(control *c, control_state *cs) {
+    /* put back what save_control took */
+    c->num_years = cs->num_years;
+    c->total_num_days = cs->total_num_days;
+    c->sub_daily = cs->sub_daily;
+    c->water_balance = cs->water_balance;
+    c->num_days = cs->num_days;
+    c->hour_idx = cs->hour_idx;
+    c->day_idx = cs->day_idx;
+    c->agg_year = cs->agg_year;
+    c->agg_period = cs->agg_period;
+    c->agg_ndays = cs->agg_ndays;
+    memcpy(c->agg_value, cs->agg_value, sizeof(c->agg_value));
+
+    return;
+}
+
+static int list_arrays(control *c, params *p, state *s, fluxes *f,
+                       nrutil *nr, saved_array *a) {
+    /*
+        The fixed size heap arrays of a run, in the order they are saved,
+        returns how many. NR vectors run from 1..N.
+    */
+    int    n = 0;
+    size_t core = p->core * sizeof(double);
+    size_t wetting = p->wetting * sizeof(double);
+    size_t N, kmax;
+
+    a[n].ptr = s->day_length;           a[n++].size = 366 * sizeof(double);
+
+    if (c->water_balance == HYDRAULICS) {
+        a[n].ptr = p->potA;             a[n++].size = core;
+        a[n].ptr = p->potB;             a[n++].size = core;
+        a[n].ptr = p->cond1;            a[n++].size = core;
+        a[n].ptr = p->cond2;            a[n++].size = core;
+        a[n].ptr = p->cond3;            a[n++].size = core;
+        a[n].ptr = p->porosity;         a[n++].size = core;
+        a[n].ptr = p->field_capacity;   a[n++].size = core;
+        a[n].ptr = f->soil_conduct;     a[n++].size = core;
+        a[n].ptr = f->swp;              a[n++].size = core;
+        a[n].ptr = f->soilR;            a[n++].size = core;
+        a[n].ptr = f->fraction_uptake;  a[n++].size = core;
+        a[n].ptr = f->ppt_gain;         a[n++].size = core;
+        a[n].ptr = f->water_loss;       a[n++].size = core;
+        a[n].ptr = f->water_gain;       a[n++].size = core;
+        a[n].ptr = f->est_evap;         a[n++].size = core;
+        a[n].ptr = s->water_frac;       a[n++].size = core;
+        a[n].ptr = s->wetting_bot;      a[n++].size = wetting;
+        a[n].ptr = s->wetting_top;      a[n++].size = wetting;
+        a[n].ptr = s->thickness;        a[n++].size = core;
+        a[n].ptr = s->root_mass;        a[n++].size = core;
+        a[n].ptr = s->root_length;      a[n++].size = core;
+        a[n].ptr = s->layer_depth;      a[n++].size = core;
+    }
+
+    if (nr->y != NULL) {
+        N = nr->N * sizeof(double);
+        kmax = nr->kmax * sizeof(double);
+        a[n].ptr = nr->ystart + 1;      a[n++].size = N;
+        a[n].ptr = nr->yscal + 1;       a[n++].size = N;
+        a[n].ptr = nr->y + 1;           a[n++].size = N;
+        a[n].ptr = nr->dydx + 1;        a[n++].size = N;
+        a[n].ptr = nr->xp + 1;          a[n++].size = kmax;
+        a[n].ptr = nr->yp[1] + 1;       a[n++].size = nr->N * kmax;
+        a[n].ptr = nr->ak2 + 1;         a[n++].size = N;
+        a[n].ptr = nr->ak3 + 1;         a[n++].size = N;
+        a[n].ptr = nr->ak4 + 1;         a[n++].size = N;
+        a[n].ptr = nr->ak5 + 1;         a[n++].size = N;
+        a[n].ptr = nr->ak6 + 1;         a[n++].size = N;
+        a[n].ptr = nr->ytemp + 1;       a[n++].size = N;
+        a[n].ptr = nr->yerr + 1;        a[n++].size = N;
+    }
+
+    return (n);
+}
+
+static void write_block(FILE *fp, void *ptr, size_t size, char *fname) {
+
+    if (size > 0 && fwrite(ptr, size, 1, fp) != 1) {
+        fprintf(stderr, "Error writing checkpoint file %s\n", fname);
+        gday_exit(EXIT_FAILURE);
+    }
+
+    return;
+}
+
+static void *take(checkpoint_reader *r, size_t size) {
+    /* the next size bytes of the checkpoint, refused if there aren't any */
+    char *block;
+
+    if (size > r->mf.size - r->pos)
+        refuse(r, "is truncated");
+    block = r->mf.data + r->pos;
+    r->pos += size;
+
+    return (block);
+}
+
+static void refuse(checkpoint_reader *r, char *why) {
+    /* nothing of the run has been touched yet, so we can just go */
+    unmap_file(&r->mf);
+    fprintf(stderr, "Error: checkpoint file %s %s\n", r->fname, why);
+    gday_exit(EXIT_FAILURE);
+}
+
+void keep_run_settings(control *c, control *now) {
+    /*
+        Give c the files and options of this run (now), keeping the model
+        it has from another run (a fork's trunk, see gday_sim_fork). The
+        model's part of the control is its options in the param registry
+        (is_model_option) and what it moves on from day to day, the part a
+        checkpoint keeps (save_control); anything else is the run's own, so
+        a new setting of the run needs nothing adding here.
+    */
+    control       model;
+    control_state cs;
+    int           i;
+
+    memcpy(&model, c, sizeof(control));
+    save_control(c, &cs);
+
+    memcpy(c, now, sizeof(control));
+    restore_control(c, &cs);
+    for (i = 0; i < num_ini_keys; i++) {
+        if (is_model_option(&ini_keys[i]))
+            memcpy((char *)c + ini_keys[i].offset,
+                   (char *)&model + ini_keys[i].offset, ini_keys[i].size);
+    }
+
+    return;
+}
@@ -34,7 +34,7 @@ void figure_out_years_with_disturbances(control *c, met_arrays *ma, params *p,
                     *cnt += 1;
                     if ((yrs = (int **)realloc(yrs, (1 + *cnt) * sizeof(int))) == NULL) {
                         fprintf(stderr,"Error resizing years array\n");
-                		exit(EXIT_FAILURE);
+                		gday_exit(EXIT_FAILURE);
                     }
                     (*yrs)[*cnt] = year_of_disturbance;
                 }
@@ -0,0 +1,577 @@
+/* ============================================================================
+* Ensemble driver: many parameter sets run against the same met forcing.
+*
+* The ensemble file is a plain text file with one member per line,
+*
+*   member_id,param_file
+*
+* Lines starting with '#' are ignored. Each member's param file is read on
+* top of the base param file (-p), so it only needs the keys that differ.
+*
+* A parameter sweep (-x) is a CSV file instead, with a header naming the
+* keys that are swept and then one row of values per member,
+*
+*   member_id,sla,cue,control.alloc_model
+*   m1,4.5,0.5,grasses
+*   m2,5.0,0.5,
+*
+* where a key is one in [params] or "section.key", and an empty value
+* leaves the base param file's. The values are set straight into each
+* member, there's no param file or any other file written for it.
+*
+* NOTES:
+*   The met file is read (and for sub-daily runs the solar geometry worked
+*   out) once, then shared read-only by every member, see gday_forcing_new.
+*   Members can't change anything the forcing depends on (met file,
+*   timestep, location) or the kind of output.
+*
+*   Every member writes to its own part file next to the base output file,
+*   these are then stitched together in ensemble order into the base output
+*   file with the member id as an extra first column.
+*
+*   The keys in a sweep's header are looked up when it is read, so a typo
+*   stops the sweep before anything is run.
+*
+* =========================================================================== */
+#include "ensemble.h"
+#include "forcing.h"
+#include "param_registry.h"
+
+#define COPY_BUFFER 65536
+#define SWEEP_LINE  65536
+
+typedef struct {
+    ensemble_member    *members;
+    int                 nmembers;
+    int                 next;       /* next member to be picked up */
+    gday_mutex          lock;
+    const gday_forcing *fc;
+    char               *cfg_fname;
+    char               *out_fname;
+    int                 flags;
+    const char        **names;      /* keys swept, NULL if not a sweep */
+    int                 nnames;
+} ensemble_pool;
+
+static int  run_members(ensemble_pool *, int);
+static void ensemble_worker(void *);
+static void part_fname(char *, size_t, char *, int);
+static int  merge_parts(ensemble_pool *);
+static int  copy_part(FILE *, FILE *, char *, int);
+static char *copy_field(char *);
+static int  read_sweep(char *, ensemble_member **, int *, char ***, int *);
+static int  split_row(char *, char *, int, char ***, int *);
+static void free_names(char **, int);
+
+
+int run_ensemble(char *cfg_fname, char *ensemble_fname, int nthreads,
+                 int flags) {
+    /*
+        Run every member in the ensemble file, returns the number that
+        failed (or -1 if nothing could be run at all, or their output
+        couldn't be merged).
+    */
+    ensemble_pool ep;
+    int           nfailed;
+
+    if (flags & GDAY_SIM_SPIN_UP) {
+        fprintf(stderr, "Ensembles can't be spun up, spin-up each member\n");
+        return (-1);
+    }
+
+    if (read_ensemble(ensemble_fname, &(ep.members), &(ep.nmembers)) != 0)
+        return (-1);
+
+    ep.cfg_fname = cfg_fname;
+    ep.flags = flags;
+    ep.names = NULL;
+    ep.nnames = 0;
+    nfailed = run_members(&ep, nthreads);
+    free_ensemble(ep.members, ep.nmembers);
+
+    return (nfailed);
+}
+
+int run_sweep(char *cfg_fname, char *sweep_fname, int nthreads, int flags) {
+    /*
+        Run every row of the parameter sweep, returns the number that
+        failed (or -1 if nothing could be run at all, or their output
+        couldn't be merged).
+    */
+    ensemble_pool ep;
+    char        **names;
+    int           nnames, nfailed;
+
+    if (flags & GDAY_SIM_SPIN_UP) {
+        fprintf(stderr, "Sweeps can't be spun up, spin-up each member\n");
+        return (-1);
+    }
+
+    if (read_sweep(sweep_fname, &(ep.members), &(ep.nmembers), &names,
+                   &nnames) != 0)
+        return (-1);
+
+    ep.cfg_fname = cfg_fname;
+    ep.flags = flags;
+    ep.names = (const char **)names;
+    ep.nnames = nnames;
+    nfailed = run_members(&ep, nthreads);
+    free_ensemble(ep.members, ep.nmembers);
+    free_names(names, nnames);
+
+    return (nfailed);
+}
+
+static int run_members(ensemble_pool *ep, int nthreads) {
+    /*
+        Run the members in the pool against the base param file's forcing
+        and merge their output, returns the number that failed (or -1).
+    */
+    gday_forcing  *fc;
+    gday_thread   *threads;
+    char           out_fname[STRING_LENGTH];
+    int            i, nstarted = 0, nfailed = 0;
+
+    if ((fc = gday_forcing_new(ep->cfg_fname, NULL)) == NULL)
+        return (-1);
+
+    /* the part files are daily CSVs we can simply append to one another */
+    if (fc->c.print_options != DAILY || fc->c.output_ascii == FALSE) {
+        fprintf(stderr, "%s: ensembles need print_options = daily and "
+                "output_ascii = true\n", ep->cfg_fname);
+        gday_forcing_free(fc);
+        return (-1);
+    }
+    strncpy0(out_fname, fc->c.out_fname, sizeof(out_fname));
+
+    ep->next = 0;
+    ep->fc = fc;
+    ep->out_fname = out_fname;
+    mutex_init(&(ep->lock));
+
+    if (nthreads <= 0)
+        nthreads = number_of_cpus();
+    nthreads = MAX(MIN(nthreads, ep->nmembers), 1);
+
+    if ((threads = (gday_thread *)calloc(nthreads,
+                                         sizeof(gday_thread))) != NULL) {
+        for (i = 0; i < nthreads; i++) {
+            if (thread_start(&threads[i], ensemble_worker, ep) != 0) {
+                fprintf(stderr, "Couldn't start ensemble thread %d\n", i);
+                break;
+            }
+            nstarted++;
+        }
+    }
+
+    /* Nothing started, do the work on this thread instead */
+    if (nstarted == 0)
+        ensemble_worker(ep);
+
+    for (i = 0; i < nstarted; i++)
+        thread_join(threads[i]);
+
+    for (i = 0; i < ep->nmembers; i++) {
+        if (ep->members[i].status != 0) {
+            if (ep->members[i].cfg_fname != NULL)
+                fprintf(stderr, "Ensemble: member %s (%s) failed\n",
+                        ep->members[i].id, ep->members[i].cfg_fname);
+            else
+                fprintf(stderr, "Ensemble: member %s failed\n",
+                        ep->members[i].id);
+            nfailed++;
+        }
+    }
+    fprintf(stderr, "Ensemble: %d of %d members ran successfully\n",
+            ep->nmembers - nfailed, ep->nmembers);
+
+    if (merge_parts(ep) != 0)
+        nfailed = -1;
+
+    mutex_free(&(ep->lock));
+    free(threads);
+    gday_forcing_free(fc);
+
+    return (nfailed);
+}
+
+static void ensemble_worker(void *arg) {
+
+    ensemble_pool   *ep = (ensemble_pool *)arg;
+    ensemble_member *member;
+    gday_sim        *sim;
+    char             fname[STRING_LENGTH];
+    int              i;
+
+    if ((sim = gday_sim_new()) == NULL)
+        return;
+
+    while (TRUE) {
+        mutex_lock(&(ep->lock));
+        i = (ep->next < ep->nmembers) ? ep->next++ : -1;
+        mutex_unlock(&(ep->lock));
+        if (i < 0)
+            break;
+
+        member = &(ep->members[i]);
+        part_fname(fname, sizeof(fname), ep->out_fname, i);
+        if (ep->names != NULL)
+            /* skipping the id column */
+            member->status = gday_sim_load_values(sim, ep->cfg_fname,
+                                    ep->nnames - 1, ep->names + 1,
+                                    (const char **)member->values + 1,
+                                    ep->fc, fname, ep->flags);
+        else
+            member->status = gday_sim_load_member(sim, ep->cfg_fname,
+                                                  member->cfg_fname, ep->fc,
+                                                  fname, ep->flags);
+        if (member->status == 0)
+            member->status = gday_sim_run(sim);
+    }
+    gday_sim_destroy(sim);
+
+    return;
+}
+
+static void part_fname(char *fname, size_t size, char *out_fname, int i) {
+    /* where member i writes its output before it is merged */
+    char suffix[32];
+
+    sprintf(suffix, ".%d.part", i);
+    strncpy0(fname, out_fname, size - strlen(suffix));
+    strcat(fname, suffix);
+
+    return;
+}
+
+static int merge_parts(ensemble_pool *ep) {
+    /*
+        Concatenate the part files of the members that ran into the base
+        output file, keeping the first header only. The parts are only
+        removed once they've all been merged, otherwise they're left for
+        the user. Returns 0 on success.
+    */
+    FILE *ofp, *ifp;
+    char  fname[STRING_LENGTH];
+    int   i, header = TRUE, error = 0;
+
+    if ((ofp = fopen(ep->out_fname, "w")) == NULL) {
+        fprintf(stderr, "Error: couldn't open output file %s for write\n",
+                ep->out_fname);
+        error = 1;
+    }
+
+    for (i = 0; i < ep->nmembers && error == 0; i++) {
+        if (ep->members[i].status != 0)
+            continue;
+        part_fname(fname, sizeof(fname), ep->out_fname, i);
+        if ((ifp = fopen(fname, "r")) == NULL) {
+            fprintf(stderr, "Error: couldn't open %s for read\n", fname);
+            error = 1;
+        } else {
+            error = copy_part(ifp, ofp, ep->members[i].id, header);
+            header = FALSE;
+            fclose(ifp);
+        }
+    }
+
+    if (ofp != NULL && fclose(ofp) != 0)
+        error = 1;
+    if (error) {
+        fprintf(stderr, "Error writing ensemble output %s, the members' "
+                "outputs are left in %s.N.part\n", ep->out_fname,
+                ep->out_fname);
+        return (error);
+    }
+
+    for (i = 0; i < ep->nmembers; i++) {
+        part_fname(fname, sizeof(fname), ep->out_fname, i);
+        remove(fname);
+    }
+
+    return (error);
+}
+
+static int copy_part(FILE *ifp, FILE *ofp, char *id, int header) {
+    /*
+        Copy one member's output, putting its id in front of every row (and
+        "member" in front of the header if we're keeping it).
+    */
+    char   buffer[COPY_BUFFER];
+    char  *start, *end;
+    size_t n;
+    int    line_start = TRUE, skipping = ! header, first = TRUE;
+
+    while ((n = fread(buffer, 1, sizeof(buffer), ifp)) > 0) {
+        start = buffer;
+        while (start < buffer + n) {
+            end = memchr(start, '\n', buffer + n - start);
+            end = (end == NULL) ? buffer + n : end + 1;
+            if (! skipping) {
+                if (line_start)
+                    fprintf(ofp, "%s,", first ? "member" : id);
+                fwrite(start, 1, end - start, ofp);
+            }
+            line_start = (end[-1] == '\n');
+            if (line_start) {
+                skipping = FALSE;
+                first = FALSE;
+            }
+            start = end;
+        }
+    }
+
+    return (ferror(ifp) || ferror(ofp));
+}
+
+int read_ensemble(char *fname, ensemble_member **members, int *nmembers) {
+    /* returns 0 on success */
+    FILE            *fp;
+    char             line[STRING_LENGTH];
+    char            *start, *comma;
+    ensemble_member *tmp;
+    int              i, size = 0, line_number = 0;
+
+    *members = NULL;
+    *nmembers = 0;
+
+    if ((fp = fopen(fname, "r")) == NULL) {
+        fprintf(stderr, "Error: couldn't open ensemble file %s for read\n",
+                fname);
+        return (1);
+    }
+
+    while (fgets(line, STRING_LENGTH, fp) != NULL) {
+        line_number++;
+        start = lskip(rstrip(line));
+
+        /* ignore comments and blank lines */
+        if (*start == '#' || *start == '\0')
+            continue;
+
+        comma = strchr(start, ',');
+        if (comma != NULL)
+            *comma++ = '\0';
+        if (comma == NULL || strchr(comma, ',') != NULL ||
+            *rstrip(start) == '\0' || *(comma = lskip(comma)) == '\0') {
+            fprintf(stderr, "%s: badly formatted ensemble on line %d\n",
+                    fname, line_number);
+            fclose(fp);
+            free_ensemble(*members, *nmembers);
+            *members = NULL;
+            *nmembers = 0;
+            return (1);
+        }
+
+        if (*nmembers == size) {
+            size = (size == 0) ? 64 : size * 2;
+            tmp = (ensemble_member *)realloc(*members,
+                                             size * sizeof(ensemble_member));
+            if (tmp == NULL) {
+                fprintf(stderr, "Error allocating space for ensemble\n");
+                fclose(fp);
+                free_ensemble(*members, *nmembers);
+                *members = NULL;
+                *nmembers = 0;
+                return (1);
+            }
+            *members = tmp;
+        }
+
+        i = (*nmembers)++;
+        (*members)[i].id = copy_field(start);
+        (*members)[i].cfg_fname = copy_field(comma);
+        (*members)[i].values = NULL;
+        (*members)[i].nvalues = 0;
+        (*members)[i].status = -1;
+    }
+    fclose(fp);
+
+    if (*nmembers == 0) {
+        fprintf(stderr, "%s: ensemble doesn't list any members\n", fname);
+        return (1);
+    }
+
+    return (0);
+}
+
+void free_ensemble(ensemble_member *members, int nmembers) {
+    int i;
+
+    for (i = 0; i < nmembers; i++) {
+        free(members[i].id);
+        free(members[i].cfg_fname);
+        free_names(members[i].values, members[i].nvalues);
+    }
+    free(members);
+
+    return;
+}
+
+static char *copy_field(char *field) {
+    /* heap copy of an ensemble column */
+    char *copy;
+
+    if ((copy = (char *)malloc(strlen(field) + 1)) == NULL) {
+        fprintf(stderr, "Error allocating space for ensemble\n");
+        return (NULL);
+    }
+    strcpy(copy, field);
+
+    return (copy);
+}
+
+static int read_sweep(char *fname, ensemble_member **members, int *nmembers,
+                      char ***names, int *nnames) {
+    /*
+        The header's keys into names, the rows into members. Returns 0 on
+        success.
+    */
+    FILE            *fp;
+    char            *line, *start, **fields;
+    ensemble_member *tmp;
+    int              i, nfields, size = 0, line_number = 0, error = 0;
+
+    *members = NULL;
+    *nmembers = 0;
+    *names = NULL;
+    *nnames = 0;
+
+    if ((line = (char *)malloc(SWEEP_LINE)) == NULL) {
+        fprintf(stderr, "Error allocating space for sweep\n");
+        return (1);
+    }
+    if ((fp = fopen(fname, "r")) == NULL) {
+        fprintf(stderr, "Error: couldn't open sweep file %s for read\n",
+                fname);
+        free(line);
+        return (1);
+    }
+
+    while (error == 0 && fgets(line, SWEEP_LINE, fp) != NULL) {
+        line_number++;
+        if (strchr(line, '\n') == NULL && ! feof(fp)) {
+            fprintf(stderr, "%s: line %d is too long\n", fname, line_number);
+            error = 1;
+            break;
+        }
+        start = lskip(rstrip(line));
+
+        /* ignore comments and blank lines */
+        if (*start == '#' || *start == '\0')
+            continue;
+
+        if ((error = split_row(fname, start, line_number, &fields,
+                               &nfields)) != 0)
+            break;
+
+        if (*names == NULL) {
+            /* the header, the first column is the member id */
+            *names = fields;
+            *nnames = nfields;
+            for (i = 1; i < nfields && error == 0; i++) {
+                if (find_ini_name(fields[i]) == NULL) {
+                    fprintf(stderr, "%s: unknown parameter %s in the "
+                            "header\n", fname, fields[i]);
+                    error = 1;
+                }
+            }
+            continue;
+        }
+
+        if (nfields != *nnames) {
+            fprintf(stderr, "%s: badly formatted sweep on line %d\n",
+                    fname, line_number);
+            free_names(fields, nfields);
+            error = 1;
+            break;
+        }
+
+        if (*nmembers == size) {
+            size = (size == 0) ? 64 : size * 2;
+            tmp = (ensemble_member *)realloc(*members,
+                                             size * sizeof(ensemble_member));
+            if (tmp == NULL) {
+                fprintf(stderr, "Error allocating space for sweep\n");
+                free_names(fields, nfields);
+                error = 1;
+                break;
+            }
+            *members = tmp;
+        }
+
+        /* the id moves out of the values and into the member */
+        i = (*nmembers)++;
+        (*members)[i].id = fields[0];
+        (*members)[i].cfg_fname = NULL;
+        (*members)[i].values = fields;
+        (*members)[i].nvalues = nfields;
+        (*members)[i].status = -1;
+        fields[0] = NULL;
+    }
+    fclose(fp);
+    free(line);
+
+    if (error == 0 && *nmembers == 0) {
+        fprintf(stderr, "%s: sweep doesn't list any members\n", fname);
+        error = 1;
+    }
+    if (error) {
+        free_ensemble(*members, *nmembers);
+        free_names(*names, *nnames);
+        *members = NULL;
+        *nmembers = 0;
+        *names = NULL;
+        *nnames = 0;
+    }
+
+    return (error);
+}
+
+static int split_row(char *fname, char *line, int line_number,
+                     char ***fields, int *nfields) {
+    /* heap copies of the comma separated fields on a line of a sweep */
+    char *comma;
+    int   i, n = 1;
+
+    for (comma = line; (comma = strchr(comma, ',')) != NULL; comma++)
+        n++;
+
+    if ((*fields = (char **)calloc(n, sizeof(char *))) == NULL) {
+        fprintf(stderr, "Error allocating space for sweep\n");
+        return (1);
+    }
+    *nfields = n;
+
+    for (i = 0; i < n; i++) {
+        if ((comma = strchr(line, ',')) != NULL)
+            *comma = '\0';
+        if (((*fields)[i] = copy_field(lskip(rstrip(line)))) == NULL) {
+            free_names(*fields, n);
+            return (1);
+        }
+        if (comma != NULL)
+            line = comma + 1;
+    }
+
+    /* only a value can be left empty */
+    if (*(*fields)[0] == '\0') {
+        fprintf(stderr, "%s: no member id on line %d\n", fname, line_number);
+        free_names(*fields, n);
+        return (1);
+    }
+
+    return (0);
+}
+
+static void free_names(char **names, int n) {
+    int i;
+
+    if (names == NULL)
+        return;
+    for (i = 0; i < n; i++)
+        free(names[i]);
+    free(names);
+
+    return;
+}
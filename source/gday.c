@@ -19,239 +19,215 @@
 * =========================================================================== */
 
 #include "gday.h"
+#include "gday_sim.h"
+#include "batch.h"
+#include "ensemble.h"
+#include "checkpoint.h"
+#include "scenario.h"
+#include "server.h"
+#include "spinup_cache.h"
+#include "anderson.h"
+#include "met_cache.h"
+#include "met_window.h"
 
 int main(int argc, char **argv)
 {
-    int error = 0;
+    int       error = 0;
+    control   cl;
+    gday_sim *sim;
 
     /*
-     * Setup structures, initialise stuff, e.g. zero fluxes.
+     * Only the command line options live out here, everything else is owned
+     * by the simulation handle (see gday_sim.c).
      */
-    control *c;
-    canopy_wk *cw;
-    fluxes *f;
-    met_arrays *ma;
-    met *m;
-    params *p;
-    state *s;
-    nrutil *nr;
-    fast_spinup *fs;
-
-    c = (control *)malloc(sizeof(control));
-    if (c == NULL) {
-        fprintf(stderr, "control structure: Not allocated enough memory!\n");
-    	exit(EXIT_FAILURE);
-    }
-
-    cw = (canopy_wk *)malloc(sizeof(canopy_wk));
-    if (cw == NULL) {
-        fprintf(stderr, "canopy wk structure: Not allocated enough memory!\n");
-    	exit(EXIT_FAILURE);
-    }
-
-    f = (fluxes *)malloc(sizeof(fluxes));
-    if (f == NULL) {
-    	fprintf(stderr, "fluxes structure: Not allocated enough memory!\n");
-    	exit(EXIT_FAILURE);
-    }
+    initialise_control(&cl);
+    strcpy(cl.cfg_fname, "par.cfg");
+    clparser(argc, argv, &cl);
 
-    ma = (met_arrays *)malloc(sizeof(met_arrays));
-    if (ma == NULL) {
-    	fprintf(stderr, "met arrays structure: Not allocated enough memory!\n");
-    	exit(EXIT_FAILURE);
+    //strcpy(c->git_code_ver, build_git_sha);
+    if (cl.PRINT_GIT) {
+        fprintf(stderr, "\n%s\n", cl.git_code_ver);
+        exit(EXIT_FAILURE);
     }
 
-    m = (met *)malloc(sizeof(met));
-    if (m == NULL) {
-    	fprintf(stderr, "met structure: Not allocated enough memory!\n");
-    	exit(EXIT_FAILURE);
+    /* Convert a met file to its binary cache, see met_cache.c */
+    if (cl.convert_met) {
+        write_met_cache(&cl, cl.sub_daily);
+        exit(EXIT_SUCCESS);
     }
 
-    p = (params *)malloc(sizeof(params));
-    if (p == NULL) {
-    	fprintf(stderr, "params structure: Not allocated enough memory!\n");
-    	exit(EXIT_FAILURE);
+    /* Many sites from a manifest, spread over a pool of threads */
+    if (strlen(cl.batch_fname) > 0) {
+        error = run_batch(cl.batch_fname, cl.nthreads,
+                          GDAY_SIM_QUIET |
+                          (cl.spin_up ? GDAY_SIM_SPIN_UP : 0));
+        if (error != 0) {
+            exit(EXIT_FAILURE);
+        }
+        exit(EXIT_SUCCESS);
     }
 
-    s = (state *)malloc(sizeof(state));
-    if (s == NULL) {
-    	fprintf(stderr, "state structure: Not allocated enough memory!\n");
-    	exit(EXIT_FAILURE);
+    /* Many parameter sets against one met file, see ensemble.c */
+    if (strlen(cl.ensemble_fname) > 0) {
+        error = run_ensemble(cl.cfg_fname, cl.ensemble_fname, cl.nthreads,
+                             GDAY_SIM_QUIET |
+                             (cl.spin_up ? GDAY_SIM_SPIN_UP : 0));
+        if (error != 0) {
+            exit(EXIT_FAILURE);
+        }
+        exit(EXIT_SUCCESS);
     }
 
-    nr = (nrutil *)malloc(sizeof(nrutil));
-    if (nr == NULL) {
-        fprintf(stderr, "nrutil structure: Not allocated enough memory!\n");
-        exit(EXIT_FAILURE);
+    /* Rows of parameter values against one met file, see ensemble.c */
+    if (strlen(cl.sweep_fname) > 0) {
+        error = run_sweep(cl.cfg_fname, cl.sweep_fname, cl.nthreads,
+                          GDAY_SIM_QUIET |
+                          (cl.spin_up ? GDAY_SIM_SPIN_UP : 0));
+        if (error != 0) {
+            exit(EXIT_FAILURE);
+        }
+        exit(EXIT_SUCCESS);
     }
 
-    fs = (fast_spinup *)malloc(sizeof(fast_spinup));
-    if (fs == NULL) {
-        fprintf(stderr, "fast spinup structure: Not allocated enough memory!\n");
-    	exit(EXIT_FAILURE);
+    /* Many runs, one request at a time, see server.c */
+    if (strlen(cl.serve_path) > 0) {
+        error = run_server(cl.cfg_fname, cl.serve_path,
+                           GDAY_SIM_QUIET |
+                           (cl.spin_up ? GDAY_SIM_SPIN_UP : 0));
+        if (error != 0) {
+            exit(EXIT_FAILURE);
+        }
+        exit(EXIT_SUCCESS);
     }
 
-    // potentially allocating 1 extra spot, but will be fine as we always
-    // index by num_days
-    if ((s->day_length = (double *)calloc(366, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for day_length\n");
-		exit(EXIT_FAILURE);
+    /* Scenarios forked from a shared history, see scenario.c */
+    if (strlen(cl.scenario_fname) > 0) {
+        if (cl.fork_year < 0) {
+            fprintf(stderr, "Scenarios need the day to fork on (-d)\n");
+            exit(EXIT_FAILURE);
+        }
+        error = run_scenarios(cl.cfg_fname, cl.scenario_fname, cl.fork_year,
+                              cl.fork_doy, cl.nthreads,
+                              GDAY_SIM_QUIET |
+                              (cl.spin_up ? GDAY_SIM_SPIN_UP : 0));
+        if (error != 0) {
+            exit(EXIT_FAILURE);
+        }
+        exit(EXIT_SUCCESS);
     }
 
-    initialise_control(c);
-    initialise_params(p);
-    initialise_fluxes(f);
-    initialise_state(s);
-    initialise_nrutil(nr);
-
-    clparser(argc, argv, c);
     /*
      * Read .ini parameter file and meterological data
      */
-    error = parse_ini_file(c, p, s);
-    if (error != 0) {
-        prog_error("Error reading .INI file on line", __LINE__);
-    }
-    //strcpy(c->git_code_ver, build_git_sha);
-    if (c->PRINT_GIT) {
-        fprintf(stderr, "\n%s\n", c->git_code_ver);
+    sim = gday_sim_create(cl.cfg_fname, cl.spin_up ? GDAY_SIM_SPIN_UP : 0);
+    if (sim == NULL) {
         exit(EXIT_FAILURE);
     }
 
-    /* House keeping! */
-    if (c->water_balance == HYDRAULICS && c->sub_daily == FALSE) {
-        fprintf(stderr, "You can't run the hydraulics model with daily flag\n");
+    error = gday_sim_run(sim);
+
+    /* clean up */
+    gday_sim_destroy(sim);
+
+    if (error != 0) {
         exit(EXIT_FAILURE);
     }
 
-    if (c->water_balance == HYDRAULICS) {
-        allocate_numerical_libs_stuff(nr);
-        initialise_roots(f, p, s);
-        setup_hydraulics_arrays(f, p, s);
-
-        // i.e. not dead
-        cw->death_year = -999.9;
-        cw->death_doy = -999.9;
-        cw->not_dead = TRUE;
-    }
+    exit(EXIT_SUCCESS);
+}
 
-    if (c->sub_daily) {
-        read_subdaily_met_data(argv, c, ma);
-        fill_up_solar_arrays(cw, c, ma, p);
-    } else {
-        read_daily_met_data(argv, c, ma);
-    }
+void run_sim(canopy_wk *cw, control *c, fluxes *f, fast_spinup *fs,
+             met_arrays *ma, met *m, params *p, state *s, nrutil *nr) {
+    /*
+        Run the model through the whole met record. The year and day loops
+        are driven through run_clock so that a run can also be stepped one
+        day at a time from outside (e.g. gday_sim_advance_day).
 
+        A run can pick up from a checkpoint (restart_fname) and/or write one
+        every checkpoint_interval days (checkpoint_fname), see checkpoint.c.
+        During a spin-up the restart only applies to the first pass.
+    */
+    run_clock rc;
 
-    if (c->spin_up) {
-        spin_up_pools(cw, c, f, fs, ma, m, p, s, nr);
-    } else {
-        run_sim(cw, c, f, fs, ma, m, p, s, nr);
-    }
+    start_run(cw, c, f, fs, ma, m, p, s, nr, &rc);
+    run_days(cw, c, f, fs, ma, m, p, s, nr, &rc, -1, -1);
+    end_run(c, p, s, &rc);
 
-    /* clean up */
-    fclose(c->ofp);
-    if (c->print_options == SUBDAILY ) {
-        fclose(c->ofp_sd);
-    }
-    fclose(c->ifp);
-    if (c->output_ascii == FALSE) {
-        fclose(c->ofp_hdr);
-    }
+    return;
+}
 
+void run_days(canopy_wk *cw, control *c, fluxes *f, fast_spinup *fs,
+              met_arrays *ma, met *m, params *p, state *s, nrutil *nr,
+              run_clock *rc, int stop_year, int stop_doy) {
+    /*
+        Run day by day to the end of the met record or, unless stop_year is
+        -1, until the next day to run is day stop_doy (1 = 1st Jan) of
+        stop_year, writing checkpoints on the way if asked to.
+    */
+    int year, doy;
 
-    free(ma->year);
-    free(ma->tair);
-    free(ma->rain);
-    free(ma->tsoil);
-    free(ma->co2);
-    free(ma->ndep);
-    free(ma->wind);
-    free(ma->press);
-    free(ma->par);
-    if (c->sub_daily) {
-        free(ma->vpd);
-        free(ma->doy);
-        free(cw->cz_store);
-        free(cw->ele_store);
-        free(cw->df_store);
+    while (next_day(c, ma, rc, &year, &doy)) {
+        if (stop_year != -1 && year == stop_year && doy == stop_doy)
+            break;
+        step_day(cw, c, f, fs, ma, m, p, s, nr, rc);
+    }
 
-        /* Clean up hydraulics */
-        if (c->water_balance == HYDRAULICS) {
-            free(f->soil_conduct);
-            free(f->swp);
-            free(f->soilR);
-            free(f->fraction_uptake);
-            free(f->ppt_gain);
-            free(f->water_loss);
-            free(f->water_gain);
-            free(f->est_evap);
-            free(s->water_frac);
-            free(s->wetting_bot);
-            free(s->wetting_top);
-            free(p->potA);
-            free(p->potB);
-            free(p->cond1);
-            free(p->cond2);
-            free(p->cond3);
-            free(p->porosity);
-            free(p->field_capacity);
-            free(s->thickness);
-            free(s->root_mass);
-            free(s->root_length);
-            free(s->layer_depth);
-
-
-            free_dvector(nr->y, 1, nr->N);
-            free_dvector(nr->ystart, 1, nr->N);
-            free_dvector(nr->dydx, 1, nr->N);
-			free_dvector(nr->yscal, 1, nr->N);
-            free_dvector(nr->xp, 1, nr->kmax);
-            free_dmatrix(nr->yp, 1, nr->N, 1, nr->kmax);
-            free_dvector(nr->ytemp, 1, nr->N);
-        	free_dvector(nr->ak6, 1, nr->N);
-        	free_dvector(nr->ak5, 1, nr->N);
-        	free_dvector(nr->ak4, 1, nr->N);
-        	free_dvector(nr->ak3, 1, nr->N);
-        	free_dvector(nr->ak2, 1, nr->N);
-            free_dvector(nr->yerr, 1, nr->N);
-        }
+    return;
+}
 
+int next_day(control *c, met_arrays *ma, run_clock *rc, int *year,
+             int *doy) {
+    /*
+        The day that is run next, doy 1 being 1st Jan. Returns FALSE if the
+        run has reached the end of the met record.
+    */
+    if (rc->nyr >= c->num_years)
+        return (FALSE);
+
+    /* rc->year only moves on once the new year has started */
+    if (rc->doy == 0) {
+        met_window_day(ma, c->sub_daily ? c->hour_idx : c->day_idx);
+        *year = (int)(c->sub_daily ? ma->year[c->hour_idx] :
+                                     ma->year[c->day_idx]);
     } else {
-        free(ma->prjday);
-        free(ma->tam);
-        free(ma->tpm);
-        free(ma->tmin);
-        free(ma->tmax);
-        free(ma->vpd_am);
-        free(ma->vpd_pm);
-        free(ma->wind_am);
-        free(ma->wind_pm);
-        free(ma->par_am);
-        free(ma->par_pm);
+        *year = rc->year;
     }
-    free(s->day_length);
-    free(ma);
-    free(m);
-    free(p);
-    free(s);
-    free(f);
-    free(fs);
-	free(cw);
-	free(c);
+    *doy = rc->doy + 1;
 
-    exit(EXIT_SUCCESS);
+    return (TRUE);
 }
 
-void run_sim(canopy_wk *cw, control *c, fluxes *f, fast_spinup *fs,
-             met_arrays *ma, met *m, params *p, state *s, nrutil *nr) {
+void step_day(canopy_wk *cw, control *c, fluxes *f, fast_spinup *fs,
+              met_arrays *ma, met *m, params *p, state *s, nrutil *nr,
+              run_clock *rc) {
+    /* run the next day, writing a checkpoint after it if one is due */
+    advance_day(cw, c, f, fs, ma, m, p, s, nr, rc);
+
+    if (c->checkpoint_interval > 0 &&
+        c->day_idx % c->checkpoint_interval == 0 &&
+        strlen(c->checkpoint_fname) > 0) {
+        write_checkpoint(c->checkpoint_fname, cw, c, f, fs, m, p, s, nr, rc);
+    }
+
+    return;
+}
 
-    int    nyr, doy, window_size, i, dummy = 0, year;
-    int    fire_found = FALSE;;
-    int    num_disturbance_yrs = 0;
+void start_run(canopy_wk *cw, control *c, fluxes *f, fast_spinup *fs,
+               met_arrays *ma, met *m, params *p, state *s, nrutil *nr,
+               run_clock *rc) {
+    /* Everything that happens before the first day of the run */
+    int    window_size, i;
+    double nitfac;
 
-    double fdecay, rdecay, current_limitation, nitfac;
-    int   *disturbance_yrs = NULL;
+    rc->hw = NULL;
+    rc->disturbance_yrs = NULL;
+    rc->num_disturbance_yrs = 0;
+    rc->fdecay = 0.0;
+    rc->rdecay = 0.0;
+    rc->year = 0;
+
+    /* the indices are still wherever the last run (if any) left them */
+    met_window_day(ma, c->sub_daily ? c->hour_idx : c->day_idx);
 
     if (c->deciduous_model) {
         /* Are we reading in last years average growing season? */
@@ -273,44 +249,62 @@ void run_sim(canopy_wk *cw, control *c, fluxes *f, fast_spinup *fs,
         allocate_stored_c_and_n(f, p, s);
     }
 
-    /* Setup output file */
-    if (c->print_options == SUBDAILY && c->spin_up == FALSE) {
+    /* Setup output file, an Arrow stream being a binary one */
+    if (c->output_arrow)
+        c->output_ascii = FALSE;
+    if (c->out_buffer != NULL) {
+        /* rows go to the caller's buffer instead, see gday_sim_set_output */
+    } else if (c->print_options == SUBDAILY && c->spin_up == FALSE) {
         /* open the 30 min outputs file and the daily output files */
-        open_output_file(c, c->out_subdaily_fname, &(c->ofp_sd));
-        open_output_file(c, c->out_fname, &(c->ofp));
-
         if (c->output_ascii) {
+            open_output_file(c, c->out_subdaily_fname, &(c->ofp_sd));
+            open_output_file(c, c->out_fname, &(c->ofp));
             write_output_subdaily_header(c, &(c->ofp_sd));
             write_output_header(c, &(c->ofp));
         } else {
-            fprintf(stderr, "Nothing implemented for sub-daily binary\n");
-            exit(EXIT_FAILURE);
+            open_binary_output_file(c, c->out_subdaily_fname, &(c->ofp_sd));
+            open_binary_output_file(c, c->out_fname, &(c->ofp));
+            write_binary_output_header(c, c->ofp_sd, TRUE);
+            if (! c->output_arrow)
+                write_binary_output_header(c, c->ofp, FALSE);
         }
-    } else if (c->print_options == DAILY && c->spin_up == FALSE) {
-        /* Daily outputs */
-        open_output_file(c, c->out_fname, &(c->ofp));
-
+    } else if ((c->print_options == DAILY || AGGREGATED(c->print_options)) &&
+               c->spin_up == FALSE) {
+        /* Daily outputs, or monthly etc. aggregates of them */
         if (c->output_ascii) {
+            open_output_file(c, c->out_fname, &(c->ofp));
             write_output_header(c, &(c->ofp));
         } else {
-            open_output_file(c, c->out_fname_hdr, &(c->ofp_hdr));
-            write_output_header(c, &(c->ofp_hdr));
+            open_binary_output_file(c, c->out_fname, &(c->ofp));
+            if (! c->output_arrow)
+                write_binary_output_header(c, c->ofp, FALSE);
         }
-    } else if (c->print_options == END && c->spin_up == FALSE) {
-        /* Final state + param file */
+    } else if (c->print_options == END && c->spin_up == FALSE &&
+               *c->cfg_fname != '\0') {
+        /* Final state + param file, see write_final_state */
         open_output_file(c, c->out_param_fname, &(c->ofp));
     }
 
+    /* the daily/sub-daily records can go out on a thread of their own */
+    if (c->async_output && c->spin_up == FALSE &&
+        (c->print_options == DAILY || c->print_options == SUBDAILY ||
+         AGGREGATED(c->print_options)))
+        c->writer = open_output_writer();
+    if (c->output_arrow && c->spin_up == FALSE &&
+        (c->print_options == DAILY || c->print_options == SUBDAILY ||
+         AGGREGATED(c->print_options)))
+        open_arrow_output(c);
+
     /*
      * Window size = root lifespan in days...
      * For deciduous species window size is set as the length of the
      * growing season in the main part of the code
      */
     window_size = (int)(1.0 / p->rdecay * NDAYS_IN_YR);
-    sma_obj *hw = sma(SMA_NEW, window_size).handle;
+    rc->hw = sma(SMA_NEW, window_size).handle;
     if (s->prev_sma > -900) {
         for (i = 0; i < window_size; i++) {
-            sma(SMA_ADD, hw, s->prev_sma);
+            sma(SMA_ADD, rc->hw, s->prev_sma);
         }
     }
     /* Set up SMA
@@ -386,221 +380,281 @@ void run_sim(canopy_wk *cw, control *c, fluxes *f, fast_spinup *fs,
 
 
     if (c->disturbance) {
-        if ((disturbance_yrs = (int *)calloc(1, sizeof(int))) == NULL) {
+        if ((rc->disturbance_yrs = (int *)calloc(1, sizeof(int))) == NULL) {
             fprintf(stderr,"Error allocating space for disturbance_yrs\n");
-    		exit(EXIT_FAILURE);
+    		gday_exit(EXIT_FAILURE);
         }
-        figure_out_years_with_disturbances(c, ma, p, &disturbance_yrs,
-                                           &num_disturbance_yrs);
+        figure_out_years_with_disturbances(c, ma, p, &(rc->disturbance_yrs),
+                                           &(rc->num_disturbance_yrs));
     }
 
-
     /* ====================== **
     **   Y E A R    L O O P   **
     ** ====================== */
     c->day_idx = 0;
     c->hour_idx = 0;
+    rc->nyr = 0;
+    rc->doy = 0;
 
+    /* or carry on from where a previous run left off */
+    if (strlen(c->restart_fname) > 0) {
+        read_checkpoint(c->restart_fname, cw, c, f, fs, m, p, s, nr, rc);
+        strcpy(c->restart_fname, "");
+    }
 
+    return;
+}
 
-    for (nyr = 0; nyr < c->num_years; nyr++) {
+void advance_day(canopy_wk *cw, control *c, fluxes *f, fast_spinup *fs,
+                 met_arrays *ma, met *m, params *p, state *s, nrutil *nr,
+                 run_clock *rc) {
+    /*
+        Simulate the day rc->doy of year rc->nyr, starting and finishing the
+        year as needed. The clock is moved on to the next day.
+    */
+    begin_day(c, f, fs, ma, m, p, s, rc);
 
-        if (c->sub_daily) {
-            year = ma->year[c->hour_idx];
-        } else {
-            year = ma->year[c->day_idx];
-        }
-        if (is_leap_year(year))
-            c->num_days = 366;
-        else
-            c->num_days = 365;
+    // growth and all
+    calc_day_growth(cw, c, f, fs, ma, m, nr, p, s, s->day_length[rc->doy],
+                    rc->doy, rc->fdecay, rc->rdecay);
 
-        calculate_daylength(s, c->num_days, p->latitude);
+    end_day(cw, c, f, fs, m, p, s, rc);
 
-        if (c->deciduous_model) {
-            phenology(c, f, ma, p, s);
+    return;
+}
 
-            /* Change window size to length of growing season */
-            sma(SMA_FREE, hw);
-            hw = sma(SMA_NEW, p->growing_seas_len).handle;
-            if (s->prev_sma > -900) {
-                for (i = 0; i < p->growing_seas_len; i++) {
-                    sma(SMA_ADD, hw, s->prev_sma);
-                }
-            }
+void begin_day(control *c, fluxes *f, fast_spinup *fs, met_arrays *ma,
+               met *m, params *p, state *s, run_clock *rc) {
+    /* Start of the day, up to (but not including) the growth calculations */
+    int dummy = 0;
 
-            zero_stuff(c, s);
-        }
-        /* =================== **
-        **   D A Y   L O O P   **
-        ** =================== */
-        for (doy = 0; doy < c->num_days; doy++) {
+    met_window_day(ma, c->sub_daily ? c->hour_idx : c->day_idx);
+    if (rc->doy == 0) {
+        start_year(c, f, ma, p, s, rc);
+    }
 
-            //if (year == 2001 && doy+1 == 230) {
-            //    c->pdebug = TRUE;
-            //}
+    /* =================== **
+    **   D A Y   L O O P   **
+    ** =================== */
+    //if (rc->year == 2001 && rc->doy+1 == 230) {
+    //    c->pdebug = TRUE;
+    //}
 
 
-            if (! c->sub_daily) {
-                unpack_met_data(c, f, ma, m, dummy, s->day_length[doy]);
-            }
-            //grazing should really be done here
-            calculate_litterfall(c, f, fs, p, s, doy, &fdecay, &rdecay);
+    if (! c->sub_daily) {
+        unpack_met_data(c, f, ma, m, dummy, s->day_length[rc->doy]);
+    }
+    //grazing should really be done here
+    calculate_litterfall(c, f, fs, p, s, rc->doy, &(rc->fdecay),
+                         &(rc->rdecay));
 
-            // do grazing/harvest in a cheating way--jim feb 2022
-            calculate_harvest(f, p, s, doy, year);
+    // do grazing/harvest in a cheating way--jim feb 2022
+    calculate_harvest(f, p, s, rc->doy, rc->year);
 
+    return;
+}
 
-            // growth and all
-            calc_day_growth(cw, c, f, fs, ma, m, nr, p, s, s->day_length[doy],
-                            doy, fdecay, rdecay);
+void end_day(canopy_wk *cw, control *c, fluxes *f, fast_spinup *fs, met *m,
+             params *p, state *s, run_clock *rc) {
+    /* Soils, outputs and book keeping after the day's growth */
+    double current_limitation;
 
-            //printf("%d %f %f\n", doy, f->gpp*100, s->lai);
-            calculate_csoil_flows(c, f, fs, p, s, m->tsoil, doy);
-            calculate_nsoil_flows(c, f, p, s, doy);
+    //printf("%d %f %f\n", rc->doy, f->gpp*100, s->lai);
+    calculate_csoil_flows(c, f, fs, p, s, m->tsoil, rc->doy);
+    calculate_nsoil_flows(c, f, p, s, rc->doy);
 
-            // here we wan evergreen grassland to be able to regrowth after complete foliage dieback
-            // we have a storage pool for decusuious so probably don't need to do anything for them
-            //Jim added 2022
-            
-            if (c->deciduous_model) {
-                //nothing to do
-            }
-            else {
-                //assume some minimum shoot biomass and under good water condition
-                if (s->shoot < 0.001 && s->pawater_topsoil > 0.8) {
-                    //this assumes 10% of root biomass would go to leaf growth 
-                    //following Grazplan
-                    s->shoot = min(0.1 * s->root * s->pawater_topsoil,0.05);// 0.05 is based on 5 g m-2 d-1 estimated from the empirical model fitting
-                    s->root = s->root - s->shoot;
-                }
-            }
-            //jim added for mingkai
-            printf("Plant C: %f\n", s->plantc);
-            printf("Soil C: %f\n", s->soilc);
-            /* update stress SMA */
-            if (c->deciduous_model && s->leaf_out_days[doy] > 0.0) {
-                 /*
-                  * Allocation is annually for deciduous "tree" model, but we
-                  * need to keep a check on stresses during the growing season
-                  * and the LAI figure out limitations during leaf growth period.
-                  * This also applies for deciduous grasses, need to do the
-                  * growth stress calc for grasses here too.
-                  */
-                current_limitation = calculate_growth_stress_limitation(p, s);
-                sma(SMA_ADD, hw, current_limitation);
-                s->prev_sma = sma(SMA_MEAN, hw).sma;
-            } else if (c->deciduous_model == FALSE) {
-                current_limitation = calculate_growth_stress_limitation(p, s);
-                sma(SMA_ADD, hw, current_limitation);
-                s->prev_sma = sma(SMA_MEAN, hw).sma;
-            }
+    // here we wan evergreen grassland to be able to regrowth after complete foliage dieback
+    // we have a storage pool for decusuious so probably don't need to do anything for them
+    //Jim added 2022
+    
+    if (c->deciduous_model) {
+        //nothing to do
+    }
+    else {
+        //assume some minimum shoot biomass and under good water condition
+        if (s->shoot < 0.001 && s->pawater_topsoil > 0.8) {
+            //this assumes 10% of root biomass would go to leaf growth 
+            //following Grazplan
+            s->shoot = MIN(0.1 * s->root * s->pawater_topsoil,0.05);// 0.05 is based on 5 g m-2 d-1 estimated from the empirical model fitting
+            s->root = s->root - s->shoot;
+        }
+    }
+    //jim added for mingkai
+    if (c->quiet == FALSE) {
+        printf("Plant C: %f\n", s->plantc);
+        printf("Soil C: %f\n", s->soilc);
+    }
+    /* update stress SMA */
+    if (c->deciduous_model && s->leaf_out_days[rc->doy] > 0.0) {
+         /*
+          * Allocation is annually for deciduous "tree" model, but we
+          * need to keep a check on stresses during the growing season
+          * and the LAI figure out limitations during leaf growth period.
+          * This also applies for deciduous grasses, need to do the
+          * growth stress calc for grasses here too.
+          */
+        current_limitation = calculate_growth_stress_limitation(p, s);
+        sma(SMA_ADD, rc->hw, current_limitation);
+        s->prev_sma = sma(SMA_MEAN, rc->hw).sma;
+    } else if (c->deciduous_model == FALSE) {
+        current_limitation = calculate_growth_stress_limitation(p, s);
+        sma(SMA_ADD, rc->hw, current_limitation);
+        s->prev_sma = sma(SMA_MEAN, rc->hw).sma;
+    }
 
-            /*
-             * if grazing took place need to reset "stress" running mean
-             * calculation for grasses
-             */
-            if (c->grazing == 2 && p->disturbance_doy == doy+1) {
-                sma(SMA_FREE, hw);
-                hw = sma(SMA_NEW, p->growing_seas_len).handle;
-            }
+    /*
+     * if grazing took place need to reset "stress" running mean
+     * calculation for grasses
+     */
+    if (c->grazing == 2 && p->disturbance_doy == rc->doy+1) {
+        sma(SMA_FREE, rc->hw);
+        rc->hw = sma(SMA_NEW, p->growing_seas_len).handle;
+    }
 
-            /* Turn off all N calculations */
-            if (c->ncycle == FALSE)
-                reset_all_n_pools_and_fluxes(f, s);
+    /* Turn off all N calculations */
+    if (c->ncycle == FALSE)
+        reset_all_n_pools_and_fluxes(f, s);
 
-            /* calculate C:N ratios and increment annual flux sum */
-            day_end_calculations(c, p, s, c->num_days, FALSE);
+    /* calculate C:N ratios and increment annual flux sum */
+    day_end_calculations(c, p, s, c->num_days, FALSE);
 
-            if (c->print_options == SUBDAILY && c->spin_up == FALSE) {
-                write_daily_outputs_ascii(c, cw, f, s, year, doy+1);
-            } else if (c->print_options == DAILY && c->spin_up == FALSE) {
-                if(c->output_ascii)
-                    write_daily_outputs_ascii(c, cw, f, s, year, doy+1);
-                else
-                    write_daily_outputs_binary(c, f, s, year, doy+1);
-            }
+    if ((c->print_options == SUBDAILY || c->print_options == DAILY) &&
+        c->spin_up == FALSE) {
+        if(c->output_ascii)
+            write_daily_outputs_ascii(c, cw, f, s, rc->year, rc->doy+1);
+        else
+            write_daily_outputs_binary(c, cw, f, s, rc->year, rc->doy+1);
+    } else if (AGGREGATED(c->print_options) && c->spin_up == FALSE) {
+        write_aggregated_outputs(c, cw, f, s, rc->year, rc->doy+1);
+    }
 
-            // Step 2: Store the time-varying variables
-            if (c->spinup_method == SAS) {
-                fs->npp_ss += f->npp;
-                fs->ndays ++;
-                fs->shoot_nc += s->shootn / s->shoot;
-                fs->root_nc += s->rootn / s->root;
-                fs->branch_nc += s->branchn / s->branch;
-                if (s->croot > 0.0) {
-                    fs->croot_nc += s->crootn / s->croot;
-                } else {
-                    fs->croot_nc = 0.0;
-                }
-                fs->stem_nc += s->stemn / s->stem;
-                if (s->stemnmob > 0.0) {
-                    fs->stemnmob_ratio += s->stemnmob / s->stem;
-                } else {
-                    fs->stemnmob_ratio = 0.0;
-                }
-                if (s->stemnimm > 0.0) {
-                    fs->stemnimm_ratio += s->stemnimm / s->stem;
-                } else {
-                    fs->stemnimm_ratio = 0.0;
-                }
+    // Step 2: Store the time-varying variables
+    if (c->spinup_method == SAS) {
+        fs->npp_ss += f->npp;
+        fs->ndays ++;
+        fs->shoot_nc += s->shootn / s->shoot;
+        fs->root_nc += s->rootn / s->root;
+        fs->branch_nc += s->branchn / s->branch;
+        if (s->croot > 0.0) {
+            fs->croot_nc += s->crootn / s->croot;
+        } else {
+            fs->croot_nc = 0.0;
+        }
+        fs->stem_nc += s->stemn / s->stem;
+        if (s->stemnmob > 0.0) {
+            fs->stemnmob_ratio += s->stemnmob / s->stem;
+        } else {
+            fs->stemnmob_ratio = 0.0;
+        }
+        if (s->stemnimm > 0.0) {
+            fs->stemnimm_ratio += s->stemnimm / s->stem;
+        } else {
+            fs->stemnimm_ratio = 0.0;
+        }
 
-                if (s->metabsoil > 0.0) {
-                    fs->metablsoil_nc += s->metabsoiln / s->metabsoil;
-                } else {
-                    fs->metablsoil_nc += 0.0;
-                }
+        if (s->metabsoil > 0.0) {
+            fs->metablsoil_nc += s->metabsoiln / s->metabsoil;
+        } else {
+            fs->metablsoil_nc += 0.0;
+        }
 
-                if (s->metabsurf > 0.0) {
-                    fs->metabsurf_nc += s->metabsurfn / s->metabsurf;
-                } else {
-                    fs->metabsurf_nc += 0.0;
-                }
+        if (s->metabsurf > 0.0) {
+            fs->metabsurf_nc += s->metabsurfn / s->metabsurf;
+        } else {
+            fs->metabsurf_nc += 0.0;
+        }
+
+        fs->structsoil_nc += s->structsoiln / s->structsoil;
+        fs->structsurf_nc += s->structsurfn / s->structsurf;
+        fs->activesoil_nc += s->activesoiln / s->activesoil;
+        fs->slowsoil_nc += s->slowsoiln / s->slowsoil;
+        fs->passivesoil_nc += s->passivesoiln / s->passivesoil;
+    }
+    c->day_idx++;
+    /* ======================= **
+    **   E N D   O F   D A Y   **
+    ** ======================= */
+
+    rc->doy++;
+    if (rc->doy == c->num_days) {
+        end_year(c, f, p, s);
+        rc->doy = 0;
+        rc->nyr++;
+    }
+
+    return;
+}
+
+void start_year(control *c, fluxes *f, met_arrays *ma, params *p, state *s,
+                run_clock *rc) {
+    int i;
+
+    if (c->sub_daily) {
+        rc->year = ma->year[c->hour_idx];
+    } else {
+        rc->year = ma->year[c->day_idx];
+    }
+    if (is_leap_year(rc->year))
+        c->num_days = 366;
+    else
+        c->num_days = 365;
+
+    calculate_daylength(s, c->num_days, p->latitude);
 
-                fs->structsoil_nc += s->structsoiln / s->structsoil;
-                fs->structsurf_nc += s->structsurfn / s->structsurf;
-                fs->activesoil_nc += s->activesoiln / s->activesoil;
-                fs->slowsoil_nc += s->slowsoiln / s->slowsoil;
-                fs->passivesoil_nc += s->passivesoiln / s->passivesoil;
+    if (c->deciduous_model) {
+        phenology(c, f, ma, p, s);
+
+        /* Change window size to length of growing season */
+        sma(SMA_FREE, rc->hw);
+        rc->hw = sma(SMA_NEW, p->growing_seas_len).handle;
+        if (s->prev_sma > -900) {
+            for (i = 0; i < p->growing_seas_len; i++) {
+                sma(SMA_ADD, rc->hw, s->prev_sma);
             }
-            c->day_idx++;
-            /* ======================= **
-            **   E N D   O F   D A Y   **
-            ** ======================= */
         }
 
+        zero_stuff(c, s);
+    }
 
-        /* Allocate stored C&N for the following year */
-        if (c->deciduous_model) {
-            calculate_average_alloc_fractions(f, s, p->growing_seas_len);
-            allocate_stored_c_and_n(f, p, s);
-        }
+    return;
+}
 
-        // Adjust rooting distribution at the end of the year to account for
-        // growth of new roots. It is debatable when this should be done. I've
-        // picked the year end for computation reasons and probably because
-        // plants wouldn't do this as dynamcially as on a daily basis. Probably
-        if (c->water_balance == HYDRAULICS) {
-            update_roots(c, p, s);
-        }
+void end_year(control *c, fluxes *f, params *p, state *s) {
+
+    /* Allocate stored C&N for the following year */
+    if (c->deciduous_model) {
+        calculate_average_alloc_fractions(f, s, p->growing_seas_len);
+        allocate_stored_c_and_n(f, p, s);
+    }
+
+    // Adjust rooting distribution at the end of the year to account for
+    // growth of new roots. It is debatable when this should be done. I've
+    // picked the year end for computation reasons and probably because
+    // plants wouldn't do this as dynamcially as on a daily basis. Probably
+    if (c->water_balance == HYDRAULICS) {
+        update_roots(c, p, s);
     }
     /* ========================= **
     **   E N D   O F   Y E A R   **
     ** ========================= */
+
+    return;
+}
+
+void end_run(control *c, params *p, state *s, run_clock *rc) {
+    /* Everything that happens after the last day of the run */
     correct_rate_constants(p, TRUE);
 
     if (c->print_options == END && c->spin_up == FALSE) {
         write_final_state(c, p, s);
     }
 
-    sma(SMA_FREE, hw);
+    sma(SMA_FREE, rc->hw);
     if (c->disturbance) {
-        free(disturbance_yrs);
+        free(rc->disturbance_yrs);
     }
 
     return;
-
-
 }
 
 void spin_up_pools(canopy_wk *cw, control *c, fluxes *f, fast_spinup *fs,
@@ -615,14 +669,30 @@ void spin_up_pools(canopy_wk *cw, control *c, fluxes *f, fast_spinup *fs,
     Adapted from...
     * Murty, D and McMurtrie, R. E. (2000) Ecological Modelling, 134,
       185-205, specifically page 196.
+
+    If a spinup_cache_dir is given, a spin-up that has been done before
+    with the same parameters and met data is taken from there instead,
+    see spinup_cache.c.
     */
     double tol = 5E-03;
     double prev_plantc = 99999.9;
     double prev_soilc = 99999.9;
-    int    i, cntrl_flag;
+    int    i, cntrl_flag, cycles = 0;
+    int    use_cache = (strlen(c->spinup_cache_dir) > 0);
+    char   key[SPINUP_CACHE_KEY_LEN];
 
-    /* Final state + param file */
-    open_output_file(c, c->out_param_fname, &(c->ofp));
+    /* Final state + param file, see write_final_state */
+    if (*c->cfg_fname != '\0')
+        open_output_file(c, c->out_param_fname, &(c->ofp));
+
+    if (use_cache)
+        use_cache = spinup_cache_key(c, ma, p, s, key);
+    if (use_cache) {
+        if (read_spinup_cache(key, cw, c, f, fs, m, p, s, nr)) {
+            write_final_state(c, p, s);
+            return;
+        }
+    }
 
     /* If we are prescribing disturbance, first allow the forest to establish */
     if (c->disturbance) {
@@ -651,6 +721,7 @@ void spin_up_pools(canopy_wk *cw, control *c, fluxes *f, fast_spinup *fs,
                 for (i = 0; i < 20; i++) {
                     run_sim(cw, c, f, fs, ma, m, p, s, nr); /* run GDAY */
                 }
+                cycles += 20;
 
                 /* Have we reached a steady state? */
                 fprintf(stderr,
@@ -666,6 +737,8 @@ void spin_up_pools(canopy_wk *cw, control *c, fluxes *f, fast_spinup *fs,
             s->totalc = s->soilc + s->litterc + s->plantc;
 
         }
+        fprintf(stderr, "Spunup after %d cycles (%d years)\n", cycles,
+                cycles * c->num_years);
 
     } else if (c->spinup_method == SAS) {
         //
@@ -673,8 +746,18 @@ void spin_up_pools(canopy_wk *cw, control *c, fluxes *f, fast_spinup *fs,
         // carbon–nitrogen pools, following Xia et al. (2013) GMD.
         //
         sas_spinup(cw, c, f, fs, ma, m, p, s, nr);
+    } else if (c->spinup_method == ANDERSON) {
+        /*
+         * Anderson acceleration of the same fixed-point iteration as BRUTE,
+         * one cycle at a time, to the per-cycle drift BRUTE's 20-cycle test
+         * allows.
+         */
+        anderson_spinup(cw, c, f, fs, ma, m, p, s, nr, tol / 20.0);
     }
 
+    if (use_cache) {
+        write_spinup_cache(key, cw, c, f, fs, m, p, s, nr);
+    }
     write_final_state(c, p, s);
 
     return;
@@ -690,25 +773,13 @@ void sas_spinup(canopy_wk *cw, control *c, fluxes *f, fast_spinup *fs,
     double cleaf0, cwood0, croot0, criteria, arg1, arg2, arg3;
     double NPP, mu_af, mu_ar, mu_acr, mu_ab, mu_aw, mu_lf, mu_lr, mu_lcr;
     double mu_lb, mu_lw, shootX, rootX, crootX, branchX, stemX, wood, woodX;
-    double mu_ass1, mu_ass2, mu_ass3, leaf_material, wood_material, mu_as1;
-    double surf_struct_litter, structout_surf, structout_soil;
-    double surf_struct_to_slow, surf_struct_to_active;
-    double soil_struct_to_slow, soil_struct_litter;
-    double soil_metab_litter, metabsurfX, metabsoilX;
-    double structsurfX, structsoilX, surf_metab_to_active, soil_metab_to_active;
-    double co2_to_air0, co2_to_air1, co2_to_air2, co2_to_air3, co2_to_air4;
-    double co2_to_air5, co2_to_air6;
-    double activesoilX, slowsoilX, passivesoilX, passive_to_active;
-    double c_into_active, slow_to_active, slow_to_passive, slowout;
-    double activeout, frac_microb_resp, c_into_passive;
-    double active_to_slow, active_to_passive, c_into_slow, mu_fmleaf, mu_fmroot;
+    double leaf_material, wood_material, frac_microb_resp;
+    double mu_fmleaf, mu_fmroot;
     double leafgrowth, rootgrowth, crootgrowth, branchgrowth, stemgrowth;
     double deadleaves, deadroots, deadcroots, deadbranches, deadstems;
-    double mu_decayrate0, mu_decayrate1, mu_decayrate2, mu_decayrate3, mu_decayrate4;
-    double mu_decayrate5, mu_decayrate6, surf_metab_litter, soil_struct_to_active;
-    double total_days, deadsapwood, sapwoodX = 0.0, new_passive;
-    double prev_passivec = 99999.9;
-    int    i, cntrl_flag;
+    double total_days, deadsapwood, sapwoodX = 0.0;
+    double mu_decayrate[7], litter[4], pools[7];
+    int    i;
 
     // Step 1: Initial spin
     // - we first need to achieve steady state plant pools (or NPP is an
@@ -755,13 +826,9 @@ void sas_spinup(canopy_wk *cw, control *c, fluxes *f, fast_spinup *fs,
     mu_lb = fs->loss[LB] / total_days;
     mu_aw = fs->alloc[AW] / total_days;
     mu_lw = fs->loss[LW] / total_days;
-    mu_decayrate0 = fs->dr[0] / total_days;
-    mu_decayrate1 = fs->dr[1] / total_days;
-    mu_decayrate2 = fs->dr[2] / total_days;
-    mu_decayrate3 = fs->dr[3] / total_days;
-    mu_decayrate4 = fs->dr[4] / total_days;
-    mu_decayrate5 = fs->dr[5] / total_days;
-    mu_decayrate6 = fs->dr[6] / total_days;
+    for (i = 0; i < 7; i++) {
+        mu_decayrate[i] = fs->dr[i] / total_days;
+    }
     mu_fmleaf = fs->alloc[S1] / total_days;
     mu_fmroot = fs->alloc[S2] / total_days;
 
@@ -806,81 +873,37 @@ void sas_spinup(canopy_wk *cw, control *c, fluxes *f, fast_spinup *fs,
 
     woodX = branchX + stemX + crootX;
 
-    deadsapwood = (mu_lw + p->sapturnover) * s->sapwood;
+    // sapturnover is still per year out here, see correct_rate_constants
+    deadsapwood = (mu_lw + p->sapturnover / NDAYS_IN_YR) * s->sapwood;
     sapwoodX += stemgrowth - deadsapwood;
 
     leaf_material = deadleaves * (1.0 - mu_fmleaf);
     wood_material = deadbranches + deadstems + deadsapwood;
 
-    surf_metab_litter = deadleaves * mu_fmleaf;
-    surf_metab_to_active = s->metabsurf * mu_decayrate1 * 0.45;
-
-    soil_metab_litter = deadroots * mu_fmroot;
-    soil_metab_to_active = s->metabsoil * mu_decayrate3 * 0.45;
-
-    surf_struct_litter = leaf_material + wood_material;
-    structout_surf = s->structsurf * mu_decayrate0;
-    surf_struct_to_slow = structout_surf * p->ligshoot * 0.7;
-    surf_struct_to_active = structout_surf * (1.0 - p->ligshoot) * 0.55;
-
-    structout_soil = s->structsoil * mu_decayrate2;
-    soil_struct_to_slow = structout_soil * p->ligroot * 0.7;
-    soil_struct_to_active = structout_soil * (1.0 - p->ligroot) * 0.45;
-    soil_struct_litter = deadroots * (1.0 - mu_fmroot) + deadcroots;
+    // The mean litter inputs implied by the plant pools, these feed the
+    // seven litter/SOM pools, see partition_plant_litter
+    litter[0] = leaf_material + wood_material;
+    litter[1] = deadleaves * mu_fmleaf;
+    litter[2] = deadroots * (1.0 - mu_fmroot) + deadcroots;
+    litter[3] = deadroots * mu_fmroot;
 
+    // Solve the litter/SOM C pools directly, i.e. the steady state of the
+    // CENTURY transfer matrix under the mean decay rates, rather than
+    // cycling the full model until the passive pool stops moving.
     frac_microb_resp = 0.85 - (0.68 * p->finesoil);
-
-    activeout = s->activesoil * mu_decayrate4;
-	slowout = s->slowsoil * mu_decayrate5;
-	slow_to_active = slowout * 0.42;
-	passive_to_active = s->passivesoil * mu_decayrate6 * 0.45;
-    c_into_active = surf_struct_to_active + soil_struct_to_active + \
-                    surf_metab_to_active + soil_metab_to_active + \
-                    slow_to_active + passive_to_active;
-    active_to_slow = activeout * (1.0 - frac_microb_resp - 0.004);
-    active_to_passive = activeout * 0.004;
-
-    
-    
-    slow_to_passive = slowout * 0.03;
-    c_into_slow = surf_struct_to_slow + soil_struct_to_slow + \
-                  active_to_slow;
-
-    
-    c_into_passive = active_to_passive + slow_to_passive;
-
-    co2_to_air0 = (structout_surf * \
-                   (p->ligshoot * 0.3 + (1.0 - p->ligshoot) * 0.45));
-    co2_to_air1 = (structout_soil * \
-                  (p->ligroot * 0.3 + (1.0 - p->ligroot) * 0.55));
-    co2_to_air2 = s->metabsurf * mu_decayrate1 * 0.55;
-    co2_to_air3 = s->metabsoil * mu_decayrate3 * 0.55;
-    co2_to_air4 = activeout * frac_microb_resp;
-    co2_to_air5 = slowout * 0.55;
-    co2_to_air6 = s->passivesoil * mu_decayrate6 * 0.55;
-
-    structsurfX = (surf_struct_litter - \
-                  (surf_struct_to_slow + surf_struct_to_active +
-                   co2_to_air0));
-
-    structsoilX = (soil_struct_litter - \
-                  (soil_struct_to_slow + soil_struct_to_active +
-                   co2_to_air1));
-
-    metabsurfX = (surf_metab_litter - \
-                  (surf_metab_to_active + co2_to_air2));
-
-    metabsoilX = (soil_metab_litter - \
-                  (soil_metab_to_active + co2_to_air3));
-
-    activesoilX = c_into_active - \
-                  (active_to_slow + active_to_passive + co2_to_air4);
-
-    slowsoilX = c_into_slow - \
-                (slow_to_active + slow_to_passive + co2_to_air5);
-
-    passivesoilX = c_into_passive - \
-                    (passive_to_active + co2_to_air6);
+    pools[0] = s->structsurf;
+    pools[1] = s->metabsurf;
+    pools[2] = s->structsoil;
+    pools[3] = s->metabsoil;
+    pools[4] = s->activesoil;
+    pools[5] = s->slowsoil;
+    pools[6] = s->passivesoil;
+    if (! steady_state_soil_c(p, mu_decayrate, litter, frac_microb_resp,
+                              c->passiveconst, pools)) {
+        fprintf(stderr, "SAS spin-up: no steady state for the soil pools, "
+                "do they all decay?\n");
+        gday_exit(EXIT_FAILURE);
+    }
 
     // Update the state
     s->shoot += shootX;
@@ -889,15 +912,18 @@ void sas_spinup(canopy_wk *cw, control *c, fluxes *f, fast_spinup *fs,
     s->branch += branchX;
     s->stem += stemX;
     s->sapwood += sapwoodX;
-    s->metabsoil += metabsoilX;
-    s->metabsurf += metabsurfX;
-    s->structsoil += structsoilX;
-    s->structsurf += structsurfX;
-    s->activesoil += activesoilX;
-    s->slowsoil += slowsoilX;
-    s->passivesoil += passivesoilX;
-
-    // Now solve the N pools using the average NC ratio
+    s->structsurf = pools[0];
+    s->metabsurf = pools[1];
+    s->structsoil = pools[2];
+    s->metabsoil = pools[3];
+    s->activesoil = pools[4];
+    s->slowsoil = pools[5];
+    s->passivesoil = pools[6];
+
+    // Now solve the N pools using the average NC ratio. Immobilisation
+    // brings whatever enters the SOM pools to their target N:C, and the
+    // litter pools are held within their N:C bounds, so at steady state
+    // the N pools are the C pools at these ratios.
     s->shootn = s->shoot * fs->shoot_nc;
     s->rootn = s->root * fs->root_nc;
     s->crootn = s->croot * fs->croot_nc;
@@ -913,18 +939,170 @@ void sas_spinup(canopy_wk *cw, control *c, fluxes *f, fast_spinup *fs,
     s->slowsoiln = s->slowsoil * fs->slowsoil_nc;
     s->passivesoiln = s->passivesoil * fs->passivesoil_nc;
 
-    // Step 4:  Keep spinning until the slowest C pool (passive) hit equilibrium
+    // Step 4: recompute the totals, there's no need to keep spinning
+    // until the passive pool settles as it is already at steady state
+    s->soilc = s->activesoil + s->slowsoil + s->passivesoil;
+    s->littercag = s->structsurf + s->metabsurf;
+    s->littercbg = s->structsoil + s->metabsoil;
+    s->litterc = s->littercag + s->littercbg;
+    s->plantc = s->root + s->croot + s->shoot + s->stem + s->branch;
+    s->totalc = s->soilc + s->litterc + s->plantc;
+
+    fprintf(stderr,
+      "Spunup: Plant C - %f, Soil C - %f\n", s->plantc, s->soilc);
+
+    return;
+}
+
+void anderson_spinup(canopy_wk *cw, control *c, fluxes *f, fast_spinup *fs,
+                     met_arrays *ma, met *m, params *p, state *s,
+                     nrutil *nr, double tol) {
+    /*
+        Treat a cycle through the met data as a map of the plant, litter and
+        soil C & N pools onto themselves and find its fixed point with
+        Anderson acceleration (see anderson.c), rather than just applying
+        the map until the pools stop changing.
+
+        Converged once plant and soil C, and each pool on its own, change by
+        less than tol over a plain cycle. The run carries more than just the
+        pools from one cycle to the next, so an extrapolated state that
+        looks settled is always checked by running on from it unaltered.
+
+        A step that would make any pool negative, or isn't finite, is
+        thrown away altogether along with the history, and the plain cycle
+        taken instead. Putting back just the pools that went negative would
+        leave them out of step with their C or N partners.
+    */
+    anderson *a;
+    double    x[N_SPINUP_POOLS], g[N_SPINUP_POOLS];
+    double    plantc, soilc;
+    int       i, cycles = 0, resets = 0, ok, plain = TRUE;
+
+    a = anderson_new(N_SPINUP_POOLS, ANDERSON_DEPTH);
+    get_spinup_pools(s, x);
+
     while (TRUE) {
-        if (fabs(s->passivesoil - prev_passivec) < 0.05) {
+        plantc = x[0] + x[1] + x[2] + x[3] + x[4];
+        soilc = x[9] + x[10] + x[11];
+
+        run_sim(cw, c, f, fs, ma, m, p, s, nr); /* run GDAY */
+        cycles++;
+        get_spinup_pools(s, g);
+
+        ok = (fabs(s->plantc - plantc) < tol && fabs(s->soilc - soilc) < tol);
+        for (i = 0; i < N_SPINUP_POOLS && ok; i++) {
+            ok = (fabs(g[i] - x[i]) < tol);
+        }
+        if (ok && plain) {
             break;
-        } else {
-            prev_passivec = s->passivesoil;
-            run_sim(cw, c, f, fs, ma, m, p, s, nr);
+        } else if (ok) {
+            /* settled from an extrapolated state, confirm with a plain one */
+            memcpy(x, g, sizeof(x));
+            plain = TRUE;
+            continue;
+        }
+
+        anderson_step(a, x, g);
+        plain = FALSE;
+        ok = TRUE;
+        for (i = 0; i < N_SPINUP_POOLS && ok; i++) {
+            ok = (isfinite(x[i]) && x[i] >= 0.0);
+        }
+        if (! ok) {
+            memcpy(x, g, sizeof(x));
+            anderson_reset(a);
+            resets++;
+        }
+        set_spinup_pools(s, x);
+
+        if (cycles % 20 == 0) {
+            fprintf(stderr,
+              "Spinup: Plant C - %f, Soil C - %f\n", s->plantc, s->soilc);
         }
     }
+    anderson_free(a);
 
-    fprintf(stderr,
-      "Spunup: Plant C - %f, Soil C - %f\n", s->plantc, s->soilc);
+    fprintf(stderr, "Spunup after %d cycles (%d years), %d restarts\n",
+            cycles, cycles * c->num_years, resets);
+
+    return;
+}
+
+void get_spinup_pools(state *s, double *x) {
+    /* the pools the ANDERSON spin-up iterates on, plant C first, then soil */
+    x[0] = s->shoot;
+    x[1] = s->root;
+    x[2] = s->croot;
+    x[3] = s->branch;
+    x[4] = s->stem;
+    x[5] = s->structsurf;
+    x[6] = s->structsoil;
+    x[7] = s->metabsurf;
+    x[8] = s->metabsoil;
+    x[9] = s->activesoil;
+    x[10] = s->slowsoil;
+    x[11] = s->passivesoil;
+    x[12] = s->shootn;
+    x[13] = s->rootn;
+    x[14] = s->crootn;
+    x[15] = s->branchn;
+    x[16] = s->stemnimm;
+    x[17] = s->stemnmob;
+    x[18] = s->structsurfn;
+    x[19] = s->structsoiln;
+    x[20] = s->metabsurfn;
+    x[21] = s->metabsoiln;
+    x[22] = s->activesoiln;
+    x[23] = s->slowsoiln;
+    x[24] = s->passivesoiln;
+    x[25] = s->inorgn;
+
+    return;
+}
+
+void set_spinup_pools(state *s, double *x) {
+    /* and back again, along with the totals that depend on them */
+    s->shoot = x[0];
+    s->root = x[1];
+    s->croot = x[2];
+    s->branch = x[3];
+    s->stem = x[4];
+    s->structsurf = x[5];
+    s->structsoil = x[6];
+    s->metabsurf = x[7];
+    s->metabsoil = x[8];
+    s->activesoil = x[9];
+    s->slowsoil = x[10];
+    s->passivesoil = x[11];
+    s->shootn = x[12];
+    s->rootn = x[13];
+    s->crootn = x[14];
+    s->branchn = x[15];
+    s->stemnimm = x[16];
+    s->stemnmob = x[17];
+    s->stemn = s->stemnimm + s->stemnmob;
+    s->structsurfn = x[18];
+    s->structsoiln = x[19];
+    s->metabsurfn = x[20];
+    s->metabsoiln = x[21];
+    s->activesoiln = x[22];
+    s->slowsoiln = x[23];
+    s->passivesoiln = x[24];
+    s->inorgn = x[25];
+
+    s->soiln = s->inorgn + s->activesoiln + s->slowsoiln + s->passivesoiln;
+    s->litternag = s->structsurfn + s->metabsurfn;
+    s->litternbg = s->structsoiln + s->metabsoiln;
+    s->littern = s->litternag + s->litternbg;
+    s->plantn = s->shootn + s->rootn + s->crootn + s->branchn + s->stemn;
+    s->totaln = s->plantn + s->littern + s->soiln;
+
+    s->soilc = s->activesoil + s->slowsoil + s->passivesoil;
+    s->littercag = s->structsurf + s->metabsurf;
+    s->littercbg = s->structsoil + s->metabsoil;
+    s->litterc = s->littercag + s->littercbg;
+    s->plantc = s->root + s->croot + s->shoot + s->stem + s->branch;
+    s->totalc = s->soilc + s->litterc + s->plantc;
 
     return;
 }
@@ -935,7 +1113,43 @@ void clparser(int argc, char **argv, control *c) {
     for (i = 1; i < argc; i++) {
         if (*argv[i] == '-') {
             if (!strncasecmp(argv[i], "-p", 2)) {
-			    strcpy(c->cfg_fname, argv[++i]);
+                strncpy0(c->cfg_fname, next_arg(argc, argv, &i),
+                         sizeof(c->cfg_fname));
+            } else if (!strncasecmp(argv[i], "-b", 2)) {
+                strncpy0(c->batch_fname, next_arg(argc, argv, &i),
+                         sizeof(c->batch_fname));
+            } else if (!strncasecmp(argv[i], "-e", 2)) {
+                strncpy0(c->ensemble_fname, next_arg(argc, argv, &i),
+                         sizeof(c->ensemble_fname));
+            } else if (!strncasecmp(argv[i], "-x", 2)) {
+                strncpy0(c->sweep_fname, next_arg(argc, argv, &i),
+                         sizeof(c->sweep_fname));
+            } else if (!strncasecmp(argv[i], "-f", 2)) {
+                strncpy0(c->scenario_fname, next_arg(argc, argv, &i),
+                         sizeof(c->scenario_fname));
+            } else if (!strncasecmp(argv[i], "-d", 2)) {
+                if (sscanf(next_arg(argc, argv, &i), "%d,%d", &(c->fork_year),
+                           &(c->fork_doy)) != 2 ||
+                    c->fork_doy < 1 || c->fork_doy > 366) {
+                    fprintf(stderr, "%s: -d expects year,doy e.g. 2001,150\n",
+                            argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+            } else if (!strncasecmp(argv[i], "-ms", 3)) {
+                strncpy0(c->met_fname, next_arg(argc, argv, &i),
+                         sizeof(c->met_fname));
+                c->convert_met = TRUE;
+                c->sub_daily = TRUE;
+            } else if (!strncasecmp(argv[i], "-m", 2)) {
+                strncpy0(c->met_fname, next_arg(argc, argv, &i),
+                         sizeof(c->met_fname));
+                c->convert_met = TRUE;
+                c->sub_daily = FALSE;
+            } else if (!strncasecmp(argv[i], "-t", 2)) {
+                c->nthreads = atoi(next_arg(argc, argv, &i));
+            } else if (!strncasecmp(argv[i], "-serve", 6)) {
+                strncpy0(c->serve_path, next_arg(argc, argv, &i),
+                         sizeof(c->serve_path));
             } else if (!strncasecmp(argv[i], "-s", 2)) {
                 c->spin_up = TRUE;
             } else if (!strncasecmp(argv[i], "-ver", 4)) {
@@ -956,6 +1170,16 @@ void clparser(int argc, char **argv, control *c) {
 }
 
 
+char *next_arg(int argc, char **argv, int *i) {
+    /* the value that goes with the option at argv[*i], which it steps over */
+    if (*i + 1 >= argc) {
+        fprintf(stderr, "%s: %s needs a value\n", argv[0], argv[*i]);
+        usage(argv);
+        exit(EXIT_FAILURE);
+    }
+    return (argv[++(*i)]);
+}
+
 void usage(char **argv) {
     fprintf(stderr, "\n========\n");
     fprintf(stderr, " USAGE:\n");
@@ -967,6 +1191,28 @@ void usage(char **argv) {
     fprintf(stderr, "[-ver          \t] Print the git hash tag.]\n");
     fprintf(stderr, "[-p       fname\t] Location of parameter file (.ini/.cfg).]\n");
     fprintf(stderr, "[-s            \t] Spin-up GDAY, when it the model is finished it will print the final state to the param file.]\n");
+    fprintf(stderr, "\n++Batch options:\n" );
+    fprintf(stderr, "[-b       fname\t] Run every site in a manifest (lines of param_file,met_file,output_file).]\n");
+    fprintf(stderr, "[              \t] Run times are kept in <manifest>.cost to schedule the longest sites first.]\n");
+    fprintf(stderr, "[-t    nthreads\t] Number of batch/ensemble worker threads, default is one per CPU.]\n");
+    fprintf(stderr, "\n++Ensemble options:\n" );
+    fprintf(stderr, "[-e       fname\t] Run every member in an ensemble file (lines of member_id,param_file) against the\n");
+    fprintf(stderr, "[              \t] met file of the -p param file, which is only read once. Member param files only need\n");
+    fprintf(stderr, "[              \t] the keys that differ, all output goes to the -p file's out_fname keyed by member id.]\n");
+    fprintf(stderr, "[-x       fname\t] As -e for a parameter sweep, a CSV with a header of member_id then the keys\n");
+    fprintf(stderr, "[              \t] swept (sla, cue, control.alloc_model, ...) and a row of values per member.]\n");
+    fprintf(stderr, "\n++Scenario options:\n" );
+    fprintf(stderr, "[-f       fname\t] Fork every scenario in a file (lines of scenario_id,param_file) from the -p run.]\n");
+    fprintf(stderr, "[              \t] Scenario param files only need the [control]/[params] keys that change at the fork.]\n");
+    fprintf(stderr, "[-d    year,doy\t] Day the scenarios are forked on, output is written to out_fname_<scenario_id>.]\n");
+    fprintf(stderr, "\n++Server options:\n" );
+    fprintf(stderr, "[-serve    path\t] Read the met data of the -p param file once, then answer run requests (lines of\n");
+    fprintf(stderr, "[              \t] key=value overrides, start=/end= years, vars=) on a Unix socket at path, or on\n");
+    fprintf(stderr, "[              \t] stdin/stdout for \"-\". See server.c for the answers, \"quit\" stops it.]\n");
+    fprintf(stderr, "\n++Met options:\n" );
+    fprintf(stderr, "[-m       fname\t] Write the binary cache of a daily met file, which is then read in its place\n");
+    fprintf(stderr, "[              \t] for as long as the met file is unchanged.]\n");
+    fprintf(stderr, "[-ms      fname\t] As -m for a sub-daily met file.]\n");
     fprintf(stderr, "\n++Print this message:\n" );
     fprintf(stderr, "[-u/-h         \t] usage/help]\n");
 
@@ -1277,6 +1523,10 @@ void unpack_met_data(control *c, fluxes *f, met_arrays *ma, met *m, int hod,
 
 void allocate_numerical_libs_stuff(nrutil *nr) {
 
+    /* already done for a previous site, N and kmax never change */
+    if (nr->y != NULL)
+        return;
+
     nr->xp = dvector(1, nr->kmax);
     nr->yp = dmatrix(1, nr->N, 1, nr->kmax);
     nr->yscal = dvector(1, nr->N);
@@ -1303,23 +1553,32 @@ void fill_up_solar_arrays(canopy_wk *cw, control *c, met_arrays *ma, params *p)
     int    nyr, doy, hod;
     long   ntimesteps = c->total_num_days * 48;
     double year, sw_rad;
+    double *tmp;
+
+    // The stores are kept when a simulation handle moves on to the next
+    // site, so only grow them if this met file is longer
+    if (ntimesteps > cw->solar_capacity) {
+        tmp = realloc(cw->cz_store, ntimesteps * sizeof(double));
+        if (tmp == NULL) {
+            fprintf(stderr, "malloc failed allocating cz store\n");
+            gday_exit(EXIT_FAILURE);
+        }
+        cw->cz_store = tmp;
 
-    cw->cz_store = malloc(ntimesteps * sizeof(double));
-    if (cw->cz_store == NULL) {
-        fprintf(stderr, "malloc failed allocating cz store\n");
-        exit(EXIT_FAILURE);
-    }
-
-    cw->ele_store = malloc(ntimesteps * sizeof(double));
-    if (cw->ele_store == NULL) {
-        fprintf(stderr, "malloc failed allocating ele store\n");
-        exit(EXIT_FAILURE);
-    }
+        tmp = realloc(cw->ele_store, ntimesteps * sizeof(double));
+        if (tmp == NULL) {
+            fprintf(stderr, "malloc failed allocating ele store\n");
+            gday_exit(EXIT_FAILURE);
+        }
+        cw->ele_store = tmp;
 
-    cw->df_store = malloc(ntimesteps * sizeof(double));
-    if (cw->df_store == NULL) {
-        fprintf(stderr, "malloc failed allocating df store\n");
-        exit(EXIT_FAILURE);
+        tmp = realloc(cw->df_store, ntimesteps * sizeof(double));
+        if (tmp == NULL) {
+            fprintf(stderr, "malloc failed allocating df store\n");
+            gday_exit(EXIT_FAILURE);
+        }
+        cw->df_store = tmp;
+        cw->solar_capacity = ntimesteps;
     }
 
     c->hour_idx = 0;
@@ -0,0 +1,1538 @@
+/* ============================================================================
+* Re-entrant simulation handle.
+*
+* Owns every structure that main() used to allocate, so that many sites can
+* be set up and run inside one process. There is no shared state between
+* handles, two handles can be run concurrently on different threads.
+*
+* NOTES:
+*   Model errors are routed through gday_exit(), which we trap here with a
+*   per-thread landing pad. A failing site therefore returns an error code
+*   to the caller rather than calling exit().
+*
+*   The model never writes to the met arrays or the sub-daily solar stores,
+*   so these can be read once into a gday_forcing and borrowed by any number
+*   of handles (ensemble members) at the same time. While the met store is
+*   open handles borrow from it in the same way, see met_store.c.
+*
+*   A run can be stopped part way (gday_sim_run_to) and other handles forked
+*   from it (gday_sim_fork) to run different scenarios from that day on.
+*
+*   A run can also be driven a day at a time (gday_sim_advance_day) to
+*   couple it to another model, which reads and changes the pools by name
+*   in between days (gday_sim_get_state, gday_sim_set_state).
+*
+*   A handle is only run once per load. Once its run has finished another
+*   gday_sim_run is an error and gday_sim_advance_day keeps returning
+*   GDAY_SIM_END, rather than starting over from the end state on top of
+*   the output. A handle that failed, to load or part way through its run,
+*   can't be run at all until it has been loaded again.
+*
+*   Nothing has to go through files. The forcing can be made from met
+*   columns the caller already holds (gday_forcing_from_columns), which
+*   are borrowed in place like any other shared forcing, the .ini can be
+*   left out for values set by name (gday_sim_load_values), and the
+*   output rows can go into the caller's buffer (gday_sim_set_output).
+*
+* =========================================================================== */
+#include "gday_sim.h"
+#include "gday.h"
+#include "water_balance_sub_daily.h"
+#include "forcing.h"
+#include "checkpoint.h"
+#include "met_window.h"
+#include "met_store.h"
+#include "param_registry.h"
+
+/* met comes from gday_forcing_from_columns, don't read any */
+#define LOAD_COLUMNS 0x100
+
+struct gday_sim {
+    canopy_wk   cw;
+    control     c;
+    fluxes      f;
+    fast_spinup fs;
+    met_arrays  ma;
+    met         m;
+    params      p;
+    state       s;
+    nrutil      nr;
+    int         met_sub_daily;  /* timestep the met arrays were sized for */
+    int         met_shared;     /* met and solar arrays borrowed, not owned */
+    met_store_ref met_ref;      /* ...from the met store, if that's where */
+    run_clock   rc;             /* where a run stopped by run_to has got to */
+    int         running;        /* start_run done, end_run not yet */
+    int         loaded;         /* by gday_sim_load etc., and not failed */
+    int         finished;       /* run to the end, load it again to rerun */
+};
+
+/* Heap arrays that survive from one site to the next on the same handle */
+typedef struct {
+    double *day_length;
+    double *potA, *potB, *cond1, *cond2, *cond3, *porosity, *field_capacity;
+    double *soil_conduct, *swp, *soilR, *fraction_uptake, *ppt_gain;
+    double *water_loss, *water_gain, *est_evap;
+    double *water_frac, *wetting_bot, *wetting_top;
+    double *thickness, *root_mass, *root_length, *layer_depth;
+    nrutil  nr;
+    double *cz_store, *ele_store, *df_store;
+    long    solar_capacity;
+} kept_arrays;
+
+static void setup_sim(gday_sim *, const char *, const char *, int,
+                      const char **, const char **, const char *,
+                      const gday_forcing *, const char *, int);
+static void apply_values(control *, params *, state *, int, const char **,
+                         const char **);
+static void attach_forcing(gday_sim *, const gday_forcing *);
+static int  use_columns(gday_sim *, long, const double *const *);
+static void take_forcing(gday_sim *, gday_forcing *);
+static void offset_met(met_arrays *, long);
+static void free_own_forcing(gday_sim *);
+static int  check_runnable(gday_sim *);
+static void start_running(gday_sim *);
+static void stop_running(gday_sim *);
+static void fork_state(gday_sim *, gday_sim *);
+static void override_mask(control *, unsigned char *, unsigned char *);
+static void merge_masked(void *, const void *, const unsigned char *, size_t);
+static void keep_arrays(gday_sim *, kept_arrays *);
+static void restore_arrays(gday_sim *, kept_arrays *);
+static int  close_output_files(control *);
+
+
+gday_sim *gday_sim_new(void) {
+    /*
+        An empty handle, call gday_sim_load() to point it at a site. A handle
+        can be loaded again once a run has finished, in which case the met,
+        hydraulics and numerical arrays are recycled rather than reallocated.
+    */
+    gday_sim *sim;
+
+    /* calloc so that every array pointer starts out NULL */
+    if ((sim = (gday_sim *)calloc(1, sizeof(gday_sim))) == NULL) {
+        fprintf(stderr, "gday_sim structure: Not allocated enough memory!\n");
+        return (NULL);
+    }
+
+    return (sim);
+}
+
+int gday_sim_load(gday_sim *sim, const char *cfg_fname, const char *met_fname,
+                  const char *out_fname, int flags) {
+    /*
+        Read the .ini file and met forcing into the handle. met_fname and
+        out_fname override the [files] section of the .ini when not NULL.
+        Returns 0 on success.
+    */
+    jmp_buf env, *prev;
+    int     error;
+
+    prev = set_exit_handler(&env);
+    if ((error = setjmp(env)) != 0) {
+        set_exit_handler(prev);
+        close_output_files(&(sim->c));
+        return (error);
+    }
+
+    setup_sim(sim, cfg_fname, NULL, 0, NULL, NULL, met_fname, NULL, out_fname,
+              flags);
+    sim->loaded = TRUE;
+
+    set_exit_handler(prev);
+
+    return (0);
+}
+
+int gday_sim_load_member(gday_sim *sim, const char *cfg_fname,
+                         const char *member_fname, const gday_forcing *fc,
+                         const char *out_fname, int flags) {
+    /*
+        Load an ensemble member: the base .ini, then the member's .ini on
+        top of it (so it only needs the keys that differ), running against
+        forcing that has already been read. The handle borrows fc, which
+        has to outlive the run. Returns 0 on success.
+    */
+    jmp_buf env, *prev;
+    int     error;
+
+    prev = set_exit_handler(&env);
+    if ((error = setjmp(env)) != 0) {
+        set_exit_handler(prev);
+        close_output_files(&(sim->c));
+        return (error);
+    }
+
+    setup_sim(sim, cfg_fname, member_fname, 0, NULL, NULL, NULL, fc,
+              out_fname, flags);
+    sim->loaded = TRUE;
+
+    set_exit_handler(prev);
+
+    return (0);
+}
+
+int gday_sim_load_values(gday_sim *sim, const char *cfg_fname, int nvalues,
+                         const char **names, const char **values,
+                         const gday_forcing *fc, const char *out_fname,
+                         int flags) {
+    /*
+        Load a member of a parameter sweep: the base .ini, then names[i] set
+        to values[i] as though it were in the .ini, running against forcing
+        that has already been read (see gday_sim_load_member). A name is a
+        key in [params] or "section.key" for any other. Empty or NULL values
+        are left as they were in the .ini. Returns 0 on success.
+    */
+    jmp_buf env, *prev;
+    int     error;
+
+    prev = set_exit_handler(&env);
+    if ((error = setjmp(env)) != 0) {
+        set_exit_handler(prev);
+        close_output_files(&(sim->c));
+        return (error);
+    }
+
+    setup_sim(sim, cfg_fname, NULL, nvalues, names, values, NULL, fc,
+              out_fname, flags);
+    sim->loaded = TRUE;
+
+    set_exit_handler(prev);
+
+    return (0);
+}
+
+gday_forcing *gday_forcing_new(const char *cfg_fname, const char *met_fname) {
+    /*
+        Read the met forcing named by the .ini (or met_fname if not NULL)
+        and, for sub-daily runs, the solar geometry at the site, ready to be
+        shared by handles loaded with gday_sim_load_member. Returns NULL if
+        anything goes wrong.
+    */
+    gday_sim     *sim;
+    gday_forcing *fc;
+
+    if ((sim = gday_sim_new()) == NULL)
+        return (NULL);
+
+    if (gday_sim_load(sim, cfg_fname, met_fname, NULL, GDAY_SIM_QUIET) != 0 ||
+        (fc = (gday_forcing *)calloc(1, sizeof(gday_forcing))) == NULL) {
+        gday_sim_destroy(sim);
+        return (NULL);
+    }
+
+    /* each member would need the window on its own year */
+    if (sim->ma.window != NULL) {
+        fprintf(stderr, "%s: stream_met can't be used with shared forcing\n",
+                cfg_fname);
+        free(fc);
+        gday_sim_destroy(sim);
+        return (NULL);
+    }
+
+    take_forcing(sim, fc);
+    gday_sim_destroy(sim);
+
+    return (fc);
+}
+
+gday_forcing *gday_forcing_from_columns(const char *cfg_fname, long nrows,
+                                        const double *const *columns) {
+    /*
+        Forcing made from met data the caller already has in memory, a
+        column of nrows values for each column of the met file, in its
+        order (see gday_met_columns). The columns are used where they are,
+        not copied, so they have to outlive the forcing, the model never
+        writes to them. The .ini (NULL for the defaults) says whether they
+        are daily or sub-daily and, for sub-daily, where the site is.
+        Returns NULL if anything goes wrong.
+    */
+    gday_sim     *sim;
+    gday_forcing *fc = NULL;
+
+    if ((sim = gday_sim_new()) == NULL)
+        return (NULL);
+
+    if (gday_sim_load(sim, cfg_fname, NULL, NULL,
+                      GDAY_SIM_QUIET | LOAD_COLUMNS) != 0 ||
+        use_columns(sim, nrows, columns) != 0 ||
+        (fc = (gday_forcing *)calloc(1, sizeof(gday_forcing))) == NULL) {
+        /* the met arrays are the caller's */
+        memset(&(sim->ma), 0, sizeof(met_arrays));
+        gday_sim_destroy(sim);
+        return (NULL);
+    }
+
+    take_forcing(sim, fc);
+    fc->caller_met = TRUE;
+    gday_sim_destroy(sim);
+
+    return (fc);
+}
+
+gday_forcing *gday_forcing_years(const gday_forcing *fc, int first_year,
+                                 int last_year) {
+    /*
+        The years first_year to last_year of fc, pointing into its arrays
+        rather than copying them, so that runs can be started part way
+        through the met data without reading any of it again. fc has to
+        outlive the view. Returns NULL if fc has none of those years.
+    */
+    gday_forcing *view;
+    long          nrows, row0, row1, i;
+    double        current_yr;
+
+    nrows = fc->c.sub_daily ? fc->c.total_num_days * 48 :
+                              fc->c.total_num_days;
+    for (row0 = 0; row0 < nrows && fc->ma.year[row0] < first_year; row0++)
+        ;
+    for (row1 = row0; row1 < nrows && fc->ma.year[row1] <= last_year; row1++)
+        ;
+    if (row1 == row0) {
+        fprintf(stderr, "%s: no met data for %d-%d\n", fc->c.cfg_fname,
+                first_year, last_year);
+        return (NULL);
+    }
+
+    if ((view = (gday_forcing *)malloc(sizeof(gday_forcing))) == NULL) {
+        fprintf(stderr, "forcing view: Not allocated enough memory!\n");
+        return (NULL);
+    }
+    *view = *fc;
+    view->view = TRUE;
+    offset_met(&(view->ma), row0);
+    if (fc->cz_store != NULL) {
+        view->cz_store = fc->cz_store + row0;
+        view->ele_store = fc->ele_store + row0;
+        view->df_store = fc->df_store + row0;
+    }
+
+    view->c.num_years = 0;
+    current_yr = -999.9;
+    for (i = row0; i < row1; i++) {
+        if (current_yr != fc->ma.year[i]) {
+            view->c.num_years++;
+            current_yr = fc->ma.year[i];
+        }
+    }
+    view->c.total_num_days = fc->c.sub_daily ? (row1 - row0) / 48 :
+                                               row1 - row0;
+
+    return (view);
+}
+
+int gday_met_columns(int sub_daily, const char **names) {
+    /*
+        The names of the met file's columns, in order, returning how many
+        there are (at most GDAY_MET_COLUMNS). names can be NULL.
+    */
+    met_arrays   ma;
+    double     **arrays[MAX_MET_VARS];
+    char        *cols[MAX_MET_VARS];
+    int          i, n;
+
+    memset(&ma, 0, sizeof(met_arrays));
+    n = met_columns(&ma, sub_daily, arrays, cols);
+    for (i = 0; names != NULL && i < n; i++)
+        names[i] = cols[i];
+
+    return (n);
+}
+
+void gday_forcing_free(gday_forcing *fc) {
+
+    if (fc == NULL)
+        return;
+
+    /* everything belongs to the forcing it is a view on */
+    if (fc->view) {
+        free(fc);
+        return;
+    }
+
+    if (! fc->caller_met)
+        free_met_arrays(&(fc->ma));
+    free(fc->cz_store);
+    free(fc->ele_store);
+    free(fc->df_store);
+    free(fc);
+
+    return;
+}
+
+gday_sim *gday_sim_create(const char *cfg_fname, int flags) {
+    /*
+        Read the .ini file and met forcing into a new handle, returns NULL if
+        anything goes wrong.
+    */
+    gday_sim *sim;
+
+    if ((sim = gday_sim_new()) == NULL)
+        return (NULL);
+
+    if (gday_sim_load(sim, cfg_fname, NULL, NULL, flags) != 0) {
+        gday_sim_destroy(sim);
+        return (NULL);
+    }
+
+    return (sim);
+}
+
+int gday_sim_set_output(gday_sim *sim, double *buffer, long nrows) {
+    /*
+        Have the run put its output records into buffer, nrows rows of the
+        columns gday_sim_output_columns names, rather than any output file.
+        Only daily (or monthly etc.) records can, and the run fails if it
+        writes more than nrows of them. Call it once the handle is loaded
+        and before it is run. Returns 0 on success.
+    */
+    control *c = &(sim->c);
+
+    if (sim->running) {
+        fprintf(stderr, "%s: the output can't be changed part way through "
+                "a run\n", c->cfg_fname);
+        return (1);
+    }
+    if (c->print_options != DAILY && ! AGGREGATED(c->print_options)) {
+        fprintf(stderr, "%s: only daily or aggregated outputs can be kept "
+                "in memory\n", c->cfg_fname);
+        return (1);
+    }
+
+    c->out_buffer = buffer;
+    c->out_buffer_rows = nrows;
+    c->out_rows = 0;
+    c->output_ascii = FALSE;
+    c->output_arrow = FALSE;
+    c->async_output = FALSE;
+    if (c->num_out_vars == 0)
+        default_output_vars(c);
+
+    return (0);
+}
+
+int gday_sim_output_columns(gday_sim *sim, const char **names,
+                            long *max_rows) {
+    /*
+        The names of the columns in each of a loaded handle's output
+        records (names can be NULL to find out how many there are first),
+        returning how many. max_rows, if not NULL, gets a number of rows
+        that will always be enough, one for every day of the met data.
+    */
+    control    *c = &(sim->c);
+    const char *cols[MAX_OUTPUT_VARS + 3];
+    int         i, n, ascii;
+
+    if (c->num_out_vars == 0) {
+        /* the defaults gday_sim_set_output will pick, leaving them unset */
+        ascii = c->output_ascii;
+        c->output_ascii = FALSE;
+        default_output_vars(c);
+        n = output_columns(c, cols);
+        c->num_out_vars = 0;
+        c->output_ascii = ascii;
+    } else {
+        n = output_columns(c, cols);
+    }
+    for (i = 0; names != NULL && i < n; i++)
+        names[i] = cols[i];
+    if (max_rows != NULL)
+        *max_rows = sim->c.total_num_days;
+
+    return (n);
+}
+
+long gday_sim_output_rows(gday_sim *sim) {
+    /* rows put in the buffer given to gday_sim_set_output so far */
+    return (sim->c.out_rows);
+}
+
+int gday_sim_run(gday_sim *sim) {
+    /*
+        Run (or spin-up) the model, returns 0 on success, otherwise the
+        status the model tried to exit with. The handle has to be loaded
+        again before it can be run again.
+    */
+    canopy_wk   *cw = &(sim->cw);
+    control     *c = &(sim->c);
+    fluxes      *f = &(sim->f);
+    fast_spinup *fs = &(sim->fs);
+    met_arrays  *ma = &(sim->ma);
+    met         *m = &(sim->m);
+    params      *p = &(sim->p);
+    state       *s = &(sim->s);
+    nrutil      *nr = &(sim->nr);
+    jmp_buf      env, *prev;
+    int          error;
+
+    if ((error = check_runnable(sim)) != 0)
+        return (error);
+
+    prev = set_exit_handler(&env);
+    if ((error = setjmp(env)) != 0) {
+        set_exit_handler(prev);
+        stop_running(sim);
+        sim->loaded = FALSE;
+        close_output_files(&(sim->c));
+        return (error);
+    }
+
+    if (sim->running) {
+        /* finish off a run stopped by gday_sim_run_to, or forked */
+        run_days(cw, c, f, fs, ma, m, p, s, nr, &(sim->rc), -1, -1);
+        end_run(c, p, s, &(sim->rc));
+        sim->running = FALSE;
+    } else if (c->spin_up) {
+        spin_up_pools(cw, c, f, fs, ma, m, p, s, nr);
+    } else {
+        run_sim(cw, c, f, fs, ma, m, p, s, nr);
+    }
+    sim->finished = TRUE;
+
+    set_exit_handler(prev);
+
+    return (close_output_files(c));
+}
+
+int gday_sim_run_to(gday_sim *sim, int year, int doy) {
+    /*
+        Run the model up to, but not including, day doy (1 = 1st Jan) of
+        year, where it can be forked (gday_sim_fork) and then finished off
+        with gday_sim_run. Returns 0 on success.
+    */
+    canopy_wk   *cw = &(sim->cw);
+    control     *c = &(sim->c);
+    fluxes      *f = &(sim->f);
+    fast_spinup *fs = &(sim->fs);
+    met_arrays  *ma = &(sim->ma);
+    met         *m = &(sim->m);
+    params      *p = &(sim->p);
+    state       *s = &(sim->s);
+    nrutil      *nr = &(sim->nr);
+    jmp_buf      env, *prev;
+    int          error;
+
+    if ((error = check_runnable(sim)) != 0)
+        return (error);
+
+    prev = set_exit_handler(&env);
+    if ((error = setjmp(env)) != 0) {
+        set_exit_handler(prev);
+        stop_running(sim);
+        sim->loaded = FALSE;
+        close_output_files(&(sim->c));
+        return (error);
+    }
+
+    start_running(sim);
+    run_days(cw, c, f, fs, ma, m, p, s, nr, &(sim->rc), year, doy);
+
+    if (sim->rc.nyr >= c->num_years) {
+        fprintf(stderr, "%s: reached the end of the met data before day %d "
+                "of %d\n", c->cfg_fname, doy, year);
+        gday_exit(EXIT_FAILURE);
+    }
+
+    set_exit_handler(prev);
+
+    return (0);
+}
+
+int gday_sim_start(gday_sim *sim) {
+    /*
+        Start the run of a loaded handle, everything before its first day,
+        ready for gday_sim_advance_day. Returns 0 on success.
+    */
+    jmp_buf env, *prev;
+    int     error;
+
+    if ((error = check_runnable(sim)) != 0)
+        return (error);
+
+    prev = set_exit_handler(&env);
+    if ((error = setjmp(env)) != 0) {
+        set_exit_handler(prev);
+        stop_running(sim);
+        sim->loaded = FALSE;
+        close_output_files(&(sim->c));
+        return (error);
+    }
+
+    start_running(sim);
+
+    set_exit_handler(prev);
+
+    return (0);
+}
+
+int gday_sim_advance_day(gday_sim *sim) {
+    /*
+        Run the next day, starting the run first if it hasn't been. Returns
+        0 once the day has been run, GDAY_SIM_END if the met data has been
+        run to the end (the run is then finished off, as by gday_sim_run,
+        and it keeps returning GDAY_SIM_END until the handle is loaded
+        again), otherwise the status the model tried to exit with.
+    */
+    canopy_wk   *cw = &(sim->cw);
+    control     *c = &(sim->c);
+    fluxes      *f = &(sim->f);
+    fast_spinup *fs = &(sim->fs);
+    met_arrays  *ma = &(sim->ma);
+    met         *m = &(sim->m);
+    params      *p = &(sim->p);
+    state       *s = &(sim->s);
+    nrutil      *nr = &(sim->nr);
+    jmp_buf      env, *prev;
+    int          error, year, doy;
+
+    if (sim->loaded && sim->finished)
+        return (GDAY_SIM_END);
+    if ((error = check_runnable(sim)) != 0)
+        return (error);
+
+    prev = set_exit_handler(&env);
+    if ((error = setjmp(env)) != 0) {
+        set_exit_handler(prev);
+        stop_running(sim);
+        sim->loaded = FALSE;
+        close_output_files(&(sim->c));
+        return (error);
+    }
+
+    start_running(sim);
+    if (! next_day(c, ma, &(sim->rc), &year, &doy)) {
+        end_run(c, p, s, &(sim->rc));
+        sim->running = FALSE;
+        sim->finished = TRUE;
+        set_exit_handler(prev);
+        if ((error = close_output_files(c)) != 0)
+            return (error);
+        return (GDAY_SIM_END);
+    }
+    step_day(cw, c, f, fs, ma, m, p, s, nr, &(sim->rc));
+
+    set_exit_handler(prev);
+
+    return (0);
+}
+
+int gday_sim_next_day(gday_sim *sim, int *year, int *doy) {
+    /*
+        The day gday_sim_advance_day runs next (doy 1 = 1st Jan) of a run
+        that has been started. Returns 0, or GDAY_SIM_END if there isn't
+        one.
+    */
+    if (! sim->running ||
+        ! next_day(&(sim->c), &(sim->ma), &(sim->rc), year, doy))
+        return (GDAY_SIM_END);
+
+    return (0);
+}
+
+int gday_sim_get_state(gday_sim *sim, const char *name, double *value) {
+    /*
+        The value of a pool by name, any key in [state] of the .ini, or of
+        any output variable (see output_vars.c), which for the fluxes is
+        the day last run. Returns 0, or 1 if there's no such name.
+    */
+    const ini_key *k;
+    int            i;
+
+    if ((k = find_ini_key("state", name)) != NULL && k->type == INI_DOUBLE) {
+        *value = *(double *)ini_field(&(sim->c), &(sim->p), &(sim->s), k);
+        return (0);
+    }
+    if ((i = find_output_var(name)) >= 0) {
+        *value = output_var_value(&(sim->c), &(sim->cw), &(sim->f),
+                                  &(sim->s), &(output_vars[i]));
+        return (0);
+    }
+    fprintf(stderr, "%s: no state called %s\n", sim->c.cfg_fname, name);
+
+    return (1);
+}
+
+int gday_sim_set_state(gday_sim *sim, const char *name, double value) {
+    /*
+        Change a pool by name before the next day is run, e.g. take off the
+        shoot C that was grazed, along with its N (shootn), the model
+        keeping the two apart. Anything in [state] of the .ini can be
+        changed. The totals worked out from the pools (soilc, plantc, ...)
+        can't, as they are worked out again at the end of the next day,
+        change the pools they are made of instead. Returns 0, or 1 if
+        there's no such pool.
+    */
+    const ini_key *k;
+    int            i;
+
+    if ((k = find_ini_key("state", name)) != NULL && k->type == INI_DOUBLE) {
+        *(double *)ini_field(&(sim->c), &(sim->p), &(sim->s), k) = value;
+        return (0);
+    }
+    if ((i = find_output_var(name)) >= 0 &&
+        output_vars[i].where == OUT_STATE) {
+        fprintf(stderr, "%s: %s is worked out from the pools each day, "
+                "change those instead\n", sim->c.cfg_fname, name);
+        return (1);
+    }
+    fprintf(stderr, "%s: no pool called %s that can be set\n",
+            sim->c.cfg_fname, name);
+
+    return (1);
+}
+
+int gday_sim_fork(gday_sim *branch, gday_sim *trunk) {
+    /*
+        Start branch off from wherever trunk has been run to. branch has to
+        have been loaded against the same met data, the keys in its own
+        .ini's [control] and [params] sections (e.g. a different harvest
+        date) take effect from the fork on, everything else is carried over
+        from trunk. trunk is only read, so several branches can be forked
+        from it at once. Returns 0 on success.
+    */
+    canopy_wk   *cw = &(branch->cw);
+    control     *c = &(branch->c);
+    fluxes      *f = &(branch->f);
+    fast_spinup *fs = &(branch->fs);
+    met_arrays  *ma = &(branch->ma);
+    met         *m = &(branch->m);
+    params      *p = &(branch->p);
+    state       *s = &(branch->s);
+    nrutil      *nr = &(branch->nr);
+    jmp_buf      env, *prev;
+    int          error;
+
+    if ((error = check_runnable(branch)) != 0)
+        return (error);
+
+    prev = set_exit_handler(&env);
+    if ((error = setjmp(env)) != 0) {
+        set_exit_handler(prev);
+        stop_running(branch);
+        branch->loaded = FALSE;
+        close_output_files(&(branch->c));
+        return (error);
+    }
+
+    if (! trunk->running || branch->running || c->spin_up) {
+        fprintf(stderr, "%s: can only fork a new run from one that has been "
+                "stopped part way\n", c->cfg_fname);
+        gday_exit(EXIT_FAILURE);
+    }
+
+    /* opens the branch's own output files, the rest is overwritten */
+    start_run(cw, c, f, fs, ma, m, p, s, nr, &(branch->rc));
+    branch->running = TRUE;
+    fork_state(branch, trunk);
+
+    set_exit_handler(prev);
+
+    return (0);
+}
+
+void gday_sim_destroy(gday_sim *sim) {
+
+    canopy_wk  *cw;
+    control    *c;
+    fluxes     *f;
+    met_arrays *ma;
+    params     *p;
+    state      *s;
+    nrutil     *nr;
+
+    if (sim == NULL)
+        return;
+
+    cw = &(sim->cw);
+    c = &(sim->c);
+    f = &(sim->f);
+    ma = &(sim->ma);
+    p = &(sim->p);
+    s = &(sim->s);
+    nr = &(sim->nr);
+
+    stop_running(sim);
+    close_output_files(c);
+    if (c->ifp != NULL) {
+        fclose(c->ifp);
+        c->ifp = NULL;
+    }
+
+    if (! sim->met_shared) {
+        free_met_arrays(ma);
+        free(cw->cz_store);
+        free(cw->ele_store);
+        free(cw->df_store);
+    }
+    met_store_release(&(sim->met_ref));
+
+    /* Clean up hydraulics */
+    free(f->soil_conduct);
+    free(f->swp);
+    free(f->soilR);
+    free(f->fraction_uptake);
+    free(f->ppt_gain);
+    free(f->water_loss);
+    free(f->water_gain);
+    free(f->est_evap);
+    free(s->water_frac);
+    free(s->wetting_bot);
+    free(s->wetting_top);
+    free(p->potA);
+    free(p->potB);
+    free(p->cond1);
+    free(p->cond2);
+    free(p->cond3);
+    free(p->porosity);
+    free(p->field_capacity);
+    free(s->thickness);
+    free(s->root_mass);
+    free(s->root_length);
+    free(s->layer_depth);
+
+    /* NR vectors are offset, so they can't go straight to free(NULL) */
+    if (nr->y != NULL) {
+        free_dvector(nr->y, 1, nr->N);
+        free_dvector(nr->ystart, 1, nr->N);
+        free_dvector(nr->dydx, 1, nr->N);
+        free_dvector(nr->yscal, 1, nr->N);
+        free_dvector(nr->xp, 1, nr->kmax);
+        free_dmatrix(nr->yp, 1, nr->N, 1, nr->kmax);
+        free_dvector(nr->ytemp, 1, nr->N);
+        free_dvector(nr->ak6, 1, nr->N);
+        free_dvector(nr->ak5, 1, nr->N);
+        free_dvector(nr->ak4, 1, nr->N);
+        free_dvector(nr->ak3, 1, nr->N);
+        free_dvector(nr->ak2, 1, nr->N);
+        free_dvector(nr->yerr, 1, nr->N);
+    }
+
+    free(s->day_length);
+    free(sim);
+
+    return;
+}
+
+static void setup_sim(gday_sim *sim, const char *cfg_fname,
+                      const char *member_fname, int nvalues,
+                      const char **names, const char **values,
+                      const char *met_fname, const gday_forcing *fc,
+                      const char *out_fname, int flags) {
+    /*
+        Setup structures, initialise stuff, e.g. zero fluxes, then read the
+        .ini parameter file(s), and any values given in place of keys in
+        them, and meterological data, unless we've been handed forcing that
+        has already been read.
+    */
+    canopy_wk   *cw = &(sim->cw);
+    control     *c = &(sim->c);
+    fluxes      *f = &(sim->f);
+    met_arrays  *ma = &(sim->ma);
+    params      *p = &(sim->p);
+    state       *s = &(sim->s);
+    nrutil      *nr = &(sim->nr);
+    kept_arrays  kept;
+    int          error = 0;
+
+    /* anything left open by a previous site on this handle */
+    stop_running(sim);
+    sim->loaded = FALSE;
+    sim->finished = FALSE;
+    close_output_files(c);
+    if (c->ifp != NULL) {
+        fclose(c->ifp);
+        c->ifp = NULL;
+    }
+
+    /* the last site borrowed its forcing, don't let anything free it */
+    if (sim->met_shared) {
+        met_store_release(&(sim->met_ref));
+        memset(ma, 0, sizeof(met_arrays));
+        cw->cz_store = NULL;
+        cw->ele_store = NULL;
+        cw->df_store = NULL;
+        cw->solar_capacity = 0;
+        sim->met_shared = FALSE;
+    }
+
+    /*
+     * Parts of the model rely on fields the initialise_* functions don't
+     * touch starting out as zero, so a reused handle has to look exactly
+     * like a freshly calloc'd one.
+     */
+    keep_arrays(sim, &kept);
+    memset(cw, 0, sizeof(canopy_wk));
+    memset(c, 0, sizeof(control));
+    memset(f, 0, sizeof(fluxes));
+    memset(&(sim->fs), 0, sizeof(fast_spinup));
+    memset(&(sim->m), 0, sizeof(met));
+    memset(p, 0, sizeof(params));
+    memset(s, 0, sizeof(state));
+    memset(nr, 0, sizeof(nrutil));
+    initialise_control(c);
+    initialise_params(p);
+    initialise_fluxes(f);
+    initialise_state(s);
+    initialise_nrutil(nr);
+    restore_arrays(sim, &kept);
+
+    // potentially allocating 1 extra spot, but will be fine as we always
+    // index by num_days
+    if (s->day_length == NULL &&
+        (s->day_length = (double *)calloc(366, sizeof(double))) == NULL) {
+        fprintf(stderr,"Error allocating space for day_length\n");
+        gday_exit(EXIT_FAILURE);
+    }
+
+    strncpy0(c->cfg_fname, cfg_fname != NULL ? (char *)cfg_fname : "",
+             sizeof(c->cfg_fname));
+    c->spin_up = (flags & GDAY_SIM_SPIN_UP) ? TRUE : FALSE;
+    c->quiet = (flags & GDAY_SIM_QUIET) ? TRUE : FALSE;
+
+    /* -ve error means the file couldn't be opened, already reported */
+    if (cfg_fname != NULL)
+        error = parse_ini_file(c, p, s);
+    if (error > 0) {
+        fprintf(stderr, "Error reading .INI file %s on line %d\n",
+                cfg_fname, error);
+        gday_exit(EXIT_FAILURE);
+    } else if (error != 0) {
+        gday_exit(EXIT_FAILURE);
+    }
+
+    if (member_fname != NULL) {
+        strncpy0(c->cfg_fname, (char *)member_fname, sizeof(c->cfg_fname));
+        error = parse_ini_file(c, p, s);
+        if (error > 0) {
+            fprintf(stderr, "Error reading .INI file %s on line %d\n",
+                    member_fname, error);
+            gday_exit(EXIT_FAILURE);
+        } else if (error != 0) {
+            gday_exit(EXIT_FAILURE);
+        }
+    }
+    apply_values(c, p, s, nvalues, names, values);
+
+    if (met_fname != NULL) {
+        strncpy0(c->met_fname, (char *)met_fname, sizeof(c->met_fname));
+    }
+    if (out_fname != NULL) {
+        /* whichever file this run actually writes to */
+        if (c->spin_up || c->print_options == END) {
+            strncpy0(c->out_param_fname, (char *)out_fname,
+                     sizeof(c->out_param_fname));
+        } else {
+            strncpy0(c->out_fname, (char *)out_fname, sizeof(c->out_fname));
+        }
+    }
+
+    /* House keeping! */
+    if (c->water_balance == HYDRAULICS && c->sub_daily == FALSE) {
+        fprintf(stderr, "You can't run the hydraulics model with daily flag\n");
+        gday_exit(EXIT_FAILURE);
+    }
+
+    if (c->water_balance == HYDRAULICS) {
+        allocate_numerical_libs_stuff(nr);
+        initialise_roots(f, p, s);
+        setup_hydraulics_arrays(f, p, s);
+
+        // i.e. not dead
+        cw->death_year = -999.9;
+        cw->death_doy = -999.9;
+        cw->not_dead = TRUE;
+    }
+
+    if (fc != NULL) {
+        attach_forcing(sim, fc);
+        return;
+    } else if (flags & LOAD_COLUMNS) {
+        /* see use_columns */
+        return;
+    }
+
+    /* daily and sub-daily use different sets of arrays, start again */
+    if (c->sub_daily != sim->met_sub_daily) {
+        free_met_arrays(ma);
+        sim->met_sub_daily = c->sub_daily;
+    }
+
+    if (c->stream_met) {
+        /* only a window on the file is kept, see met_window.c */
+        free_own_forcing(sim);
+        open_met_window(cw, c, ma, p);
+    } else if (met_store_active()) {
+        /* read once for every handle on the same file, see met_store.c */
+        free_own_forcing(sim);
+        met_store_acquire(cw, c, ma, p, &(sim->met_ref));
+        sim->met_shared = TRUE;
+    } else if (c->sub_daily) {
+        read_subdaily_met_data(c, ma);
+        fill_up_solar_arrays(cw, c, ma, p);
+    } else {
+        read_daily_met_data(c, ma);
+    }
+
+    return;
+}
+
+static void apply_values(control *c, params *p, state *s, int nvalues,
+                         const char **names, const char **values) {
+    /* set each of the named keys as if its line had been in the .ini */
+    const ini_key *k;
+    char           value[STRING_LENGTH];
+    int            i;
+
+    for (i = 0; i < nvalues; i++) {
+        if (values[i] == NULL || *values[i] == '\0')
+            continue;
+        if ((k = find_ini_name(names[i])) == NULL) {
+            fprintf(stderr, "%s: unknown parameter %s\n", c->cfg_fname,
+                    names[i]);
+            gday_exit(EXIT_FAILURE);
+        }
+        /* the setters are allowed to write into the value */
+        strncpy0(value, (char *)values[i], sizeof(value));
+        set_ini_value(c, p, s, k, value);
+    }
+
+    return;
+}
+
+static int use_columns(gday_sim *sim, long nrows,
+                       const double *const *columns) {
+    /*
+        Point the met arrays at the caller's columns and, if sub-daily,
+        work out the solar geometry from them, as reading the met file
+        would have. Returns 0 on success.
+    */
+    canopy_wk   *cw = &(sim->cw);
+    control     *c = &(sim->c);
+    met_arrays  *ma = &(sim->ma);
+    params      *p = &(sim->p);
+    double     **arrays[MAX_MET_VARS];
+    char        *names[MAX_MET_VARS];
+    double       current_yr;
+    jmp_buf      env, *prev;
+    long         i;
+    int          k, ncols, error;
+
+    prev = set_exit_handler(&env);
+    if ((error = setjmp(env)) != 0) {
+        set_exit_handler(prev);
+        return (error);
+    }
+
+    if (nrows <= 0) {
+        fprintf(stderr, "%s: no met data\n", c->cfg_fname);
+        gday_exit(EXIT_FAILURE);
+    }
+
+    /* the columns the reader wouldn't keep aren't needed either */
+    ncols = met_columns(ma, c->sub_daily, arrays, names);
+    for (k = 0; k < ncols; k++) {
+        if (arrays[k] == NULL)
+            continue;
+        if (columns[k] == NULL) {
+            fprintf(stderr, "%s: no %s met column\n", c->cfg_fname,
+                    names[k]);
+            gday_exit(EXIT_FAILURE);
+        }
+        *(arrays[k]) = (double *)columns[k];
+    }
+
+    c->num_years = 0;
+    current_yr = -999.9;
+    for (i = 0; i < nrows; i++) {
+        if (current_yr != ma->year[i]) {
+            c->num_years++;
+            current_yr = ma->year[i];
+        }
+    }
+    if (c->sub_daily) {
+        /* output is daily, so correct for n_timesteps */
+        c->total_num_days = nrows / 48;
+        fill_up_solar_arrays(cw, c, ma, p);
+    } else {
+        c->total_num_days = nrows;
+    }
+
+    set_exit_handler(prev);
+
+    return (0);
+}
+
+static void take_forcing(gday_sim *sim, gday_forcing *fc) {
+    /* the loader's met and solar arrays, before it is thrown away */
+    fc->c = sim->c;
+    fc->c.ifp = NULL;
+    fc->ma = sim->ma;
+    fc->cz_store = sim->cw.cz_store;
+    fc->ele_store = sim->cw.ele_store;
+    fc->df_store = sim->cw.df_store;
+    fc->latitude = sim->p.latitude;
+    fc->longitude = sim->p.longitude;
+
+    memset(&(sim->ma), 0, sizeof(met_arrays));
+    sim->cw.cz_store = NULL;
+    sim->cw.ele_store = NULL;
+    sim->cw.df_store = NULL;
+
+    return;
+}
+
+static void offset_met(met_arrays *ma, long row0) {
+    /* move every met array that's there on to row0 */
+    double **arrays[] = {
+        &(ma->year), &(ma->rain), &(ma->par), &(ma->tair), &(ma->tsoil),
+        &(ma->co2), &(ma->ndep), &(ma->nfix), &(ma->wind), &(ma->press),
+        &(ma->prjday), &(ma->tam), &(ma->tpm), &(ma->tmin), &(ma->tmax),
+        &(ma->tday), &(ma->vpd_am), &(ma->vpd_pm), &(ma->wind_am),
+        &(ma->wind_pm), &(ma->par_am), &(ma->par_pm), &(ma->vpd),
+        &(ma->doy), &(ma->diffuse_frac)
+    };
+    int k;
+
+    for (k = 0; k < (int)ARRAY_SIZE(arrays); k++) {
+        if (*(arrays[k]) != NULL)
+            *(arrays[k]) += row0;
+    }
+    ma->capacity = 0;
+
+    return;
+}
+
+static void attach_forcing(gday_sim *sim, const gday_forcing *fc) {
+    /*
+        Point the handle at shared forcing instead of reading its own. The
+        member's .ini mustn't have changed anything the forcing depends on.
+    */
+    canopy_wk  *cw = &(sim->cw);
+    control    *c = &(sim->c);
+    params     *p = &(sim->p);
+
+    if (strcmp(c->met_fname, fc->c.met_fname) != 0 ||
+        c->sub_daily != fc->c.sub_daily) {
+        fprintf(stderr, "%s: met_fname and sub_daily must match the shared "
+                "forcing (%s)\n", c->cfg_fname, fc->c.met_fname);
+        gday_exit(EXIT_FAILURE);
+    }
+
+    /* members' outputs get stitched together, so they have to agree */
+    if (c->print_options != fc->c.print_options ||
+        c->output_ascii != fc->c.output_ascii) {
+        fprintf(stderr, "%s: print_options and output_ascii must match the "
+                "base .ini\n", c->cfg_fname);
+        gday_exit(EXIT_FAILURE);
+    }
+
+    /* the solar geometry was worked out for one place */
+    if (c->sub_daily &&
+        (p->latitude != fc->latitude || p->longitude != fc->longitude)) {
+        fprintf(stderr, "%s: latitude and longitude must match the shared "
+                "forcing\n", c->cfg_fname);
+        gday_exit(EXIT_FAILURE);
+    }
+
+    if (! sim->met_shared)
+        free_own_forcing(sim);
+
+    sim->ma = fc->ma;
+    cw->cz_store = fc->cz_store;
+    cw->ele_store = fc->ele_store;
+    cw->df_store = fc->df_store;
+    c->num_years = fc->c.num_years;
+    c->total_num_days = fc->c.total_num_days;
+    sim->met_shared = TRUE;
+
+    return;
+}
+
+static void free_own_forcing(gday_sim *sim) {
+    /* the handle's own met and solar arrays, before it borrows some */
+    canopy_wk *cw = &(sim->cw);
+
+    free_met_arrays(&(sim->ma));
+    free(cw->cz_store);
+    free(cw->ele_store);
+    free(cw->df_store);
+    cw->cz_store = NULL;
+    cw->ele_store = NULL;
+    cw->df_store = NULL;
+    cw->solar_capacity = 0;
+    sim->met_sub_daily = 0;
+
+    return;
+}
+
+static int check_runnable(gday_sim *sim) {
+    /* returns 0 if the handle has a run to do, see NOTES */
+    if (! sim->loaded) {
+        fprintf(stderr, "%s: the handle hasn't been loaded, or its run "
+                "failed, load it again\n", sim->c.cfg_fname);
+        return (EXIT_FAILURE);
+    }
+    if (sim->finished) {
+        fprintf(stderr, "%s: the run has finished, load the handle again to "
+                "run it again\n", sim->c.cfg_fname);
+        return (EXIT_FAILURE);
+    }
+
+    return (0);
+}
+
+static void start_running(gday_sim *sim) {
+    /* everything before the first day of the run, unless it's been done */
+    canopy_wk   *cw = &(sim->cw);
+    control     *c = &(sim->c);
+    fluxes      *f = &(sim->f);
+    fast_spinup *fs = &(sim->fs);
+    met_arrays  *ma = &(sim->ma);
+    met         *m = &(sim->m);
+    params      *p = &(sim->p);
+    state       *s = &(sim->s);
+    nrutil      *nr = &(sim->nr);
+
+    if (sim->running)
+        return;
+    if (c->spin_up) {
+        fprintf(stderr, "A spin-up can't be stopped part way\n");
+        gday_exit(EXIT_FAILURE);
+    }
+    start_run(cw, c, f, fs, ma, m, p, s, nr, &(sim->rc));
+    sim->running = TRUE;
+
+    return;
+}
+
+static void stop_running(gday_sim *sim) {
+    /* abandon a run that was stopped part way and never finished */
+    if (sim->running) {
+        if (sim->rc.hw != NULL)
+            sma(SMA_FREE, sim->rc.hw);
+        free(sim->rc.disturbance_yrs);
+        memset(&(sim->rc), 0, sizeof(run_clock));
+        sim->running = FALSE;
+    }
+
+    return;
+}
+
+static void fork_state(gday_sim *branch, gday_sim *trunk) {
+    /*
+        Copy trunk's run into branch, which has just been started. The met
+        arrays and solar geometry are never written to, so branch keeps its
+        own (or the shared) copies rather than taking trunk's, everything
+        else is small enough to simply be copied.
+    */
+    control        c_start = branch->c, c_now;
+    params         p_start = branch->p;
+    kept_arrays    kept;
+    int            core = branch->p.core, wetting = branch->p.wetting;
+    int            period;
+    unsigned char  cmask[sizeof(control)], pmask[sizeof(params)];
+
+    if (branch->c.total_num_days != trunk->c.total_num_days ||
+        branch->c.sub_daily != trunk->c.sub_daily ||
+        branch->c.water_balance != trunk->c.water_balance ||
+        (branch->c.water_balance == HYDRAULICS &&
+         (core != trunk->p.core || wetting != trunk->p.wetting))) {
+        fprintf(stderr, "%s: a fork must use the same met data and model "
+                "set up as the run it is forked from\n", branch->c.cfg_fname);
+        gday_exit(EXIT_FAILURE);
+    }
+
+    /* which control/params fields the branch's own .ini sets */
+    override_mask(&c_start, cmask, pmask);
+
+    keep_arrays(branch, &kept);
+    branch->cw = trunk->cw;
+    branch->c = trunk->c;
+    branch->f = trunk->f;
+    branch->fs = trunk->fs;
+    branch->m = trunk->m;
+    branch->p = trunk->p;
+    branch->s = trunk->s;
+    branch->nr = trunk->nr;
+    restore_arrays(branch, &kept);
+
+    /*
+     * Overrides take the values a fresh run of the branch started with, so
+     * the per-day rate constants come out exactly as correct_rate_constants
+     * left them.
+     */
+    merge_masked(&(branch->c), &c_start, cmask, sizeof(control));
+    merge_masked(&(branch->p), &p_start, pmask, sizeof(params));
+    c_now = c_start;
+    keep_run_settings(&(branch->c), &c_now);
+
+    memcpy(branch->s.day_length, trunk->s.day_length, 366 * sizeof(double));
+    if (branch->c.water_balance == HYDRAULICS) {
+        memcpy(branch->p.potA, trunk->p.potA, core * sizeof(double));
+        memcpy(branch->p.potB, trunk->p.potB, core * sizeof(double));
+        memcpy(branch->p.cond1, trunk->p.cond1, core * sizeof(double));
+        memcpy(branch->p.cond2, trunk->p.cond2, core * sizeof(double));
+        memcpy(branch->p.cond3, trunk->p.cond3, core * sizeof(double));
+        memcpy(branch->p.porosity, trunk->p.porosity, core * sizeof(double));
+        memcpy(branch->p.field_capacity, trunk->p.field_capacity,
+               core * sizeof(double));
+        memcpy(branch->f.soil_conduct, trunk->f.soil_conduct,
+               core * sizeof(double));
+        memcpy(branch->f.swp, trunk->f.swp, core * sizeof(double));
+        memcpy(branch->f.soilR, trunk->f.soilR, core * sizeof(double));
+        memcpy(branch->f.fraction_uptake, trunk->f.fraction_uptake,
+               core * sizeof(double));
+        memcpy(branch->f.ppt_gain, trunk->f.ppt_gain, core * sizeof(double));
+        memcpy(branch->f.water_loss, trunk->f.water_loss,
+               core * sizeof(double));
+        memcpy(branch->f.water_gain, trunk->f.water_gain,
+               core * sizeof(double));
+        memcpy(branch->f.est_evap, trunk->f.est_evap, core * sizeof(double));
+        memcpy(branch->s.water_frac, trunk->s.water_frac,
+               core * sizeof(double));
+        memcpy(branch->s.wetting_bot, trunk->s.wetting_bot,
+               wetting * sizeof(double));
+        memcpy(branch->s.wetting_top, trunk->s.wetting_top,
+               wetting * sizeof(double));
+        memcpy(branch->s.thickness, trunk->s.thickness, core * sizeof(double));
+        memcpy(branch->s.root_mass, trunk->s.root_mass, core * sizeof(double));
+        memcpy(branch->s.root_length, trunk->s.root_length,
+               core * sizeof(double));
+        memcpy(branch->s.layer_depth, trunk->s.layer_depth,
+               core * sizeof(double));
+    }
+    if (branch->nr.y != NULL && trunk->nr.y != NULL) {
+        memcpy(branch->nr.ystart + 1, trunk->nr.ystart + 1,
+               branch->nr.N * sizeof(double));
+        memcpy(branch->nr.yscal + 1, trunk->nr.yscal + 1,
+               branch->nr.N * sizeof(double));
+        memcpy(branch->nr.y + 1, trunk->nr.y + 1,
+               branch->nr.N * sizeof(double));
+        memcpy(branch->nr.dydx + 1, trunk->nr.dydx + 1,
+               branch->nr.N * sizeof(double));
+        memcpy(branch->nr.xp + 1, trunk->nr.xp + 1,
+               branch->nr.kmax * sizeof(double));
+        memcpy(branch->nr.yp[1] + 1, trunk->nr.yp[1] + 1,
+               branch->nr.N * branch->nr.kmax * sizeof(double));
+        memcpy(branch->nr.ak2 + 1, trunk->nr.ak2 + 1,
+               branch->nr.N * sizeof(double));
+        memcpy(branch->nr.ak3 + 1, trunk->nr.ak3 + 1,
+               branch->nr.N * sizeof(double));
+        memcpy(branch->nr.ak4 + 1, trunk->nr.ak4 + 1,
+               branch->nr.N * sizeof(double));
+        memcpy(branch->nr.ak5 + 1, trunk->nr.ak5 + 1,
+               branch->nr.N * sizeof(double));
+        memcpy(branch->nr.ak6 + 1, trunk->nr.ak6 + 1,
+               branch->nr.N * sizeof(double));
+        memcpy(branch->nr.ytemp + 1, trunk->nr.ytemp + 1,
+               branch->nr.N * sizeof(double));
+        memcpy(branch->nr.yerr + 1, trunk->nr.yerr + 1,
+               branch->nr.N * sizeof(double));
+    }
+
+    /* the clock, with its own copy of the running mean */
+    if (branch->rc.hw != NULL)
+        sma(SMA_FREE, branch->rc.hw);
+    free(branch->rc.disturbance_yrs);
+    branch->rc = trunk->rc;
+    branch->rc.hw = NULL;
+    branch->rc.disturbance_yrs = NULL;
+
+    if (trunk->rc.hw != NULL) {
+        period = trunk->rc.hw->period;
+        branch->rc.hw = sma(SMA_NEW, period).handle;
+        branch->rc.hw->sma = trunk->rc.hw->sma;
+        branch->rc.hw->sum = trunk->rc.hw->sum;
+        branch->rc.hw->lv = trunk->rc.hw->lv;
+        memcpy(branch->rc.hw->values, trunk->rc.hw->values,
+               period * sizeof(double));
+    }
+    if (trunk->rc.disturbance_yrs != NULL) {
+        branch->rc.disturbance_yrs = (int *)calloc(
+                        MAX(trunk->rc.num_disturbance_yrs, 1), sizeof(int));
+        if (branch->rc.disturbance_yrs == NULL) {
+            fprintf(stderr,"Error allocating space for disturbance_yrs\n");
+            gday_exit(EXIT_FAILURE);
+        }
+        memcpy(branch->rc.disturbance_yrs, trunk->rc.disturbance_yrs,
+               trunk->rc.num_disturbance_yrs * sizeof(int));
+    }
+
+    return;
+}
+
+static void override_mask(control *c, unsigned char *cmask,
+                          unsigned char *pmask) {
+    /*
+        Find the bytes of control and params the branch's .ini writes to by
+        reading it into two scratch copies that start out differently, the
+        bytes that come out the same are the ones it set. [state] is left
+        out, the state always comes from the run being forked.
+    */
+    control *ca, *cb;
+    params  *pa, *pb;
+    state   *sa, *sb;
+    size_t   i;
+    int      error;
+
+    ca = (control *)malloc(2 * sizeof(control));
+    pa = (params *)malloc(2 * sizeof(params));
+    sa = (state *)malloc(2 * sizeof(state));
+    if (ca == NULL || pa == NULL || sa == NULL) {
+        fprintf(stderr, "fork: Not allocated enough memory!\n");
+        free(ca);
+        free(pa);
+        free(sa);
+        gday_exit(EXIT_FAILURE);
+    }
+    cb = ca + 1;
+    pb = pa + 1;
+    sb = sa + 1;
+
+    memset(ca, 0x00, sizeof(control));
+    memset(cb, 0xff, sizeof(control));
+    memset(pa, 0x00, sizeof(params));
+    memset(pb, 0xff, sizeof(params));
+    strcpy(ca->cfg_fname, c->cfg_fname);
+    strcpy(cb->cfg_fname, c->cfg_fname);
+
+    error = parse_ini_file(ca, pa, sa);
+    if (error == 0)
+        error = parse_ini_file(cb, pb, sb);
+
+    if (error == 0) {
+        for (i = 0; i < sizeof(control); i++)
+            cmask[i] = (((unsigned char *)ca)[i] == ((unsigned char *)cb)[i]);
+        for (i = 0; i < sizeof(params); i++)
+            pmask[i] = (((unsigned char *)pa)[i] == ((unsigned char *)pb)[i]);
+    }
+    free(ca);
+    free(pa);
+    free(sa);
+
+    if (error != 0) {
+        fprintf(stderr, "Error re-reading .INI file %s\n", c->cfg_fname);
+        gday_exit(EXIT_FAILURE);
+    }
+
+    return;
+}
+
+static void merge_masked(void *dst, const void *src,
+                         const unsigned char *mask, size_t size) {
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        if (mask[i])
+            ((unsigned char *)dst)[i] = ((const unsigned char *)src)[i];
+    }
+
+    return;
+}
+
+static void keep_arrays(gday_sim *sim, kept_arrays *k) {
+    /* stash the heap arrays before the initialise_* functions NULL them */
+    k->day_length = sim->s.day_length;
+    k->potA = sim->p.potA;
+    k->potB = sim->p.potB;
+    k->cond1 = sim->p.cond1;
+    k->cond2 = sim->p.cond2;
+    k->cond3 = sim->p.cond3;
+    k->porosity = sim->p.porosity;
+    k->field_capacity = sim->p.field_capacity;
+    k->soil_conduct = sim->f.soil_conduct;
+    k->swp = sim->f.swp;
+    k->soilR = sim->f.soilR;
+    k->fraction_uptake = sim->f.fraction_uptake;
+    k->ppt_gain = sim->f.ppt_gain;
+    k->water_loss = sim->f.water_loss;
+    k->water_gain = sim->f.water_gain;
+    k->est_evap = sim->f.est_evap;
+    k->water_frac = sim->s.water_frac;
+    k->wetting_bot = sim->s.wetting_bot;
+    k->wetting_top = sim->s.wetting_top;
+    k->thickness = sim->s.thickness;
+    k->root_mass = sim->s.root_mass;
+    k->root_length = sim->s.root_length;
+    k->layer_depth = sim->s.layer_depth;
+    k->nr = sim->nr;
+    k->cz_store = sim->cw.cz_store;
+    k->ele_store = sim->cw.ele_store;
+    k->df_store = sim->cw.df_store;
+    k->solar_capacity = sim->cw.solar_capacity;
+
+    return;
+}
+
+static void restore_arrays(gday_sim *sim, kept_arrays *k) {
+
+    sim->s.day_length = k->day_length;
+    sim->p.potA = k->potA;
+    sim->p.potB = k->potB;
+    sim->p.cond1 = k->cond1;
+    sim->p.cond2 = k->cond2;
+    sim->p.cond3 = k->cond3;
+    sim->p.porosity = k->porosity;
+    sim->p.field_capacity = k->field_capacity;
+    sim->f.soil_conduct = k->soil_conduct;
+    sim->f.swp = k->swp;
+    sim->f.soilR = k->soilR;
+    sim->f.fraction_uptake = k->fraction_uptake;
+    sim->f.ppt_gain = k->ppt_gain;
+    sim->f.water_loss = k->water_loss;
+    sim->f.water_gain = k->water_gain;
+    sim->f.est_evap = k->est_evap;
+    sim->s.water_frac = k->water_frac;
+    sim->s.wetting_bot = k->wetting_bot;
+    sim->s.wetting_top = k->wetting_top;
+    sim->s.thickness = k->thickness;
+    sim->s.root_mass = k->root_mass;
+    sim->s.root_length = k->root_length;
+    sim->s.layer_depth = k->layer_depth;
+    /* only once it has been allocated, otherwise keep N/kmax from initialise */
+    if (k->nr.y != NULL)
+        sim->nr = k->nr;
+    sim->cw.cz_store = k->cz_store;
+    sim->cw.ele_store = k->ele_store;
+    sim->cw.df_store = k->df_store;
+    sim->cw.solar_capacity = k->solar_capacity;
+
+    return;
+}
+
+static int close_output_files(control *c) {
+    /*
+        Returns 0, or EXIT_FAILURE if some of the output couldn't be written,
+        which fails a run that had otherwise finished.
+    */
+    int error = 0;
+
+    /* everything handed to the writer thread goes out first */
+    finish_aggregated_outputs(c);
+    finish_arrow_output(c);
+    if (c->writer != NULL) {
+        if (close_output_writer(c->writer) != 0)
+            error = EXIT_FAILURE;
+        c->writer = NULL;
+    }
+    finish_binary_outputs(c);
+    if (c->ofp != NULL) {
+        if (ferror(c->ofp))
+            error = EXIT_FAILURE;
+        if (fclose(c->ofp) != 0)
+            error = EXIT_FAILURE;
+        c->ofp = NULL;
+    }
+    if (c->ofp_sd != NULL) {
+        if (ferror(c->ofp_sd))
+            error = EXIT_FAILURE;
+        if (fclose(c->ofp_sd) != 0)
+            error = EXIT_FAILURE;
+        c->ofp_sd = NULL;
+    }
+
+    if (error)
+        fprintf(stderr, "%s: error writing output file %s\n", c->cfg_fname,
+                c->out_fname);
+
+    return (error);
+}
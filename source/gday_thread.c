@@ -0,0 +1,184 @@
+/* ============================================================================
+* Threading shim, see gday_thread.h
+*
+* NOTES:
+*   Both thread APIs want a differently typed entry point, so the caller's
+*   function and argument are carried through in a small heap trampoline.
+*
+* =========================================================================== */
+#include <stdio.h>
+#include <stdlib.h>
+#include "gday_thread.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <time.h>
+#endif
+
+typedef struct {
+    void (*func)(void *);
+    void  *arg;
+} trampoline;
+
+#ifdef _WIN32
+static BOOL CALLBACK once_entry(PINIT_ONCE once, PVOID func, PVOID *unused) {
+    ((void (*)(void))func)();
+
+    return (TRUE);
+}
+#endif
+
+#ifdef _WIN32
+static DWORD WINAPI thread_entry(LPVOID tp)
+#else
+static void *thread_entry(void *tp)
+#endif
+{
+    trampoline t = *(trampoline *)tp;
+
+    free(tp);
+    t.func(t.arg);
+
+    return (0);
+}
+
+int thread_start(gday_thread *th, void (*func)(void *), void *arg) {
+    /* returns 0 on success */
+    trampoline *tp;
+
+    if ((tp = (trampoline *)malloc(sizeof(trampoline))) == NULL) {
+        fprintf(stderr, "thread trampoline: Not allocated enough memory!\n");
+        return (1);
+    }
+    tp->func = func;
+    tp->arg = arg;
+
+#ifdef _WIN32
+    *th = CreateThread(NULL, 0, thread_entry, tp, 0, NULL);
+    if (*th == NULL) {
+        free(tp);
+        return (1);
+    }
+#else
+    if (pthread_create(th, NULL, thread_entry, tp) != 0) {
+        free(tp);
+        return (1);
+    }
+#endif
+    return (0);
+}
+
+void thread_join(gday_thread th) {
+#ifdef _WIN32
+    WaitForSingleObject(th, INFINITE);
+    CloseHandle(th);
+#else
+    pthread_join(th, NULL);
+#endif
+}
+
+void mutex_init(gday_mutex *mtx) {
+#ifdef _WIN32
+    InitializeCriticalSection(mtx);
+#else
+    pthread_mutex_init(mtx, NULL);
+#endif
+}
+
+void mutex_lock(gday_mutex *mtx) {
+#ifdef _WIN32
+    EnterCriticalSection(mtx);
+#else
+    pthread_mutex_lock(mtx);
+#endif
+}
+
+void mutex_unlock(gday_mutex *mtx) {
+#ifdef _WIN32
+    LeaveCriticalSection(mtx);
+#else
+    pthread_mutex_unlock(mtx);
+#endif
+}
+
+void mutex_free(gday_mutex *mtx) {
+#ifdef _WIN32
+    DeleteCriticalSection(mtx);
+#else
+    pthread_mutex_destroy(mtx);
+#endif
+}
+
+void cond_init(gday_cond *cv) {
+#ifdef _WIN32
+    InitializeConditionVariable(cv);
+#else
+    pthread_cond_init(cv, NULL);
+#endif
+}
+
+void cond_wait(gday_cond *cv, gday_mutex *mtx) {
+    /* mtx is let go while waiting and held again on waking, which may be
+       spurious, so wait in a loop on whatever is being waited for */
+#ifdef _WIN32
+    SleepConditionVariableCS(cv, mtx, INFINITE);
+#else
+    pthread_cond_wait(cv, mtx);
+#endif
+}
+
+void cond_signal(gday_cond *cv) {
+#ifdef _WIN32
+    WakeConditionVariable(cv);
+#else
+    pthread_cond_signal(cv);
+#endif
+}
+
+void cond_free(gday_cond *cv) {
+#ifdef _WIN32
+    (void)cv;
+#else
+    pthread_cond_destroy(cv);
+#endif
+}
+
+int number_of_cpus(void) {
+    long n;
+#ifdef _WIN32
+    SYSTEM_INFO si;
+
+    GetSystemInfo(&si);
+    n = (long)si.dwNumberOfProcessors;
+#else
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return (n < 1 ? 1 : (int)n);
+}
+
+double wall_clock(void) {
+    /* seconds from an arbitrary, monotonic starting point */
+#ifdef _WIN32
+    LARGE_INTEGER count, freq;
+
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+
+    return ((double)count.QuadPart / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((double)ts.tv_sec + (double)ts.tv_nsec * 1E-9);
+#endif
+}
+
+void thread_once(gday_once *once, void (*func)(void)) {
+    /* call func the first time, anyone else waiting until it has run */
+#ifdef _WIN32
+    InitOnceExecuteOnce(once, once_entry, (PVOID)func, NULL);
+#else
+    pthread_once(once, func);
+#endif
+}
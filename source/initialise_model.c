@@ -8,16 +8,20 @@ void initialise_control(control *c) {
 
     /* Values set via param file */
     strcpy(c->git_hash, "Err");
+    strcpy(c->git_code_ver, "Err");
 
     c->ifp = NULL;
     c->ofp = NULL;
-    c->ofp_hdr = NULL;
+    c->ofp_sd = NULL;
     strcpy(c->cfg_fname, "*NOT SET*");
     strcpy(c->met_fname, "*NOT SET*");
     strcpy(c->out_fname, "*NOT SET*");
     strcpy(c->out_subdaily_fname, "*NOT SET*");
     strcpy(c->out_fname_hdr, "*NOT SET*");
     strcpy(c->out_param_fname, "*NOT SET*");
+    strcpy(c->checkpoint_fname, "");
+    strcpy(c->restart_fname, "");
+    strcpy(c->spinup_cache_dir, "");
 
     c->alloc_model = GRASSES;    /* C allocation scheme: FIXED, GRASSES, ALLOMETRIC */
     c->assim_model = MATE;          /* Photosynthesis model: BEWDY (not coded :p) or MATE */
@@ -45,6 +49,26 @@ void initialise_control(control *c) {
     c->water_store = FALSE;         /* Simulate capacitance or not? */
     c->spin_up = FALSE;             /* Spin up to a steady state? If False it just runs the model */
     c->soil_drainage = GRAVITY;
+    c->checkpoint_interval = 0;     /* Days between checkpoints, 0 = never */
+    c->stream_met = FALSE;          /* Read the met a year at a time? */
+    c->verify_met_cache = FALSE;    /* Digest the met file on each cache load? */
+    c->num_out_vars = 0;            /* Daily outputs, 0 = the default set */
+    c->out_precision = 10;          /* Decimals in the ascii outputs */
+    c->async_output = FALSE;        /* Write the outputs on their own thread? */
+    c->writer = NULL;
+    c->num_out_records = -1;
+    c->num_out_sd_records = -1;
+    c->out_aggregate = AGG_MEAN;    /* Monthly etc. outputs are the mean */
+    c->agg_year = 0;
+    c->agg_period = 0;
+    c->agg_ndays = 0;
+    c->output_arrow = FALSE;        /* Outputs as an Arrow IPC stream? */
+    c->arrow_batch = ARROW_BATCH_ROWS;
+    strcpy(c->site_id, "");         /* No site column */
+    c->arrow = NULL;
+    c->out_buffer = NULL;           /* Outputs to files, not memory */
+    c->out_buffer_rows = 0;
+    c->out_rows = 0;
 
     /* Internal calculated */
     c->num_years = 0;               /* Total number of years simulated */
@@ -55,6 +79,16 @@ void initialise_control(control *c) {
     c->sub_daily = FALSE;           /* Run at daily or 30 minute timestep */
     c->num_hlf_hrs = 48;
     c->pdebug = FALSE;              /* Use to debug a specific day */
+    c->quiet = FALSE;               /* Print the daily plant/soil C to stdout */
+    strcpy(c->batch_fname, "");     /* Site manifest, set via -b */
+    strcpy(c->ensemble_fname, "");  /* Ensemble members, set via -e */
+    strcpy(c->sweep_fname, "");     /* Parameter sweep, set via -x */
+    strcpy(c->serve_path, "");      /* Server socket or "-", set via -serve */
+    strcpy(c->scenario_fname, "");  /* Forked scenarios, set via -f */
+    c->fork_year = -1;              /* Day scenarios are forked on, set via -d */
+    c->fork_doy = -1;
+    c->nthreads = 0;                /* Batch worker threads, 0 = one per CPU */
+    c->convert_met = FALSE;         /* Make a met cache, set via -m/-ms */
     return;
 }
 
@@ -0,0 +1,315 @@
+/* ============================================================================
+* Binary met cache, a column by column copy of a met file that can be mapped
+* straight into the met arrays.
+*
+* The cache for met.csv is met.csv.metcache, made with -m (daily) or -ms
+* (sub-daily). From then on read_daily_met_data/read_subdaily_met_data map
+* it in place of reading the text, for as long as it is fresh, i.e. the met
+* file still has the size and modification time the cache was made from,
+* or failing that the same contents.
+*
+* NOTES:
+*   The file is a met_cache_header followed by one column of doubles per
+*   met array the reader fills, each starting on a MET_CACHE_ALIGN boundary,
+*   so loading is a single mapping with the arrays pointed into it and the
+*   pages only come in as the run reaches them. The mapping is private, so
+*   the arrays can still be written to without touching the file. The
+*   arrays then belong to the mapping rather than the heap, which
+*   free_met_arrays knows about.
+*
+*   Values are stored in the machine's own format, like the checkpoints, so
+*   a cache is only good on the kind of machine that made it; one from
+*   elsewhere fails the byte order check and the text is read instead. The
+*   checksum covers the columns and is checked when the cache is written
+*   and read back, not on every load.
+*
+*   Loading only stats the met file. If its size and modification time
+*   (to the nanosecond where the system keeps it) are as they were, the
+*   cache is used as it stands. A different time alone (e.g. the file was
+*   touched or copied) isn't enough to throw the cache away, so the met
+*   file is digested and compared with the digest of the text it was made
+*   from; that happens on every load until the cache is made again.
+*   [control] verify_met_cache = true digests it on every load regardless,
+*   for when a same-size edit might have kept the old time.
+*
+* =========================================================================== */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "met_cache.h"
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+static int  check_header(met_cache_header *, size_t, struct stat *, int,
+                         char **, double ***, int);
+static int  check_source(met_cache_header *, struct stat *, char *, int);
+static unsigned long long checksum_columns(met_cache_header *, char *);
+static int  digest_file(char *, unsigned long long *);
+static void file_mtime(struct stat *, long long *, long long *);
+static void cache_fname(char *, char *);
+
+
+long load_met_cache(control *c, met_arrays *ma, int sub_daily) {
+    /*
+        Point the met arrays into the cache next to the met file, returns
+        the number of rows or -1 if there's no fresh cache to use.
+    */
+    mapped_file       mf;
+    met_cache_header *h;
+    struct stat       st;
+    double          **arrays[MAX_MET_VARS];
+    char             *names[MAX_MET_VARS];
+    char              fname[STRING_LENGTH + 16];
+    int               ncols, j, k;
+
+    if (stat(c->met_fname, &st) != 0)
+        return (-1);
+    cache_fname(c->met_fname, fname);
+    if (! map_file(fname, TRUE, &mf))
+        return (-1);
+
+    ncols = met_columns(ma, sub_daily, arrays, names);
+    h = (met_cache_header *)mf.data;
+    if (! check_header(h, mf.size, &st, sub_daily, names, arrays, ncols) ||
+        ! check_source(h, &st, c->met_fname, c->verify_met_cache)) {
+        unmap_file(&mf);
+        return (-1);
+    }
+
+    /* whatever the arrays held before goes */
+    free_met_arrays(ma);
+    ncols = met_columns(ma, sub_daily, arrays, names);
+    for (k = 0, j = 0; k < ncols; k++) {
+        if (arrays[k] == NULL)
+            continue;
+        *(arrays[k]) = (double *)(mf.data + h->offset[j++]);
+    }
+    ma->cache = mf;
+    ma->capacity = 0;
+    c->num_years = h->num_years;
+
+    return ((long)h->nrows);
+}
+
+void write_met_cache(control *c, int sub_daily) {
+    /* write the cache of c->met_fname, see NOTES */
+    FILE               *fp;
+    met_arrays          ma;
+    met_cache_header    h;
+    mapped_file         mf;
+    struct stat         st;
+    double            **arrays[MAX_MET_VARS];
+    char               *names[MAX_MET_VARS];
+    char                fname[STRING_LENGTH + 16];
+    char                tmp_fname[STRING_LENGTH + 64];
+    char                zeros[MET_CACHE_ALIGN];
+    long                nrows;
+    long long           pos;
+    int                 ncols, j, k;
+
+    if (stat(c->met_fname, &st) != 0) {
+        fprintf(stderr, "Error: couldn't open met file %s\n", c->met_fname);
+        gday_exit(EXIT_FAILURE);
+    }
+    memset(&ma, 0, sizeof(met_arrays));
+    nrows = read_met_csv(c, &ma, sub_daily);
+
+    memset(&h, 0, sizeof(met_cache_header));
+    memcpy(h.magic, MET_CACHE_MAGIC, sizeof(h.magic));
+    h.version = MET_CACHE_VERSION;
+    h.byte_order = MET_CACHE_BYTE_ORDER;
+    h.steps_per_day = sub_daily ? 48 : 1;
+    h.nrows = nrows;
+    h.num_years = c->num_years;
+    h.source_size = (long long)st.st_size;
+    file_mtime(&st, &(h.source_mtime), &(h.source_mtime_ns));
+    if (! digest_file(c->met_fname, &(h.source_digest))) {
+        fprintf(stderr, "Error: couldn't open met file %s\n", c->met_fname);
+        gday_exit(EXIT_FAILURE);
+    }
+    h.checksum = FNV_OFFSET;
+
+    /* lay the columns out after the header */
+    ncols = met_columns(&ma, sub_daily, arrays, names);
+    pos = sizeof(met_cache_header);
+    for (k = 0, j = 0; k < ncols; k++) {
+        if (arrays[k] == NULL)
+            continue;
+        strncpy(h.names[j], names[k], MET_CACHE_NAME_LEN - 1);
+        pos = (pos + MET_CACHE_ALIGN - 1) / MET_CACHE_ALIGN * MET_CACHE_ALIGN;
+        h.offset[j++] = pos;
+        pos += nrows * (long long)sizeof(double);
+        h.checksum = hash_bytes(h.checksum, *(arrays[k]),
+                                nrows * sizeof(double));
+    }
+    h.ncols = j;
+
+    /* written under a name of our own and moved into place when done */
+    cache_fname(c->met_fname, fname);
+    sprintf(tmp_fname, "%s.%ld", fname, (long)getpid());
+    if ((fp = fopen(tmp_fname, "wb")) == NULL) {
+        fprintf(stderr, "Error: couldn't open met cache %s for write\n",
+                tmp_fname);
+        gday_exit(EXIT_FAILURE);
+    }
+    memset(zeros, 0, sizeof(zeros));
+    pos = sizeof(met_cache_header);
+    if (fwrite(&h, sizeof(met_cache_header), 1, fp) != 1) {
+        fprintf(stderr, "Error writing met cache %s\n", tmp_fname);
+        gday_exit(EXIT_FAILURE);
+    }
+    for (k = 0, j = 0; k < ncols; k++) {
+        if (arrays[k] == NULL)
+            continue;
+        if (fwrite(zeros, 1, (size_t)(h.offset[j] - pos), fp) !=
+                (size_t)(h.offset[j] - pos) ||
+            fwrite(*(arrays[k]), sizeof(double), (size_t)nrows, fp) !=
+                (size_t)nrows) {
+            fprintf(stderr, "Error writing met cache %s\n", tmp_fname);
+            gday_exit(EXIT_FAILURE);
+        }
+        pos = h.offset[j++] + nrows * (long long)sizeof(double);
+    }
+    fclose(fp);
+
+    /* read it back, which also proves it maps */
+    if (! map_file(tmp_fname, FALSE, &mf) ||
+        ! check_header((met_cache_header *)mf.data, mf.size, &st, sub_daily,
+                       names, arrays, ncols) ||
+        checksum_columns((met_cache_header *)mf.data, mf.data) !=
+            h.checksum) {
+        fprintf(stderr, "Error: met cache %s doesn't read back\n",
+                tmp_fname);
+        gday_exit(EXIT_FAILURE);
+    }
+    unmap_file(&mf);
+
+    /* Windows won't rename over an existing file */
+    remove(fname);
+    if (rename(tmp_fname, fname) != 0) {
+        fprintf(stderr, "Error: couldn't move met cache into place %s\n",
+                fname);
+        gday_exit(EXIT_FAILURE);
+    }
+    free_met_arrays(&ma);
+
+    fprintf(stderr, "Met cache written: %s (%ld rows, %d years)\n", fname,
+            nrows, c->num_years);
+
+    return;
+}
+
+static int check_header(met_cache_header *h, size_t size, struct stat *st,
+                        int sub_daily, char **names, double ***arrays,
+                        int ncols) {
+    /* is this a cache we can use for the met file as it stands */
+    long long end;
+    int       j, k;
+
+    if (size < sizeof(met_cache_header) ||
+        memcmp(h->magic, MET_CACHE_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != MET_CACHE_VERSION ||
+        h->byte_order != MET_CACHE_BYTE_ORDER ||
+        h->steps_per_day != (sub_daily ? 48 : 1) ||
+        h->nrows < 0 || h->ncols > MAX_MET_VARS)
+        return (FALSE);
+
+    /* stale, the rest is checked by check_source */
+    if (h->source_size != (long long)st->st_size)
+        return (FALSE);
+
+    /* the columns this build's reader fills, in the same order */
+    for (k = 0, j = 0; k < ncols; k++) {
+        if (arrays[k] == NULL)
+            continue;
+        if (j >= h->ncols ||
+            strncmp(h->names[j], names[k], MET_CACHE_NAME_LEN) != 0 ||
+            h->offset[j] % MET_CACHE_ALIGN != 0)
+            return (FALSE);
+        end = h->offset[j] + h->nrows * (long long)sizeof(double);
+        if (h->offset[j] < (long long)sizeof(met_cache_header) ||
+            end > (long long)size)
+            return (FALSE);
+        j++;
+    }
+
+    return (j == h->ncols);
+}
+
+static int check_source(met_cache_header *h, struct stat *st,
+                        char *met_fname, int verify) {
+    /*
+        Was it this met file, as it stands, the cache was made from? The
+        contents are only digested if its time has moved or we're asked to
+        (see NOTES). Call after check_header.
+    */
+    unsigned long long digest;
+    long long          sec, nsec;
+
+    file_mtime(st, &sec, &nsec);
+    if (! verify && sec == h->source_mtime && nsec == h->source_mtime_ns)
+        return (TRUE);
+
+    return (digest_file(met_fname, &digest) && digest == h->source_digest);
+}
+
+static unsigned long long checksum_columns(met_cache_header *h, char *data) {
+    unsigned long long sum = FNV_OFFSET;
+    int                j;
+
+    for (j = 0; j < h->ncols; j++) {
+        sum = hash_bytes(sum, data + h->offset[j],
+                         (size_t)h->nrows * sizeof(double));
+    }
+
+    return (sum);
+}
+
+static int digest_file(char *fname, unsigned long long *digest) {
+    /*
+        FNV-1a of the file taken 8 bytes at a time, rather than a byte, so
+        that it keeps up with reading the file. Returns FALSE if it can't be
+        read.
+    */
+    mapped_file         mf;
+    unsigned long long  h = FNV_OFFSET, w;
+    size_t              i;
+
+    if (! map_file(fname, FALSE, &mf))
+        return (FALSE);
+
+    for (i = 0; i + sizeof(w) <= mf.size; i += sizeof(w)) {
+        memcpy(&w, mf.data + i, sizeof(w));
+        h ^= w;
+        h *= FNV_PRIME;
+    }
+    h = hash_bytes(h, mf.data + i, mf.size - i);
+    unmap_file(&mf);
+
+    *digest = h;
+
+    return (TRUE);
+}
+
+static void file_mtime(struct stat *st, long long *sec, long long *nsec) {
+
+    *sec = (long long)st->st_mtime;
+#if defined(_WIN32)
+    *nsec = 0;
+#elif defined(__APPLE__)
+    *nsec = (long long)st->st_mtimespec.tv_nsec;
+#else
+    *nsec = (long long)st->st_mtim.tv_nsec;
+#endif
+
+    return;
+}
+
+static void cache_fname(char *met_fname, char *fname) {
+    sprintf(fname, "%s%s", met_fname, MET_CACHE_SUFFIX);
+    return;
+}
@@ -0,0 +1,363 @@
+/* ============================================================================
+* Process-wide met store.
+*
+* Regional runs put hundreds of sites on the same climate grid cell, and
+* each of them used to read its own copy of the same met file. While the
+* store is open (run_batch opens it for the length of a batch) handles take
+* their forcing from it instead: a met file is read once, by whichever
+* handle gets to it first, and every other handle loaded against it shares
+* the arrays. Sub-daily solar geometry depends on where the site is too, so
+* it is kept per latitude/longitude under the met file it was worked out
+* from.
+*
+* NOTES:
+*   Met files are told apart by what the file system says about them
+*   (device, inode, size and modification time, and the name where there
+*   are no inodes), so two names for the same file share and a file that is
+*   rewritten during a batch is read again. Daily and sub-daily readings of
+*   a file are different entries.
+*
+*   Entries are reference counted. One nobody is using is kept around in
+*   case the next site on the cell comes along, until the unused entries
+*   come to more than MET_STORE_IDLE_BYTES, when the longest unused ones are
+*   freed.
+*
+*   The store's lock covers the list and the counts and is never held while
+*   reading. Each entry has a lock of its own which is held while its file
+*   is read, or its solar geometry worked out, so anyone else wanting it
+*   waits on that rather than reading it again. If the read fails the entry
+*   is dropped from the store, the handles already waiting on it fail as
+*   well and the next one to come along tries again.
+*
+*   The model never writes to the met arrays or the solar stores (see
+*   gday_sim.c), which is what makes sharing them safe.
+*
+* =========================================================================== */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "met_store.h"
+#include "gday_thread.h"
+
+struct met_solar {
+    met_solar  *next;
+    double      latitude;
+    double      longitude;
+    double     *cz_store;
+    double     *ele_store;
+    double     *df_store;
+};
+
+struct met_entry {
+    met_entry      *next;
+    long long       dev;            /* which file, see NOTES */
+    long long       ino;
+    long long       size;
+    long long       mtime;
+    int             sub_daily;
+    char            met_fname[STRING_LENGTH];
+    met_arrays      ma;
+    int             num_years;
+    long            total_num_days;
+    size_t          bytes;          /* met arrays and solar stores */
+    int             refs;           /* handles using (or waiting for) it */
+    int             ready;          /* read in */
+    int             linked;         /* in the store, FALSE once it failed */
+    unsigned long   idle_since;     /* store clock when refs went to 0 */
+    gday_mutex      load_lock;      /* held while reading, see NOTES */
+    met_solar      *solar;
+};
+
+static struct {
+    int             open;
+    gday_mutex      lock;
+    met_entry      *entries;
+    size_t          idle_bytes;     /* in entries nobody is using */
+    unsigned long   clock;
+} store;
+
+static met_entry *find_entry(control *, struct stat *);
+static void       load_entry(met_entry *, control *);
+static met_solar *find_solar(met_entry *, canopy_wk *, control *, params *);
+static void       unlink_entry(met_entry *);
+static void       evict_idle(void);
+static void       free_entry(met_entry *);
+
+
+void met_store_open(void) {
+    /* start sharing met forcing between handles, see NOTES */
+    if (store.open)
+        return;
+    mutex_init(&(store.lock));
+    store.entries = NULL;
+    store.idle_bytes = 0;
+    store.clock = 0;
+    store.open = TRUE;
+
+    return;
+}
+
+void met_store_close(void) {
+    /* every handle has to have let go of its forcing by now */
+    met_entry *e;
+
+    if (! store.open)
+        return;
+    while ((e = store.entries) != NULL) {
+        store.entries = e->next;
+        free_entry(e);
+    }
+    mutex_free(&(store.lock));
+    store.open = FALSE;
+
+    return;
+}
+
+int met_store_active(void) {
+    return (store.open);
+}
+
+void met_store_acquire(canopy_wk *cw, control *c, met_arrays *ma, params *p,
+                       met_store_ref *ref) {
+    /*
+        Point ma (and for sub-daily runs the solar stores) at the stored
+        forcing for c->met_fname, reading it first if need be. The handle
+        has to give it back with met_store_release.
+    */
+    met_entry  *e;
+    struct stat st;
+    jmp_buf     env, *prev;
+    int         error;
+
+    if (stat(c->met_fname, &st) != 0) {
+        fprintf(stderr, "Error: couldn't open %s Met file %s for read\n",
+                c->sub_daily ? "sub-daily" : "daily", c->met_fname);
+        gday_exit(EXIT_FAILURE);
+    }
+
+    mutex_lock(&(store.lock));
+    if ((e = find_entry(c, &st)) == NULL) {
+        mutex_unlock(&(store.lock));
+        fprintf(stderr, "Error allocating space for met store\n");
+        gday_exit(EXIT_FAILURE);
+    }
+    if (e->refs++ == 0 && e->ready)
+        store.idle_bytes -= e->bytes;
+    mutex_unlock(&(store.lock));
+    ref->entry = e;
+    ref->solar = NULL;
+
+    /* whoever gets the entry's lock first reads the file */
+    mutex_lock(&(e->load_lock));
+    prev = set_exit_handler(&env);
+    if ((error = setjmp(env)) != 0) {
+        set_exit_handler(prev);
+        mutex_lock(&(store.lock));
+        unlink_entry(e);
+        mutex_unlock(&(store.lock));
+        mutex_unlock(&(e->load_lock));
+        met_store_release(ref);
+        gday_exit(error);
+    }
+
+    if (! e->ready) {
+        if (! e->linked) {
+            /* the read we were waiting on failed, and was reported */
+            fprintf(stderr, "%s: couldn't read met file %s\n",
+                    c->cfg_fname, c->met_fname);
+            gday_exit(EXIT_FAILURE);
+        }
+        load_entry(e, c);
+    }
+    c->num_years = e->num_years;
+    c->total_num_days = e->total_num_days;
+    if (c->sub_daily)
+        ref->solar = find_solar(e, cw, c, p);
+
+    set_exit_handler(prev);
+    mutex_unlock(&(e->load_lock));
+
+    *ma = e->ma;
+    if (ref->solar != NULL) {
+        cw->cz_store = ref->solar->cz_store;
+        cw->ele_store = ref->solar->ele_store;
+        cw->df_store = ref->solar->df_store;
+        cw->solar_capacity = 0;
+    }
+
+    return;
+}
+
+void met_store_release(met_store_ref *ref) {
+    /* the handle no longer uses the forcing ref points at */
+    met_entry *e = ref->entry;
+
+    if (e == NULL)
+        return;
+
+    mutex_lock(&(store.lock));
+    if (--e->refs == 0) {
+        if (! e->linked) {
+            free_entry(e);
+        } else if (e->ready) {
+            e->idle_since = ++store.clock;
+            store.idle_bytes += e->bytes;
+            evict_idle();
+        } else {
+            unlink_entry(e);
+            free_entry(e);
+        }
+    }
+    mutex_unlock(&(store.lock));
+    ref->entry = NULL;
+    ref->solar = NULL;
+
+    return;
+}
+
+static met_entry *find_entry(control *c, struct stat *st) {
+    /* the entry for this met file, added if need be; store lock held */
+    met_entry *e;
+
+    for (e = store.entries; e != NULL; e = e->next) {
+        if (e->dev == (long long)st->st_dev &&
+            e->ino == (long long)st->st_ino &&
+            e->size == (long long)st->st_size &&
+            e->mtime == (long long)st->st_mtime &&
+            e->sub_daily == c->sub_daily &&
+            (st->st_ino != 0 || strcmp(e->met_fname, c->met_fname) == 0))
+            return (e);
+    }
+
+    if ((e = (met_entry *)calloc(1, sizeof(met_entry))) == NULL)
+        return (NULL);
+    e->dev = (long long)st->st_dev;
+    e->ino = (long long)st->st_ino;
+    e->size = (long long)st->st_size;
+    e->mtime = (long long)st->st_mtime;
+    e->sub_daily = c->sub_daily;
+    strncpy0(e->met_fname, c->met_fname, sizeof(e->met_fname));
+    mutex_init(&(e->load_lock));
+    e->linked = TRUE;
+    e->next = store.entries;
+    store.entries = e;
+
+    return (e);
+}
+
+static void load_entry(met_entry *e, control *c) {
+    /* read the met file into the entry; its lock held */
+    double **arrays[MAX_MET_VARS];
+    char    *names[MAX_MET_VARS];
+    int      ncols, k, n = 0;
+
+    if (c->sub_daily)
+        read_subdaily_met_data(c, &(e->ma));
+    else
+        read_daily_met_data(c, &(e->ma));
+    e->num_years = c->num_years;
+    e->total_num_days = c->total_num_days;
+
+    ncols = met_columns(&(e->ma), c->sub_daily, arrays, names);
+    for (k = 0; k < ncols; k++) {
+        if (arrays[k] != NULL)
+            n++;
+    }
+    mutex_lock(&(store.lock));
+    if (e->ma.cache.data != NULL)
+        e->bytes += e->ma.cache.size;
+    else
+        e->bytes += (size_t)e->ma.capacity * (n + 1) * sizeof(double);
+    e->ready = TRUE;
+    mutex_unlock(&(store.lock));
+
+    return;
+}
+
+static met_solar *find_solar(met_entry *e, canopy_wk *cw, control *c,
+                             params *p) {
+    /* the solar geometry for the site, worked out if need be; lock held */
+    met_solar *sol;
+    canopy_wk  geom;
+
+    for (sol = e->solar; sol != NULL; sol = sol->next) {
+        if (sol->latitude == p->latitude && sol->longitude == p->longitude)
+            return (sol);
+    }
+
+    if ((sol = (met_solar *)calloc(1, sizeof(met_solar))) == NULL) {
+        fprintf(stderr, "Error allocating space for met store\n");
+        gday_exit(EXIT_FAILURE);
+    }
+    sol->latitude = p->latitude;
+    sol->longitude = p->longitude;
+
+    /* into a scratch canopy so nothing of the handle's own gets used */
+    memset(&geom, 0, sizeof(canopy_wk));
+    fill_up_solar_arrays(&geom, c, &(e->ma), p);
+    sol->cz_store = geom.cz_store;
+    sol->ele_store = geom.ele_store;
+    sol->df_store = geom.df_store;
+
+    mutex_lock(&(store.lock));
+    sol->next = e->solar;
+    e->solar = sol;
+    e->bytes += (size_t)geom.solar_capacity * 3 * sizeof(double);
+    mutex_unlock(&(store.lock));
+
+    return (sol);
+}
+
+static void unlink_entry(met_entry *e) {
+    /* take the entry out of the store's list; store lock held */
+    met_entry **pe;
+
+    if (! e->linked)
+        return;
+    for (pe = &(store.entries); *pe != NULL; pe = &((*pe)->next)) {
+        if (*pe == e) {
+            *pe = e->next;
+            break;
+        }
+    }
+    e->linked = FALSE;
+
+    return;
+}
+
+static void evict_idle(void) {
+    /* free the longest unused entries over the budget; store lock held */
+    met_entry *e, *oldest;
+
+    while (store.idle_bytes > MET_STORE_IDLE_BYTES) {
+        oldest = NULL;
+        for (e = store.entries; e != NULL; e = e->next) {
+            if (e->refs == 0 && e->ready &&
+                (oldest == NULL || e->idle_since < oldest->idle_since))
+                oldest = e;
+        }
+        if (oldest == NULL)
+            break;
+        store.idle_bytes -= oldest->bytes;
+        unlink_entry(oldest);
+        free_entry(oldest);
+    }
+
+    return;
+}
+
+static void free_entry(met_entry *e) {
+    met_solar *sol;
+
+    while ((sol = e->solar) != NULL) {
+        e->solar = sol->next;
+        free(sol->cz_store);
+        free(sol->ele_store);
+        free(sol->df_store);
+        free(sol);
+    }
+    free_met_arrays(&(e->ma));
+    mutex_free(&(e->load_lock));
+    free(e);
+
+    return;
+}
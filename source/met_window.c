@@ -0,0 +1,465 @@
+/* ============================================================================
+* Stream the met forcing from the file a year at a time rather than holding
+* the whole record in memory ([control] stream_met = true).
+*
+* The window holds, for every column the model uses, the model year being
+* run, the MET_LOOKBACK_DAYS (or p->days_rain if longer) days before it and
+* room for the year after it, which is read on a thread of its own while the
+* current year runs. Sub-daily runs carry the solar geometry for the same
+* rows, worked out as fill_up_solar_arrays does. A multi-century sub-daily
+* run needs a few MB per site instead of several GB.
+*
+* NOTES:
+*   The met arrays (and cw->cz_store etc) are pointed at the buffers offset
+*   by the first row they hold, as nrutil does for its vectors, so the model
+*   goes on indexing them with day_idx/hour_idx. Only rows in the window may
+*   be touched, which is everything the model looks at: the day (or half
+*   hour) being run, phenology's look ahead over the rest of the year and
+*   its 30 day look back, and the HUFKEN allocation's days_rain look back.
+*   Sub-daily deciduous and HUFKEN runs index the sub-daily arrays by day,
+*   so they aren't streamed.
+*
+*   begin_day calls met_window_day every day; moving on to the next year
+*   waits for the read ahead, slides the look back and the new year to the
+*   front of the buffers and starts reading the year after. Anything else,
+*   e.g. the next pass of a spin-up or a fork part way through the record,
+*   reads the year it needs there and then.
+*
+*   The file is scanned once when it is opened for the rows where the year
+*   changes, after which any row can be found without reading the rows
+*   before it. Only the year column is checked then, a bad line further
+*   along the row is reported when that year is read. The binary met cache
+*   isn't used, and a window can't be shared between ensemble members as
+*   each has got to its own year.
+*
+* =========================================================================== */
+#include "met_window.h"
+#include "gday_thread.h"
+
+typedef struct {
+    long         row;           /* first row of a run with the same year */
+    long         line;          /* the line it is on, 1 is the first */
+    size_t       offset;        /* where in the file that line starts */
+    double       year;
+} met_anchor;
+
+struct met_window {
+    mapped_file  mf;
+    control     *c;
+    canopy_wk   *cw;            /* whose solar stores point in, sub-daily */
+    int          sub_daily;
+    int          steps;         /* rows a day */
+    int          ncols;
+    double     **arrays[MAX_MET_VARS]; /* file columns, as met_columns */
+    double      *cols[MAX_MET_VARS];   /* their buffers, NULL if not kept */
+    double      *par;           /* the par buffer, sub-daily only */
+    double      *cz;            /* solar geometry buffers, sub-daily only */
+    double      *ele;
+    double      *df;
+    canopy_wk    geom;          /* scratch for the read ahead's geometry */
+    params       site;          /* where the geometry is worked out for */
+    met_anchor  *anchors;
+    int          nanchors;
+    long         nrows;
+    long        *year_row;      /* first row of each model year, and one
+                                   past the last row of the last */
+    int          nyears;
+    long         lookback;      /* rows kept before the current year */
+    long         capacity;      /* rows each buffer holds */
+    long         base;          /* row in the first slot of the buffers */
+    int          year;          /* model year in the window, -1 if none */
+    int          pending;       /* year being read ahead, -1 if none */
+    int          threaded;      /* ...on a thread that has to be joined */
+    gday_thread  th;
+    long         load_start;    /* rows being read */
+    long         load_end;
+    long         bad_line;      /* first unreadable line in them, 0 if none */
+};
+
+static void index_years(met_window *);
+static void model_years(met_window *);
+static void load_rows(void *);
+static void solar_geometry(met_window *, long, long);
+static void point_arrays(met_window *);
+static int  year_of_row(met_window *, long);
+static const char *find_row(met_window *, long, long *);
+static const char *skip_rows(const char *, const char *, long, long *);
+static double *window_buffer(met_window *, char *);
+
+
+void open_met_window(canopy_wk *cw, control *c, met_arrays *ma, params *p) {
+    /*
+        Point ma (and for sub-daily runs the solar stores) at a window on
+        c->met_fname with the first year read in. Whatever ma held before
+        has to have been freed.
+    */
+    met_window *w;
+    char       *names[MAX_MET_VARS];
+    int         k;
+
+    if (c->sub_daily && (c->deciduous_model || c->alloc_model == HUFKEN)) {
+        fprintf(stderr, "%s: stream_met can't be used for sub-daily "
+                "deciduous or HUFKEN runs\n", c->cfg_fname);
+        gday_exit(EXIT_FAILURE);
+    }
+
+    /* hung on ma straight away so free_met_arrays tidies up after errors */
+    if ((w = (met_window *)calloc(1, sizeof(met_window))) == NULL) {
+        fprintf(stderr, "Error allocating space for met window\n");
+        gday_exit(EXIT_FAILURE);
+    }
+    ma->window = w;
+    w->c = c;
+    w->cw = cw;
+    w->sub_daily = c->sub_daily;
+    w->steps = c->sub_daily ? c->num_hlf_hrs : 1;
+    w->year = -1;
+    w->pending = -1;
+
+    if (! map_file(c->met_fname, FALSE, &(w->mf))) {
+        fprintf(stderr, "Error: couldn't open %s Met file %s for read\n",
+                c->sub_daily ? "sub-daily" : "daily", c->met_fname);
+        gday_exit(EXIT_FAILURE);
+    }
+    index_years(w);
+    model_years(w);
+
+    w->lookback = c->sub_daily ? 0 : MAX(MET_LOOKBACK_DAYS, p->days_rain);
+    w->capacity = MAX(1, MIN(w->nrows,
+                             w->lookback + 2 * 366 * (long)w->steps));
+
+    w->ncols = met_columns(ma, c->sub_daily, w->arrays, names);
+    for (k = 0; k < w->ncols; k++) {
+        if (w->arrays[k] != NULL)
+            w->cols[k] = window_buffer(w, names[k]);
+    }
+
+    if (c->sub_daily) {
+        for (k = 0; k < w->ncols; k++) {
+            if (w->arrays[k] == &(ma->par))
+                w->par = w->cols[k];
+        }
+        w->cz = window_buffer(w, "cz store");
+        w->ele = window_buffer(w, "ele store");
+        w->df = window_buffer(w, "df store");
+        w->site.latitude = p->latitude;
+        w->site.longitude = p->longitude;
+    }
+
+    c->num_years = w->nanchors;
+    c->total_num_days = w->nrows / w->steps;
+
+    met_window_day(ma, 0);
+
+    return;
+}
+
+void met_window_day(met_arrays *ma, long row) {
+    /*
+        Make sure the model year holding row (or the last year, if row is
+        past the end of the record) is in the window.
+    */
+    met_window *w = ma->window;
+    long        base, shift, n;
+    int         y, k;
+
+    if (w == NULL)
+        return;
+    if (w->year >= 0 && row >= w->year_row[w->year] &&
+        row < w->year_row[w->year + 1])
+        return;
+    if ((y = year_of_row(w, row)) == w->year)
+        return;
+
+    if (w->threaded) {
+        thread_join(w->th);
+        w->threaded = FALSE;
+    }
+
+    base = MAX(0, w->year_row[y] - w->lookback);
+    if (y == w->pending) {
+        w->pending = -1;
+        if (w->bad_line > 0)
+            bad_met_line(w->c, w->sub_daily, w->bad_line);
+
+        /* the look back comes from the year just run */
+        shift = base - w->base;
+        n = w->year_row[y + 1] - base;
+        for (k = 0; k < w->ncols; k++) {
+            if (w->cols[k] != NULL)
+                memmove(w->cols[k], w->cols[k] + shift, n * sizeof(double));
+        }
+        if (w->sub_daily) {
+            memmove(w->cz, w->cz + shift, n * sizeof(double));
+            memmove(w->ele, w->ele + shift, n * sizeof(double));
+            memmove(w->df, w->df + shift, n * sizeof(double));
+        }
+        w->base = base;
+    } else {
+        /* nothing in the buffers is any use */
+        w->pending = -1;
+        w->year = -1;
+        w->base = base;
+        w->load_start = base;
+        w->load_end = w->year_row[y + 1];
+        load_rows(w);
+        if (w->bad_line > 0)
+            bad_met_line(w->c, w->sub_daily, w->bad_line);
+    }
+    w->year = y;
+    point_arrays(w);
+
+    /* and read the next year while this one runs */
+    if (y + 1 < w->nyears) {
+        w->pending = y + 1;
+        w->load_start = w->year_row[y + 1];
+        w->load_end = w->year_row[y + 2];
+        w->threaded = (thread_start(&(w->th), load_rows, w) == 0);
+        if (! w->threaded)
+            load_rows(w);
+    }
+
+    return;
+}
+
+void close_met_window(met_arrays *ma) {
+    /* free the window and NULL the solar stores, ma is left to the caller */
+    met_window *w = ma->window;
+    int         k;
+
+    if (w == NULL)
+        return;
+    if (w->threaded)
+        thread_join(w->th);
+    if (w->mf.data != NULL)
+        unmap_file(&(w->mf));
+
+    for (k = 0; k < w->ncols; k++)
+        free(w->cols[k]);
+    free(w->cz);
+    free(w->ele);
+    free(w->df);
+    if (w->sub_daily) {
+        w->cw->cz_store = NULL;
+        w->cw->ele_store = NULL;
+        w->cw->df_store = NULL;
+        w->cw->solar_capacity = 0;
+    }
+    free(w->anchors);
+    free(w->year_row);
+    free(w);
+    ma->window = NULL;
+
+    return;
+}
+
+static void index_years(met_window *w) {
+    /* note where the year changes, checking the year column on the way */
+    const char *p = w->mf.data, *stop = w->mf.data + w->mf.size, *eol;
+    met_anchor *tmp;
+    long        line = 0;
+    double      year, current_yr = -999.9;
+    int         size = 0;
+
+    while (p < stop) {
+        eol = memchr(p, '\n', stop - p);
+        if (eol == NULL)
+            eol = stop;
+        line++;
+
+        /* ignore comment line */
+        if (*p != '#') {
+            if (parse_met_number(p, eol, &year) == NULL)
+                bad_met_line(w->c, w->sub_daily, line);
+            if (year != current_yr) {
+                if (w->nanchors == size) {
+                    size = MAX(64, 2 * size);
+                    tmp = (met_anchor *)realloc(w->anchors,
+                                                size * sizeof(met_anchor));
+                    if (tmp == NULL) {
+                        fprintf(stderr, "Error allocating space for met "
+                                "window years\n");
+                        gday_exit(EXIT_FAILURE);
+                    }
+                    w->anchors = tmp;
+                }
+                w->anchors[w->nanchors].row = w->nrows;
+                w->anchors[w->nanchors].line = line;
+                w->anchors[w->nanchors].offset = (size_t)(p - w->mf.data);
+                w->anchors[w->nanchors].year = year;
+                w->nanchors++;
+                current_yr = year;
+            }
+            w->nrows++;
+        }
+        p = (eol == stop) ? stop : eol + 1;
+    }
+
+    return;
+}
+
+static void model_years(met_window *w) {
+    /*
+        The rows each model year covers. Like the model, a year is 365 or
+        366 days depending on the year on its first row, whatever the year
+        column does after that.
+    */
+    long r;
+    int  a = 0, y;
+
+    w->nyears = w->nanchors;
+    if ((w->year_row = (long *)calloc(w->nyears + 2, sizeof(long))) == NULL) {
+        fprintf(stderr, "Error allocating space for met window years\n");
+        gday_exit(EXIT_FAILURE);
+    }
+
+    for (y = 0; y < w->nyears; y++) {
+        r = w->year_row[y];
+        if (r >= w->nrows) {
+            w->year_row[y + 1] = r;
+            continue;
+        }
+        while (a + 1 < w->nanchors && w->anchors[a + 1].row <= r)
+            a++;
+        if (is_leap_year((int)w->anchors[a].year))
+            r += 366 * (long)w->steps;
+        else
+            r += 365 * (long)w->steps;
+        w->year_row[y + 1] = MIN(w->nrows, r);
+    }
+    w->year_row[w->nyears + 1] = w->year_row[w->nyears];
+
+    return;
+}
+
+static void load_rows(void *arg) {
+    /* read rows load_start to load_end - 1 into the buffers */
+    met_window *w = (met_window *)arg;
+    met_chunk   ch;
+    long        line;
+
+    w->bad_line = 0;
+    if (w->load_end <= w->load_start)
+        return;
+
+    ch.start = find_row(w, w->load_start, &line);
+    ch.end = skip_rows(ch.start, w->mf.data + w->mf.size,
+                       w->load_end - w->load_start, NULL);
+    ch.row0 = w->load_start - w->base;
+    ch.cols = w->cols;
+    ch.ncols = w->ncols;
+    parse_met_chunk(&ch);
+    if (ch.bad_line > 0) {
+        w->bad_line = line + ch.bad_line - 1;
+        return;
+    }
+
+    if (w->sub_daily)
+        solar_geometry(w, w->load_start, w->load_end);
+
+    return;
+}
+
+static void solar_geometry(met_window *w, long start, long end) {
+    /* as fill_up_solar_arrays, for rows start to end - 1 */
+    long   r, i;
+    int    y, doy, hod;
+    double sw_rad;
+
+    y = year_of_row(w, start);
+    for (r = start; r < end; r++) {
+        while (y < w->nyears - 1 && r >= w->year_row[y + 1])
+            y++;
+        doy = (int)((r - w->year_row[y]) / w->steps);
+        hod = (int)((r - w->year_row[y]) % w->steps);
+        i = r - w->base;
+
+        calculate_solar_geometry(&(w->geom), &(w->site), doy, hod);
+        sw_rad = w->par[i] * PAR_2_SW; /* W m-2 */
+        get_diffuse_frac(&(w->geom), doy, sw_rad);
+        w->cz[i] = w->geom.cos_zenith;
+        w->ele[i] = w->geom.elevation;
+        w->df[i] = w->geom.diffuse_frac;
+    }
+
+    return;
+}
+
+static void point_arrays(met_window *w) {
+    /* the model indexes by row, see NOTES */
+    int k;
+
+    for (k = 0; k < w->ncols; k++) {
+        if (w->arrays[k] != NULL)
+            *(w->arrays[k]) = w->cols[k] - w->base;
+    }
+    if (w->sub_daily) {
+        w->cw->cz_store = w->cz - w->base;
+        w->cw->ele_store = w->ele - w->base;
+        w->cw->df_store = w->df - w->base;
+        w->cw->solar_capacity = 0;
+    }
+
+    return;
+}
+
+static int year_of_row(met_window *w, long row) {
+    /* the model year a row falls in, the last one past the end */
+    int lo = 0, hi = w->nyears - 1, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (w->year_row[mid] <= row)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    return (lo);
+}
+
+static const char *find_row(met_window *w, long row, long *line) {
+    /* where in the file a row starts, and the line that is on */
+    int lo = 0, hi = w->nanchors - 1, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (w->anchors[mid].row <= row)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    *line = w->anchors[lo].line;
+
+    return (skip_rows(w->mf.data + w->anchors[lo].offset,
+                      w->mf.data + w->mf.size, row - w->anchors[lo].row,
+                      line));
+}
+
+static const char *skip_rows(const char *p, const char *stop, long n,
+                             long *line) {
+    /* move p, which starts a line, on past n rows and any comments */
+    const char *eol;
+
+    while (p < stop && (n > 0 || *p == '#')) {
+        eol = memchr(p, '\n', stop - p);
+        if (*p != '#')
+            n--;
+        p = (eol == NULL) ? stop : eol + 1;
+        if (line != NULL)
+            (*line)++;
+    }
+
+    return (p);
+}
+
+static double *window_buffer(met_window *w, char *name) {
+    double *x;
+
+    if ((x = (double *)calloc(w->capacity, sizeof(double))) == NULL) {
+        fprintf(stderr, "Error allocating space for %s array\n", name);
+        gday_exit(EXIT_FAILURE);
+    }
+
+    return (x);
+}
@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include "utilities.h"
 #define NR_END 1
 #define FREE_ARG char*
 
@@ -12,7 +13,7 @@ void nrerror(char error_text[])
 	fprintf(stderr,"Numerical Recipes run-time error...\n");
 	fprintf(stderr,"%s\n",error_text);
 	fprintf(stderr,"...now exiting to system...\n");
-	exit(1);
+	gday_exit(1);
 }
 
 float *vector(long nl, long nh)
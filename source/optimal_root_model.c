@@ -304,5 +304,5 @@ double newton(double (*func)(double, double, double, double),
         x0 = x;
     }
     fprintf(stderr, "Minimum not found!!\n");
-    exit(EXIT_FAILURE);
+    gday_exit(EXIT_FAILURE);
 }
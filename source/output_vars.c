@@ -0,0 +1,340 @@
+/* ============================================================================
+* Daily output variables.
+*
+* Every column the daily output files can have is listed here, once, by the
+* name it goes under in the header and where the model keeps it. The
+* [output] section of the param file picks which of them a run writes,
+*
+*   [output]
+*   variables = gpp,npp,lai,et,transpiration
+*
+* and only those are formatted and written, after the year and doy which
+* are always there. Without it the ascii output has every column, in the
+* order they are listed below, and the binary output the handful it has
+* always had.
+*
+* The ascii columns have [output] precision decimals (10 unless it says
+* otherwise), which a column can change for itself, e.g. "lai:3".
+*
+* With print_options = monthly, seasonal or annual, rather than a row a day
+* there is a row for each month, season (DJF, MAM, JJA, SON, December going
+* with the January after it) or year, of the [output] aggregate (mean, sum,
+* min or max) of the days in it, which again a column can change, e.g.
+* "npp:sum" or "npp:sum:4". The row has the number of days that went into
+* it, as the first and last periods of a run needn't be whole ones.
+*
+* Each variable has its units too, which go into the binary outputs' header
+* (see write_output_file.c). The sub-daily output has a short list of its
+* own.
+*
+* NOTES:
+*   The theta columns are the water content of the soil layers, which only
+*   the hydraulics water balance has; with the bucket model they are
+*   written as OUT_MISSING.
+*
+* =========================================================================== */
+#include "output_vars.h"
+
+#define S(x, u)       { #x, u, OUT_STATE, offsetof(state, x) }
+#define F(x, u)       { #x, u, OUT_FLUXES, offsetof(fluxes, x) }
+#define C(name, x, u) { name, u, OUT_CANOPY, offsetof(canopy_wk, x) }
+#define T(layer)      { "theta" #layer, "m3/m3", OUT_THETA, layer }
+
+const output_var output_vars[] = {
+    /* STATE: water */
+    S(wtfac_root, "-"),
+    S(wtfac_topsoil, "-"),
+    S(pawater_root, "mm"),
+    S(pawater_topsoil, "mm"),
+
+    /* plant */
+    S(nsc, "t/ha"),
+    S(shoot, "t/ha"),
+    S(lai, "m2/m2"),
+    S(branch, "t/ha"),
+    S(stem, "t/ha"),
+    S(root, "t/ha"),
+    S(croot, "t/ha"),
+    S(shootn, "t/ha"),
+    S(branchn, "t/ha"),
+    S(stemn, "t/ha"),
+    S(rootn, "t/ha"),
+    S(crootn, "t/ha"),
+    S(cstore, "t/ha"),
+    S(nstore, "t/ha"),
+
+    /* belowground */
+    S(soilc, "t/ha"),
+    S(soiln, "t/ha"),
+    S(inorgn, "t/ha"),
+    S(litterc, "t/ha"),
+    S(littercag, "t/ha"),
+    S(littercbg, "t/ha"),
+    S(litternag, "t/ha"),
+    S(litternbg, "t/ha"),
+    S(activesoil, "t/ha"),
+    S(slowsoil, "t/ha"),
+    S(passivesoil, "t/ha"),
+    S(activesoiln, "t/ha"),
+    S(slowsoiln, "t/ha"),
+    S(passivesoiln, "t/ha"),
+
+    /* FLUXES: water */
+    F(et, "mm/d"),
+    F(transpiration, "mm/d"),
+    F(soil_evap, "mm/d"),
+    F(canopy_evap, "mm/d"),
+    F(runoff, "mm/d"),
+    F(gs_mol_m2_sec, "mol/m2/s"),
+    F(ga_mol_m2_sec, "mol/m2/s"),
+
+    /* litter */
+    F(deadleaves, "t/ha/d"),
+    F(deadbranch, "t/ha/d"),
+    F(deadstems, "t/ha/d"),
+    F(deadroots, "t/ha/d"),
+    F(deadcroots, "t/ha/d"),
+    F(deadleafn, "t/ha/d"),
+    F(deadbranchn, "t/ha/d"),
+    F(deadstemn, "t/ha/d"),
+    F(deadrootn, "t/ha/d"),
+    F(deadcrootn, "t/ha/d"),
+
+    /* C fluxes */
+    F(nep, "t/ha/d"),
+    F(gpp, "t/ha/d"),
+    F(a_max, "umol/m2/s"),
+    F(npp, "t/ha/d"),
+    F(hetero_resp, "t/ha/d"),
+    F(auto_resp, "t/ha/d"),
+    F(apar, "MJ/m2/d"),
+
+    /* C & N growth */
+    F(cpleaf, "t/ha/d"),
+    F(cpbranch, "t/ha/d"),
+    F(cpstem, "t/ha/d"),
+    F(cproot, "t/ha/d"),
+    F(cpcroot, "t/ha/d"),
+    F(npleaf, "t/ha/d"),
+    F(npbranch, "t/ha/d"),
+    F(npstemimm, "t/ha/d"),
+    F(npstemmob, "t/ha/d"),
+    F(nproot, "t/ha/d"),
+    F(npcroot, "t/ha/d"),
+
+    /* N stuff */
+    F(nuptake, "t/ha/d"),
+    F(ngross, "t/ha/d"),
+    F(nmineralisation, "t/ha/d"),
+    F(nloss, "t/ha/d"),
+
+    /* traceability stuff */
+    F(tfac_soil_decomp, "-"),
+    F(c_into_active, "t/ha/d"),
+    F(c_into_slow, "t/ha/d"),
+    F(c_into_passive, "t/ha/d"),
+    F(active_to_slow, "t/ha/d"),
+    F(active_to_passive, "t/ha/d"),
+    F(slow_to_active, "t/ha/d"),
+    F(slow_to_passive, "t/ha/d"),
+    F(passive_to_active, "t/ha/d"),
+    F(co2_rel_from_surf_struct_litter, "t/ha/d"),
+    F(co2_rel_from_soil_struct_litter, "t/ha/d"),
+    F(co2_rel_from_surf_metab_litter, "t/ha/d"),
+    F(co2_rel_from_soil_metab_litter, "t/ha/d"),
+    F(co2_rel_from_active_pool, "t/ha/d"),
+    F(co2_rel_from_slow_pool, "t/ha/d"),
+    F(co2_rel_from_passive_pool, "t/ha/d"),
+
+    /* extra priming stuff */
+    F(root_exc, "t/ha/d"),
+    F(root_exn, "t/ha/d"),
+    F(co2_released_exud, "t/ha/d"),
+    F(factive, "t/ha/d"),
+    F(rtslow, "yr"),
+    F(rexc_cue, "-"),
+
+    /* Misc */
+    S(predawn_swp, "MPa"),
+    S(midday_lwp, "MPa"),
+    S(midday_xwp, "MPa"),
+    F(leafretransn, "t/ha/d"),
+    C("dead_year", death_year, "year"),
+    C("dead_doy", death_doy, "day"),
+    T(0), T(1), T(2), T(3), T(4), T(5), T(6), T(7), T(8), T(9), T(10),
+    T(11), T(12), T(13), T(14), T(15), T(16), T(17), T(18), T(19), T(20)
+};
+
+const int num_output_vars = (int)ARRAY_SIZE(output_vars);
+
+/* the sub-daily (half-hourly) output's columns, all of them always */
+const output_var subdaily_output_vars[] = {
+    C("an_canopy", an_canopy, "umol/m2/s"),
+    C("rd_canopy", rd_canopy, "umol/m2/s"),
+    C("gsc_canopy", gsc_canopy, "mol/m2/s"),
+    C("apar_canopy", apar_canopy, "umol/m2/s"),
+    C("trans_canopy", trans_canopy, "mm/30min"),
+    C("tleaf", tleaf_new, "degC")
+};
+
+const int num_subdaily_output_vars = (int)ARRAY_SIZE(subdaily_output_vars);
+
+static const char *aggregate_names[] = { "mean", "sum", "min", "max" };
+
+/* what the binary output has always had */
+static const char *binary_default[] = {
+    "shoot", "lai", "branch", "stem", "root",
+    "wtfac_root", "pawater_root", "transpiration", "soil_evap",
+    "canopy_evap", "runoff",
+    "npp"
+};
+
+
+int find_output_var(const char *name) {
+    /* index of the variable in the registry, -1 if there isn't one */
+    int i;
+
+    for (i = 0; i < num_output_vars; i++) {
+        if (strcasecmp(output_vars[i].name, name) == 0)
+            return (i);
+    }
+    return (-1);
+}
+
+void select_output_vars(control *c, char *list) {
+    /*
+        The comma separated variables of [output] variables, in the order
+        given, each optionally followed by its decimals and/or how it is
+        aggregated as name:digits:how. The year and doy are always written
+        so asking for them is allowed but does nothing.
+    */
+    char *name, *next, *opt, *end;
+    int   i, ndigits, how;
+
+    c->num_out_vars = 0;
+    for (name = list; name != NULL; name = next) {
+        if ((next = strchr(name, ',')) != NULL)
+            *next++ = '\0';
+        ndigits = -1;
+        how = -1;
+        for (opt = strchr(name, ':'); opt != NULL; opt = end) {
+            *opt++ = '\0';
+            if ((end = strchr(opt, ':')) != NULL)
+                *end = '\0';
+            opt = rstrip(lskip(opt));
+            if (isdigit((unsigned char)*opt)) {
+                ndigits = atoi(opt);
+                if (strspn(opt, "0123456789") != strlen(opt) ||
+                    ndigits > MAX_OUTPUT_DIGITS) {
+                    fprintf(stderr, "Unknown output precision: %s\n", opt);
+                    gday_exit(EXIT_FAILURE);
+                }
+            } else if ((how = find_aggregate(opt)) < 0) {
+                fprintf(stderr, "Unknown aggregate option: %s\n", opt);
+                gday_exit(EXIT_FAILURE);
+            }
+            if (end != NULL)
+                *end = ':';
+        }
+        name = rstrip(lskip(name));
+        if (*name == '\0' || strcasecmp(name, "year") == 0 ||
+            strcasecmp(name, "doy") == 0)
+            continue;
+
+        if ((i = find_output_var(name)) < 0) {
+            fprintf(stderr, "Unknown output variable: %s\n", name);
+            gday_exit(EXIT_FAILURE);
+        }
+        if (c->num_out_vars == MAX_OUTPUT_VARS) {
+            fprintf(stderr, "Too many output variables, max is %d\n",
+                    MAX_OUTPUT_VARS);
+            gday_exit(EXIT_FAILURE);
+        }
+        c->out_digits[c->num_out_vars] = ndigits;
+        c->out_how[c->num_out_vars] = how;
+        c->out_vars[c->num_out_vars++] = i;
+    }
+
+    return;
+}
+
+int find_aggregate(const char *name) {
+    /* the AGG_ called name, -1 if there isn't one */
+    int i;
+
+    for (i = 0; i < (int)ARRAY_SIZE(aggregate_names); i++) {
+        if (strcasecmp(aggregate_names[i], name) == 0)
+            return (i);
+    }
+    return (-1);
+}
+
+void aggregation_period(control *c, int year, int doy, int *pyear,
+                        int *period) {
+    /*
+        The period (month 1-12, season 1-4 or just the year) that day doy
+        (1 = 1st Jan) of year is aggregated into, and the year it counts
+        as, which for December in a seasonal run is the next one.
+    */
+    static const int month_end[] = {
+        31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334, 365
+    };
+    int month, leap = is_leap_year(year) ? 1 : 0;
+
+    for (month = 0; month < 11; month++) {
+        if (doy <= month_end[month] + (month >= 1 ? leap : 0))
+            break;
+    }
+    month++;
+
+    *pyear = year;
+    if (c->print_options == MONTHLY) {
+        *period = month;
+    } else if (c->print_options == SEASONAL) {
+        *period = (month % 12) / 3 + 1;
+        if (month == 12)
+            *pyear = year + 1;
+    } else {
+        *period = 0;
+    }
+
+    return;
+}
+
+void default_output_vars(control *c) {
+    /* the columns written when [output] variables wasn't given */
+    int i;
+
+    if (c->output_ascii) {
+        for (i = 0; i < num_output_vars; i++)
+            c->out_vars[i] = i;
+        c->num_out_vars = num_output_vars;
+    } else {
+        for (i = 0; i < (int)ARRAY_SIZE(binary_default); i++)
+            c->out_vars[i] = find_output_var(binary_default[i]);
+        c->num_out_vars = (int)ARRAY_SIZE(binary_default);
+    }
+    for (i = 0; i < c->num_out_vars; i++) {
+        c->out_digits[i] = -1;
+        c->out_how[i] = -1;
+    }
+
+    return;
+}
+
+double output_var_value(control *c, canopy_wk *cw, fluxes *f, state *s,
+                        const output_var *v) {
+    /* the variable's value now */
+    switch (v->where) {
+    case OUT_STATE:
+        return (*(double *)((char *)s + v->offset));
+    case OUT_FLUXES:
+        return (*(double *)((char *)f + v->offset));
+    case OUT_CANOPY:
+        return (*(double *)((char *)cw + v->offset));
+    default:
+        if (c->water_balance == HYDRAULICS)
+            return (s->water_frac[v->offset]);
+        return (OUT_MISSING);
+    }
+}
@@ -0,0 +1,187 @@
+/* ============================================================================
+* Output files written on a thread of their own.
+*
+* With async_output set in [output] a run's daily and sub-daily records
+* don't go to the files from the day loop, where a slow disk holds up the
+* model, but into a ring of OUTPUT_WRITER_SLOTS buffers which a writer
+* thread empties into the files. The model only waits for it when the ring
+* is full, i.e. when the disk really can't keep up.
+*
+* NOTES:
+*   There is one model thread filling the ring and one writer thread
+*   emptying it: the model fills the buffer at head and then moves head
+*   on, the writer writes out the buffer at tail and then moves tail on,
+*   and each only ever sets its own counter. The counters only go up, a
+*   buffer being counter % OUTPUT_WRITER_SLOTS. The lock is only held to
+*   move a counter or look at the other's, never while a buffer is being
+*   filled or written out.
+*
+*   So this isn't a lock-free single producer/single consumer ring. With
+*   the counters as atomics the lock would go, but a side that found the
+*   ring full (or empty) would have to spin or sleep. Here each side takes
+*   the lock once per OUTPUT_WRITER_SLOT_LEN (64 KB) buffer, which costs
+*   next to nothing beside filling or writing the buffer, and in return it
+*   can block.
+*
+*   A buffer holds bytes for one file. Records are collected into it until
+*   it is full or one for another file comes along, so the files are
+*   written in large blocks, in the order the model wrote them.
+*
+*   Neither side has anything to do while it waits (the model for a free
+*   buffer, the writer for a full one), so it blocks on moved, which the
+*   other signals whenever it moves its counter. Both can't be waiting at
+*   once, the ring can't be full and empty, so one signal is always
+*   enough. close_output_writer hands over the last buffer and waits for
+*   the writer to finish, on the way out of a run that failed as well (see
+*   close_output_files), so nothing the model wrote is lost. A buffer the
+*   writer couldn't write out fails the run. The header and the END file
+*   aren't part of this, they are written before the writer starts and
+*   after it has finished.
+*
+* =========================================================================== */
+#include "output_writer.h"
+#include "gday_thread.h"
+
+typedef struct {
+    FILE   *fp;
+    size_t  len;
+    char    data[OUTPUT_WRITER_SLOT_LEN];
+} writer_slot;
+
+struct output_writer {
+    gday_thread     thread;
+    gday_mutex      lock;           /* over head, tail and closing */
+    gday_cond       moved;          /* head or tail moved on, or closing */
+    long            head;           /* buffers handed over, model's */
+    long            tail;           /* buffers written out, writer's */
+    int             closing;
+    int             filling;        /* model has the buffer at head */
+    int             error;          /* writer failed to write something */
+    writer_slot     slots[OUTPUT_WRITER_SLOTS];
+};
+
+static void  writer_thread(void *);
+static void  hand_over(output_writer *);
+static void  free_writer(output_writer *);
+
+
+output_writer *open_output_writer(void) {
+    /* start a writer, NULL if there can't be one */
+    output_writer *w;
+
+    if ((w = (output_writer *)calloc(1, sizeof(output_writer))) == NULL)
+        return (NULL);
+    mutex_init(&(w->lock));
+    cond_init(&(w->moved));
+    if (thread_start(&(w->thread), writer_thread, w) != 0) {
+        free_writer(w);
+        return (NULL);
+    }
+
+    return (w);
+}
+
+void output_writer_put(output_writer *w, FILE *fp, const void *data,
+                       size_t len) {
+    /* have len bytes written to fp, in order after anything before */
+    const char  *from = (const char *)data;
+    writer_slot *slot;
+    size_t       n;
+
+    while (len > 0) {
+        if (w->filling && w->slots[w->head % OUTPUT_WRITER_SLOTS].fp != fp)
+            hand_over(w);
+
+        if (! w->filling) {
+            /* wait for the writer to free a buffer, see NOTES */
+            mutex_lock(&(w->lock));
+            while (w->head - w->tail >= OUTPUT_WRITER_SLOTS)
+                cond_wait(&(w->moved), &(w->lock));
+            mutex_unlock(&(w->lock));
+            slot = &(w->slots[w->head % OUTPUT_WRITER_SLOTS]);
+            slot->fp = fp;
+            slot->len = 0;
+            w->filling = TRUE;
+        }
+
+        slot = &(w->slots[w->head % OUTPUT_WRITER_SLOTS]);
+        n = MIN(len, OUTPUT_WRITER_SLOT_LEN - slot->len);
+        memcpy(slot->data + slot->len, from, n);
+        slot->len += n;
+        from += n;
+        len -= n;
+        if (slot->len == OUTPUT_WRITER_SLOT_LEN)
+            hand_over(w);
+    }
+
+    return;
+}
+
+int close_output_writer(output_writer *w) {
+    /*
+        Write out everything that was put and stop the writer. Returns 0 if
+        all of it was written.
+    */
+    int error;
+
+    if (w->filling)
+        hand_over(w);
+    mutex_lock(&(w->lock));
+    w->closing = TRUE;
+    cond_signal(&(w->moved));
+    mutex_unlock(&(w->lock));
+    thread_join(w->thread);
+    error = w->error;
+    free_writer(w);
+
+    return (error);
+}
+
+static void hand_over(output_writer *w) {
+    /* the buffer at head is ready to be written out */
+    w->filling = FALSE;
+    mutex_lock(&(w->lock));
+    w->head++;
+    cond_signal(&(w->moved));
+    mutex_unlock(&(w->lock));
+
+    return;
+}
+
+static void free_writer(output_writer *w) {
+
+    cond_free(&(w->moved));
+    mutex_free(&(w->lock));
+    free(w);
+
+    return;
+}
+
+static void writer_thread(void *arg) {
+    output_writer *w = (output_writer *)arg;
+    writer_slot   *slot;
+    long           tail = w->tail;
+
+    for (;;) {
+        /* everything handed over before closing is written out first */
+        mutex_lock(&(w->lock));
+        while (w->head == tail && ! w->closing)
+            cond_wait(&(w->moved), &(w->lock));
+        if (w->head == tail) {
+            mutex_unlock(&(w->lock));
+            break;
+        }
+        mutex_unlock(&(w->lock));
+
+        slot = &(w->slots[tail % OUTPUT_WRITER_SLOTS]);
+        if (fwrite(slot->data, 1, slot->len, slot->fp) != slot->len)
+            w->error = TRUE;
+
+        mutex_lock(&(w->lock));
+        w->tail = ++tail;
+        cond_signal(&(w->moved));
+        mutex_unlock(&(w->lock));
+    }
+
+    return;
+}
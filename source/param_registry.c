@@ -0,0 +1,670 @@
+/* ============================================================================
+* Param file keys.
+*
+* Every key the param (.ini) file can have is listed here, once, with the
+* section it goes in, the field of the control, params or state structure
+* it sets, how its value is read and its units. Reading the file
+* (read_param_file.c), writing the final state back out
+* (write_output_file.c) and anything else that sets a value by name all
+* go through it, so a new key is a line here and nothing else.
+*
+* Keys and sections are matched whatever their case, and so are the
+* true/false of a flag and the names of an option (e.g. print_options =
+* Daily, daily or DAILY). Outside of a param file a key goes by
+* "section.key", or just "key" for one in [params] (see find_ini_name).
+*
+* NOTES:
+*   A key is found with a perfect hash of its section and name, built the
+*   first time one is looked up: the keys are split into INI_BUCKETS
+*   buckets by one hash, then each bucket gets a seed for a second hash
+*   which puts all of its keys into empty slots of a table of INI_SLOTS.
+*   So finding a key is two hashes and a compare, rather than the compare
+*   with every key before it that the chain of ifs there used to be took.
+*
+* =========================================================================== */
+#include "param_registry.h"
+#include "gday_thread.h"
+
+#define INI_SLOTS   1024    /* power of 2, well over the number of keys */
+#define INI_BUCKETS 256
+#define INI_SEEDS   100000  /* to try for a bucket before giving up */
+
+#define FIELD(type, x) offsetof(type, x), sizeof(((type *)0)->x)
+#define P(x, u)  { "params", #x, INI_DOUBLE, INI_PARAMS, FIELD(params, x), u, \
+                   NULL, NULL, NULL, FALSE, FALSE }
+#define PW(x, u) { "params", #x, INI_DOUBLE, INI_PARAMS, FIELD(params, x), u, \
+                   NULL, NULL, NULL, TRUE, FALSE }
+#define PI(x)    { "params", #x, INI_INT, INI_PARAMS, FIELD(params, x), "", \
+                   NULL, NULL, NULL, FALSE, FALSE }
+#define PS(x)    { "params", #x, INI_STRING, INI_PARAMS, FIELD(params, x), "", \
+                   NULL, NULL, NULL, FALSE, FALSE }
+#define S(x, u)  { "state", #x, INI_DOUBLE, INI_STATE, FIELD(state, x), u, \
+                   NULL, NULL, NULL, TRUE, FALSE }
+#define S0(x, u) { "state", #x, INI_DOUBLE, INI_STATE, FIELD(state, x), u, \
+                   NULL, NULL, NULL, FALSE, FALSE }
+#define I(sec, x) { sec, #x, INI_INT, INI_CONTROL, FIELD(control, x), "", \
+                    NULL, NULL, NULL, FALSE, FALSE }
+#define B(sec, x, what) BX(sec, x, x, what)
+#define BX(sec, key, x, what) { sec, #key, INI_BOOL, INI_CONTROL, \
+                                FIELD(control, x), "", what, NULL, NULL, \
+                                FALSE, FALSE }
+#define O(x, what) { "control", #x, INI_OPTION, INI_CONTROL, \
+                     FIELD(control, x), "", what, x##_opts, NULL, FALSE, \
+                     FALSE }
+#define STR(sec, x) { sec, #x, INI_STRING, INI_CONTROL, FIELD(control, x), \
+                      "", NULL, NULL, NULL, FALSE, FALSE }
+#define X(sec, key, x, fn) { sec, #key, INI_SPECIAL, INI_CONTROL, \
+                             FIELD(control, x), "", NULL, NULL, fn, FALSE, \
+                             FALSE }
+
+/* [control] keys that are settings of the run rather than of the model */
+#define RUN_B(x, what) { "control", #x, INI_BOOL, INI_CONTROL, \
+                         FIELD(control, x), "", what, NULL, NULL, FALSE, \
+                         TRUE }
+#define RUN_I(x) { "control", #x, INI_INT, INI_CONTROL, FIELD(control, x), \
+                   "", NULL, NULL, NULL, FALSE, TRUE }
+#define RUN_O(x, what) { "control", #x, INI_OPTION, INI_CONTROL, \
+                         FIELD(control, x), "", what, x##_opts, NULL, FALSE, \
+                         TRUE }
+
+static void set_out_fname_hdr(control *, params *, state *, char *);
+static void set_variables(control *, params *, state *, char *);
+static void set_precision(control *, params *, state *, char *);
+static void set_aggregate(control *, params *, state *, char *);
+static void set_arrow_batch(control *, params *, state *, char *);
+static void set_water_balance(control *, params *, state *, char *);
+static void set_water_stress(control *, params *, state *, char *);
+static void build_hash(void);
+static unsigned int key_hash(const char *, const char *, unsigned int);
+
+static const ini_option alloc_model_opts[] = {
+    { "fixed", FIXED }, { "grasses", GRASSES }, { "allometric", ALLOMETRIC },
+    { "sgs", SGS }, { "hufken", HUFKEN }, { NULL, 0 }
+};
+static const ini_option assim_model_opts[] = {
+    { "bewdy", BEWDY }, { "mate", MATE }, { NULL, 0 }
+};
+static const ini_option gs_model_opts[] = {
+    { "medlyn", MEDLYN }, { NULL, 0 }
+};
+static const ini_option print_options_opts[] = {
+    { "subdaily", SUBDAILY }, { "daily", DAILY }, { "end", END },
+    { "monthly", MONTHLY }, { "seasonal", SEASONAL }, { "annual", ANNUAL },
+    { NULL, 0 }
+};
+static const ini_option ps_pathway_opts[] = {
+    /* "end" has always been taken as C4 */
+    { "c3", C3 }, { "c4", C4 }, { "end", C4 }, { NULL, 0 }
+};
+static const ini_option respiration_model_opts[] = {
+    { "fixed", FIXED }, { "vary", VARY }, { NULL, 0 }
+};
+static const ini_option spinup_method_opts[] = {
+    { "brute", BRUTE }, { "sas", SAS }, { "anderson", ANDERSON }, { NULL, 0 }
+};
+static const ini_option soil_drainage_opts[] = {
+    { "gravity", GRAVITY }, { "cascading", CASCADING }, { NULL, 0 }
+};
+
+const ini_key ini_keys[] = {
+    /* GIT */
+    STR("git", git_hash),
+
+    /* FILES */
+    STR("files", cfg_fname),
+    STR("files", met_fname),
+    STR("files", out_fname),
+    STR("files", out_subdaily_fname),
+    X("files", out_fname_hdr, out_fname_hdr, set_out_fname_hdr),
+    STR("files", out_param_fname),
+    STR("files", checkpoint_fname),
+    STR("files", restart_fname),
+    STR("files", spinup_cache_dir),
+
+    /* OUTPUT */
+    X("output", variables, out_vars, set_variables),
+    X("output", precision, out_precision, set_precision),
+    X("output", aggregate, out_aggregate, set_aggregate),
+    B("output", async_output, "async_output option"),
+    BX("output", arrow, output_arrow, "arrow option"),
+    X("output", arrow_batch, arrow_batch, set_arrow_batch),
+    STR("output", site_id),
+
+    /* CONTROL */
+    B("control", adjust_rtslow, "adjust_rtslow option"),
+    O(alloc_model, "alloc model"),
+    O(assim_model, "photosynthesis model"),
+    B("control", calc_sw_params, "SW param option"),
+    RUN_I(checkpoint_interval),
+    B("control", deciduous_model, "deciduous option"),
+    B("control", disturbance, "disturbance option"),
+    B("control", exudation, "exudation option"),
+    B("control", fixed_stem_nc, "fixed_stem_nc option"),
+    B("control", fixed_lai, "fixed_lai option"),
+    B("control", fixleafnc, "fixleafnc option"),
+    I("control", grazing),
+    O(gs_model, "gs model"),
+    B("control", hurricane, "hurricane option"),
+    B("control", model_optroot, "model_optroot option"),
+    I("control", modeljm),
+    B("control", ncycle, "ncycle option"),
+    I("control", nuptake_model),
+    RUN_B(output_ascii, "output_ascii option"),
+    B("control", passiveconst, "passiveconst option"),
+    RUN_O(print_options, "print option"),
+    O(ps_pathway, "ps pathway"),
+    O(respiration_model, "respiration model"),
+    O(spinup_method, "spinup method"),
+    O(soil_drainage, "soil_drainage option"),
+    B("control", sub_daily, "sub_daily option"),
+    RUN_B(stream_met, "stream_met option"),
+    I("control", strfloat),
+    I("control", sw_stress_model),
+    I("control", use_eff_nc),
+    RUN_B(verify_met_cache, "verify_met_cache option"),
+    X("control", water_balance, water_balance, set_water_balance),
+    B("control", water_store, "water_store option"),
+    X("control", water_stress, water_stress, set_water_stress),
+
+    /* STATE */
+    S(activesoil, "t/ha"),
+    S(activesoiln, "t/ha"),
+    S(age, "years"),
+    S(avg_albranch, ""),
+    S(avg_alcroot, ""),
+    S(avg_alleaf, ""),
+    S(avg_alroot, ""),
+    S(avg_alstem, ""),
+    S(branch, "t/ha"),
+    S(branchn, "t/ha"),
+    S(canht, "m"),
+    S(croot, "t/ha"),
+    S(crootn, "t/ha"),
+    S(cstore, "t/ha"),
+    S(inorgn, "t/ha"),
+    S(lai, "m2/m2"),
+    S(metabsoil, "t/ha"),
+    S(metabsoiln, "t/ha"),
+    S(metabsurf, "t/ha"),
+    S(metabsurfn, "t/ha"),
+    S(nstore, "t/ha"),
+    S(passivesoil, "t/ha"),
+    S(passivesoiln, "t/ha"),
+    S(pawater_root, "mm"),
+    S(pawater_topsoil, "mm"),
+    S(prev_sma, ""),
+    S(root, "t/ha"),
+    S(root_depth, "m"),
+    S(rootn, "t/ha"),
+    S(sapwood, "t/ha"),
+    S(shoot, "t/ha"),
+    S(shootn, "t/ha"),
+    S(sla, "m2/kg"),
+    S(slowsoil, "t/ha"),
+    S(slowsoiln, "t/ha"),
+    S(stem, "t/ha"),
+    S(stemn, "t/ha"),
+    S(stemnimm, "t/ha"),
+    S(stemnmob, "t/ha"),
+    S(structsoil, "t/ha"),
+    S(structsoiln, "t/ha"),
+    S(structsurf, "t/ha"),
+    S(structsurfn, "t/ha"),
+    S0(nsc, "t/ha"),
+
+    /* PARAMS */
+    P(actncmax, "gN/gC"),
+    P(actncmin, "gN/gC"),
+    P(a0rhizo, ""),
+    P(a1rhizo, ""),
+    P(adapt, ""),
+    P(ageold, ""),
+    P(ageyoung, ""),
+    P(albedo, ""),
+    P(alpha_c4, ""),
+    P(alpha_j, ""),
+    P(b_root, ""),
+    P(b_topsoil, ""),
+    P(bdecay, "1/yr"),
+    P(branch0, ""),
+    P(branch1, ""),
+    P(capac, ""),
+    P(c_alloc_bmax, ""),
+    P(c_alloc_bmin, ""),
+    P(c_alloc_cmax, ""),
+    P(c_alloc_fmax, ""),
+    P(c_alloc_fmin, ""),
+    P(c_alloc_rmax, ""),
+    P(c_alloc_rmin, ""),
+    P(cfracts, ""),
+    P(crdecay, "1/yr"),
+    P(cretrans, ""),
+    P(croot0, ""),
+    P(croot1, ""),
+    P(ctheta_root, ""),
+    P(ctheta_topsoil, ""),
+    P(cue, ""),
+    P(d0, ""),
+    P(d0x, ""),
+    P(d1, ""),
+    P(delsj, "J mol-1 K-1"),
+    P(density, "kg DM m-3"),
+    P(direct_frac, ""),
+    P(displace_ratio, ""),
+    PI(disturbance_doy),
+    P(dz0v_dh, ""),
+    P(eac, "J mol-1"),
+    P(eag, "J mol-1"),
+    P(eaj, "J mol-1"),
+    P(eao, "J mol-1"),
+    P(eav, "J mol-1"),
+    P(edj, "J mol-1"),
+    P(faecescn, ""),
+    P(faecesn, ""),
+    P(fdecay, "1/yr"),
+    P(q, ""),
+    P(q_s, ""),
+    PI(use_cover),
+    PS(year_harvest),
+    PS(doy_harvest),
+    P(fdecaydry, "1/yr"),
+    P(fhw, ""),
+    P(finesoil, ""),
+    P(fix_lai, ""),
+    P(fracfaeces, ""),
+    P(fracteaten, ""),
+    P(fractosoil, ""),
+    P(fractup_soil, ""),
+    P(fretrans, ""),
+    P(g1, ""),
+    P(gamstar25, "umol mol-1"),
+    P(growth_efficiency, ""),
+    P(gs_min, ""),
+    P(height0, "m"),
+    P(height1, "m"),
+    P(heighto, ""),
+    P(htpower, ""),
+    P(intercep_frac, ""),
+    P(jmax, "umol m-2 s-1"),
+    P(jmaxna, ""),
+    P(jmaxnb, ""),
+    P(jv_intercept, ""),
+    P(jv_slope, ""),
+    P(kp, ""),
+    P(kc25, "mmol mol-1"),
+    P(kdec1, "1/yr"),
+    P(kdec2, "1/yr"),
+    P(kdec3, "1/yr"),
+    P(kdec4, "1/yr"),
+    P(kdec5, "1/yr"),
+    P(kdec6, "1/yr"),
+    P(kdec7, "1/yr"),
+    P(ko25, "umol mol-1"),
+    P(kq10, ""),
+    P(kr, ""),
+    P(kn, ""),
+    P(lad, ""),
+    P(lai_closed, ""),
+    P(latitude, "degrees"),
+    P(layer_thickness, "m"),
+    P(leafsap0, "mm^2/mm^2"),
+    P(leafsap1, "mm^2/mm^2"),
+    P(ligfaeces, ""),
+    P(ligroot, ""),
+    P(ligshoot, ""),
+    P(liteffnc, ""),
+    P(longitude, "degrees"),
+    P(max_depth, "m"),
+    P(max_intercep_lai, ""),
+    P(measurement_temp, "celsius"),
+    P(min_lwp, "MPa"),
+    P(ncbnew, ""),
+    P(ncbnewz, ""),
+    P(nccnew, ""),
+    P(nccnewz, ""),
+    P(ncmaxfold, ""),
+    P(ncmaxfyoung, ""),
+    P(ncmaxr, ""),
+    P(ncrfac, ""),
+    P(ncwimm, ""),
+    P(ncwimmz, ""),
+    P(ncwnew, ""),
+    P(ncwnewz, ""),
+    P(nf_crit, ""),
+    P(nf_min, ""),
+    PI(soil_layers),
+    P(nmax, ""),
+    P(nmin, "g/m2"),
+    P(nmin0, "g/m2"),
+    P(nmincrit, "g/m2"),
+    P(ntheta_root, ""),
+    P(ntheta_topsoil, ""),
+    P(nuptakez, "1/yr"),
+    P(oi, "umol mol-1"),
+    P(passivesoilnz, ""),
+    P(passivesoilz, ""),
+    P(passncmax, "gN/gC"),
+    P(passncmin, "gN/gC"),
+    P(prescribed_leaf_NC, ""),
+    PW(previous_ncd, ""),
+    P(psi_sat_root, "MPa"),
+    P(psi_sat_topsoil, "MPa"),
+    P(prime_y, ""),
+    P(prime_z, ""),
+    P(p50, ""),
+    P(plc_shape, ""),
+    P(qs, ""),
+    P(r0, "kg C/m3"),
+    P(rateloss, "1/yr"),
+    P(rateuptake, "1/yr"),
+    P(rdecay, "1/yr"),
+    P(rdecaydry, "1/yr"),
+    P(resp_coeff, ""),
+    P(retransmob, "1/yr"),
+    P(rfmult, ""),
+    P(rooting_depth, "mm"),
+    P(root_resist, ""),
+    PS(rootsoil_type),
+    P(root_exu_CUE, ""),
+    P(root_k, "g m-2"),
+    P(root_density, "g m-3"),
+    P(root_radius, "m"),
+    P(rretrans, ""),
+    P(sapturnover, "1/yr"),
+    P(sla, "m2/kg"),
+    P(slamax, "m2/kg"),
+    P(slazero, "m2/kg"),
+    P(slowncmax, "gN/gC"),
+    P(slowncmin, "gN/gC"),
+    P(store_transfer_len, ""),
+    P(structcn, ""),
+    P(structrat, ""),
+    P(targ_sens, ""),
+    P(theta, ""),
+    P(theta_fc_root, ""),
+    P(theta_fc_topsoil, ""),
+    P(theta_sp_root, ""),
+    P(theta_sp_topsoil, ""),
+    P(theta_wp_root, ""),
+    P(theta_wp_topsoil, ""),
+    P(topsoil_depth, "mm"),
+    PS(topsoil_type),
+    P(vcmax, "umol m-2 s-1"),
+    P(vcmaxna, ""),
+    P(vcmaxnb, ""),
+    P(watdecaydry, ""),
+    P(watdecaywet, ""),
+    P(wcapac_root, "mm"),
+    P(wcapac_topsoil, "mm"),
+    P(wdecay, "1/yr"),
+    P(wetloss, "mm/day"),
+    P(wretrans, ""),
+    P(z0h_z0m, ""),
+    P(green_sw_frac, ""),
+    PI(days_rain),
+};
+
+const int num_ini_keys = (int)ARRAY_SIZE(ini_keys);
+
+static short        slot_key[INI_SLOTS];     /* -1 if the slot is empty */
+static unsigned int bucket_seed[INI_BUCKETS];
+static gday_once    hash_built = GDAY_ONCE_INIT;
+
+
+const ini_key *find_ini_key(const char *section, const char *name) {
+    /* the key name of [section], NULL if there isn't one */
+    const ini_key *k;
+    unsigned int   b;
+    int            i;
+
+    thread_once(&hash_built, build_hash);
+    b = key_hash(section, name, 0) % INI_BUCKETS;
+    i = slot_key[key_hash(section, name, bucket_seed[b]) & (INI_SLOTS - 1)];
+    if (i < 0)
+        return (NULL);
+
+    k = &(ini_keys[i]);
+    if (strcasecmp(k->section, section) != 0 ||
+        strcasecmp(k->name, name) != 0)
+        return (NULL);
+
+    return (k);
+}
+
+const ini_key *find_ini_name(const char *name) {
+    /*
+        The key called name on its own, as "section.key", or as just "key"
+        for one in [params]. NULL if there isn't one.
+    */
+    char        section[STRING_LENGTH];
+    const char *dot;
+
+    if ((dot = strchr(name, '.')) == NULL)
+        return (find_ini_key("params", name));
+    if ((size_t)(dot - name) >= sizeof(section))
+        return (NULL);
+    memcpy(section, name, dot - name);
+    section[dot - name] = '\0';
+
+    return (find_ini_key(section, dot + 1));
+}
+
+void set_ini_value(control *c, params *p, state *s, const ini_key *k,
+                   char *value) {
+    /* set the key's field from the value it has in the param file */
+    const ini_option *opt;
+    void             *field = ini_field(c, p, s, k);
+
+    switch (k->type) {
+    case INI_DOUBLE:
+        *(double *)field = atof(value);
+        break;
+    case INI_INT:
+        *(int *)field = atoi(value);
+        break;
+    case INI_BOOL:
+        if (strcasecmp(value, "false") == 0) {
+            *(int *)field = FALSE;
+        } else if (strcasecmp(value, "true") == 0) {
+            *(int *)field = TRUE;
+        } else {
+            fprintf(stderr, "Unknown %s: %s\n", k->what, value);
+            gday_exit(EXIT_FAILURE);
+        }
+        break;
+    case INI_OPTION:
+        for (opt = k->options; opt->name != NULL; opt++) {
+            if (strcasecmp(opt->name, value) == 0)
+                break;
+        }
+        if (opt->name == NULL) {
+            fprintf(stderr, "Unknown %s: %s\n", k->what, value);
+            gday_exit(EXIT_FAILURE);
+        }
+        *(int *)field = opt->value;
+        break;
+    case INI_STRING:
+        strncpy0((char *)field, value, k->size);
+        break;
+    case INI_SPECIAL:
+        k->set(c, p, s, value);
+        break;
+    }
+
+    return;
+}
+
+int is_model_option(const ini_key *k) {
+    /*
+        Is the key one of the options the model itself runs by, i.e. in
+        [control] and not a setting of the run (files, outputs and such)?
+    */
+    return (k->where == INI_CONTROL && k->run == FALSE &&
+            strcasecmp(k->section, "control") == 0);
+}
+
+void *ini_field(control *c, params *p, state *s, const ini_key *k) {
+    /* where the key's value is kept */
+    if (k->where == INI_PARAMS)
+        return ((char *)p + k->offset);
+    else if (k->where == INI_STATE)
+        return ((char *)s + k->offset);
+    return ((char *)c + k->offset);
+}
+
+static void set_out_fname_hdr(control *c, params *p, state *s, char *value) {
+    /* the binary outputs carry their own header, see write_output_file.c */
+    fprintf(stderr, "Warning: out_fname_hdr is no longer written, %s won't "
+            "be made\n", value);
+    strncpy0(c->out_fname_hdr, value, sizeof(c->out_fname_hdr));
+
+    return;
+}
+
+static void set_variables(control *c, params *p, state *s, char *value) {
+    select_output_vars(c, value);
+
+    return;
+}
+
+static void set_precision(control *c, params *p, state *s, char *value) {
+    c->out_precision = atoi(value);
+    if (c->out_precision < 0 || c->out_precision > MAX_OUTPUT_DIGITS) {
+        fprintf(stderr, "Unknown output precision: %s\n", value);
+        gday_exit(EXIT_FAILURE);
+    }
+
+    return;
+}
+
+static void set_aggregate(control *c, params *p, state *s, char *value) {
+    if ((c->out_aggregate = find_aggregate(value)) < 0) {
+        fprintf(stderr, "Unknown aggregate option: %s\n", value);
+        gday_exit(EXIT_FAILURE);
+    }
+
+    return;
+}
+
+static void set_arrow_batch(control *c, params *p, state *s, char *value) {
+    c->arrow_batch = atoi(value);
+    if (c->arrow_batch < 1) {
+        fprintf(stderr, "Unknown arrow_batch option: %s\n", value);
+        gday_exit(EXIT_FAILURE);
+    }
+
+    return;
+}
+
+static void set_water_balance(control *c, params *p, state *s, char *value) {
+    /* anything but the hydraulics model is the bucket */
+    if (strcasecmp(value, "hydraulics") == 0)
+        c->water_balance = HYDRAULICS;
+    else
+        c->water_balance = BUCKET;
+
+    return;
+}
+
+static void set_water_stress(control *c, params *p, state *s, char *value) {
+    if (strcasecmp(value, "false") == 0) {
+        c->water_stress = FALSE;
+        fprintf(stderr, "\nYou have turned off the drought stress??\n");
+    } else if (strcasecmp(value, "true") == 0) {
+        c->water_stress = TRUE;
+    } else {
+        fprintf(stderr, "Unknown water stress option: %s\n", value);
+        gday_exit(EXIT_FAILURE);
+    }
+
+    return;
+}
+
+static void build_hash(void) {
+    /*
+        Find each bucket a seed that puts its keys in empty slots, the
+        buckets with the most keys first, see NOTES. Two keys that are the
+        same would never fit, so they end up here as an error too.
+    */
+    int          nkeys[INI_BUCKETS], order[INI_BUCKETS];
+    int          bucket[ARRAY_SIZE(ini_keys)], slot[ARRAY_SIZE(ini_keys)];
+    int          key[ARRAY_SIZE(ini_keys)];
+    int          i, j, k, b, n, fits;
+    unsigned int seed;
+
+    memset(nkeys, 0, sizeof(nkeys));
+    for (i = 0; i < num_ini_keys; i++) {
+        bucket[i] = (int)(key_hash(ini_keys[i].section, ini_keys[i].name, 0) %
+                          INI_BUCKETS);
+        nkeys[bucket[i]]++;
+    }
+    for (b = 0; b < INI_BUCKETS; b++) {
+        order[b] = b;
+        bucket_seed[b] = 0;
+    }
+    for (i = 1; i < INI_BUCKETS; i++) {
+        for (j = i; j > 0 && nkeys[order[j]] > nkeys[order[j-1]]; j--) {
+            b = order[j];
+            order[j] = order[j-1];
+            order[j-1] = b;
+        }
+    }
+    for (i = 0; i < INI_SLOTS; i++)
+        slot_key[i] = -1;
+
+    for (j = 0; j < INI_BUCKETS && nkeys[order[j]] > 0; j++) {
+        b = order[j];
+        for (seed = 1; seed <= INI_SEEDS; seed++) {
+            fits = TRUE;
+            n = 0;
+            for (k = 0; k < num_ini_keys && fits; k++) {
+                if (bucket[k] != b)
+                    continue;
+                slot[n] = (int)(key_hash(ini_keys[k].section,
+                                         ini_keys[k].name, seed) &
+                                (INI_SLOTS - 1));
+                key[n] = k;
+                if (slot_key[slot[n]] >= 0)
+                    fits = FALSE;
+                for (i = 0; i < n && fits; i++) {
+                    if (slot[i] == slot[n])
+                        fits = FALSE;
+                }
+                n++;
+            }
+            if (fits)
+                break;
+        }
+        if (seed > INI_SEEDS) {
+            fprintf(stderr, "Can't build the param file keys' hash, is a key "
+                    "listed twice?\n");
+            gday_exit(EXIT_FAILURE);
+        }
+        bucket_seed[b] = seed;
+        for (i = 0; i < n; i++)
+            slot_key[slot[i]] = (short)key[i];
+    }
+
+    return;
+}
+
+static unsigned int key_hash(const char *section, const char *name,
+                             unsigned int seed) {
+    /* FNV-1a of "section.name" in lower case, then mixed up a bit more */
+    unsigned int h = 2166136261U ^ (seed * 0x9e3779b9U);
+    const char  *q;
+
+    for (q = section; *q != '\0'; q++)
+        h = (h ^ (unsigned char)tolower((unsigned char)*q)) * 16777619U;
+    h = (h ^ '.') * 16777619U;
+    for (q = name; *q != '\0'; q++)
+        h = (h ^ (unsigned char)tolower((unsigned char)*q)) * 16777619U;
+
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+
+    return (h);
+}
@@ -99,7 +99,7 @@ void phenology(control *c, fluxes *f, met_arrays *ma, params *p, state *s) {
 
     if (leaf_on_found == FALSE) {
         fprintf(stderr, "Problem in phenology leaf *ON* not found\n");
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
     }
 
 
@@ -407,7 +407,7 @@ void calc_ini_grass_pheno_stuff(control *c, met_arrays *ma, int project_day,
         *grass_temp_threshold = 5.0;
     else {
         fprintf(stderr, "Problem grass thresholds\n");
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
     }
 
     /*
@@ -359,7 +359,7 @@ void calculate_jmaxt_vcmaxt(control *c, canopy_wk *cw, params *p, state *s,
         *jmax = peaked_arrhenius(jmax25, p->eaj, tleaf, tref, p->delsj, p->edj);
     } else {
         fprintf(stderr, "You haven't set Jmax/Vcmax model: modeljm \n");
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
     }
 
     // reduce photosynthetic capacity with moisture stress
@@ -424,7 +424,7 @@ void calc_carbon_allocation_fracs(control* c, fluxes* f, fast_spinup* fs,
     }
 	else {
 		fprintf(stderr, "Unknown C allocation model: %d\n", c->alloc_model);
-		exit(EXIT_FAILURE);
+		gday_exit(EXIT_FAILURE);
 	}
 
 	///*printf("%f %f %f %f %f\n", f->alleaf, f->albranch + f->alstem, f->alroot,  f->alcroot, s->canht);*/
@@ -433,7 +433,7 @@ void calc_carbon_allocation_fracs(control* c, fluxes* f, fast_spinup* fs,
 	total_alloc = f->alroot + f->alleaf + f->albranch + f->alstem + f->alcroot;
 	if (total_alloc > 1.0 + EPSILON) {
 		fprintf(stderr, "Allocation fracs > 1: %.13f\n", total_alloc);
-		exit(EXIT_FAILURE);
+		gday_exit(EXIT_FAILURE);
 	}
 
 	//if (c->spinup_method == SAS) {
@@ -811,7 +811,7 @@ void carbon_daily_production(control *c, fluxes *f, met *m, params *p, state *s,
     }
     /* Estimate photosynthesis */
     if (c->assim_model == BEWDY){
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
     } else if (c->assim_model == MATE) {
         if (c->ps_pathway == C3) {
             mate_C3_photosynthesis(c, f, m, p, s, daylen, ncontent);
@@ -820,7 +820,7 @@ void carbon_daily_production(control *c, fluxes *f, met *m, params *p, state *s,
         }
     } else {
         fprintf(stderr,"Unknown photosynthesis model'");
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
     }
 
     /* Calculate plant respiration */
@@ -1473,7 +1473,7 @@ double calculate_nuptake(control *c, params *p, state *s) {
             nuptake = max(U0 * s->root / (s->root + Kr), U0) */
     } else {
         fprintf(stderr, "Unknown N uptake option\n");
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
     }
 
     return (nuptake);
@@ -1488,29 +1488,32 @@ void initialise_roots(fluxes *f, params *p, state *s) {
     // Using CABLE depths, but spread over 2 m.
     //double cable_thickness[7] = {0.01, 0.025, 0.067, 0.178, 0.472, 1.248, 2.0};
 
-    s->thickness = malloc(p->core * sizeof(double));
+    /* Kept from a previous site on this handle, p->core is fixed */
     if (s->thickness == NULL) {
-        fprintf(stderr, "malloc failed allocating thickness\n");
-        exit(EXIT_FAILURE);
-    }
+        s->thickness = malloc(p->core * sizeof(double));
+        if (s->thickness == NULL) {
+            fprintf(stderr, "malloc failed allocating thickness\n");
+            gday_exit(EXIT_FAILURE);
+        }
 
-    /* root mass is g biomass, i.e. ~twice the C content */
-    s->root_mass = malloc(p->core * sizeof(double));
-    if (s->root_mass == NULL) {
-        fprintf(stderr, "malloc failed allocating root_mass\n");
-        exit(EXIT_FAILURE);
-    }
+        /* root mass is g biomass, i.e. ~twice the C content */
+        s->root_mass = malloc(p->core * sizeof(double));
+        if (s->root_mass == NULL) {
+            fprintf(stderr, "malloc failed allocating root_mass\n");
+            gday_exit(EXIT_FAILURE);
+        }
 
-    s->root_length = malloc(p->core * sizeof(double));
-    if (s->root_length == NULL) {
-        fprintf(stderr, "malloc failed allocating root_length\n");
-        exit(EXIT_FAILURE);
-    }
+        s->root_length = malloc(p->core * sizeof(double));
+        if (s->root_length == NULL) {
+            fprintf(stderr, "malloc failed allocating root_length\n");
+            gday_exit(EXIT_FAILURE);
+        }
 
-    s->layer_depth = malloc(p->core * sizeof(double));
-    if (s->layer_depth == NULL) {
-        fprintf(stderr, "malloc failed allocating layer_depth\n");
-        exit(EXIT_FAILURE);
+        s->layer_depth = malloc(p->core * sizeof(double));
+        if (s->layer_depth == NULL) {
+            fprintf(stderr, "malloc failed allocating layer_depth\n");
+            gday_exit(EXIT_FAILURE);
+        }
     }
 
     // force a thin top layer = 0.1
@@ -1,312 +1,434 @@
+/* ============================================================================
+* Read the daily and sub-daily met forcing files.
+*
+* NOTES:
+*   The file is mapped into memory and read in a single pass over the bytes
+*   rather than once to count lines and again through sscanf. It is cut into
+*   line-aligned chunks, one per thread, and each thread first counts the
+*   data lines in its chunk; that gives every chunk the row it starts on, so
+*   the threads can then parse their rows straight into the met arrays.
+*   Small files are done on the calling thread. A fresh binary cache next
+*   to the met file is mapped instead of reading it at all, see met_cache.c.
+*
+*   Rows are parsed field by field with parse_met_number. Plain decimals
+*   whose digits fit a double exactly are scaled by an exact power of ten,
+*   which is correctly rounded (Clinger's fast path), and anything else goes to
+*   strtod, so the values are bit for bit what sscanf gave. The same rows
+*   are accepted: comma separated, white space allowed before a number but
+*   not before a comma, and anything after the last field ignored. Comment
+*   lines start with '#' and errors give the line number in the file.
+*
+* References:
+* ----------
+* * Clinger, W. D. (1990) How to read floating point numbers accurately,
+*   PLDI '90, 92-101.
+*
+* =========================================================================== */
+#include <float.h>
 #include "read_met_file.h"
+#include "met_cache.h"
+#include "met_window.h"
+#include "gday_thread.h"
 
-void read_daily_met_data(char **argv, control *c, met_arrays *ma)
-{
-    FILE  *fp;
-    char   line[STRING_LENGTH];
-    int    file_len = 0;
-    int    i = 0;
-    int    nvars = 21;
-    int    skipped_lines = 0;
-    double current_yr = -999.9;
-
-    if ((fp = fopen(c->met_fname, "r")) == NULL) {
-		fprintf(stderr, "Error: couldn't open daily Met file %s for read\n",
-                c->met_fname);
-		exit(EXIT_FAILURE);
-	 }
-
-    /* work out how big the file is */
-    file_len = 0;
-    while (fgets(line, STRING_LENGTH, fp) != NULL) {
-        /* ignore comment line */
-        if (*line == '#')
-            continue;
-        file_len++;
-    }
-    rewind(fp);
-    c->total_num_days = file_len;
+#define MET_CHUNK_SIZE  (1 << 20)   /* smallest chunk worth a thread, bytes */
+#define MAX_MET_THREADS 16
 
-    /* allocate memory for meteorological arrays */
-    if ((ma->year = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for year array\n");
-		exit(EXIT_FAILURE);
-    }
+static void read_met_data(control *, met_arrays *, int);
+static void count_chunk(void *);
+static void run_chunks(met_chunk *, int, void (*)(void *));
+static void size_met_array(double **, long, long, char *);
 
-    if ((ma->prjday = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for prjday array\n");
-		exit(EXIT_FAILURE);
-    }
+void read_daily_met_data(control *c, met_arrays *ma)
+{
+    read_met_data(c, ma, FALSE);
+    return;
+}
 
-    if ((ma->tair = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for tair array\n");
-		exit(EXIT_FAILURE);
-    }
+void read_subdaily_met_data(control *c, met_arrays *ma)
+{
+    read_met_data(c, ma, TRUE);
+    return;
+}
 
-    if ((ma->rain = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for rain array\n");
-		exit(EXIT_FAILURE);
-    }
+static void read_met_data(control *c, met_arrays *ma, int sub_daily)
+{
+    /* from the binary cache next to the met file if it's up to date */
+    long file_len;
 
-    if ((ma->tsoil = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for tsoil array\n");
-		exit(EXIT_FAILURE);
-    }
+    if ((file_len = load_met_cache(c, ma, sub_daily)) < 0)
+        file_len = read_met_csv(c, ma, sub_daily);
 
-    if ((ma->tam = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for tam array\n");
-		exit(EXIT_FAILURE);
+    if (sub_daily) {
+        /* output is daily, so correct for n_timesteps */
+        c->total_num_days = file_len / 48;
+    } else {
+        c->total_num_days = file_len;
     }
 
-    if ((ma->tpm = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for tpm array\n");
-		exit(EXIT_FAILURE);
-    }
+    return;
+}
 
-    if ((ma->tmin = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for tmin array\n");
-		exit(EXIT_FAILURE);
-    }
+int met_columns(met_arrays *ma, int sub_daily, double ***arrays,
+                char **names)
+{
+    /*
+        The met file columns in order, as where each goes in ma (NULL if it
+        isn't kept) and its name. Returns the number of columns.
+    */
+    static char *daily_names[N_DAILY_VARS] = {
+        "year", "prjday", "tair", "rain", "tsoil", "tam", "tpm", "tmin",
+        "tmax", "tday", "vpd_am", "vpd_pm", "co2", "ndep", "nfix", "wind",
+        "press", "wind_am", "wind_pm", "par_am", "par_pm"
+    };
+    static char *subdaily_names[N_SUBDAILY_VARS] = {
+        "year", "doy", "hod", "rain", "par", "tair", "tsoil", "vpd", "co2",
+        "ndep", "nfix", "wind", "press"
+    };
+    double **daily[N_DAILY_VARS] = {
+        &(ma->year), &(ma->prjday), &(ma->tair), &(ma->rain),
+        &(ma->tsoil), &(ma->tam), &(ma->tpm), &(ma->tmin), &(ma->tmax),
+        &(ma->tday), &(ma->vpd_am), &(ma->vpd_pm), &(ma->co2),
+        &(ma->ndep), &(ma->nfix), &(ma->wind), &(ma->press),
+        &(ma->wind_am), &(ma->wind_pm), &(ma->par_am), &(ma->par_pm)
+    };
+
+    /* the hour of day column is read but not kept */
+    double **subdaily[N_SUBDAILY_VARS] = {
+        &(ma->year), &(ma->doy), NULL, &(ma->rain), &(ma->par),
+        &(ma->tair), &(ma->tsoil), &(ma->vpd), &(ma->co2), &(ma->ndep),
+        &(ma->nfix), &(ma->wind), &(ma->press)
+    };
+    int n = sub_daily ? N_SUBDAILY_VARS : N_DAILY_VARS;
+
+    memcpy(arrays, sub_daily ? subdaily : daily, n * sizeof(double **));
+    memcpy(names, sub_daily ? subdaily_names : daily_names,
+           n * sizeof(char *));
+
+    return (n);
+}
 
-    if ((ma->tmax = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for tmax array\n");
-		exit(EXIT_FAILURE);
+long read_met_csv(control *c, met_arrays *ma, int sub_daily)
+{
+    /*
+        Read the met file (never the cache) into ma, sizing the arrays to
+        it. Sets c->num_years and returns the number of data rows.
+    */
+    mapped_file  mf;
+    met_chunk    chunks[MAX_MET_THREADS];
+    double     **arrays[MAX_MET_VARS], *cols[MAX_MET_VARS];
+    char        *names[MAX_MET_VARS];
+    const char  *p, *stop;
+    long         file_len, line, i;
+    int          nchunks, ncols, k;
+    double       current_yr;
+
+    /* the arrays might still belong to the last site's cache or window */
+    if (ma->cache.data != NULL || ma->window != NULL)
+        free_met_arrays(ma);
+    ncols = met_columns(ma, sub_daily, arrays, names);
+
+    if (! map_file(c->met_fname, FALSE, &mf)) {
+        fprintf(stderr, "Error: couldn't open %s Met file %s for read\n",
+                sub_daily ? "sub-daily" : "daily", c->met_fname);
+        gday_exit(EXIT_FAILURE);
+    }
+
+    /* cut the file into line-aligned chunks */
+    nchunks = (int)MAX(1, MIN(mf.size / MET_CHUNK_SIZE,
+                              (size_t)MIN(number_of_cpus(),
+                                          MAX_MET_THREADS)));
+    p = mf.data;
+    stop = mf.data + mf.size;
+    for (k = 0; k < nchunks; k++) {
+        chunks[k].start = p;
+        if (k == nchunks - 1) {
+            p = stop;
+        } else {
+            p = MAX(p, mf.data + mf.size / nchunks * (k + 1));
+            while (p < stop && p[-1] != '\n')
+                p++;
+        }
+        chunks[k].end = p;
+        chunks[k].ncols = ncols;
     }
+    run_chunks(chunks, nchunks, count_chunk);
 
-    if ((ma->tday = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for tday array\n");
-		exit(EXIT_FAILURE);
+    file_len = 0;
+    for (k = 0; k < nchunks; k++) {
+        chunks[k].row0 = file_len;
+        file_len += chunks[k].nrows;
     }
 
-    if ((ma->vpd_am = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for vpd_am array\n");
-		exit(EXIT_FAILURE);
+    /* allocate memory for meteorological arrays */
+    for (k = 0; k < ncols; k++) {
+        cols[k] = NULL;
+        if (arrays[k] == NULL)
+            continue;
+        size_met_array(arrays[k], file_len, ma->capacity, names[k]);
+        cols[k] = *(arrays[k]);
     }
+    if (! sub_daily)
+        size_met_array(&(ma->par), file_len, ma->capacity, "par");
+    ma->capacity = MAX(ma->capacity, file_len);
 
-    if ((ma->vpd_pm = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for vpd_pm array\n");
-		exit(EXIT_FAILURE);
-    }
+    for (k = 0; k < nchunks; k++)
+        chunks[k].cols = cols;
+    run_chunks(chunks, nchunks, parse_met_chunk);
+    unmap_file(&mf);
 
-    if ((ma->co2 = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for co2 array\n");
-		exit(EXIT_FAILURE);
+    /* report the first bad line in the file */
+    line = 0;
+    for (k = 0; k < nchunks; k++) {
+        if (chunks[k].bad_line > 0)
+            bad_met_line(c, sub_daily, line + chunks[k].bad_line);
+        line += chunks[k].nlines;
     }
 
-    if ((ma->ndep = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for ndep array\n");
-		exit(EXIT_FAILURE);
+    /* Build an array of the unique years as we loop over the input file */
+    c->num_years = 0;
+    current_yr = -999.9;
+    for (i = 0; i < file_len; i++) {
+        if (current_yr != ma->year[i]) {
+            c->num_years++;
+            current_yr = ma->year[i];
+        }
     }
 
-    if ((ma->nfix = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for nfix array\n");
-		exit(EXIT_FAILURE);
-    }
+    return (file_len);
+}
 
-    if ((ma->wind = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for wind array\n");
-		exit(EXIT_FAILURE);
-    }
+void bad_met_line(control *c, int sub_daily, long line) {
+    /* line is counted from 1, comment lines included */
+    fprintf(stderr, "%s: badly formatted input in %s file on line %d %d\n",
+            c->met_fname, sub_daily ? "subdaily met" : "met", (int)line,
+            sub_daily ? N_SUBDAILY_VARS : N_DAILY_VARS);
+    gday_exit(EXIT_FAILURE);
 
-    if ((ma->press = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for press array\n");
-		exit(EXIT_FAILURE);
-    }
+    return;
+}
 
-    if ((ma->wind_am = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for wind_am array\n");
-		exit(EXIT_FAILURE);
-    }
+static void count_chunk(void *arg) {
+    /* count the lines and data rows, fgets-style lines end after '\n' */
+    met_chunk  *ch = (met_chunk *)arg;
+    const char *p = ch->start, *eol;
 
-    if ((ma->wind_pm = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for wind_pm array\n");
-		exit(EXIT_FAILURE);
-    }
+    ch->nlines = 0;
+    ch->nrows = 0;
+    while (p < ch->end) {
+        eol = memchr(p, '\n', ch->end - p);
+        eol = (eol == NULL) ? ch->end : eol + 1;
+        ch->nlines++;
 
-    if ((ma->par = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for par array\n");
-		exit(EXIT_FAILURE);
+        /* ignore comment line */
+        if (*p != '#')
+            ch->nrows++;
+        p = eol;
     }
 
-    if ((ma->par_am = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for par_am array\n");
-		exit(EXIT_FAILURE);
-    }
+    return;
+}
 
-    if ((ma->par_pm = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for par_pm array\n");
-		exit(EXIT_FAILURE);
-    }
+void parse_met_chunk(void *arg) {
+    met_chunk  *ch = (met_chunk *)arg;
+    const char *p = ch->start, *q, *eol;
+    long        line = 0, row = ch->row0;
+    double      value;
+    int         j;
 
+    ch->bad_line = 0;
+    while (p < ch->end) {
+        eol = memchr(p, '\n', ch->end - p);
+        if (eol == NULL)
+            eol = ch->end;
+        line++;
 
-    i = 0;
-    c->num_years = 0;
-    skipped_lines = 0;
-    while (fgets(line, STRING_LENGTH, fp) != NULL) {
         /* ignore comment line */
-        if (*line == '#') {
-            skipped_lines++;
+        if (*p == '#') {
+            p = eol + 1;
             continue;
         }
 
-        if (sscanf(line, "%lf,%lf,\
-                          %lf,%lf,%lf,\
-                          %lf,%lf,%lf,\
-                          %lf,%lf,%lf,\
-                          %lf,%lf,%lf,\
-                          %lf,%lf,%lf,\
-                          %lf,%lf,\
-                          %lf,%lf",\
-                          &(ma->year[i]), &(ma->prjday[i]), \
-                          &(ma->tair[i]), &(ma->rain[i]), &(ma->tsoil[i]), \
-                          &(ma->tam[i]), &(ma->tpm[i]), &(ma->tmin[i]), \
-                          &(ma->tmax[i]), &(ma->tday[i]), &(ma->vpd_am[i]), \
-                          &(ma->vpd_pm[i]), &(ma->co2[i]), &(ma->ndep[i]), \
-                          &(ma->nfix[i]),  &(ma->wind[i]), &(ma->press[i]), \
-                          &(ma->wind_am[i]), &(ma->wind_pm[i]), \
-                          &(ma->par_am[i]), &(ma->par_pm[i])) != nvars) {
-            fprintf(stderr, "%s: badly formatted input in met file on line %d %d\n", \
-                    *argv, (int)i+1+skipped_lines, nvars);
-            exit(EXIT_FAILURE);
+        q = p;
+        for (j = 0; j < ch->ncols; j++) {
+            if (j > 0) {
+                if (q == eol || *q != ',')
+                    break;
+                q++;
+            }
+            if ((q = parse_met_number(q, eol, &value)) == NULL)
+                break;
+            if (ch->cols[j] != NULL)
+                ch->cols[j][row] = value;
         }
-
-        /* Build an array of the unique years as we loop over the input file */
-        if (current_yr != ma->year[i]) {
-            c->num_years++;
-            current_yr = ma->year[i];
+        if (j < ch->ncols) {
+            /* threads can't bail out, the caller reports it */
+            ch->bad_line = line;
+            return;
         }
-        i++;
+        row++;
+        p = eol + 1;
     }
-    fclose(fp);
+
     return;
 }
 
-void read_subdaily_met_data(char **argv, control *c, met_arrays *ma)
-{
-    FILE  *fp;
-    char   line[STRING_LENGTH];
-    int    i = 0;
-    int    nvars = 13;
-    int    skipped_lines = 0;
-    double current_yr, temp_HOD;
-    long   file_len;
-
-    if ((fp = fopen(c->met_fname, "r")) == NULL) {
-		fprintf(stderr, "Error: couldn't open sub-daily Met file %s for read\n",
-                c->met_fname);
-		exit(EXIT_FAILURE);
-	 }
-
-    /* work out how big the file is */
-    file_len = 0;
-    while (fgets(line, STRING_LENGTH, fp) != NULL) {
-        /* ignore comment line */
-        if (*line == '#')
-            continue;
-        file_len++;
-    }
-    rewind(fp);
-
-    /* output is daily, so correct for n_timesteps */
-    c->total_num_days = file_len / 48;
-
-    /* allocate memory for meteorological arrays */
-    if ((ma->year = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for year array\n");
-		exit(EXIT_FAILURE);
-    }
-
-    if ((ma->doy = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for doy array\n");
-		exit(EXIT_FAILURE);
-    }
-
-    if ((ma->rain = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for rain array\n");
-		exit(EXIT_FAILURE);
-    }
-
-    if ((ma->par = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for par array\n");
-		exit(EXIT_FAILURE);
-    }
-
-    if ((ma->tair = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for tair array\n");
-		exit(EXIT_FAILURE);
-    }
-
-    if ((ma->tsoil = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for tsoil array\n");
-		exit(EXIT_FAILURE);
-    }
-
-    if ((ma->vpd = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for vpd array\n");
-		exit(EXIT_FAILURE);
-    }
-
-    if ((ma->co2 = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for co2 array\n");
-		exit(EXIT_FAILURE);
-    }
-
-    if ((ma->ndep = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for ndep array\n");
-		exit(EXIT_FAILURE);
-    }
+static void run_chunks(met_chunk *chunks, int nchunks, void (*func)(void *)) {
+    /* run func on every chunk, the first on this thread */
+    gday_thread th[MAX_MET_THREADS];
+    int         started[MAX_MET_THREADS];
+    int         k;
 
-    if ((ma->nfix = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for nfix array\n");
-		exit(EXIT_FAILURE);
+    for (k = 1; k < nchunks; k++)
+        started[k] = (thread_start(&th[k], func, &chunks[k]) == 0);
+    func(&chunks[0]);
+    for (k = 1; k < nchunks; k++) {
+        if (started[k])
+            thread_join(th[k]);
+        else
+            func(&chunks[k]);
     }
 
-    if ((ma->wind = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for wind array\n");
-		exit(EXIT_FAILURE);
-    }
+    return;
+}
 
-    if ((ma->press = (double *)calloc(file_len, sizeof(double))) == NULL) {
-        fprintf(stderr,"Error allocating space for press array\n");
-		exit(EXIT_FAILURE);
+const char *parse_met_number(const char *p, const char *eol, double *x) {
+    /*
+        Read a double starting at p, skipping leading white space as %lf
+        does, without reading past eol. Returns where the number ends or
+        NULL if there isn't one.
+    */
+    static const double pow10[] = {
+        1E0, 1E1, 1E2, 1E3, 1E4, 1E5, 1E6, 1E7, 1E8, 1E9, 1E10, 1E11,
+        1E12, 1E13, 1E14, 1E15, 1E16, 1E17, 1E18, 1E19, 1E20, 1E21, 1E22
+    };
+    const char         *start, *q;
+    char                buf[256], *end;
+    unsigned long long  m = 0;
+    int                 neg = FALSE, ndigits = 0, scale = 0, e = 0, eneg;
+    int                 exact = TRUE;
+    size_t              len;
+
+    while (p < eol && isspace((unsigned char)*p))
+        p++;
+    start = q = p;
+
+    if (q < eol && (*q == '-' || *q == '+'))
+        neg = (*q++ == '-');
+    for (; q < eol && isdigit((unsigned char)*q); q++, ndigits++) {
+        if (m > 99999999999999999ULL)
+            exact = FALSE;
+        else
+            m = m * 10 + (*q - '0');
+    }
+    if (q < eol && *q == '.') {
+        for (q++; q < eol && isdigit((unsigned char)*q); q++, ndigits++) {
+            if (m > 99999999999999999ULL) {
+                exact = FALSE;
+            } else {
+                m = m * 10 + (*q - '0');
+                scale--;
+            }
+        }
     }
+    if (ndigits == 0)
+        exact = FALSE;
+    if (exact && q < eol && (*q == 'e' || *q == 'E')) {
+        q++;
+        eneg = FALSE;
+        if (q < eol && (*q == '-' || *q == '+'))
+            eneg = (*q++ == '-');
+        if (q == eol || ! isdigit((unsigned char)*q))
+            exact = FALSE;
+        for (; q < eol && isdigit((unsigned char)*q) && e < 10000; q++)
+            e = e * 10 + (*q - '0');
+        scale += eneg ? -e : e;
+    }
+
+    /* hex, inf, nan, 0x..., long exponents etc. are left to strtod */
+    if (q < eol && (isalnum((unsigned char)*q) || *q == '.'))
+        exact = FALSE;
+
+    if (exact && FLT_EVAL_METHOD == 0 && m <= (1ULL << 53) &&
+        scale >= -22 && scale <= 22) {
+        *x = (scale < 0) ? (double)m / pow10[-scale] :
+                           (double)m * pow10[scale];
+        if (neg)
+            *x = -*x;
+        return (q);
+    }
+
+    len = MIN((size_t)(eol - start), sizeof(buf) - 1);
+    memcpy(buf, start, len);
+    buf[len] = '\0';
+    *x = strtod(buf, &end);
+    if (end == buf)
+        return (NULL);
+
+    return (start + (end - buf));
+}
 
-    current_yr = ma->year[0];
+void free_met_arrays(met_arrays *ma) {
+    /* met forcing, daily or sub-daily, unused arrays are still NULL */
+
+    if (ma->cache.data != NULL) {
+        /* the arrays point into the cache, see load_met_cache */
+        unmap_file(&(ma->cache));
+        memset(ma, 0, sizeof(met_arrays));
+        return;
+    } else if (ma->window != NULL) {
+        /* ...or a streamed window on the file, see met_window.c */
+        close_met_window(ma);
+        memset(ma, 0, sizeof(met_arrays));
+        return;
+    }
+    free(ma->year);
+    free(ma->tair);
+    free(ma->rain);
+    free(ma->tsoil);
+    free(ma->co2);
+    free(ma->ndep);
+    free(ma->nfix);
+    free(ma->wind);
+    free(ma->press);
+    free(ma->par);
+    free(ma->vpd);
+    free(ma->doy);
+    free(ma->prjday);
+    free(ma->tam);
+    free(ma->tpm);
+    free(ma->tmin);
+    free(ma->tmax);
+    free(ma->tday);
+    free(ma->vpd_am);
+    free(ma->vpd_pm);
+    free(ma->wind_am);
+    free(ma->wind_pm);
+    free(ma->par_am);
+    free(ma->par_pm);
+    memset(ma, 0, sizeof(met_arrays));
 
-    i = 0;
-    c->num_years = 0;
-    skipped_lines = 0;
+    return;
+}
 
-    while (fgets(line, STRING_LENGTH, fp) != NULL) {
-        /* ignore comment line */
-        if (*line == '#') {
-            skipped_lines++;
-            continue;
-        }
+static void size_met_array(double **x, long file_len, long capacity,
+                           char *name)
+{
+    /*
+    Arrays are kept between sites when a simulation handle is reused, so
+    only go back to the allocator if this file is longer than anything we
+    have read before.
+    */
+    double *tmp;
 
-        if (sscanf(line, "%lf,%lf,%lf,\
-                          %lf,%lf,%lf,\
-                          %lf,%lf,%lf,\
-                          %lf,%lf,%lf,\
-                          %lf", \
-                          &(ma->year[i]), &(ma->doy[i]), &temp_HOD, \
-                          &(ma->rain[i]), &(ma->par[i]), &(ma->tair[i]), \
-                          &(ma->tsoil[i]), &(ma->vpd[i]), &(ma->co2[i]), \
-                          &(ma->ndep[i]), &(ma->nfix[i]), &(ma->wind[i]), \
-                          &(ma->press[i])) != nvars) {
-            fprintf(stderr, "%s: badly formatted input in subdaily met file on line %d %d\n", \
-                    *argv, (int)i+1+skipped_lines, nvars);
-            exit(EXIT_FAILURE);
-        }
+    if (*x != NULL && file_len <= capacity)
+        return;
 
-        /* Build an array of the unique years as we loop over the input file */
-        if (current_yr != ma->year[i]) {
-            c->num_years++;
-            current_yr = ma->year[i];
-        }
-        i++;
+    tmp = (double *)realloc(*x, MAX(file_len, capacity) * sizeof(double));
+    if (tmp == NULL) {
+        fprintf(stderr,"Error allocating space for %s array\n", name);
+		gday_exit(EXIT_FAILURE);
     }
+    *x = tmp;
 
-    fclose(fp);
     return;
 }
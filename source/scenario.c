@@ -0,0 +1,196 @@
+/* ============================================================================
+* Scenario driver: management scenarios forked from a shared history.
+*
+* The scenario file has the same layout as an ensemble file, one scenario
+* per line,
+*
+*   scenario_id,param_file
+*
+* The base param file (-p) is run up to the fork day once, then every
+* scenario is forked from that point with the [control] and [params] keys in
+* its own param file (e.g. a different harvest date or grazing setting)
+* taking effect from the fork on. Only the tail after the fork is run for
+* each scenario.
+*
+* NOTES:
+*   The baseline carries on to the end of the met data as usual and writes
+*   the base output file. Scenario output goes to the base output file name
+*   with the scenario id added, e.g. out.csv -> out_late_harvest.csv, and
+*   only covers the days from the fork on.
+*
+*   The met data is read once and shared by the baseline and every
+*   scenario, see gday_forcing_new.
+*
+* =========================================================================== */
+#include "scenario.h"
+#include "forcing.h"
+
+typedef struct {
+    gday_sim  **sims;       /* baseline first, then one per scenario */
+    int        *status;
+    int         nsims;
+    int         next;
+    gday_mutex  lock;
+} scenario_pool;
+
+static void scenario_worker(void *);
+static void scenario_fname(char *, size_t, char *, char *);
+
+
+int run_scenarios(char *cfg_fname, char *scenario_file, int year, int doy,
+                  int nthreads, int flags) {
+    /*
+        Run the baseline to day doy (1 = 1st Jan) of year, fork every
+        scenario from there and run them all to the end. Returns the number
+        of scenarios (baseline included) that failed, or -1 if the
+        baseline couldn't be run to the fork.
+    */
+    scenario_pool    sp;
+    ensemble_member *scenarios;
+    gday_forcing    *fc;
+    gday_thread     *threads = NULL;
+    char             fname[STRING_LENGTH];
+    int              nscenarios, i, nstarted = 0, nfailed = 0;
+
+    if (flags & GDAY_SIM_SPIN_UP) {
+        fprintf(stderr, "Scenarios can't be forked from a spin-up\n");
+        return (-1);
+    }
+
+    if (read_ensemble(scenario_file, &scenarios, &nscenarios) != 0)
+        return (-1);
+
+    if ((fc = gday_forcing_new(cfg_fname, NULL)) == NULL) {
+        free_ensemble(scenarios, nscenarios);
+        return (-1);
+    }
+
+    sp.nsims = nscenarios + 1;
+    sp.next = 0;
+    sp.sims = (gday_sim **)calloc(sp.nsims, sizeof(gday_sim *));
+    sp.status = (int *)calloc(sp.nsims, sizeof(int));
+    if (sp.sims == NULL || sp.status == NULL) {
+        fprintf(stderr, "scenarios: Not allocated enough memory!\n");
+        free(sp.sims);
+        free(sp.status);
+        gday_forcing_free(fc);
+        free_ensemble(scenarios, nscenarios);
+        return (-1);
+    }
+
+    /* the shared history, once */
+    if ((sp.sims[0] = gday_sim_new()) == NULL ||
+        gday_sim_load_member(sp.sims[0], cfg_fname, NULL, fc, NULL,
+                             flags) != 0 ||
+        gday_sim_run_to(sp.sims[0], year, doy) != 0) {
+        fprintf(stderr, "Scenarios: couldn't run the baseline to day %d of "
+                "%d\n", doy, year);
+        nfailed = -1;
+        goto finished;
+    }
+
+    /* forking is cheap, so it's done here rather than on the workers */
+    for (i = 0; i < nscenarios; i++) {
+        scenario_fname(fname, sizeof(fname), fc->c.print_options == END ?
+                       fc->c.out_param_fname : fc->c.out_fname,
+                       scenarios[i].id);
+        if ((sp.sims[i+1] = gday_sim_new()) == NULL) {
+            sp.status[i+1] = 1;
+            continue;
+        }
+        sp.status[i+1] = gday_sim_load_member(sp.sims[i+1], cfg_fname,
+                                              scenarios[i].cfg_fname, fc,
+                                              fname, flags);
+        if (sp.status[i+1] == 0)
+            sp.status[i+1] = gday_sim_fork(sp.sims[i+1], sp.sims[0]);
+    }
+
+    /* and then the baseline and every scenario run to the end */
+    mutex_init(&(sp.lock));
+    if (nthreads <= 0)
+        nthreads = number_of_cpus();
+    nthreads = MAX(MIN(nthreads, sp.nsims), 1);
+    if ((threads = (gday_thread *)calloc(nthreads,
+                                         sizeof(gday_thread))) != NULL) {
+        for (i = 0; i < nthreads; i++) {
+            if (thread_start(&threads[i], scenario_worker, &sp) != 0) {
+                fprintf(stderr, "Couldn't start scenario thread %d\n", i);
+                break;
+            }
+            nstarted++;
+        }
+    }
+
+    /* Nothing started, do the work on this thread instead */
+    if (nstarted == 0)
+        scenario_worker(&sp);
+
+    for (i = 0; i < nstarted; i++)
+        thread_join(threads[i]);
+    mutex_free(&(sp.lock));
+
+    for (i = 0; i < sp.nsims; i++) {
+        if (sp.status[i] != 0) {
+            if (i == 0)
+                fprintf(stderr, "Scenarios: the baseline failed\n");
+            else
+                fprintf(stderr, "Scenarios: scenario %s (%s) failed\n",
+                        scenarios[i-1].id, scenarios[i-1].cfg_fname);
+            nfailed++;
+        }
+    }
+    fprintf(stderr, "Scenarios: %d of %d scenarios ran successfully\n",
+            sp.nsims - nfailed, sp.nsims);
+
+finished:
+    for (i = 0; i < sp.nsims; i++)
+        gday_sim_destroy(sp.sims[i]);
+    free(threads);
+    free(sp.sims);
+    free(sp.status);
+    gday_forcing_free(fc);
+    free_ensemble(scenarios, nscenarios);
+
+    return (nfailed);
+}
+
+static void scenario_worker(void *arg) {
+
+    scenario_pool *sp = (scenario_pool *)arg;
+    int            i;
+
+    while (TRUE) {
+        mutex_lock(&(sp->lock));
+        i = (sp->next < sp->nsims) ? sp->next++ : -1;
+        mutex_unlock(&(sp->lock));
+        if (i < 0)
+            break;
+
+        if (sp->status[i] == 0)
+            sp->status[i] = gday_sim_run(sp->sims[i]);
+    }
+
+    return;
+}
+
+static void scenario_fname(char *fname, size_t size, char *out_fname, char *id) {
+    /* out_fname with _id added before the extension, if there is one */
+    char   *dot, *slash;
+    size_t  stem;
+
+    dot = strrchr(out_fname, '.');
+    slash = strrchr(out_fname, '/');
+    if (slash == NULL)
+        slash = strrchr(out_fname, '\\');
+    if (dot == NULL || (slash != NULL && dot < slash))
+        dot = out_fname + strlen(out_fname);
+
+    stem = MIN((size_t)(dot - out_fname), size - 1);
+    memcpy(fname, out_fname, stem);
+    fname[stem] = '\0';
+    strncat(fname, "_", size - strlen(fname) - 1);
+    strncat(fname, id, size - strlen(fname) - 1);
+    strncat(fname, dot, size - strlen(fname) - 1);
+
+    return;
+}
@@ -0,0 +1,412 @@
+/* ============================================================================
+* Server mode: one long-lived process answering many short runs.
+*
+* With -serve the met data is read once and the process then waits for run
+* requests, on a Unix domain socket at the path given or, for "-", on stdin,
+* answering each on the socket or stdout. A request is a line of key=value
+* pairs separated by spaces, e.g.
+*
+*   start=1995 end=2000 vars=lai,npp sla=5.5 control.alloc_model=grasses
+*
+* where every key is optional,
+*
+*   cfg         the base param file, the -p one if not given
+*   start, end  the first and last years of its met data to run
+*   vars        the output columns, as [output] variables in a param file
+*
+* and any other key is one from the param file (see find_ini_name) set to
+* the value for this run. The answer is either
+*
+*   ok nrows ncols
+*   year,doy,lai,npp
+*
+* followed by nrows lines of ncols values, or a single line "error <why>".
+* A "quit" line stops the server.
+*
+* NOTES:
+*   Each base param file's met data is read the first time it is asked for
+*   and kept for every later request (see gday_forcing_new), a period is a
+*   view on it (gday_forcing_years). Runs write into memory rather than any
+*   output file, see gday_sim_set_output, with the one handle reused for
+*   every run. The param file itself is read again for each run, which
+*   since the key registry (see param_registry.c) costs very little next
+*   to the run.
+*
+*   Requests are answered one at a time, in the order they arrive, for one
+*   client at a time. Anything the model prints, including why a run went
+*   wrong, goes to stderr, never into the answers.
+*
+*   Unix domain sockets are only used on POSIX systems, on Windows the
+*   requests can only come through stdin.
+*
+* =========================================================================== */
+#include <limits.h>
+#include "server.h"
+#include "forcing.h"
+#include "param_registry.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+/* A base param file and the met data read for it */
+typedef struct {
+    char         *cfg_fname;
+    gday_forcing *fc;
+} server_dataset;
+
+typedef struct {
+    char           *cfg_fname;      /* base param file, unless asked for */
+    int             flags;
+    server_dataset *datasets;
+    int             ndatasets;
+    gday_sim       *sim;            /* reused for every run */
+    double         *buffer;         /* the runs' output rows */
+    long            buffer_len;     /* doubles it can hold */
+    char           *line;
+} server;
+
+static int   serve_stream(server *, FILE *, FILE *);
+static int   serve_pipe(server *);
+#ifndef _WIN32
+static int   serve_socket(server *, char *);
+#endif
+static void  answer(server *, char *, FILE *);
+static void  write_rows(FILE *, const double *, long, int);
+static const gday_forcing *dataset(server *, char *);
+static void  free_server(server *);
+
+
+int run_server(char *cfg_fname, char *path, int flags) {
+    /*
+        Read the -p param file's met data and answer requests until told to
+        quit (or stdin runs out), returns 0 unless it couldn't start.
+    */
+    server sv;
+    int    error;
+
+    if (flags & GDAY_SIM_SPIN_UP) {
+        fprintf(stderr, "The server can't spin-up, spin-up each site first\n");
+        return (1);
+    }
+
+    memset(&sv, 0, sizeof(server));
+    sv.cfg_fname = cfg_fname;
+    sv.flags = flags;
+    if ((sv.sim = gday_sim_new()) == NULL ||
+        (sv.line = (char *)malloc(SERVER_LINE)) == NULL) {
+        fprintf(stderr, "server: Not allocated enough memory!\n");
+        free_server(&sv);
+        return (1);
+    }
+
+    /* so that a bad -p file stops it straight away */
+    if (dataset(&sv, cfg_fname) == NULL) {
+        free_server(&sv);
+        return (1);
+    }
+
+    if (strcmp(path, "-") == 0) {
+        error = serve_pipe(&sv);
+    } else {
+#ifdef _WIN32
+        fprintf(stderr, "%s: only stdin (-serve -) can be served on "
+                "Windows\n", path);
+        error = 1;
+#else
+        error = serve_socket(&sv, path);
+#endif
+    }
+    free_server(&sv);
+
+    return (error);
+}
+
+static int serve_stream(server *sv, FILE *in, FILE *out) {
+    /* answer the requests on in, returns TRUE once told to quit */
+    char *start;
+    int   c;
+
+    while (fgets(sv->line, SERVER_LINE, in) != NULL) {
+        if (strchr(sv->line, '\n') == NULL && ! feof(in)) {
+            while ((c = fgetc(in)) != EOF && c != '\n')
+                ;
+            fprintf(out, "error request longer than %d characters\n",
+                    SERVER_LINE);
+            fflush(out);
+            continue;
+        }
+        start = lskip(rstrip(sv->line));
+
+        /* ignore comments and blank lines */
+        if (*start == '#' || *start == '\0')
+            continue;
+        if (strcmp(start, "quit") == 0)
+            return (TRUE);
+
+        answer(sv, start, out);
+
+        /* the client has gone away */
+        if (fflush(out) != 0 || ferror(out))
+            break;
+    }
+
+    return (FALSE);
+}
+
+static int serve_pipe(server *sv) {
+    /*
+        Requests on stdin, answers on stdout. The model's own printing is
+        sent to stderr instead so that it can't get mixed up with them.
+    */
+    FILE *out;
+    int   fd;
+
+    fflush(stdout);
+#ifdef _WIN32
+    fd = _dup(_fileno(stdout));
+    _dup2(_fileno(stderr), _fileno(stdout));
+    out = (fd < 0) ? NULL : _fdopen(fd, "w");
+#else
+    fd = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    out = (fd < 0) ? NULL : fdopen(fd, "w");
+#endif
+    if (out == NULL) {
+        fprintf(stderr, "Error: couldn't keep stdout for the answers\n");
+        return (1);
+    }
+
+    serve_stream(sv, stdin, out);
+    fclose(out);
+
+    return (0);
+}
+
+#ifndef _WIN32
+static int serve_socket(server *sv, char *path) {
+    /* requests from clients of a Unix domain socket, one after another */
+    struct sockaddr_un addr;
+    struct stat        st;
+    FILE              *in, *out;
+    int                fd, client, quit = FALSE;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: socket path is too long\n", path);
+        return (1);
+    }
+
+    /* one left behind by a server that didn't stop cleanly, nothing else */
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+        bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(fd, 8) != 0) {
+        fprintf(stderr, "Error: couldn't listen on socket %s\n", path);
+        if (fd >= 0)
+            close(fd);
+        return (1);
+    }
+
+    /* a client going away mid answer mustn't take the server with it */
+    signal(SIGPIPE, SIG_IGN);
+    fprintf(stderr, "Serving requests on %s\n", path);
+
+    while (! quit) {
+        if ((client = accept(fd, NULL, NULL)) < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "Error: couldn't accept on socket %s\n", path);
+            break;
+        }
+        in = fdopen(client, "r");
+        out = (in == NULL) ? NULL : fdopen(dup(client), "w");
+        if (out == NULL) {
+            fprintf(stderr, "Error: couldn't open a client of %s\n", path);
+            if (in != NULL)
+                fclose(in);
+            else
+                close(client);
+            continue;
+        }
+        quit = serve_stream(sv, in, out);
+        fclose(out);
+        fclose(in);
+    }
+    close(fd);
+    unlink(path);
+
+    return (0);
+}
+#endif
+
+static void answer(server *sv, char *request, FILE *out) {
+    /* run the request, see the top of the file for what comes back */
+    const gday_forcing *fc;
+    gday_forcing       *view = NULL;
+    const char         *names[SERVER_KEYS], *values[SERVER_KEYS];
+    const char         *cols[MAX_OUTPUT_VARS + 3];
+    char               *key, *end, *value, *cfg_fname = sv->cfg_fname;
+    double             *tmp;
+    long                nrows;
+    int                 i, ncols, n = 0, first_year = INT_MIN;
+    int                 last_year = INT_MAX;
+
+    /* split into key=value pairs in place */
+    key = request;
+    while (*(key = lskip(key)) != '\0') {
+        for (end = key; *end != '\0' && ! isspace((unsigned char)*end); end++)
+            ;
+        if (*end != '\0')
+            *end++ = '\0';
+        if ((value = strchr(key, '=')) == NULL) {
+            fprintf(out, "error expected key=value, not %s\n", key);
+            return;
+        }
+        *value++ = '\0';
+
+        if (strcmp(key, "cfg") == 0) {
+            cfg_fname = value;
+        } else if (strcmp(key, "start") == 0) {
+            first_year = atoi(value);
+        } else if (strcmp(key, "end") == 0) {
+            last_year = atoi(value);
+        } else if (n == SERVER_KEYS) {
+            fprintf(out, "error more than %d keys\n", SERVER_KEYS);
+            return;
+        } else if (strcmp(key, "vars") == 0) {
+            names[n] = "output.variables";
+            values[n++] = value;
+        } else if (find_ini_name(key) != NULL) {
+            names[n] = key;
+            values[n++] = value;
+        } else {
+            fprintf(out, "error unknown key %s\n", key);
+            return;
+        }
+        key = end;
+    }
+
+    if ((fc = dataset(sv, cfg_fname)) == NULL) {
+        fprintf(out, "error couldn't read the met data for %s\n", cfg_fname);
+        return;
+    }
+    if (first_year != INT_MIN || last_year != INT_MAX) {
+        if ((view = gday_forcing_years(fc, first_year, last_year)) == NULL) {
+            fprintf(out, "error no met data for those years\n");
+            return;
+        }
+        fc = view;
+    }
+
+    if (gday_sim_load_values(sv->sim, cfg_fname, n, names, values, fc, NULL,
+                             sv->flags) != 0) {
+        fprintf(out, "error couldn't set up the run\n");
+        gday_forcing_free(view);
+        return;
+    }
+
+    /* rows for every day is always enough */
+    ncols = gday_sim_output_columns(sv->sim, cols, &nrows);
+    if (nrows * ncols > sv->buffer_len) {
+        tmp = (double *)realloc(sv->buffer, nrows * ncols * sizeof(double));
+        if (tmp == NULL) {
+            fprintf(out, "error not enough memory for the output\n");
+            gday_forcing_free(view);
+            return;
+        }
+        sv->buffer = tmp;
+        sv->buffer_len = nrows * ncols;
+    }
+
+    if (gday_sim_set_output(sv->sim, sv->buffer, nrows) != 0) {
+        fprintf(out, "error print_options has to be daily or aggregated\n");
+    } else if (gday_sim_run(sv->sim) != 0) {
+        fprintf(out, "error the run failed\n");
+    } else {
+        nrows = gday_sim_output_rows(sv->sim);
+        fprintf(out, "ok %ld %d\n", nrows, ncols);
+        for (i = 0; i < ncols; i++)
+            fprintf(out, "%s%s", i > 0 ? "," : "", cols[i]);
+        fprintf(out, "\n");
+        write_rows(out, sv->buffer, nrows, ncols);
+    }
+    gday_forcing_free(view);
+
+    return;
+}
+
+static void write_rows(FILE *out, const double *rows, long nrows,
+                       int ncols) {
+    /* as text, every value to full precision */
+    long i;
+    int  j;
+
+    for (i = 0; i < nrows; i++) {
+        for (j = 0; j < ncols; j++)
+            fprintf(out, "%s%.17g", j > 0 ? "," : "", rows[i * ncols + j]);
+        fprintf(out, "\n");
+    }
+
+    return;
+}
+
+static const gday_forcing *dataset(server *sv, char *cfg_fname) {
+    /* the param file's met data, read the first time it is asked for */
+    server_dataset *tmp;
+    gday_forcing   *fc;
+    int             i;
+
+    for (i = 0; i < sv->ndatasets; i++) {
+        if (strcmp(sv->datasets[i].cfg_fname, cfg_fname) == 0)
+            return (sv->datasets[i].fc);
+    }
+
+    if ((fc = gday_forcing_new(cfg_fname, NULL)) == NULL)
+        return (NULL);
+
+    tmp = (server_dataset *)realloc(sv->datasets, (sv->ndatasets + 1) *
+                                    sizeof(server_dataset));
+    if (tmp == NULL ||
+        (tmp[sv->ndatasets].cfg_fname =
+                        (char *)malloc(strlen(cfg_fname) + 1)) == NULL) {
+        fprintf(stderr, "server: Not allocated enough memory!\n");
+        if (tmp != NULL)
+            sv->datasets = tmp;
+        gday_forcing_free(fc);
+        return (NULL);
+    }
+    sv->datasets = tmp;
+    strcpy(sv->datasets[sv->ndatasets].cfg_fname, cfg_fname);
+    sv->datasets[sv->ndatasets].fc = fc;
+    sv->ndatasets++;
+    fprintf(stderr, "Read the met data for %s\n", cfg_fname);
+
+    return (fc);
+}
+
+static void free_server(server *sv) {
+    int i;
+
+    gday_sim_destroy(sv->sim);
+    for (i = 0; i < sv->ndatasets; i++) {
+        free(sv->datasets[i].cfg_fname);
+        gday_forcing_free(sv->datasets[i].fc);
+    }
+    free(sv->datasets);
+    free(sv->buffer);
+    free(sv->line);
+
+    return;
+}
@@ -0,0 +1,481 @@
+/* ============================================================================
+* Per-site cost estimates for the batch scheduler.
+*
+* Before a batch starts every site is given a predicted cost so the longest
+* jobs can be started first. The prediction comes from two places,
+*
+*   (i)  a model: the number of simulated days (from the size of the met
+*        file) weighted by how expensive a day is for the run type and how
+*        many passes through the forcing the spin-up mode needs, and
+*   (ii) history: the measured wall time of previous runs, kept in a small
+*        text file next to the manifest (one site per line),
+*
+*        cost_class,units,seconds,param_file,met_file
+*
+* A site that has been run before is predicted from its own last run, scaled
+* if the met file has changed length. Otherwise the units are converted to
+* seconds with the mean rate seen for its cost class, or across all classes
+* if that class hasn't been seen yet. Without any history the estimates are
+* left in units, which is all the ordering needs.
+*
+* NOTES:
+*   The .ini file is only skimmed for the handful of [control]/[files] keys
+*   the cost model needs, it isn't run through the full parameter handler.
+*   Those keys are still read by the param registry, so their values mean
+*   just what they do to the model.
+*
+* =========================================================================== */
+#include "site_cost.h"
+#include "param_registry.h"
+
+/*
+ * Relative cost of one simulated day, only the ratios matter. The half-hourly
+ * runs call the canopy 48 times a day and the hydraulics model integrates
+ * each soil layer every half-hour on top of that.
+ */
+#define DAY_COST_DAILY       1.0
+#define DAY_COST_SUB_DAILY   50.0
+#define DAY_COST_HYDRAULICS  500.0
+
+/* rough number of passes through the forcing a spin-up takes */
+#define PASSES_BRUTE         100.0
+#define PASSES_SAS           20.0
+#define PASSES_ANDERSON      10.0
+
+/* data lines sampled to get the average line length of a met file */
+#define MET_SAMPLE_LINES     64
+
+static int    skim_ini_file(char *, int *, int *, int *, char *);
+static double estimate_met_rows(char *);
+static int    compare_record_keys(const void *, const void *);
+static cost_record *find_record(cost_history *, char *, char *);
+static int    add_record(cost_history *, char *, char *, int, double, double);
+static void   update_rates(cost_history *);
+
+
+int read_cost_history(char *fname, cost_history *h) {
+    /*
+        Load the measured costs of earlier runs. A missing file just means
+        there's no history yet, returns non-zero only on a malformed line.
+    */
+    FILE   *fp;
+    char    line[STRING_LENGTH];
+    char   *start, *field[5], *end;
+    int     i, j, nf, cost_class, line_number = 0;
+    double  units, seconds;
+
+    memset(h, 0, sizeof(cost_history));
+
+    if ((fp = fopen(fname, "r")) == NULL)
+        return (0);
+
+    while (fgets(line, STRING_LENGTH, fp) != NULL) {
+        line_number++;
+        start = lskip(rstrip(line));
+        if (*start == '#' || *start == '\0')
+            continue;
+
+        nf = 0;
+        while (start != NULL && nf < 5) {
+            end = strchr(start, ',');
+            if (end != NULL)
+                *end++ = '\0';
+            field[nf++] = rstrip(lskip(start));
+            start = end;
+        }
+        if (nf < 4) {
+            fprintf(stderr, "%s: badly formatted cost history on line %d\n",
+                    fname, line_number);
+            fclose(fp);
+            free_cost_history(h);
+            return (1);
+        }
+        cost_class = atoi(field[0]);
+        units = atof(field[1]);
+        seconds = atof(field[2]);
+        if (cost_class < 0 || cost_class >= N_COST_CLASSES)
+            continue;
+        if (add_record(h, field[3], nf == 5 ? field[4] : "", cost_class,
+                       units, seconds) != 0) {
+            fclose(fp);
+            free_cost_history(h);
+            return (1);
+        }
+    }
+    fclose(fp);
+
+    qsort(h->rec, h->n, sizeof(cost_record), compare_record_keys);
+
+    /* the same site listed more than once in a manifest, keep one */
+    for (i = 0, j = 1; j < h->n; j++) {
+        if (compare_record_keys(&(h->rec[i]), &(h->rec[j])) == 0) {
+            free(h->rec[j].cfg_fname);
+            free(h->rec[j].met_fname);
+        } else {
+            h->rec[++i] = h->rec[j];
+        }
+    }
+    if (h->n > 0)
+        h->n = i + 1;
+    h->nsorted = h->n;
+    update_rates(h);
+
+    return (0);
+}
+
+int write_cost_history(char *fname, cost_history *h) {
+    /*
+        Write the history back out. It goes to a temporary file first which
+        is then renamed over the old one, so a batch that dies part way, or
+        two batches finishing together, never leave a half written file
+        behind (the last one to finish wins).
+    */
+    FILE *fp;
+    char  tmp_fname[STRING_LENGTH];
+    int   i;
+
+    if (strlen(fname) + 5 > sizeof(tmp_fname)) {
+        fprintf(stderr, "Cost history file name too long: %s\n", fname);
+        return (1);
+    }
+    sprintf(tmp_fname, "%s.tmp", fname);
+
+    if ((fp = fopen(tmp_fname, "w")) == NULL) {
+        fprintf(stderr, "Error: couldn't open cost history %s for write\n",
+                tmp_fname);
+        return (1);
+    }
+    fprintf(fp, "# cost_class,units,seconds,param_file,met_file\n");
+    for (i = 0; i < h->n; i++) {
+        fprintf(fp, "%d,%.6g,%.6g,%s,%s\n", h->rec[i].cost_class,
+                h->rec[i].units, h->rec[i].seconds, h->rec[i].cfg_fname,
+                h->rec[i].met_fname);
+    }
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "Error writing cost history %s\n", tmp_fname);
+        remove(tmp_fname);
+        return (1);
+    }
+
+#ifdef _WIN32
+    /* rename won't replace an existing file on Windows */
+    remove(fname);
+#endif
+    if (rename(tmp_fname, fname) != 0) {
+        fprintf(stderr, "Error: couldn't replace cost history %s\n", fname);
+        remove(tmp_fname);
+        return (1);
+    }
+
+    return (0);
+}
+
+void free_cost_history(cost_history *h) {
+    int i;
+
+    for (i = 0; i < h->n; i++) {
+        free(h->rec[i].cfg_fname);
+        free(h->rec[i].met_fname);
+    }
+    free(h->rec);
+    memset(h, 0, sizeof(cost_history));
+
+    return;
+}
+
+void estimate_site_cost(cost_history *h, batch_site *site, int flags) {
+    /*
+        Fill in the site's cost class, work units and predicted cost. Sites
+        whose .ini can't be read get a zero estimate, they'll fail straight
+        away when they're run anyway.
+    */
+    cost_record *rec;
+    char         met_fname[STRING_LENGTH];
+    int          sub_daily, water_balance, spinup_method, run_type;
+    int          spin_up_mode = SPIN_UP_NONE;
+    double       rows, days, day_cost, passes = 1.0;
+
+    site->cost_class = COST_DAILY;
+    site->units = 0.0;
+    site->estimate = 0.0;
+    site->seconds = 0.0;
+
+    if (site->cfg_fname == NULL ||
+        skim_ini_file(site->cfg_fname, &sub_daily, &water_balance,
+                      &spinup_method, met_fname) != 0)
+        return;
+
+    if (site->met_fname != NULL)
+        strncpy0(met_fname, site->met_fname, sizeof(met_fname));
+
+    if (water_balance == HYDRAULICS) {
+        run_type = COST_HYDRAULICS;
+        day_cost = DAY_COST_HYDRAULICS;
+    } else if (sub_daily) {
+        run_type = COST_SUB_DAILY;
+        day_cost = DAY_COST_SUB_DAILY;
+    } else {
+        run_type = COST_DAILY;
+        day_cost = DAY_COST_DAILY;
+    }
+
+    if (flags & GDAY_SIM_SPIN_UP) {
+        if (spinup_method == SAS) {
+            spin_up_mode = SPIN_UP_SAS;
+            passes = PASSES_SAS;
+        } else if (spinup_method == ANDERSON) {
+            spin_up_mode = SPIN_UP_ANDERSON;
+            passes = PASSES_ANDERSON;
+        } else {
+            spin_up_mode = SPIN_UP_BRUTE;
+            passes = PASSES_BRUTE;
+        }
+    }
+
+    /* the sub-daily files have a line per half-hour */
+    rows = estimate_met_rows(met_fname);
+    days = sub_daily ? rows / 48.0 : rows;
+
+    site->cost_class = run_type + N_RUN_TYPES * spin_up_mode;
+    site->units = days * day_cost * passes;
+
+    rec = find_record(h, site->cfg_fname,
+                      site->met_fname == NULL ? "" : site->met_fname);
+    if (rec != NULL && rec->cost_class == site->cost_class &&
+        rec->units > 0.0 && rec->seconds > 0.0) {
+        site->estimate = rec->seconds * site->units / rec->units;
+    } else if (h->rate[site->cost_class] > 0.0) {
+        site->estimate = site->units * h->rate[site->cost_class];
+    } else if (h->global_rate > 0.0) {
+        site->estimate = site->units * h->global_rate;
+    } else {
+        site->estimate = site->units;
+    }
+
+    return;
+}
+
+void record_site_cost(cost_history *h, batch_site *site) {
+    /*
+        Store the measured cost of a site that ran successfully, replacing
+        whatever we had for it before. Must be called once the batch has
+        finished, new sites are appended after the sorted block.
+    */
+    cost_record *rec;
+    char        *met_fname = (site->met_fname == NULL) ? "" : site->met_fname;
+
+    if (site->status != 0 || site->cfg_fname == NULL || site->units <= 0.0)
+        return;
+
+    if ((rec = find_record(h, site->cfg_fname, met_fname)) != NULL) {
+        rec->cost_class = site->cost_class;
+        rec->units = site->units;
+        rec->seconds = site->seconds;
+    } else {
+        add_record(h, site->cfg_fname, met_fname, site->cost_class,
+                   site->units, site->seconds);
+    }
+
+    return;
+}
+
+static int skim_ini_file(char *fname, int *sub_daily, int *water_balance,
+                         int *spinup_method, char *met_fname) {
+    /*
+        Pull out just the keys the cost model needs, each one read by the
+        registry as the model would read it, returns 0 on success.
+    */
+    static const char *wanted[][2] = {
+        { "files", "met_fname" }, { "control", "sub_daily" },
+        { "control", "water_balance" }, { "control", "spinup_method" }
+    };
+    const ini_key *k;
+    control       *c;
+    FILE          *fp;
+    jmp_buf        env, *prev;
+    char           line[STRING_LENGTH];
+    char           section[STRING_LENGTH] = "";
+    char          *start, *end, *name, *value;
+    int            i, error;
+
+    if ((c = (control *)calloc(1, sizeof(control))) == NULL)
+        return (1);
+    c->sub_daily = FALSE;
+    c->water_balance = BUCKET;
+    c->spinup_method = BRUTE;
+
+    if ((fp = fopen(fname, "r")) == NULL) {
+        free(c);
+        return (1);
+    }
+
+    /* a value the model wouldn't take, it fails when it's run */
+    prev = set_exit_handler(&env);
+    if ((error = setjmp(env)) != 0) {
+        set_exit_handler(prev);
+        fclose(fp);
+        free(c);
+        return (error);
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        start = lskip(rstrip(line));
+        if (*start == ';' || *start == '#' || *start == '\0') {
+            continue;
+        } else if (*start == '[') {
+            end = find_char_or_comment(start + 1, ']');
+            if (*end == ']') {
+                *end = '\0';
+                strncpy0(section, start + 1, sizeof(section));
+            }
+            continue;
+        }
+
+        end = find_char_or_comment(start, '=');
+        if (*end != '=')
+            end = find_char_or_comment(start, ':');
+        if (*end != '=' && *end != ':')
+            continue;
+        *end = '\0';
+        name = rstrip(start);
+        value = lskip(end + 1);
+        end = find_char_or_comment(value, '\0');
+        if (*end == ';')
+            *end = '\0';
+        rstrip(value);
+
+        if ((k = find_ini_key(section, name)) == NULL)
+            continue;
+        for (i = 0; i < (int)(sizeof(wanted) / sizeof(wanted[0])); i++) {
+            if (k == find_ini_key(wanted[i][0], wanted[i][1])) {
+                set_ini_value(c, NULL, NULL, k, value);
+                break;
+            }
+        }
+    }
+    set_exit_handler(prev);
+    fclose(fp);
+
+    *sub_daily = c->sub_daily;
+    *water_balance = c->water_balance;
+    *spinup_method = c->spinup_method;
+    strncpy0(met_fname, c->met_fname, STRING_LENGTH);
+    free(c);
+
+    return (0);
+}
+
+static double estimate_met_rows(char *fname) {
+    /*
+        Approximate number of data lines in a met file from its size and the
+        length of the first few lines, saves reading the whole file twice.
+    */
+    FILE   *fp;
+    char    line[STRING_LENGTH];
+    long    file_size, header_bytes = 0, sample_bytes = 0;
+    int     nsampled = 0;
+
+    if ((fp = fopen(fname, "r")) == NULL)
+        return (0.0);
+
+    while (nsampled < MET_SAMPLE_LINES &&
+           fgets(line, STRING_LENGTH, fp) != NULL) {
+        if (*line == '#') {
+            header_bytes += (long)strlen(line);
+            continue;
+        }
+        sample_bytes += (long)strlen(line);
+        nsampled++;
+    }
+    fseek(fp, 0, SEEK_END);
+    file_size = ftell(fp);
+    fclose(fp);
+
+    if (nsampled == 0 || sample_bytes == 0)
+        return (0.0);
+
+    return ((double)(file_size - header_bytes) * nsampled /
+            (double)sample_bytes);
+}
+
+static int compare_record_keys(const void *a, const void *b) {
+    /* order by param file and then met file */
+    const cost_record *ra = (const cost_record *)a;
+    const cost_record *rb = (const cost_record *)b;
+    int                cmp;
+
+    if ((cmp = strcmp(ra->cfg_fname, rb->cfg_fname)) != 0)
+        return (cmp);
+    return (strcmp(ra->met_fname, rb->met_fname));
+}
+
+static cost_record *find_record(cost_history *h, char *cfg_fname,
+                                char *met_fname) {
+    cost_record  key;
+
+    key.cfg_fname = cfg_fname;
+    key.met_fname = met_fname;
+
+    return ((cost_record *)bsearch(&key, h->rec, h->nsorted,
+                                   sizeof(cost_record), compare_record_keys));
+}
+
+static int add_record(cost_history *h, char *cfg_fname, char *met_fname,
+                      int cost_class, double units, double seconds) {
+    /* returns 0 on success */
+    cost_record *tmp, *rec;
+
+    if (h->n == h->size) {
+        h->size = (h->size == 0) ? 64 : h->size * 2;
+        tmp = (cost_record *)realloc(h->rec, h->size * sizeof(cost_record));
+        if (tmp == NULL) {
+            fprintf(stderr, "Error allocating space for cost history\n");
+            return (1);
+        }
+        h->rec = tmp;
+    }
+
+    rec = &(h->rec[h->n]);
+    rec->cfg_fname = (char *)malloc(strlen(cfg_fname) + 1);
+    rec->met_fname = (char *)malloc(strlen(met_fname) + 1);
+    if (rec->cfg_fname == NULL || rec->met_fname == NULL) {
+        fprintf(stderr, "Error allocating space for cost history\n");
+        free(rec->cfg_fname);
+        free(rec->met_fname);
+        return (1);
+    }
+    strcpy(rec->cfg_fname, cfg_fname);
+    strcpy(rec->met_fname, met_fname);
+    rec->cost_class = cost_class;
+    rec->units = units;
+    rec->seconds = seconds;
+    h->n++;
+
+    return (0);
+}
+
+static void update_rates(cost_history *h) {
+    /* mean seconds per work unit, per cost class and overall */
+    double units[N_COST_CLASSES], seconds[N_COST_CLASSES];
+    double total_units = 0.0, total_seconds = 0.0;
+    int    i, k;
+
+    for (k = 0; k < N_COST_CLASSES; k++) {
+        units[k] = 0.0;
+        seconds[k] = 0.0;
+    }
+    for (i = 0; i < h->n; i++) {
+        if (h->rec[i].units <= 0.0 || h->rec[i].seconds <= 0.0)
+            continue;
+        k = h->rec[i].cost_class;
+        units[k] += h->rec[i].units;
+        seconds[k] += h->rec[i].seconds;
+        total_units += h->rec[i].units;
+        total_seconds += h->rec[i].seconds;
+    }
+    for (k = 0; k < N_COST_CLASSES; k++)
+        h->rate[k] = (units[k] > 0.0) ? seconds[k] / units[k] : 0.0;
+    h->global_rate = (total_units > 0.0) ? total_seconds / total_units : 0.0;
+
+    return;
+}
@@ -47,8 +47,8 @@ void calculate_csoil_flows(control* c, fluxes* f, fast_spinup* fs, params* p,
     p->fmroot = metafract(lnroot);
 
     if (c->spinup_method == SAS) {
-        fs->alloc[S1] = p->fmleaf;
-        fs->alloc[S2] = p->fmroot;
+        fs->alloc[S1] += p->fmleaf;
+        fs->alloc[S2] += p->fmroot;
 
     }
 
@@ -401,26 +401,30 @@ void cfluxes_from_structural_pool(fluxes* f, params* p, state* s) {
     double structout_soil = s->structsoil * p->decayrate[2];
 
     /* C flux surface structural pool -> slow pool */
-    f->surf_struct_to_slow = structout_surf * p->ligshoot * 0.7;
+    f->surf_struct_to_slow = structout_surf * p->ligshoot * STRUCT_TO_SLOW;
 
     /* C flux surface structural pool -> active pool */
-    f->surf_struct_to_active = structout_surf * (1.0 - p->ligshoot) * 0.55;
+    f->surf_struct_to_active = structout_surf * (1.0 - p->ligshoot) *
+                               SURF_STRUCT_TO_ACTIVE;
 
     /* C flux soil structural pool -> slow pool */
-    f->soil_struct_to_slow = structout_soil * p->ligroot * 0.7;
+    f->soil_struct_to_slow = structout_soil * p->ligroot * STRUCT_TO_SLOW;
 
     /* soil structural pool -> active pool */
-    f->soil_struct_to_active = structout_soil * (1.0 - p->ligroot) * 0.45;
+    f->soil_struct_to_active = structout_soil * (1.0 - p->ligroot) *
+                               SOIL_STRUCT_TO_ACTIVE;
 
     /* Respiration fluxes */
 
     /* CO2 lost during transfer of structural C to the slow pool */
     f->co2_to_air[0] = (structout_surf *
-        (p->ligshoot * 0.3 + (1.0 - p->ligshoot) * 0.45));
+        (p->ligshoot * (1.0 - STRUCT_TO_SLOW) +
+         (1.0 - p->ligshoot) * (1.0 - SURF_STRUCT_TO_ACTIVE)));
 
     /* CO2 lost during transfer structural C  to the active pool */
     f->co2_to_air[1] = (structout_soil *
-        (p->ligroot * 0.3 + (1.0 - p->ligroot) * 0.55));
+        (p->ligroot * (1.0 - STRUCT_TO_SLOW) +
+         (1.0 - p->ligroot) * (1.0 - SOIL_STRUCT_TO_ACTIVE)));
 
     return;
 }
@@ -429,14 +433,18 @@ void cfluxes_from_metabolic_pool(fluxes* f, params* p, state* s) {
     /* Send C from metabolic pools to other SOM pools */
 
     /* C flux surface metabolic pool -> active pool */
-    f->surf_metab_to_active = s->metabsurf * p->decayrate[1] * 0.45;
+    f->surf_metab_to_active = s->metabsurf * p->decayrate[1] *
+                              METAB_TO_ACTIVE;
 
     /* C flux soil metabolic pool  -> active pool */
-    f->soil_metab_to_active = s->metabsoil * p->decayrate[3] * 0.45;
+    f->soil_metab_to_active = s->metabsoil * p->decayrate[3] *
+                              METAB_TO_ACTIVE;
 
     /* Respiration fluxes */
-    f->co2_to_air[2] = s->metabsurf * p->decayrate[1] * 0.55;
-    f->co2_to_air[3] = s->metabsoil * p->decayrate[3] * 0.55;
+    f->co2_to_air[2] = s->metabsurf * p->decayrate[1] *
+                       (1.0 - METAB_TO_ACTIVE);
+    f->co2_to_air[3] = s->metabsoil * p->decayrate[3] *
+                       (1.0 - METAB_TO_ACTIVE);
 
     return;
 }
@@ -448,7 +456,7 @@ void cfluxes_from_active_pool(fluxes* f, params* p, state* s,
     double activeout = s->activesoil * p->decayrate[4];
 
     /* C flux active pool -> slow pool */
-    f->active_to_slow = activeout * (1.0 - frac_microb_resp - 0.004);
+    f->active_to_slow = activeout * (1.0 - frac_microb_resp - ACTIVE_TO_PASSIVE);
 
     /* (Parton 1993)
     f->active_to_slow = (activeout * (1.0 - frac_microb_resp - 0.003 -
@@ -456,7 +464,7 @@ void cfluxes_from_active_pool(fluxes* f, params* p, state* s,
     */
 
     /* C flux active pool -> passive pool */
-    f->active_to_passive = activeout * 0.004;
+    f->active_to_passive = activeout * ACTIVE_TO_PASSIVE;
 
     /* Respiration fluxes */
     f->co2_to_air[4] = activeout * frac_microb_resp;
@@ -470,13 +478,13 @@ void cfluxes_from_slow_pool(fluxes* f, params* p, state* s) {
     double slowout = s->slowsoil * p->decayrate[5];
 
     /* C flux slow pool -> active pool */
-    f->slow_to_active = slowout * 0.42;
+    f->slow_to_active = slowout * SLOW_TO_ACTIVE;
 
     /* slow pool -> passive pool */
-    f->slow_to_passive = slowout * 0.03;
+    f->slow_to_passive = slowout * SLOW_TO_PASSIVE;
 
     /* Respiration fluxes */
-    f->co2_to_air[5] = slowout * 0.55;
+    f->co2_to_air[5] = slowout * (1.0 - SLOW_TO_ACTIVE - SLOW_TO_PASSIVE);
 
     return;
 }
@@ -484,10 +492,12 @@ void cfluxes_from_slow_pool(fluxes* f, params* p, state* s) {
 void cfluxes_from_passive_pool(fluxes* f, params* p, state* s) {
 
     /* C flux passive pool -> active pool */
-    f->passive_to_active = s->passivesoil * p->decayrate[6] * 0.45;
+    f->passive_to_active = s->passivesoil * p->decayrate[6] *
+                           PASSIVE_TO_ACTIVE;
 
     /* Respiration fluxes */
-    f->co2_to_air[6] = s->passivesoil * p->decayrate[6] * 0.55;
+    f->co2_to_air[6] = s->passivesoil * p->decayrate[6] *
+                       (1.0 - PASSIVE_TO_ACTIVE);
 
     return;
 }
@@ -562,6 +572,91 @@ void calculate_cpools(fluxes* f, state* s) {
     return;
 }
 
+int steady_state_soil_c(params* p, double* k, double* litter,
+    double frac_microb_resp, int passiveconst, double* pools) {
+    /* Steady state of the seven litter/SOM C pools under constant decay
+    rates and litter inputs, from a single linear solve.
+
+    The pools follow dX/dt = u + A K X, where K holds the decay rates, A
+    the fractions of what decays in one pool that reach another (the
+    same fractions as the cfluxes_from_* functions, with -1 on the
+    diagonal) and u the litter inputs, so at steady state A K X = -u.
+
+    Parameters:
+    -----------
+    k : float[7]
+        decay rates, in p->decayrate order (surface structural, surface
+        metabolic, soil structural, soil metabolic, active, slow, passive)
+    litter : float[4]
+        C inputs to the surface structural, surface metabolic, soil
+        structural and soil metabolic pools
+    passiveconst : int
+        passive pool held at its current value
+    pools : float[7]
+        current pools on the way in, steady state on the way out
+
+    Returns:
+    --------
+    FALSE if there is no steady state (e.g. a pool that never decays)
+    */
+    double a[7 * 7], b[7];
+    int    i;
+
+    for (i = 0; i < 7 * 7; i++)
+        a[i] = 0.0;
+    for (i = 0; i < 7; i++)
+        a[i * 7 + i] = -k[i];
+
+    /* surface structural -> slow, active */
+    a[5 * 7 + 0] = k[0] * p->ligshoot * STRUCT_TO_SLOW;
+    a[4 * 7 + 0] = k[0] * (1.0 - p->ligshoot) * SURF_STRUCT_TO_ACTIVE;
+
+    /* metabolic -> active */
+    a[4 * 7 + 1] = k[1] * METAB_TO_ACTIVE;
+    a[4 * 7 + 3] = k[3] * METAB_TO_ACTIVE;
+
+    /* soil structural -> slow, active */
+    a[5 * 7 + 2] = k[2] * p->ligroot * STRUCT_TO_SLOW;
+    a[4 * 7 + 2] = k[2] * (1.0 - p->ligroot) * SOIL_STRUCT_TO_ACTIVE;
+
+    /* active -> slow, passive */
+    a[5 * 7 + 4] = k[4] * (1.0 - frac_microb_resp - ACTIVE_TO_PASSIVE);
+    a[6 * 7 + 4] = k[4] * ACTIVE_TO_PASSIVE;
+
+    /* slow -> active, passive */
+    a[4 * 7 + 5] = k[5] * SLOW_TO_ACTIVE;
+    a[6 * 7 + 5] = k[5] * SLOW_TO_PASSIVE;
+
+    /* passive -> active */
+    a[4 * 7 + 6] = k[6] * PASSIVE_TO_ACTIVE;
+
+    b[0] = -litter[0];
+    b[1] = -litter[1];
+    b[2] = -litter[2];
+    b[3] = -litter[3];
+    b[4] = 0.0;
+    b[5] = 0.0;
+    b[6] = 0.0;
+
+    if (passiveconst) {
+        for (i = 0; i < 7; i++)
+            a[6 * 7 + i] = 0.0;
+        a[6 * 7 + 6] = 1.0;
+        b[6] = pools[6];
+    }
+
+    if (! solve_linear(a, b, 7))
+        return (FALSE);
+    for (i = 0; i < 7; i++) {
+        if (! isfinite(b[i]) || b[i] < 0.0)
+            return (FALSE);
+    }
+    for (i = 0; i < 7; i++)
+        pools[i] = b[i];
+
+    return (TRUE);
+}
+
 void precision_control_soil_c(fluxes* f, state* s) {
     /* Detect very low values in state variables and force to zero to
     avoid rounding and overflow errors */
@@ -571,15 +666,15 @@ void precision_control_soil_c(fluxes* f, state* s) {
     /* C & N state variables */
     if (s->metabsurf < tolerance) {
         excess = s->metabsurf;
-        f->surf_metab_to_active = excess * 0.45;
-        f->co2_to_air[2] = excess * 0.55;
+        f->surf_metab_to_active = excess * METAB_TO_ACTIVE;
+        f->co2_to_air[2] = excess * (1.0 - METAB_TO_ACTIVE);
         s->metabsurf = 0.0;
     }
 
     if (s->metabsoil < tolerance) {
         excess = s->metabsoil;
-        f->soil_metab_to_active = excess * 0.45;
-        f->co2_to_air[3] = excess * 0.55;
+        f->soil_metab_to_active = excess * METAB_TO_ACTIVE;
+        f->co2_to_air[3] = excess * (1.0 - METAB_TO_ACTIVE);
         s->metabsoil = 0.0;
     }
 
@@ -857,22 +952,26 @@ void nfluxes_from_structural_pools(fluxes* f, params* p, state* s) {
     double structout_surf = s->structsurfn * p->decayrate[0];
     double structout_soil = s->structsoiln * p->decayrate[2];
 
-    sigwt = structout_surf / (p->ligshoot * 0.7 + (1.0 - p->ligshoot) * 0.55);
+    sigwt = structout_surf / (p->ligshoot * STRUCT_TO_SLOW +
+                              (1.0 - p->ligshoot) * SURF_STRUCT_TO_ACTIVE);
 
     /* N flux from surface structural pool -> slow pool */
-    f->n_surf_struct_to_slow = sigwt * p->ligshoot * 0.7;
+    f->n_surf_struct_to_slow = sigwt * p->ligshoot * STRUCT_TO_SLOW;
 
     /* N flux surface structural pool -> active pool */
-    f->n_surf_struct_to_active = sigwt * (1.0 - p->ligshoot) * 0.55;
+    f->n_surf_struct_to_active = sigwt * (1.0 - p->ligshoot) *
+                                 SURF_STRUCT_TO_ACTIVE;
 
-    sigwt = structout_soil / (p->ligroot * 0.7 + (1. - p->ligroot) * 0.45);
+    sigwt = structout_soil / (p->ligroot * STRUCT_TO_SLOW +
+                              (1.0 - p->ligroot) * SOIL_STRUCT_TO_ACTIVE);
 
 
     /* N flux from soil structural pool -> slow pool */
-    f->n_soil_struct_to_slow = sigwt * p->ligroot * 0.7;
+    f->n_soil_struct_to_slow = sigwt * p->ligroot * STRUCT_TO_SLOW;
 
     /* N flux from soil structural pool -> active pool */
-    f->n_soil_struct_to_active = sigwt * (1.0 - p->ligroot) * 0.45;
+    f->n_soil_struct_to_active = sigwt * (1.0 - p->ligroot) *
+                                 SOIL_STRUCT_TO_ACTIVE;
 
     return;
 }
@@ -898,10 +997,10 @@ void nfluxes_from_active_pool(fluxes* f, params* p, state* s,
     sigwt = activeout / (1.0 - frac_microb_resp);
 
     /* N flux active pool -> slow pool */
-    f->n_active_to_slow = sigwt * (1.0 - frac_microb_resp - 0.004);
+    f->n_active_to_slow = sigwt * (1.0 - frac_microb_resp - ACTIVE_TO_PASSIVE);
 
     /* N flux active pool -> passive pool */
-    f->n_active_to_passive = sigwt * 0.004;
+    f->n_active_to_passive = sigwt * ACTIVE_TO_PASSIVE;
 
     return;
 }
@@ -910,13 +1009,13 @@ void nfluxes_from_slow_pool(fluxes* f, params* p, state* s) {
     /* N fluxes from slow pools */
 
     double slowout = s->slowsoiln * p->decayrate[5];
-    double sigwt = slowout / 0.45;
+    double sigwt = slowout / (SLOW_TO_ACTIVE + SLOW_TO_PASSIVE);
 
     /* C flux slow pool -> active pool */
-    f->n_slow_to_active = sigwt * 0.42;
+    f->n_slow_to_active = sigwt * SLOW_TO_ACTIVE;
 
     /* slow pool -> passive pool */
-    f->n_slow_to_passive = sigwt * 0.03;
+    f->n_slow_to_passive = sigwt * SLOW_TO_PASSIVE;
 
     return;
 }
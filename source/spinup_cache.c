@@ -0,0 +1,213 @@
+/* ============================================================================
+* Content-addressed cache of spun-up model states.
+*
+* A spin-up is completely determined by the parameters, the starting state,
+* the control flags and the met data, so before spinning up we hash all of
+* these into a 64-bit key and look for
+*
+*   <spinup_cache_dir>/spinup_<key>.bin
+*
+* which is a checkpoint (see checkpoint.c) of the model as it stood at the
+* end of that spin-up. On a hit the checkpoint is restored instead of
+* spinning up again, giving exactly the same state (and final param file).
+*
+* NOTES:
+*   The key covers the value of every param file key the model runs by,
+*   found through the param registry: the [control] options (but not the
+*   run's own settings, like file names and outputs), the [params] and the
+*   starting [state]. Two .ini files that only differ in where they write
+*   to share an entry. The met data is digested as it was read into memory,
+*   so forcing passed in as columns is cached too; a streamed met file,
+*   only a window of which is in memory, is digested byte for byte. The
+*   structure sizes and checkpoint version go in too, so a different build
+*   never sees another's entries.
+*
+*   Many workers can share one cache directory. Each writes its entry to a
+*   file name of its own and renames it into place, so a reader only ever
+*   sees complete entries. Two workers finishing the same spin-up just
+*   replace one entry with an identical one, so nothing needs locking. A
+*   cache that can't be written to is reported but doesn't fail the run,
+*   nor does an entry that can't be read back (cut short, or from another
+*   machine), which is removed and made again by spinning up.
+*
+* =========================================================================== */
+#include "spinup_cache.h"
+#include "param_registry.h"
+#include "read_met_file.h"
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+static int  hash_file(unsigned long long *, char *);
+static void entry_fname(control *, char *, char *);
+
+
+int spinup_cache_key(control *c, met_arrays *ma, params *p, state *s,
+                     char *key) {
+    /*
+        Hash everything the spin-up of this run depends on, key gets
+        SPINUP_CACHE_KEY_LEN chars. Call once the .ini and met data have
+        been read, before anything has been run. Returns FALSE if the met
+        data can't be digested, when the run just isn't cached.
+    */
+    unsigned long long h = FNV_OFFSET;
+    const ini_key *k;
+    double       **arrays[MAX_MET_VARS];
+    char          *names[MAX_MET_VARS];
+    char          *field;
+    size_t         size;
+    long           nrows;
+    int            i, ncols, sizes[5], version = CHECKPOINT_VERSION;
+
+    sizes[0] = (int)sizeof(control);
+    sizes[1] = (int)sizeof(params);
+    sizes[2] = (int)sizeof(state);
+    sizes[3] = (int)sizeof(fluxes);
+    sizes[4] = (int)sizeof(canopy_wk);
+    h = hash_bytes(h, &version, sizeof(int));
+    h = hash_bytes(h, sizes, sizeof(sizes));
+
+    /* the model's options, params and starting state, by name */
+    for (i = 0; i < num_ini_keys; i++) {
+        k = &(ini_keys[i]);
+        if (k->where == INI_CONTROL && ! is_model_option(k))
+            continue;
+        field = (char *)ini_field(c, p, s, k);
+        size = (k->type == INI_STRING) ? strlen(field) : k->size;
+        h = hash_bytes(h, k->section, strlen(k->section) + 1);
+        h = hash_bytes(h, k->name, strlen(k->name) + 1);
+        h = hash_bytes(h, field, size);
+    }
+
+    if (c->stream_met) {
+        /* only a window of it is in memory, so digest the file itself */
+        if (! hash_file(&h, c->met_fname))
+            return (FALSE);
+    } else {
+        /* however the met data came, from a file or the caller's columns */
+        nrows = (long)c->total_num_days * (c->sub_daily ? c->num_hlf_hrs : 1);
+        h = hash_bytes(h, &nrows, sizeof(long));
+        ncols = met_columns(ma, c->sub_daily, arrays, names);
+        for (i = 0; i < ncols; i++) {
+            if (arrays[i] != NULL && *(arrays[i]) != NULL)
+                h = hash_bytes(h, *(arrays[i]), nrows * sizeof(double));
+        }
+    }
+
+    sprintf(key, "%016llx", h);
+
+    return (TRUE);
+}
+
+int read_spinup_cache(char *key, canopy_wk *cw, control *c, fluxes *f,
+                      fast_spinup *fs, met *m, params *p, state *s,
+                      nrutil *nr) {
+    /*
+        Put the model into the spun-up state stored under key, returns
+        FALSE if there isn't one. An entry that can't be read (e.g. cut
+        short by a full disk) is thrown away, so that the spin-up is done
+        again and stored afresh.
+    */
+    FILE      *fp;
+    char       fname[STRING_LENGTH + SPINUP_CACHE_KEY_LEN + 16];
+    run_clock  rc;
+    jmp_buf    env, *prev;
+
+    entry_fname(c, key, fname);
+    if ((fp = fopen(fname, "rb")) == NULL) {
+        return (FALSE);
+    }
+    fclose(fp);
+
+    /* a spin-up finishes between runs, there's no run clock to speak of */
+    memset(&rc, 0, sizeof(run_clock));
+
+    /* read_checkpoint checks it all before it changes anything */
+    prev = set_exit_handler(&env);
+    if (setjmp(env) != 0) {
+        set_exit_handler(prev);
+        fprintf(stderr, "Warning: spin-up cache entry %s can't be used, "
+                "spinning up again\n", fname);
+        remove(fname);
+        return (FALSE);
+    }
+    read_checkpoint(fname, cw, c, f, fs, m, p, s, nr, &rc);
+    set_exit_handler(prev);
+    if (rc.hw != NULL) {
+        sma(SMA_FREE, rc.hw);
+    }
+    free(rc.disturbance_yrs);
+
+    fprintf(stderr, "Spin-up found in cache: %s\n", fname);
+
+    return (TRUE);
+}
+
+void write_spinup_cache(char *key, canopy_wk *cw, control *c, fluxes *f,
+                        fast_spinup *fs, met *m, params *p, state *s,
+                        nrutil *nr) {
+    /*
+        Store the spun-up state under key, see NOTES for what happens when
+        more than one worker gets here with the same key.
+    */
+    char       fname[STRING_LENGTH + SPINUP_CACHE_KEY_LEN + 16];
+    char       tmp_fname[STRING_LENGTH + SPINUP_CACHE_KEY_LEN + 64];
+    char       tmp_tmp_fname[STRING_LENGTH + SPINUP_CACHE_KEY_LEN + 68];
+    run_clock  rc;
+    jmp_buf    env, *prev;
+
+    entry_fname(c, key, fname);
+
+    /* unique to this process and, through s, to this simulation in it */
+    sprintf(tmp_fname, "%s.%ld.%p", fname, (long)getpid(), (void *)s);
+    sprintf(tmp_tmp_fname, "%s.tmp", tmp_fname);
+
+    prev = set_exit_handler(&env);
+    if (setjmp(env) != 0) {
+        set_exit_handler(prev);
+        remove(tmp_tmp_fname);
+        remove(tmp_fname);
+        fprintf(stderr, "Warning: spin-up not cached in %s\n",
+                c->spinup_cache_dir);
+        return;
+    }
+
+    memset(&rc, 0, sizeof(run_clock));
+    write_checkpoint(tmp_fname, cw, c, f, fs, m, p, s, nr, &rc);
+    set_exit_handler(prev);
+
+    if (rename(tmp_fname, fname) != 0) {
+        /* Windows won't rename over an entry someone else has just made */
+        remove(tmp_fname);
+    }
+
+    return;
+}
+
+static int hash_file(unsigned long long *h, char *fname) {
+    /* returns FALSE if the file can't be read */
+    FILE          *fp;
+    unsigned char  buf[65536];
+    size_t         n;
+
+    if ((fp = fopen(fname, "rb")) == NULL) {
+        fprintf(stderr, "Couldn't open met file %s to digest it, the "
+                "spin-up won't be cached\n", fname);
+        return (FALSE);
+    }
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        *h = hash_bytes(*h, buf, n);
+    }
+    fclose(fp);
+
+    return (TRUE);
+}
+
+static void entry_fname(control *c, char *key, char *fname) {
+    sprintf(fname, "%s/spinup_%s.bin", c->spinup_cache_dir, key);
+    return;
+}
@@ -1,6 +1,21 @@
 
 #include "utilities.h"
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/*
+ * Where gday_exit() should land for the simulation running on this thread.
+ * NULL means no caller has asked to trap errors, so we exit like we always
+ * have (i.e. the command line model).
+ */
+static THREAD_LOCAL jmp_buf *exit_env = NULL;
 
 
 int is_leap_year(int yr) {
@@ -64,11 +79,179 @@ void calculate_daylength(state *s, int num_days, double latitude) {
 void prog_error(const char *reason, const unsigned int line)
 {
     fprintf(stderr, "%s, failed at line: %d\n", reason, line);
-	exit(EXIT_FAILURE);
+	gday_exit(EXIT_FAILURE);
 
     return;
 }
 
+NORETURN void gday_exit(int status)
+{
+    /*
+    Replacement for exit() inside the model. If the calling thread has
+    installed a handler (see gday_sim.c) we unwind back to it so that a bad
+    site doesn't take down every other simulation in the process.
+    */
+    if (exit_env != NULL)
+        longjmp(*exit_env, status == 0 ? EXIT_FAILURE : status);
+
+    exit(status);
+}
+
+jmp_buf *set_exit_handler(jmp_buf *env)
+{
+    /* Install env as this thread's landing pad, returns the previous one */
+    jmp_buf *prev = exit_env;
+
+    exit_env = env;
+    return prev;
+}
+
+int solve_linear(double *h, double *b, int m) {
+    /*
+        Gaussian elimination with partial pivoting on the m x m system
+        h x = b (h row-major), x is returned in b and h is overwritten.
+        Only meant for the handful of unknowns in the spin-up solves.
+        Returns FALSE if h is singular.
+    */
+    double t, piv;
+    int    i, j, k, p;
+
+    for (k = 0; k < m; k++) {
+        p = k;
+        for (i = k + 1; i < m; i++) {
+            if (fabs(h[i * m + k]) > fabs(h[p * m + k]))
+                p = i;
+        }
+        piv = h[p * m + k];
+        if (piv == 0.0 || ! isfinite(piv))
+            return (FALSE);
+        if (p != k) {
+            for (j = 0; j < m; j++) {
+                t = h[k * m + j];
+                h[k * m + j] = h[p * m + j];
+                h[p * m + j] = t;
+            }
+            t = b[k];
+            b[k] = b[p];
+            b[p] = t;
+        }
+        for (i = k + 1; i < m; i++) {
+            t = h[i * m + k] / piv;
+            for (j = k; j < m; j++)
+                h[i * m + j] -= t * h[k * m + j];
+            b[i] -= t * b[k];
+        }
+    }
+    for (k = m - 1; k >= 0; k--) {
+        for (j = k + 1; j < m; j++)
+            b[k] -= h[k * m + j] * b[j];
+        b[k] /= h[k * m + k];
+    }
+
+    return (TRUE);
+}
+
+int map_file(char *fname, int writable, mapped_file *mf) {
+    /*
+        Map the whole of fname into memory, returns FALSE if it can't be
+        read. A writable mapping is private, i.e. copy on write, so writes
+        never reach the file. An empty file gives data == NULL.
+    */
+#ifdef _WIN32
+    HANDLE        file, mapping;
+    LARGE_INTEGER size;
+
+    mf->data = NULL;
+    mf->size = 0;
+    file = CreateFileA(fname, GENERIC_READ, FILE_SHARE_READ, NULL,
+                       OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return (FALSE);
+    if (! GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return (FALSE);
+    }
+    mf->size = (size_t)size.QuadPart;
+
+    /* the view keeps the mapping open, so the handles can go now */
+    if (mf->size > 0) {
+        mapping = CreateFileMapping(file, NULL,
+                                    writable ? PAGE_WRITECOPY : PAGE_READONLY,
+                                    0, 0, NULL);
+        if (mapping != NULL) {
+            mf->data = (char *)MapViewOfFile(mapping, writable ?
+                                             FILE_MAP_COPY : FILE_MAP_READ,
+                                             0, 0, 0);
+            CloseHandle(mapping);
+        }
+        if (mf->data == NULL) {
+            CloseHandle(file);
+            return (FALSE);
+        }
+    }
+    CloseHandle(file);
+#else
+    struct stat st;
+    void       *data;
+    int         fd;
+
+    mf->data = NULL;
+    mf->size = 0;
+    if ((fd = open(fname, O_RDONLY)) < 0)
+        return (FALSE);
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return (FALSE);
+    }
+    mf->size = (size_t)st.st_size;
+
+    if (mf->size > 0) {
+        data = mmap(NULL, mf->size, writable ? PROT_READ | PROT_WRITE :
+                    PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return (FALSE);
+        }
+        mf->data = (char *)data;
+    }
+    close(fd);
+#endif
+
+    return (TRUE);
+}
+
+void unmap_file(mapped_file *mf) {
+
+    if (mf->data != NULL) {
+#ifdef _WIN32
+        UnmapViewOfFile(mf->data);
+#else
+        munmap(mf->data, mf->size);
+#endif
+    }
+    mf->data = NULL;
+    mf->size = 0;
+
+    return;
+}
+
+unsigned long long hash_bytes(unsigned long long h, const void *ptr,
+                              size_t size) {
+    /*
+        64-bit FNV-1a of size bytes, carried on from h (start from
+        FNV_OFFSET), e.g. for the met and spin-up cache keys.
+    */
+    const unsigned char *b = (const unsigned char *)ptr;
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        h ^= b[i];
+        h *= FNV_PRIME;
+    }
+
+    return (h);
+}
+
 bool float_eq(double a, double b) {
     /*
     Are two floats approximately equal...?
@@ -284,115 +284,120 @@ void zero_water_movement(fluxes *f, params *p) {
 
 void setup_hydraulics_arrays(fluxes *f, params *p, state *s) {
     /* Allocate the necessary memory for all the hydraulics arrays */
+
+    /* Kept from a previous site on this handle, p->core is fixed */
+    if (p->potA != NULL)
+        return;
+
     p->potA = malloc(p->core * sizeof(double));
     if (p->potA == NULL) {
         fprintf(stderr, "malloc failed allocating Saxton's potA\n");
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
     }
 
     p->potB = malloc(p->core * sizeof(double));
     if (p->potB == NULL) {
         fprintf(stderr, "malloc failed allocating Saxton's potB\n");
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
     }
 
     p->cond1 = malloc(p->core * sizeof(double));
     if (p->cond1 == NULL) {
         fprintf(stderr, "malloc failed allocating Saxton's cond1\n");
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
     }
 
     p->cond2 = malloc(p->core * sizeof(double));
     if (p->cond1 == NULL) {
         fprintf(stderr, "malloc failed allocating Saxton's cond2\n");
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
     }
 
     p->cond3 = malloc(p->core * sizeof(double));
     if (p->cond1 == NULL) {
         fprintf(stderr, "malloc failed allocating Saxton's cond3\n");
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
     }
 
     p->porosity = malloc(p->core * sizeof(double));
     if (p->porosity == NULL) {
         fprintf(stderr, "malloc failed allocating porosity\n");
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
     }
 
     p->field_capacity = malloc(p->core * sizeof(double));
     if (p->field_capacity == NULL) {
         fprintf(stderr, "malloc failed allocating field_capacity\n");
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
     }
 
     f->soil_conduct = malloc(p->core * sizeof(double));
     if (f->soil_conduct == NULL) {
         fprintf(stderr, "malloc failed allocating soil_conduct\n");
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
     }
 
     f->swp = malloc(p->core * sizeof(double));
     if (f->swp == NULL) {
         fprintf(stderr, "malloc failed allocating swp\n");
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
     }
 
     f->soilR = malloc(p->core * sizeof(double));
     if (f->soilR == NULL) {
         fprintf(stderr, "malloc failed allocating soilR\n");
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
     }
 
     f->fraction_uptake = malloc(p->core * sizeof(double));
     if (f->fraction_uptake == NULL) {
         fprintf(stderr, "malloc failed allocating soilR\n");
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
     }
 
     f->ppt_gain = malloc(p->core * sizeof(double));
     if (f->ppt_gain == NULL) {
         fprintf(stderr, "malloc failed allocating ppt_gain\n");
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
     }
 
     f->water_loss = malloc(p->core * sizeof(double));
     if (f->water_loss == NULL) {
         fprintf(stderr, "malloc failed allocating water_loss\n");
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
     }
 
     f->water_gain = malloc(p->core * sizeof(double));
     if (f->water_gain == NULL) {
         fprintf(stderr, "malloc failed allocating water_gain\n");
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
     }
 
     /* Depth to bottom of wet soil layers (m) */
     s->water_frac = malloc(p->core * sizeof(double));
     if (s->water_frac == NULL) {
         fprintf(stderr, "malloc failed allocating water_frac\n");
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
     }
 
     /* Depth to bottom of wet soil layers (m) */
     s->wetting_bot = malloc(p->wetting * sizeof(double));
     if (s->wetting_bot == NULL) {
         fprintf(stderr, "malloc failed allocating wetting_bot\n");
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
     }
 
     /* Depth to top of wet soil layers (m) */
     s->wetting_top = malloc(p->wetting * sizeof(double));
     if (s->wetting_top == NULL) {
         fprintf(stderr, "malloc failed allocating wetting_top\n");
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
     }
 
     f->est_evap = malloc(p->core * sizeof(double));
     if (f->est_evap == NULL) {
         fprintf(stderr, "malloc failed allocating est_evap\n");
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
     }
 
     return;
@@ -624,7 +629,7 @@ void calc_water_uptake_per_layer(fluxes *f, params *p, state *s) {
 
     if (f->fraction_uptake[0] > 1 || f->fraction_uptake[0] < 0) {
         fprintf(stderr, "Problem with the uptake fraction\n");
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
     }
 
     return;
@@ -741,7 +746,7 @@ void calc_wetting_layers(fluxes *f, params *p, state *s, double soil_evap,
 
     if (s->dry_thick == 0.0) {
         fprintf(stderr, "Problem in dry_thick\n");
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
     }
 
     return;
@@ -861,7 +866,7 @@ void calc_soil_balance(fluxes *f, nrutil *nr, params *p, state *s,
     if (f->water_loss[soil_layer] < 0.0) {
         fprintf(stderr, "waterloss probem in soil_balance: %d %f\n",
                 soil_layer, f->water_loss[soil_layer]);
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
     }
 
     //free_dvector(ystart, 1, N);
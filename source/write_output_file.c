@@ -4,7 +4,26 @@
 *
 *
 * NOTES:
-*   Currently I have only implemented the ascii version
+*   The ascii values don't go through printf, which was most of the cost of
+*   writing a day out, but format_fixed, which gives exactly what "%.*f"
+*   gave. A record is put together in memory and handed to stdio in one
+*   piece, and the files have an OUT_FILE_BUFFER buffer, so they are written
+*   in large blocks.
+*
+*   The binary outputs (output_ascii = false) describe themselves: an
+*   out_binary_header, a name and units for each column, then one record
+*   of ncols doubles per day, or half hour, in the machine's own byte
+*   order. So reading one is a seek to data_offset and a single read
+*   straight into an nrecords x ncols array, without parsing anything.
+*   Aggregated outputs have steps_per_day 0, their time columns saying
+*   which period each record is. Records are only ever added to the end;
+*   the count in the header is filled in when the file is closed and is -1
+*   until then (e.g. if the run was killed), in which case the file size
+*   says how many there are.
+*
+*   With [output] arrow the daily or aggregated file is an Arrow IPC stream
+*   of the same columns instead, see arrow_writer.c; the sub-daily file
+*   stays as it is.
 *
 * AUTHOR:
 *   Martin De Kauwe
@@ -15,11 +34,37 @@
 * =========================================================================== */
 #include "write_output_file.h"
 
+/* a line of ascii output, written out in one go */
+typedef struct {
+    FILE           *fp;
+    output_writer  *writer;
+    int             len;
+    int             started;    /* some of it already written out */
+    char            buf[OUT_LINE_LEN];
+} out_line;
+
+static int  time_columns(control *, int, const char **, const char **);
+static void write_period(control *);
+static void write_out(output_writer *, FILE *, const void *, size_t);
+static void buffer_row(control *, const double *, int);
+static void start_line(out_line *, FILE *, output_writer *);
+static void put_value(out_line *, double, int);
+static void end_line(out_line *);
+static void mul_64(unsigned long long, unsigned long long,
+                   unsigned long long *, unsigned long long *);
 
 void open_output_file(control *c, char *fname, FILE **fp) {
     *fp = fopen(fname, "w");
     if (*fp == NULL)
         prog_error("Error opening output file for write on line", __LINE__);
+    setvbuf(*fp, NULL, _IOFBF, OUT_FILE_BUFFER);
+}
+
+void open_binary_output_file(control *c, char *fname, FILE **fp) {
+    *fp = fopen(fname, "wb");
+    if (*fp == NULL)
+        prog_error("Error opening output file for write on line", __LINE__);
+    setvbuf(*fp, NULL, _IOFBF, OUT_FILE_BUFFER);
 }
 
 void write_output_subdaily_header(control *c, FILE **fp) {
@@ -27,18 +72,20 @@ void write_output_subdaily_header(control *c, FILE **fp) {
         Write 30 min fluxes headers to an output CSV file. This is very basic
         for now...
     */
+    int i;
 
     ///* Git version */
     //fprintf(*fp, "#Git_revision_code:%s\n", c->git_code_ver);
 
     /* time stuff */
-    fprintf(*fp, "year,doy,hod,");
+    fprintf(*fp, "year,doy,hod");
 
     /*
     ** Canopy stuff...
     */
-    fprintf(*fp, "an_canopy,rd_canopy,gsc_canopy,");
-    fprintf(*fp, "apar_canopy,trans_canopy,tleaf\n");
+    for (i = 0; i < num_subdaily_output_vars; i++)
+        fprintf(*fp, ",%s", subdaily_output_vars[i].name);
+    fprintf(*fp, "\n");
     return;
 }
 
@@ -48,109 +95,136 @@ void write_output_header(control *c, FILE **fp) {
         are not writing anything useful like units as there is a wrapper
         script to translate the outputs to a nice CSV file with input met
         data, units and nice header information.
+
+        The columns are the ones picked in [output] variables, or the
+        default set if there weren't any (see output_vars.c).
     */
-    int ncols = 86;
-    int nrows = c->num_days;
+    const char *names[3], *units[3];
+    int i, ntime;
+
+    if (c->num_out_vars == 0)
+        default_output_vars(c);
 
     ///* Git version */
     //fprintf(*fp, "#Git_revision_code:%s\n", c->git_code_ver);
 
     /* time stuff */
-    fprintf(*fp, "year,doy,");
+    ntime = time_columns(c, FALSE, names, units);
+    for (i = 0; i < ntime; i++)
+        fprintf(*fp, "%s%s", i > 0 ? "," : "", names[i]);
+
+    for (i = 0; i < c->num_out_vars; i++)
+        fprintf(*fp, ",%s", output_vars[c->out_vars[i]].name);
+    fprintf(*fp, "\n");
 
+    return;
+}
+
+void write_binary_output_header(control *c, FILE *fp, int sub_daily) {
     /*
-    ** STATE
+        Start a binary output file (daily, or sub-daily if sub_daily) with
+        its header, see write_output_file.h. The record count is filled in
+        when the file is closed, see finish_binary_outputs.
     */
+    out_binary_header h;
+    out_binary_column col[MAX_OUTPUT_VARS + 3];
+    const output_var *v;
+    const char *names[3], *units[3];
+    int i, ntime, nvars;
+
+    if (! sub_daily && c->num_out_vars == 0)
+        default_output_vars(c);
+    nvars = sub_daily ? num_subdaily_output_vars : c->num_out_vars;
+
+    memset(col, 0, sizeof(col));
+    ntime = time_columns(c, sub_daily, names, units);
+    for (i = 0; i < ntime; i++) {
+        strncpy0(col[i].name, (char *)names[i], OUT_BINARY_NAME_LEN);
+        strncpy0(col[i].units, (char *)units[i], OUT_BINARY_UNITS_LEN);
+    }
+    for (i = 0; i < nvars; i++) {
+        v = sub_daily ? &(subdaily_output_vars[i]) :
+                        &(output_vars[c->out_vars[i]]);
+        strncpy0(col[ntime+i].name, (char *)v->name, OUT_BINARY_NAME_LEN);
+        strncpy0(col[ntime+i].units, (char *)v->units, OUT_BINARY_UNITS_LEN);
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, OUT_BINARY_MAGIC, sizeof(h.magic));
+    h.version = OUT_BINARY_VERSION;
+    h.byte_order = OUT_BINARY_BYTE_ORDER;
+    if (sub_daily)
+        h.steps_per_day = c->num_hlf_hrs;
+    else
+        h.steps_per_day = AGGREGATED(c->print_options) ? 0 : 1;
+    h.ncols = ntime + nvars;
+    h.nrecords = -1;
+    h.data_offset = (long long)(sizeof(h) +
+                                h.ncols * sizeof(out_binary_column));
+    strncpy0(h.model_version, c->git_hash, sizeof(h.model_version));
+
+    fwrite(&h, sizeof(h), 1, fp);
+    fwrite(col, sizeof(out_binary_column), h.ncols, fp);
+
+    if (sub_daily)
+        c->num_out_sd_records = 0;
+    else
+        c->num_out_records = 0;
+
+    return;
+}
 
-    /* water*/
-    fprintf(*fp, "wtfac_root,wtfac_topsoil,pawater_root,pawater_topsoil,");
+void finish_binary_outputs(control *c) {
+    /*
+        Put the number of records into the header of the binary output
+        files, which have to have had everything written to them by now.
+    */
+    long long nrecords;
 
-    /* plant */
-    fprintf(*fp, "nsc,shoot,lai,branch,stem,root,croot,shootn,branchn,stemn,");
-    fprintf(*fp, "rootn,crootn,cstore,nstore,");
+    if (c->num_out_records >= 0 && c->ofp != NULL) {
+        nrecords = c->num_out_records;
+        fseek(c->ofp, (long)offsetof(out_binary_header, nrecords), SEEK_SET);
+        fwrite(&nrecords, sizeof(nrecords), 1, c->ofp);
+    }
+    if (c->num_out_sd_records >= 0 && c->ofp_sd != NULL) {
+        nrecords = c->num_out_sd_records;
+        fseek(c->ofp_sd, (long)offsetof(out_binary_header, nrecords),
+              SEEK_SET);
+        fwrite(&nrecords, sizeof(nrecords), 1, c->ofp_sd);
+    }
+    c->num_out_records = -1;
+    c->num_out_sd_records = -1;
 
-    /* belowground */
-    fprintf(*fp, "soilc,soiln,inorgn,litterc,littercag,littercbg,");
-    fprintf(*fp, "litternag,litternbg,activesoil,slowsoil,");
-    fprintf(*fp, "passivesoil,activesoiln,slowsoiln,passivesoiln,");
+    return;
+}
 
+void open_arrow_output(control *c) {
     /*
-    ** FLUXES
+        Start the Arrow stream in the daily (or aggregated) output file, once
+        the writer thread, if any, is running as the schema goes through it.
     */
+    const char *names[MAX_OUTPUT_VARS + 3], *units[3];
+    int i, ntime;
+
+    if (c->num_out_vars == 0)
+        default_output_vars(c);
+
+    ntime = time_columns(c, FALSE, names, units);
+    for (i = 0; i < c->num_out_vars; i++)
+        names[ntime+i] = output_vars[c->out_vars[i]].name;
+    c->arrow = open_arrow_writer(c->ofp, c->writer, ntime + c->num_out_vars,
+                                 names, c->site_id, c->arrow_batch);
+
+    return;
+}
 
-    /* water */
-    fprintf(*fp, "et,transpiration,soil_evap,canopy_evap,runoff,");
-    fprintf(*fp, "gs_mol_m2_sec,ga_mol_m2_sec,");
-
-    /* litter */
-    fprintf(*fp, "deadleaves,deadbranch,deadstems,deadroots,deadcroots,");
-    fprintf(*fp, "deadleafn,deadbranchn,deadstemn,deadrootn,deadcrootn,");
-
-    /* C fluxes */
-    fprintf(*fp, "nep,gpp,a_max,npp,hetero_resp,auto_resp,apar,");
-
-    /* C & N growth */
-    fprintf(*fp, "cpleaf,cpbranch,cpstem,cproot,cpcroot,");
-    fprintf(*fp, "npleaf,npbranch,npstemimm,npstemmob,nproot,npcroot,");
-
-    /* N stuff */
-    fprintf(*fp, "nuptake,ngross,nmineralisation,nloss,");
-
-    /* traceability stuff */
-    fprintf(*fp, "tfac_soil_decomp,c_into_active,c_into_slow,");
-    fprintf(*fp, "c_into_passive,active_to_slow,active_to_passive,");
-    fprintf(*fp, "slow_to_active,slow_to_passive,passive_to_active,");
-    fprintf(*fp, "co2_rel_from_surf_struct_litter,");
-    fprintf(*fp, "co2_rel_from_soil_struct_litter,");
-    fprintf(*fp, "co2_rel_from_surf_metab_litter,");
-    fprintf(*fp, "co2_rel_from_soil_metab_litter,");
-    fprintf(*fp, "co2_rel_from_active_pool,");
-    fprintf(*fp, "co2_rel_from_slow_pool,");
-    fprintf(*fp, "co2_rel_from_passive_pool,");
-
-    /* extra priming stuff */
-    fprintf(*fp, "root_exc,");
-    fprintf(*fp, "root_exn,");
-    fprintf(*fp, "co2_released_exud,");
-    fprintf(*fp, "factive,");
-    fprintf(*fp, "rtslow,");
-    fprintf(*fp, "rexc_cue,");
-
-
-
-    /* Misc */
-    fprintf(*fp, "predawn_swp,");
-    fprintf(*fp, "midday_lwp,");
-    fprintf(*fp, "midday_xwp,");
-    fprintf(*fp, "leafretransn,");
-    fprintf(*fp, "dead_year,");
-    fprintf(*fp, "dead_doy,");
-    fprintf(*fp, "theta0,");
-    fprintf(*fp, "theta1,");
-    fprintf(*fp, "theta2,");
-    fprintf(*fp, "theta3,");
-    fprintf(*fp, "theta4,");
-    fprintf(*fp, "theta5,");
-    fprintf(*fp, "theta6,");
-    fprintf(*fp, "theta7,");
-    fprintf(*fp, "theta8,");
-    fprintf(*fp, "theta9,");
-    fprintf(*fp, "theta10,");
-    fprintf(*fp, "theta11,");
-    fprintf(*fp, "theta12,");
-    fprintf(*fp, "theta13,");
-    fprintf(*fp, "theta14,");
-    fprintf(*fp, "theta15,");
-    fprintf(*fp, "theta16,");
-    fprintf(*fp, "theta17,");
-    fprintf(*fp, "theta18,");
-    fprintf(*fp, "theta19,");
-    fprintf(*fp, "theta20\n");
-
-    if (c->output_ascii == FALSE) {
-        fprintf(*fp, "nrows=%d\n", nrows);
-        fprintf(*fp, "ncols=%d\n", ncols);
+void finish_arrow_output(control *c) {
+    /* the last batch and the end of the stream, before the writer stops */
+    if (c->arrow != NULL) {
+        close_arrow_writer(c->arrow);
+        c->arrow = NULL;
     }
+
     return;
 }
 
@@ -159,15 +233,42 @@ void write_subdaily_outputs_ascii(control *c, canopy_wk *cw, double year,
     /*
         Write sub-daily canopy fluxes - very basic for now
     */
+    out_line ln;
+    int      i, digits = c->out_precision;
+
+    start_line(&ln, c->ofp_sd, c->writer);
 
     /* time stuff */
-    fprintf(c->ofp_sd, "%.10f,%.10f,%.10f,", year, doy, (double)hod);
+    put_value(&ln, year, digits);
+    put_value(&ln, doy, digits);
+    put_value(&ln, (double)hod, digits);
 
     /* Canopy stuff */
-    fprintf(c->ofp_sd, "%.10f,%.10f,%.10f,",
-                       cw->an_canopy, cw->rd_canopy, cw->gsc_canopy);
-    fprintf(c->ofp_sd, "%.10f,%.10f,%.10f\n",
-                       cw->apar_canopy, cw->trans_canopy, cw->tleaf_new);
+    for (i = 0; i < num_subdaily_output_vars; i++)
+        put_value(&ln, output_var_value(c, cw, NULL, NULL,
+                                        &(subdaily_output_vars[i])), digits);
+    end_line(&ln);
+
+    return;
+}
+
+void write_subdaily_outputs_binary(control *c, canopy_wk *cw, double year,
+                                   double doy, int hod) {
+    /* Write sub-daily canopy fluxes to the binary output file */
+    double temp[MAX_OUTPUT_VARS + 3];
+    int    i;
+
+    /* time stuff */
+    temp[0] = year;
+    temp[1] = doy;
+    temp[2] = (double)hod;
+
+    for (i = 0; i < num_subdaily_output_vars; i++)
+        temp[i+3] = output_var_value(c, cw, NULL, NULL,
+                                     &(subdaily_output_vars[i]));
+    write_out(c->writer, c->ofp_sd, temp,
+              (num_subdaily_output_vars + 3) * sizeof(double));
+    c->num_out_sd_records++;
 
     return;
 }
@@ -175,189 +276,336 @@ void write_subdaily_outputs_ascii(control *c, canopy_wk *cw, double year,
 void write_daily_outputs_ascii(control *c, canopy_wk *cw, fluxes *f, state *s,
                                int year, int doy) {
     /*
-        Write daily state and fluxes headers to an output CSV file. Note we
-        are not writing anything useful like units as there is a wrapper
-        script to translate the outputs to a nice CSV file with input met
-        data, units and nice header information.
+        Write daily state and fluxes to an output CSV file, the columns in
+        the header.
     */
+    out_line ln;
+    int      i, digits;
 
+    start_line(&ln, c->ofp, c->writer);
 
     /* time stuff */
-    fprintf(c->ofp, "%.10f,%.10f,", (double)year, (double)doy);
+    put_value(&ln, (double)year, c->out_precision);
+    put_value(&ln, (double)doy, c->out_precision);
+
+    for (i = 0; i < c->num_out_vars; i++) {
+        digits = c->out_digits[i] < 0 ? c->out_precision : c->out_digits[i];
+        put_value(&ln, output_var_value(c, cw, f, s,
+                                        &(output_vars[c->out_vars[i]])),
+                  digits);
+    }
+    end_line(&ln);
 
-    /*
-    ** STATE
+    return;
+}
 
+void write_daily_outputs_binary(control *c, canopy_wk *cw, fluxes *f,
+                                state *s, int year, int doy) {
+    /*
+        Write daily state and fluxes to the binary output file, a record of
+        the header's columns as doubles.
     */
+    double temp[MAX_OUTPUT_VARS + 2];
+    int    i;
+
+    /* time stuff */
+    temp[0] = (double)year;
+    temp[1] = (double)doy;
+
+    for (i = 0; i < c->num_out_vars; i++)
+        temp[i+2] = output_var_value(c, cw, f, s,
+                                     &(output_vars[c->out_vars[i]]));
+    if (c->out_buffer != NULL) {
+        buffer_row(c, temp, c->num_out_vars + 2);
+    } else if (c->arrow != NULL) {
+        arrow_writer_row(c->arrow, temp);
+    } else {
+        write_out(c->writer, c->ofp, temp,
+                  (c->num_out_vars + 2) * sizeof(double));
+        c->num_out_records++;
+    }
+
+    return;
+}
 
-    /* water*/
-    fprintf(c->ofp, "%.10f,%.10f,%.10f,%.10f,",
-            s->wtfac_root,s->wtfac_topsoil,s->pawater_root, s->pawater_topsoil);
-
-    /* plant */
-    fprintf(c->ofp, "%.10f,%.10f,%.10f,%.10f,%.10f,%.10f,%.10f,%.10f,%.10f,%.10f,",
-		            s->nsc, s->shoot,s->lai,s->branch,s->stem,s->root,s->croot,
-                    s->shootn,s->branchn,s->stemn);
-    fprintf(c->ofp, "%.10f,%.10f,%.10f,%.10f,",
-                    s->rootn,s->crootn,s->cstore,s->nstore);
-
-    /* belowground */
-    fprintf(c->ofp, "%.10f,%.10f,%.10f,%.10f,%.10f,%.10f,",
-                    s->soilc,s->soiln,s->inorgn,s->litterc,s->littercag,
-                    s->littercbg);
-    fprintf(c->ofp, "%.10f,%.10f,%.10f,%.10f,%.10f,%.10f,%.10f,%.10f,",
-                    s->litternag,s->litternbg,s->activesoil,s->slowsoil,
-                    s->passivesoil,s->activesoiln,s->slowsoiln,
-                    s->passivesoiln);
+void write_aggregated_outputs(control *c, canopy_wk *cw, fluxes *f, state *s,
+                              int year, int doy) {
     /*
-    ** FLUXES
+        Add the day to the month/season/year it falls in, the one before
+        being written out first if this day starts a new one.
     */
+    double x;
+    int    i, how, pyear, period;
+
+    aggregation_period(c, year, doy, &pyear, &period);
+    if (c->agg_ndays > 0 && (pyear != c->agg_year || period != c->agg_period))
+        write_period(c);
+    if (c->agg_ndays == 0) {
+        c->agg_year = pyear;
+        c->agg_period = period;
+    }
+
+    for (i = 0; i < c->num_out_vars; i++) {
+        x = output_var_value(c, cw, f, s, &(output_vars[c->out_vars[i]]));
+        how = c->out_how[i] < 0 ? c->out_aggregate : c->out_how[i];
+        if (c->agg_ndays == 0)
+            c->agg_value[i] = x;
+        else if (how == AGG_MIN)
+            c->agg_value[i] = MIN(c->agg_value[i], x);
+        else if (how == AGG_MAX)
+            c->agg_value[i] = MAX(c->agg_value[i], x);
+        else
+            c->agg_value[i] += x;
+    }
+    c->agg_ndays++;
+
+    return;
+}
+
+void finish_aggregated_outputs(control *c) {
+    /* write out the period the run stopped part way through, if any */
+    if (AGGREGATED(c->print_options) && c->spin_up == FALSE &&
+        (c->ofp != NULL || c->out_buffer != NULL) && c->agg_ndays > 0)
+        write_period(c);
+
+    return;
+}
 
-    /* water */
-    fprintf(c->ofp, "%.10f,%.10f,%.10f,%.10f,",
-                    f->et,f->transpiration,f->soil_evap,f->canopy_evap);
-    fprintf(c->ofp, "%.10f,%.10f,%.10f,",
-                    f->runoff,f->gs_mol_m2_sec,f->ga_mol_m2_sec);
-
-    /* litter */
-    fprintf(c->ofp, "%.10f,%.10f,%.10f,%.10f,%.10f,",
-                    f->deadleaves,f->deadbranch,f->deadstems,f->deadroots,
-                    f->deadcroots);
-    fprintf(c->ofp, "%.10f,%.10f,%.10f,%.10f,%.10f,",
-                    f->deadleafn,f->deadbranchn,f->deadstemn,f->deadrootn,
-                    f->deadcrootn);
-
-    /* C fluxes */
-    fprintf(c->ofp, "%.10f,%.10f,%.10f,%.10f,%.10f,%.10f,%.10f,",
-                    f->nep,f->gpp,f->a_max,f->npp,f->hetero_resp,f->auto_resp,
-                    f->apar);
-
-    /* C & N growth */
-    fprintf(c->ofp, "%.10f,%.10f,%.10f,%.10f,%.10f,",
-                    f->cpleaf,f->cpbranch,f->cpstem,f->cproot,f->cpcroot);
-    fprintf(c->ofp, "%.10f,%.10f,%.10f,%.10f,%.10f,%.10f,",
-                    f->npleaf,f->npbranch,f->npstemimm,f->npstemmob,f->nproot,
-                    f->npcroot);
-
-    /* N stuff */
-    fprintf(c->ofp, "%.10f,%.10f,%.10f,%.10f,",
-                    f->nuptake,f->ngross,f->nmineralisation,f->nloss);
-
-
-    /* traceability stuff */
-    fprintf(c->ofp, "%.10f,%.10f,%.10f,",
-                    f->tfac_soil_decomp,f->c_into_active,f->c_into_slow);
-    fprintf(c->ofp, "%.10f,%.10f,%.10f,",
-                    f->c_into_passive,f->active_to_slow,f->active_to_passive);
-    fprintf(c->ofp, "%.10f,%.10f,%.10f,",
-                    f->slow_to_active,f->slow_to_passive,f->passive_to_active);
-    fprintf(c->ofp, "%.10f,", f->co2_rel_from_surf_struct_litter);
-    fprintf(c->ofp, "%.10f,", f->co2_rel_from_soil_struct_litter);
-    fprintf(c->ofp, "%.10f,", f->co2_rel_from_surf_metab_litter);
-    fprintf(c->ofp, "%.10f,", f->co2_rel_from_soil_metab_litter);
-    fprintf(c->ofp, "%.10f,", f->co2_rel_from_active_pool);
-    fprintf(c->ofp, "%.10f,", f->co2_rel_from_slow_pool);
-    fprintf(c->ofp, "%.10f,", f->co2_rel_from_passive_pool);
-
-    /* extra priming stuff */
-    fprintf(c->ofp, "%.10f,", f->root_exc);
-    fprintf(c->ofp, "%.10f,", f->root_exn);
-    fprintf(c->ofp, "%.10f,", f->co2_released_exud);
-    fprintf(c->ofp, "%.10f,", f->factive);
-    fprintf(c->ofp, "%.10f,", f->rtslow);
-    fprintf(c->ofp, "%.10f,", f->rexc_cue);
-
-    /* Misc */
-    fprintf(c->ofp, "%.10f,", s->predawn_swp);
-    fprintf(c->ofp, "%.10f,", s->midday_lwp);
-    fprintf(c->ofp, "%.10f,", s->midday_xwp);
-    fprintf(c->ofp, "%.10f,", f->leafretransn);
-    fprintf(c->ofp, "%.10f,", cw->death_year);
-    fprintf(c->ofp, "%.10f,", cw->death_doy);
-
-    if (c->water_balance == HYDRAULICS) {
-        fprintf(c->ofp, "%.10f,", s->water_frac[0]);
-        fprintf(c->ofp, "%.10f,", s->water_frac[1]);
-        fprintf(c->ofp, "%.10f,", s->water_frac[2]);
-        fprintf(c->ofp, "%.10f,", s->water_frac[3]);
-        fprintf(c->ofp, "%.10f,", s->water_frac[4]);
-        fprintf(c->ofp, "%.10f,", s->water_frac[5]);
-        fprintf(c->ofp, "%.10f,", s->water_frac[6]);
-        fprintf(c->ofp, "%.10f,", s->water_frac[7]);
-        fprintf(c->ofp, "%.10f,", s->water_frac[8]);
-        fprintf(c->ofp, "%.10f,", s->water_frac[9]);
-        fprintf(c->ofp, "%.10f,", s->water_frac[10]);
-        fprintf(c->ofp, "%.10f,", s->water_frac[11]);
-        fprintf(c->ofp, "%.10f,", s->water_frac[12]);
-        fprintf(c->ofp, "%.10f,", s->water_frac[13]);
-        fprintf(c->ofp, "%.10f,", s->water_frac[14]);
-        fprintf(c->ofp, "%.10f,", s->water_frac[15]);
-        fprintf(c->ofp, "%.10f,", s->water_frac[16]);
-        fprintf(c->ofp, "%.10f,", s->water_frac[17]);
-        fprintf(c->ofp, "%.10f,", s->water_frac[18]);
-        fprintf(c->ofp, "%.10f,", s->water_frac[19]);
-        fprintf(c->ofp, "%.10f\n", s->water_frac[20]);
+static void write_period(control *c) {
+    /* a row of the aggregated output, see output_vars.c */
+    double   temp[MAX_OUTPUT_VARS + 3], x;
+    out_line ln;
+    int      i, how, digits, ntime = 0;
+
+    temp[ntime++] = (double)c->agg_year;
+    if (c->print_options != ANNUAL)
+        temp[ntime++] = (double)c->agg_period;
+    temp[ntime++] = (double)c->agg_ndays;
+
+    if (c->output_ascii) {
+        start_line(&ln, c->ofp, c->writer);
+        for (i = 0; i < ntime; i++)
+            put_value(&ln, temp[i], c->out_precision);
+    }
+    for (i = 0; i < c->num_out_vars; i++) {
+        how = c->out_how[i] < 0 ? c->out_aggregate : c->out_how[i];
+        x = c->agg_value[i];
+        if (how == AGG_MEAN)
+            x /= (double)c->agg_ndays;
+        if (c->output_ascii) {
+            digits = c->out_digits[i] < 0 ? c->out_precision :
+                                            c->out_digits[i];
+            put_value(&ln, x, digits);
+        } else {
+            temp[ntime+i] = x;
+        }
+    }
+    if (c->output_ascii) {
+        end_line(&ln);
+    } else if (c->out_buffer != NULL) {
+        buffer_row(c, temp, ntime + c->num_out_vars);
+    } else if (c->arrow != NULL) {
+        arrow_writer_row(c->arrow, temp);
     } else {
-        fprintf(c->ofp, "%.10f,", -999.9);
-        fprintf(c->ofp, "%.10f,", -999.9);
-        fprintf(c->ofp, "%.10f,", -999.9);
-        fprintf(c->ofp, "%.10f,", -999.9);
-        fprintf(c->ofp, "%.10f,", -999.9);
-        fprintf(c->ofp, "%.10f,", -999.9);
-        fprintf(c->ofp, "%.10f,", -999.9);
-        fprintf(c->ofp, "%.10f,", -999.9);
-        fprintf(c->ofp, "%.10f,", -999.9);
-        fprintf(c->ofp, "%.10f,", -999.9);
-        fprintf(c->ofp, "%.10f,", -999.9);
-        fprintf(c->ofp, "%.10f,", -999.9);
-        fprintf(c->ofp, "%.10f,", -999.9);
-        fprintf(c->ofp, "%.10f,", -999.9);
-        fprintf(c->ofp, "%.10f,", -999.9);
-        fprintf(c->ofp, "%.10f,", -999.9);
-        fprintf(c->ofp, "%.10f,", -999.9);
-        fprintf(c->ofp, "%.10f,", -999.9);
-        fprintf(c->ofp, "%.10f,", -999.9);
-        fprintf(c->ofp, "%.10f,", -999.9);
-        fprintf(c->ofp, "%.10f\n", -999.9);
+        write_out(c->writer, c->ofp, temp,
+                  (ntime + c->num_out_vars) * sizeof(double));
+        c->num_out_records++;
     }
+    c->agg_ndays = 0;
 
     return;
 }
 
-void write_daily_outputs_binary(control *c, fluxes *f, state *s, int year,
-                                int doy) {
+int output_columns(control *c, const char **names) {
     /*
-        Write daily state and fluxes headers to an output CSV file. Note we
-        are not writing anything useful like units as there is a wrapper
-        script to translate the outputs to a nice CSV file with input met
-        data, units and nice header information.
+        The names of the columns of a daily or aggregated output record,
+        returning how many there are.
     */
-    double temp;
+    const char *units[MAX_OUTPUT_VARS + 3];
+    int         i, n;
 
-    /* time stuff */
-    temp = (double)year;
-    fwrite(&temp, sizeof(double), 1, c->ofp);
-    temp = (double)doy;
-    fwrite(&temp, sizeof(double), 1, c->ofp);
-
-
-    /* plant */
-    fwrite(&(s->shoot), sizeof(double), 1, c->ofp);
-    fwrite(&(s->lai), sizeof(double), 1, c->ofp);
-    fwrite(&(s->branch), sizeof(double), 1, c->ofp);
-    fwrite(&(s->stem), sizeof(double), 1, c->ofp);
-    fwrite(&(s->root), sizeof(double), 1, c->ofp);
-
-    /* water */
-    fwrite(&(s->wtfac_root), sizeof(double), 1, c->ofp);
-    fwrite(&(s->pawater_root), sizeof(double), 1, c->ofp);
-    fwrite(&(f->transpiration), sizeof(double), 1, c->ofp);
-    fwrite(&(f->soil_evap), sizeof(double), 1, c->ofp);
-    fwrite(&(f->canopy_evap), sizeof(double), 1, c->ofp);
-    fwrite(&(f->runoff), sizeof(double), 1, c->ofp);
-
-    /* C fluxes */
-    fwrite(&(f->npp), sizeof(double), 1, c->ofp);
+    n = time_columns(c, FALSE, names, units);
+    for (i = 0; i < c->num_out_vars; i++)
+        names[n++] = output_vars[c->out_vars[i]].name;
+
+    return (n);
+}
+
+static int time_columns(control *c, int sub_daily, const char **names,
+                        const char **units) {
+    /* the names and units of a file's time columns, returning how many */
+    int n = 0;
+
+    names[n] = "year";
+    units[n++] = "year";
+    if (sub_daily || ! AGGREGATED(c->print_options)) {
+        names[n] = "doy";
+        units[n++] = "day";
+        if (sub_daily) {
+            names[n] = "hod";
+            units[n++] = "half hour";
+        }
+        return (n);
+    }
+
+    if (c->print_options == MONTHLY) {
+        names[n] = "month";
+        units[n++] = "month";
+    } else if (c->print_options == SEASONAL) {
+        names[n] = "season";
+        units[n++] = "DJF=1 MAM=2 JJA=3 SON=4";
+    }
+    names[n] = "ndays";
+    units[n++] = "day";
+
+    return (n);
+}
+
+static void write_out(output_writer *writer, FILE *fp, const void *data,
+                      size_t len) {
+    /* to the file, or the writer thread if there is one */
+    if (writer != NULL)
+        output_writer_put(writer, fp, data, len);
+    else
+        fwrite(data, 1, len, fp);
+
+    return;
+}
+
+static void buffer_row(control *c, const double *row, int ncols) {
+    /* a record into the caller's buffer, see gday_sim_set_output */
+    if (c->out_rows >= c->out_buffer_rows) {
+        fprintf(stderr, "%s: the output buffer only has room for %ld rows\n",
+                c->cfg_fname, c->out_buffer_rows);
+        gday_exit(EXIT_FAILURE);
+    }
+    memcpy(c->out_buffer + c->out_rows * ncols, row, ncols * sizeof(double));
+    c->out_rows++;
+
+    return;
+}
+
+static void start_line(out_line *ln, FILE *fp, output_writer *writer) {
+    ln->fp = fp;
+    ln->writer = writer;
+    ln->len = 0;
+    ln->started = FALSE;
+
+    return;
+}
+
+static void put_value(out_line *ln, double x, int digits) {
+    /* add x to the line, after a comma unless it's the first value */
+    if (ln->len + OUT_FIELD_LEN + 2 > OUT_LINE_LEN) {
+        write_out(ln->writer, ln->fp, ln->buf, ln->len);
+        ln->len = 0;
+        ln->started = TRUE;
+    }
+    if (ln->len > 0 || ln->started)
+        ln->buf[ln->len++] = ',';
+    ln->len += format_fixed(ln->buf + ln->len, x, digits);
+
+    return;
+}
+
+static void end_line(out_line *ln) {
+    ln->buf[ln->len++] = '\n';
+    write_out(ln->writer, ln->fp, ln->buf, ln->len);
+
+    return;
+}
+
+int format_fixed(char *buf, double x, int digits) {
+    /*
+        Write x into buf the way printf's "%.*f" would, returning the length
+        (buf needs OUT_FIELD_LEN bytes). This is the same decimal rounding
+        of the exact binary value, ties to even, but done in integers: x is
+        m 2^e, so x 10^digits is m 5^digits 2^(e + digits), which for
+        anything under 10^(18 - digits) is shifted down to a whole number
+        of 64 bits. Anything else (NaN, inf, huge) goes to snprintf.
+    */
+    static const unsigned long long pow5[] = {
+        1ULL, 5ULL, 25ULL, 125ULL, 625ULL, 3125ULL, 15625ULL, 78125ULL,
+        390625ULL, 1953125ULL, 9765625ULL, 48828125ULL, 244140625ULL,
+        1220703125ULL, 6103515625ULL, 30517578125ULL, 152587890625ULL,
+        762939453125ULL
+    };
+    static const double pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18
+    };
+    unsigned long long m, hi, lo, q, sticky;
+    char   tmp[24];
+    int    e, shift, roundbit, n = 0, k;
+
+    if (digits < 0 || digits > MAX_OUTPUT_DIGITS ||
+        ! (fabs(x) < pow10[18 - digits]))
+        return (snprintf(buf, OUT_FIELD_LEN, "%.*f", digits, x));
+
+    if (signbit(x))
+        buf[n++] = '-';
+
+    m = (unsigned long long)ldexp(frexp(fabs(x), &e), 53);
+    e -= 53;
+    mul_64(m, pow5[digits], &hi, &lo);
+    shift = -(e + digits);
+
+    if (m == 0 || shift >= 128) {
+        /* under 2^93 / 2^128, which rounds to nothing */
+        q = 0;
+    } else if (shift <= 0) {
+        /* whole number, and under 10^18 so it fits */
+        q = lo << -shift;
+    } else {
+        if (shift >= 64)
+            q = hi >> (shift - 64);
+        else
+            q = (lo >> shift) | (hi << (64 - shift));
+
+        /* the bit below the last one kept, and whether any under it */
+        k = shift - 1;
+        if (k >= 64) {
+            roundbit = (int)((hi >> (k - 64)) & 1);
+            sticky = lo | (hi & ((1ULL << (k - 64)) - 1));
+        } else {
+            roundbit = (int)((lo >> k) & 1);
+            sticky = k == 0 ? 0 : lo & ((1ULL << k) - 1);
+        }
+        if (roundbit && (sticky != 0 || (q & 1)))
+            q++;
+    }
+
+    /* digits out backwards, padded to one before the point */
+    k = 0;
+    do {
+        tmp[k++] = (char)('0' + q % 10);
+        q /= 10;
+    } while (q > 0 || k <= digits);
+
+    while (k > digits)
+        buf[n++] = tmp[--k];
+    if (digits > 0) {
+        buf[n++] = '.';
+        while (k > 0)
+            buf[n++] = tmp[--k];
+    }
+    buf[n] = '\0';
+
+    return (n);
+}
+
+static void mul_64(unsigned long long a, unsigned long long b,
+                   unsigned long long *hi, unsigned long long *lo) {
+    /* the full 128 bit product of a and b */
+    unsigned long long a0 = a & 0xffffffffULL, a1 = a >> 32;
+    unsigned long long b0 = b & 0xffffffffULL, b1 = b >> 32;
+    unsigned long long p00 = a0 * b0, p01 = a0 * b1;
+    unsigned long long p10 = a1 * b0, p11 = a1 * b1;
+    unsigned long long mid;
+
+    mid = (p00 >> 32) + (p01 & 0xffffffffULL) + (p10 & 0xffffffffULL);
+    *lo = (mid << 32) | (p00 & 0xffffffffULL);
+    *hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
 
     return;
 }
@@ -368,8 +616,11 @@ int write_final_state(control *c, params *p, state *s)
     /*
     Write the final state to the input param file so we can easily restart
     the model. This function copies the input param file with the exception
-    of anything in the git hash and the state which it replaces with the updated
-    stuff.
+    of the keys param_registry.c marks as saved (the state and previous_ncd),
+    which it replaces with the updated stuff.
+
+    A run loaded without a param file (see gday_sim_load_values) has none
+    to copy, so there is no final state file and nothing is written.
 
     */
 
@@ -381,11 +632,21 @@ int write_final_state(control *c, params *p, state *s)
     char *end;
     char *name;
     char *value;
+    const ini_key *k;
 
     int error = 0;
     int line_number = 0;
     int match = FALSE;
 
+    if (*c->cfg_fname == '\0')
+        return (0);
+
+    if ((c->ifp = fopen(c->cfg_fname, "r")) == NULL) {
+        fprintf(stderr, "Error: couldn't open param file %s for read\n",
+                c->cfg_fname);
+        return (-1);
+    }
+
     while (fgets(line, sizeof(line), c->ifp) != NULL) {
         strcpy(saved_line, line);
         line_number++;
@@ -423,11 +684,15 @@ int write_final_state(control *c, params *p, state *s)
                     *end = '\0';
                 rstrip(value);
 
-                /* Valid name[=:]value pair found, call handler */
+                /* Valid name[=:]value pair found, is it one to update? */
                 strncpy0(prev_name, name, sizeof(prev_name));
 
-                if (!ohandler(section, name, value, c, p, s, &match) && !error)
-                    error = line_number;
+                k = find_ini_key(section, name);
+                if (k != NULL && k->saved) {
+                    fprintf(c->ofp, "%s = %.10f\n", k->name,
+                            *(double *)ini_field(c, p, s, k));
+                    match = TRUE;
+                }
             }
             else if (!error) {
                 /* No '=' or ':' found on name[=:]value line */
@@ -440,173 +705,9 @@ int write_final_state(control *c, params *p, state *s)
         else
             match = FALSE; /* reset match flag */
     }
-    return error;
+    fclose(c->ifp);
+    c->ifp = NULL;
 
-}
-
-
-int ohandler(char *section, char *name, char *value, control *c, params *p,
-             state *s, int *match)
-{
-    /*
-    Search for matches of the git and state values and where found write the
-    current state values to the output parameter file.
-
-    - also added previous ncd as this potential can be changed internally
-    */
-
-    #define MATCH(s, n) strcasecmp(section, s) == 0 && strcasecmp(name, n) == 0
-
-    /*
-    ** GIT
-    */
-    //if (MATCH("git", "git_hash")) {
-    //    fprintf(c->ofp, "git_hash = %s\n", c->git_code_ver);
-    //    *match = TRUE;
-    //}
-
-    /*
-    ** PARAMS
-    */
-    if (MATCH("params", "previous_ncd")) {
-        fprintf(c->ofp, "previous_ncd = %.10f\n", p->previous_ncd);
-        *match = TRUE;
-    }
-
-    /*
-    ** STATE
-    */
-
-    if (MATCH("state", "activesoil")) {
-        fprintf(c->ofp, "activesoil = %.10f\n", s->activesoil);
-        *match = TRUE;
-    } else if (MATCH("state", "activesoiln")) {
-        fprintf(c->ofp, "activesoiln = %.10f\n", s->activesoiln);
-        *match = TRUE;
-    } else if (MATCH("state", "age")) {
-        fprintf(c->ofp, "age = %.10f\n", s->age);
-        *match = TRUE;
-    } else if (MATCH("state", "avg_albranch")) {
-        fprintf(c->ofp, "avg_albranch = %.10f\n", s->avg_albranch);
-        *match = TRUE;
-    } else if (MATCH("state", "avg_alcroot")) {
-        fprintf(c->ofp, "avg_alcroot = %.10f\n", s->avg_alcroot);
-        *match = TRUE;
-    } else if (MATCH("state", "avg_alleaf")) {
-        fprintf(c->ofp, "avg_alleaf = %.10f\n", s->avg_alleaf);
-        *match = TRUE;
-    } else if (MATCH("state", "avg_alroot")) {
-        fprintf(c->ofp, "avg_alroot = %.10f\n", s->avg_alroot);
-        *match = TRUE;
-    } else if (MATCH("state", "avg_alstem")) {
-        fprintf(c->ofp, "avg_alstem = %.10f\n", s->avg_alstem);
-        *match = TRUE;
-    } else if (MATCH("state", "branch")) {
-        fprintf(c->ofp, "branch = %.10f\n", s->branch);
-        *match = TRUE;
-    } else if (MATCH("state", "branchn")) {
-        fprintf(c->ofp, "branchn = %.10f\n", s->branchn);
-        *match = TRUE;
-    } else if (MATCH("state", "canht")) {
-        fprintf(c->ofp, "canht = %.10f\n", s->canht);
-        *match = TRUE;
-    } else if (MATCH("state", "croot")) {
-        fprintf(c->ofp, "croot = %.10f\n", s->croot);
-        *match = TRUE;
-    } else if (MATCH("state", "crootn")) {
-        fprintf(c->ofp, "crootn = %.10f\n", s->crootn);
-        *match = TRUE;
-    } else if (MATCH("state", "cstore")) {
-        fprintf(c->ofp, "cstore = %.10f\n", s->cstore);
-        *match = TRUE;
-    } else if (MATCH("state", "inorgn")) {
-        fprintf(c->ofp, "inorgn = %.10f\n", s->inorgn);
-        *match = TRUE;
-    } else if (MATCH("state", "lai")) {
-        fprintf(c->ofp, "lai = %.10f\n", s->lai);
-        *match = TRUE;
-    } else if (MATCH("state", "metabsoil")) {
-        fprintf(c->ofp, "metabsoil = %.10f\n", s->metabsoil);
-        *match = TRUE;
-    } else if (MATCH("state", "metabsoiln")) {
-        fprintf(c->ofp, "metabsoiln = %.10f\n", s->metabsoiln);
-        *match = TRUE;
-    } else if (MATCH("state", "metabsurf")) {
-        fprintf(c->ofp, "metabsurf = %.10f\n", s->metabsurf);
-        *match = TRUE;
-    } else if (MATCH("state", "metabsurfn")) {
-        fprintf(c->ofp, "metabsurfn = %.10f\n", s->metabsurfn);
-        *match = TRUE;
-    } else if (MATCH("state", "nstore")) {
-        fprintf(c->ofp, "nstore = %.10f\n", s->nstore);
-        *match = TRUE;
-    } else if (MATCH("state", "passivesoil")) {
-        fprintf(c->ofp, "passivesoil = %.10f\n", s->passivesoil);
-        *match = TRUE;
-    } else if (MATCH("state", "passivesoiln")) {
-        fprintf(c->ofp, "passivesoiln = %.10f\n", s->passivesoiln);
-        *match = TRUE;
-    } else if (MATCH("state", "pawater_root")) {
-        fprintf(c->ofp, "pawater_root = %.10f\n", s->pawater_root);
-        *match = TRUE;
-    } else if (MATCH("state", "pawater_topsoil")) {
-        fprintf(c->ofp, "pawater_topsoil = %.10f\n", s->pawater_topsoil);
-        *match = TRUE;
-    } else if (MATCH("state", "prev_sma")) {
-        fprintf(c->ofp, "prev_sma = %.10f\n", s->prev_sma);
-        *match = TRUE;
-    } else if (MATCH("state", "root")) {
-        fprintf(c->ofp, "root = %.10f\n", s->root);
-        *match = TRUE;
-    } else if (MATCH("state", "root_depth")) {
-        fprintf(c->ofp, "root_depth = %.10f\n", s->root_depth);
-        *match = TRUE;
-    } else if (MATCH("state", "rootn")) {
-        fprintf(c->ofp, "rootn = %.10f\n", s->rootn);
-        *match = TRUE;
-    } else if (MATCH("state", "sapwood")) {
-        fprintf(c->ofp, "sapwood = %.10f\n", s->sapwood);
-        *match = TRUE;
-    } else if (MATCH("state", "shoot")) {
-        fprintf(c->ofp, "shoot = %.10f\n", s->shoot);
-        *match = TRUE;
-    } else if (MATCH("state", "shootn")) {
-        fprintf(c->ofp, "shootn = %.10f\n", s->shootn);
-        *match = TRUE;
-    } else if (MATCH("state", "sla")) {
-        fprintf(c->ofp, "sla = %.10f\n", s->sla);
-        *match = TRUE;
-    } else if (MATCH("state", "slowsoil")) {
-        fprintf(c->ofp, "slowsoil = %.10f\n", s->slowsoil);
-        *match = TRUE;
-    } else if (MATCH("state", "slowsoiln")) {
-        fprintf(c->ofp, "slowsoiln = %.10f\n", s->slowsoiln);
-        *match = TRUE;
-    } else if (MATCH("state", "stem")) {
-        fprintf(c->ofp, "stem = %.10f\n", s->stem);
-        *match = TRUE;
-    } else if (MATCH("state", "stemn")) {
-        fprintf(c->ofp, "stemn = %.10f\n", s->stemn);
-        *match = TRUE;
-    } else if (MATCH("state", "stemnimm")) {
-        fprintf(c->ofp, "stemnimm = %.10f\n", s->stemnimm);
-        *match = TRUE;
-    } else if (MATCH("state", "stemnmob")) {
-        fprintf(c->ofp, "stemnmob = %.10f\n", s->stemnmob);
-        *match = TRUE;
-    } else if (MATCH("state", "structsoil")) {
-        fprintf(c->ofp, "structsoil = %.10f\n", s->structsoil);
-        *match = TRUE;
-    } else if (MATCH("state", "structsoiln")) {
-        fprintf(c->ofp, "structsoiln = %.10f\n", s->structsoiln);
-        *match = TRUE;
-    } else if (MATCH("state", "structsurf")) {
-        fprintf(c->ofp, "structsurf = %.10f\n", s->structsurf);
-        *match = TRUE;
-    } else if (MATCH("state", "structsurfn")) {
-        fprintf(c->ofp, "structsurfn = %.10f\n", s->structsurfn);
-        *match = TRUE;
-    }
+    return error;
 
-    return (1);
 }
@@ -24,7 +24,7 @@ double zbrent(double (*func)(double, double, double, double, double, double),
 
     if (fb*fa > 0.0) {
         printf("ERROR: Root must be bracketed in ZBRENT\n");
-        exit(EXIT_FAILURE);
+        gday_exit(EXIT_FAILURE);
 	}
 	fc=fb;
 	for (iter=1; iter<=ITMAX; iter++) {
@@ -82,7 +82,7 @@ double zbrent(double (*func)(double, double, double, double, double, double),
     }
 
     printf("Maximum number of iterations exceeded in ZBRENT\n");
-	exit(EXIT_FAILURE);
+	gday_exit(EXIT_FAILURE);
 }
 
 #undef ITMAX
@@ -0,0 +1,54 @@
+# Shared by the tests, sourced with GDAY set to the model and the current
+# directory a scratch one of the test's own.
+
+make_met() {
+    # make_met file first_year nyears: a made up daily met file, a warm wet
+    # start to every year and rain every fourth day
+    awk -v y0="$2" -v n="$3" 'BEGIN {
+        print "#year,doy,tair,rain,tsoil,tam,tpm,tmin,tmax,tday,vpd_am," \
+              "vpd_pm,co2,ndep,nfix,wind,press,wind_am,wind_pm,par_am,par_pm"
+        for (y = y0; y < y0 + n; y++) {
+            nd = (y % 4 == 0 && (y % 100 != 0 || y % 400 == 0)) ? 366 : 365
+            for (d = 1; d <= nd; d++) {
+                t = 14.0 + 7.0 * cos(2.0 * 3.14159265 * (d - 1) / nd)
+                r = (d % 4 == 0) ? 5.0 : 0.0
+                printf "%d,%d,%.4f,%.1f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f," \
+                       "0.8,1.2,380,0.0,0.0,2.0,100.0,2.0,2.0,%.4f,%.4f\n",
+                       y, d, t, r, t - 1.0, t - 2.0, t + 2.0, t - 6.0,
+                       t + 6.0, t + 3.0, t / 2.0 + 0.5, t / 2.0 + 0.5
+            }
+        }
+    }' > "$1"
+}
+
+make_subdaily_met() {
+    # make_subdaily_met file first_year nyears: as make_met, every half
+    # hour, with the light and a little warmth in the middle of the day
+    awk -v y0="$2" -v n="$3" 'BEGIN {
+        print "#year,doy,hod,rain,par,tair,tsoil,vpd,co2,ndep,nfix,wind,press"
+        for (y = y0; y < y0 + n; y++) {
+            nd = (y % 4 == 0 && (y % 100 != 0 || y % 400 == 0)) ? 366 : 365
+            for (d = 1; d <= nd; d++) {
+                t = 14.0 + 7.0 * cos(2.0 * 3.14159265 * (d - 1) / nd)
+                for (h = 0; h < 48; h++) {
+                    s = sin(3.14159265 * (h - 12) / 24.0)
+                    par = (h >= 12 && h < 36) ? 1800.0 * s : 0.0
+                    r = (d % 4 == 0 && h == 30) ? 5.0 : 0.0
+                    printf "%d,%d,%d,%.1f,%.4f,%.4f,%.4f,%.4f,380,0.0,0.0," \
+                           "2.0,100.0\n", y, d, h, r, par, t + 4.0 * s,
+                           t - 1.0, 0.5 + 0.5 * (s > 0 ? s : 0)
+                }
+            }
+        }
+    }' > "$1"
+}
+
+fail() {
+    echo "FAIL: $*"
+    exit 1
+}
+
+clean_exit() {
+    # clean_exit status: the model refused, rather than crashed
+    [ "$1" -gt 0 ] && [ "$1" -lt 128 ]
+}
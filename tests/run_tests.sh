@@ -0,0 +1,31 @@
+#!/bin/sh
+#
+# Run every test_*.sh here against a built model, each in a scratch
+# directory of its own:
+#
+#   tests/run_tests.sh path/to/gday
+#
+if [ $# -ne 1 ] || [ ! -x "$1" ]; then
+    echo "usage: $0 path/to/gday"
+    exit 2
+fi
+
+here=$(cd "$(dirname "$0")" && pwd)
+GDAY=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+export GDAY
+failed=0
+
+for t in "$here"/test_*.sh; do
+    name=$(basename "$t" .sh)
+    dir=$(mktemp -d)
+    if (cd "$dir" && . "$here/common.sh" && . "$t") > "$dir.log" 2>&1; then
+        echo "ok   $name"
+    else
+        echo "FAIL $name"
+        sed 's/^/    /' "$dir.log"
+        failed=$((failed + 1))
+    fi
+    rm -rf "$dir" "$dir.log"
+done
+
+[ $failed -eq 0 ]
@@ -0,0 +1,70 @@
+# The ascii outputs are written with format_fixed and the met files read
+# with parse_met_number rather than printf/sscanf. Pin both against output
+# made with printf ("%.10f") and check a bad met line is still reported on
+# the right line, comment lines and threaded chunks included.
+#
+# The expected files are slices of the whole output (the full daily file
+# is over a megabyte): days 1-5 and 179-183 of the daily one, and the
+# middle of day 51 of the half-hourly one.
+
+expected="$here/expected"
+
+make_met met.csv 2000 2
+make_subdaily_met met_hh.csv 2000 1
+
+ini() {
+    # ini name met files_line control_line
+    cat > "$1.cfg" <<EOC
+[files]
+met_fname = $2
+out_fname = $1.csv
+out_param_fname = $1_final.cfg
+$3
+
+[control]
+alloc_model = grasses
+$4
+
+[params]
+latitude = -33.6
+
+[state]
+shoot = 1.0
+root = 1.0
+EOC
+}
+
+ini daily met.csv "" "print_options = daily"
+ini subdaily met_hh.csv "out_subdaily_fname = hh.csv" \
+    "print_options = subdaily
+sub_daily = true"
+ini bad bad.csv "" "print_options = daily"
+ini bad_hh bad_hh.csv "" "print_options = subdaily
+sub_daily = true"
+
+"$GDAY" -p daily.cfg > /dev/null || fail "daily run"
+sed -n '1,6p;180,184p' daily.csv > daily_slice.csv
+cmp -s daily_slice.csv "$expected/daily.csv" ||
+    fail "daily output differs: $(diff daily_slice.csv "$expected/daily.csv" |
+                                  head -5)"
+
+"$GDAY" -p subdaily.cfg > /dev/null || fail "sub-daily run"
+sed -n '1p;2420,2432p' hh.csv > hh_slice.csv
+cmp -s hh_slice.csv "$expected/subdaily.csv" ||
+    fail "sub-daily output differs: $(diff hh_slice.csv \
+                                      "$expected/subdaily.csv" | head -5)"
+
+# ~2 MB, so it is read in more than one chunk where there's a second CPU
+make_met big.csv 1960 50
+awk 'NR == 7000 { print "# a comment half way" } { print }' big.csv |
+    sed '17001s/,380,/,38O,/' > bad.csv
+"$GDAY" -p bad.cfg > /dev/null 2> bad.err
+clean_exit $? || fail "bad met line not refused cleanly"
+grep -q "bad.csv: badly formatted input in met file on line 17001 " bad.err ||
+    fail "bad met line reported wrongly: $(cat bad.err)"
+
+sed '301s/,380,/,,/' met_hh.csv > bad_hh.csv
+"$GDAY" -p bad_hh.cfg > /dev/null 2> bad_hh.err
+clean_exit $? || fail "bad sub-daily met line not refused cleanly"
+grep -q "in subdaily met file on line 301 " bad_hh.err ||
+    fail "bad sub-daily met line reported wrongly: $(cat bad_hh.err)"
@@ -0,0 +1,54 @@
+# A restart picks up exactly where the checkpoint left off, and one against
+# the wrong met data or a truncated checkpoint is refused cleanly.
+
+make_met met.csv 2000 4
+make_met other.csv 2000 5
+
+ini() {
+    # ini name met file_line control_line
+    cat > "$1.cfg" <<EOC
+[files]
+met_fname = $2
+out_fname = $1.csv
+out_param_fname = $1_final.cfg
+$3
+
+[control]
+print_options = daily
+alloc_model = grasses
+$4
+
+[params]
+latitude = -33.6
+
+[state]
+shoot = 1.0
+root = 1.0
+EOC
+}
+
+ini full met.csv "checkpoint_fname = run.ckpt" "checkpoint_interval = 1000"
+ini rest met.csv "restart_fname = run.ckpt" ""
+ini other other.csv "restart_fname = run.ckpt" ""
+ini short met.csv "restart_fname = short.ckpt" ""
+
+"$GDAY" -p full.cfg > /dev/null || fail "full run"
+"$GDAY" -p rest.cfg > /dev/null || fail "restart"
+n=$(($(wc -l < rest.csv) - 1))
+[ $n -gt 0 ] || fail "restart wrote nothing"
+tail -n $n full.csv > full_tail.csv
+tail -n $n rest.csv > rest_tail.csv
+cmp -s full_tail.csv rest_tail.csv || fail "restart differs from the full run"
+
+"$GDAY" -p other.cfg > /dev/null 2> other.err
+status=$?
+clean_exit $status || fail "mismatched met data gave exit status $status"
+grep -q "run.ckpt doesn't match the met file" other.err ||
+    fail "mismatched met data: $(cat other.err)"
+
+head -c 1000 run.ckpt > short.ckpt
+"$GDAY" -p short.cfg > /dev/null 2> short.err
+status=$?
+clean_exit $status || fail "truncated checkpoint gave exit status $status"
+grep -q "short.ckpt is truncated" short.err ||
+    fail "truncated checkpoint: $(cat short.err)"
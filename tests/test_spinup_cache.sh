@@ -0,0 +1,47 @@
+# A spin-up is taken from the cache the second time round, and a cache
+# entry that can't be read is thrown away and made again, rather than
+# failing every run with the same key.
+
+make_met met.csv 2000 4
+mkdir cache
+
+cat > sp.cfg <<EOC
+[files]
+met_fname = met.csv
+out_fname = sp.csv
+out_param_fname = sp_final.cfg
+spinup_cache_dir = cache
+
+[control]
+print_options = end
+alloc_model = grasses
+spinup_method = anderson
+
+[params]
+latitude = -33.6
+
+[state]
+shoot = 1.0
+root = 1.0
+EOC
+
+"$GDAY" -p sp.cfg -s > /dev/null 2> first.err || fail "first spin-up"
+cp sp_final.cfg first.cfg
+entry=$(ls cache/spinup_*.bin)
+[ -f "$entry" ] || fail "no cache entry made"
+
+"$GDAY" -p sp.cfg -s > /dev/null 2> hit.err || fail "cached spin-up"
+grep -q "Spin-up found in cache" hit.err || fail "cache not used: $(cat hit.err)"
+cmp -s sp_final.cfg first.cfg || fail "cached spin-up differs"
+
+head -c 1000 "$entry" > short.bin
+mv short.bin "$entry"
+"$GDAY" -p sp.cfg -s > /dev/null 2> short.err ||
+    fail "truncated cache entry: $(cat short.err)"
+grep -q "can't be used, spinning up again" short.err ||
+    fail "truncated cache entry not reported: $(cat short.err)"
+cmp -s sp_final.cfg first.cfg || fail "spin-up after a bad entry differs"
+
+"$GDAY" -p sp.cfg -s > /dev/null 2> again.err || fail "remade spin-up"
+grep -q "Spin-up found in cache" again.err ||
+    fail "bad cache entry not made again: $(cat again.err)"